@@ -11,6 +11,7 @@
 #include "esp_timer.h"
 #include "esp_vfs_fat.h"
 #include "esp_heap_caps.h"
+#include "esp_random.h"
 #include "driver/spi_master.h"
 #include "driver/sdmmc_host.h"
 #include "driver/gpio.h"
@@ -21,15 +22,27 @@
 #include "quirc.h"
 #include "quirc_internal.h"
 #include "esp_camera.h"
+#include "img_converters.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "nvs_flash.h"
 #include "esp_http_client.h"
+#include "esp_ota_ops.h"
+#include "esp_app_desc.h"
+#include "esp_partition.h"
 #include "cJSON.h"
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
 #include "lwip/sys.h"
+#include "nvs.h"
+#include "esp_crt_bundle.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/sha256.h"
+#include "esp32s3/rom/miniz.h"
 #include <errno.h>
 
 static const char *TAG = "example";
@@ -43,6 +56,167 @@ static const char *TAG = "example";
 
 // WebSocket configuration
 #define WEBSOCKET_USE_MASKING 1  // WebSocket clients MUST mask frames
+// All-zero masking key: frames are still masked as the protocol requires, but
+// XOR with zero changes nothing, so payloads are copied instead of masked here
+// and the relay skips unmasking them. Masking guards proxies against browser
+// scripts choosing the bytes on the wire; the firmware picks all of its bytes
+// and never had an unpredictable key.
+#define WEBSOCKET_MASK_KEY 0x00000000
+#define WS_OPCODE_TEXT   0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE  0x8
+#define WS_OPCODE_PING   0x9
+#define WS_OPCODE_PONG   0xA
+#define WS_CONTROL_MAX_PAYLOAD 1024  // Largest server->camera message accepted
+
+// Binary message types, identified by the first payload byte:
+//   0xFF  raw JPEG of the main profile (SOI marker, no prefix)
+//   0xA0  telemetry (see TELEMETRY_* below)
+//   0xA1  profile frame: u8 profile id, then a JPEG
+//   0xA2  timed frame: u8 profile id, u32 capture time (ms since boot, little
+//         endian), then a JPEG; used for both profiles once the relay asks for
+//         capture times ("capture_time" in stream_profiles)
+//   0xA3  pre-roll frame: laid out like 0xA2, sent from the pre-event ring
+//         when an event triggers (see PREROLL_* below)
+//   0xA4  clock probe reply: u32 probe id, u64 receive time, u64 reply time
+//         (us since boot, little endian); see CLOCK_* below
+// In 0xA2/0xA3 frames the profile byte carries CAPTURE_CLOCK_SERVER once the
+// relay has synchronised the camera clock: the capture time is then the low
+// 32 bits of server time (ms since the Unix epoch) instead of ms since boot.
+#define MSG_TYPE_PROFILE_FRAME 0xA1
+#define MSG_TYPE_TIMED_FRAME 0xA2
+#define MSG_TYPE_PREROLL_FRAME 0xA3
+#define MSG_TYPE_CLOCK_REPLY 0xA4
+#define TIMED_FRAME_PREFIX_LEN 6
+#define CAPTURE_CLOCK_SERVER 0x80
+#define CLOCK_REPLY_LEN 21
+
+// Stream profiles: the full-resolution main stream plus a low-resolution
+// substream for grid tiles. The relay enables each one based on what its
+// viewers are watching ("stream_profiles" control message).
+#define PROFILE_MAIN 0
+#define PROFILE_SUB  1
+#define SUBSTREAM_SCALE JPG_SCALE_4X   // DCT-domain downscale while decoding the main JPEG
+#define SUBSTREAM_SCALE_DIV 4
+#define SUBSTREAM_INTERVAL_MS 500      // 2 FPS is plenty for a thumbnail tile
+#define SUBSTREAM_JPEG_QUALITY 60      // fmt2jpg quality (1-100, higher is better)
+#define SUBSTREAM_MAX_JPEG_SIZE 32768
+#define IDLE_SNAPSHOT_INTERVAL_MS 15000  // Heartbeat snapshot while nobody is watching
+#define IDLE_WAIT_MAX_MS 1000          // Longest sleep on the socket between loop iterations
+#define STREAM_FB_COUNT 2
+
+// Uplink budget from the relay ("bandwidth_budget" control message, 0 kbps =
+// unlimited) when cameras share an access point. Main-profile frames are paced
+// to the budget's fps and admitted by a token bucket holding BUDGET_BURST_MS of
+// budget. If the bucket keeps refusing frames the JPEG quality is lowered so
+// frames shrink, and raised back toward the user's setting once they fit.
+#define BUDGET_BURST_MS 500
+#define BUDGET_ADJUST_INTERVAL_MS 2000
+#define BUDGET_QUALITY_STEP 4
+#define BUDGET_QUALITY_MAX 40          // esp32-camera quality: higher number = smaller frames
+#define STREAM_JPEG_QUALITY 6
+
+// Relay overload ("relay_load" control message: max_fps, 0 = lifted). An
+// overloaded relay asks lower-priority cameras to capture main-profile frames
+// no faster than max_fps instead of dropping them after they crossed the
+// uplink. Event frames and the substream are not limited.
+#define RELAY_LOAD_MAX_FPS 30
+
+// Low-rate burst mode ("burst_mode" control message: interval_ms, fps; 0 ms = off)
+// At a few frames per second the radio never sleeps: each frame wakes it
+// before it has settled from the last one. In burst mode main-profile frames
+// are captured at fps (substream frames at their usual interval) and copied
+// into a PSRAM buffer instead of sent. Every interval_ms the buffer goes out
+// back to back as timed frames (0xA2) with power save off, and between bursts
+// the modem sleeps, waking every RADIO_LISTEN_INTERVAL beacons for traffic
+// from the relay. Frames reach viewers up to interval_ms late; a full buffer
+// is sent early. Events and LAN viewers stream live as usual.
+#define BURST_BUFFER_BYTES (768 * 1024)
+#define BURST_MAX_FRAMES 128
+#define BURST_MIN_INTERVAL_MS 1000
+#define BURST_MAX_INTERVAL_MS 30000
+#define BURST_MAX_FPS 10
+#define RADIO_LISTEN_INTERVAL 10        // Beacons (~102 ms each) between wake-ups under WIFI_PS_MAX_MODEM
+
+// Direct LAN viewing: a small HTTP server on the camera serves
+// multipart/x-mixed-replace MJPEG (/stream) and single JPEGs (/snapshot) to
+// dashboards on the same network, without the relay hop. All clients share
+// the streaming task's capture: each frame is published once and every client
+// sends the newest one when it is ready, so a slow client skips frames instead
+// of delaying the others or the relay. Requests need the token sent to the
+// relay at registration (?token=); the relay hands it only to the owner.
+#define LAN_MJPEG_ENABLED 1
+#define LAN_MJPEG_PORT 81
+#define LAN_MJPEG_MAX_CLIENTS 3
+#define LAN_MJPEG_TOKEN_LEN 16
+#define LAN_MJPEG_REQUEST_MAX 512
+#define LAN_MJPEG_FRAME_WAIT_MS 3000   // Client gives up on a camera that stopped capturing
+#define LAN_MJPEG_SEND_TIMEOUT_MS 5000 // Drop a client whose socket stopped draining
+#define LAN_MJPEG_SNAPSHOT_MAX_AGE_MS 1000
+#define LAN_MJPEG_BOUNDARY "zccframe"
+
+// Pre-event recording ("preroll" control message: seconds, max_kb, post_ms; 0 s = off)
+// While on, the camera keeps capturing even with no viewers and copies a frame
+// every PREROLL_CAPTURE_INTERVAL_MS into a ring in PSRAM holding the last
+// `seconds` of video, up to max_kb. On a trigger (local motion, or
+// "event_trigger" from the relay) the ring is uploaded oldest first as 0xA3
+// frames, back to back ahead of the live frames, and the camera then streams
+// live for post_ms whether or not anyone is watching. The frame that triggered
+// (or extended) the event goes out as 0xA3 too, so the relay knows how long to
+// keep its clip open. The ring is
+// one arena plus a fixed index: frames are copied in at the write position and
+// overwrite the oldest ones, with no allocation per frame.
+#define PREROLL_ARENA_BYTES (2 * 1024 * 1024)
+#define PREROLL_MAX_FRAMES 256
+#define PREROLL_MAX_SECONDS 30
+#define PREROLL_CAPTURE_INTERVAL_MS 100
+#define PREROLL_POST_EVENT_MS 10000     // Default post_ms
+#define PREROLL_POST_EVENT_MAX_MS 120000
+#define PREROLL_RETRIGGER_MS 5000       // Motion within this of the last trigger only extends the event
+// Motion test: a scene change shows up as a jump in JPEG size against its
+// running average. Crude, but free: no decode.
+#define MOTION_SIZE_DELTA_PCT 20
+#define MOTION_WARMUP_FRAMES 10         // Frames to settle the average after a settings change
+
+// Clock synchronisation with the relay (NTP-style, over the stream connection)
+// The relay sends bursts of {"type":"time_sync","id"} probes, which are
+// answered at once with 0xA4 replies carrying when the probe was read and when
+// the reply left, and fits the camera's offset and drift from the fastest
+// round trips. It then sends {"type":"clock","camera_ms","server_ms",
+// "drift_ppm"}: server_ms is server time at camera_ms (ms since boot), and
+// drift_ppm how much faster the server clock runs. Capture times are mapped
+// through that from then on. The mapping survives reconnects, since the boot
+// clock does; the relay refreshes it every few seconds to minutes.
+#define CLOCK_MAX_DRIFT_PPM 500         // Ignore fits beyond any crystal's tolerance
+
+// Firmware updates over the air ("ota" control message: url, size, delta,
+// target_size, target_sha256; see backend/services/ota.js)
+// ota_task downloads url over an HTTP connection of its own and ota_flash_task
+// writes the inactive OTA partition, so the camera keeps streaming until the
+// final reboot. The two overlap through OTA_BUFFER_COUNT buffers of one flash
+// sector: while one is erased and written, the download fills the next. A
+// delta (backend/services/firmwareDelta.js) is inflated with the ROM's tinfl
+// into a 32 KB window in PSRAM and applied against the running partition,
+// read through a memory mapping; a full image is copied as it arrives. The
+// source hash is checked before anything is written and the target hash
+// before the new partition is set to boot. Erasing and writing flash stalls
+// code running from flash on both cores, so the writer leaves
+// OTA_WRITE_GAP_MS between sectors for the streaming task. The camera reports
+// {"type":"ota_status","state","received","written"[,"error"]} when the state
+// changes and every OTA_STATUS_INTERVAL_MS while downloading, and reboots once
+// the image is ready and no event is streaming. Needs a partition table with
+// two OTA app slots (CONFIG_PARTITION_TABLE_TWO_OTA or a custom one).
+#define OTA_CHUNK_BYTES 4096            // One flash sector per buffer
+#define OTA_BUFFER_COUNT 2
+#define OTA_HTTP_READ_BYTES 1460
+#define OTA_HTTP_TIMEOUT_MS 10000
+#define OTA_WRITE_GAP_MS 2
+#define OTA_STATUS_INTERVAL_MS 2000
+#define OTA_TASK_PRIORITY 3             // Below the streaming task
+#define OTA_DELTA_HEADER_LEN 80         // 'ZCCD', u8 version, 3 reserved, u32 source size,
+                                        // source sha256, u32 target size, target sha256
+#define OTA_DELTA_VERSION 1
+#define OTA_URL_MAX 160
 
 // Frame validation constants
 #define JPEG_SOI_MARKER 0xFFD8  // Start of Image marker
@@ -57,6 +231,65 @@ static uint32_t invalid_frames_detected = 0;
 static uint32_t websocket_send_failures = 0;
 static uint32_t jpeg_validation_failures = 0;
 
+// Telemetry configuration
+// A compact binary telemetry message is sent over the streaming WebSocket
+// every TELEMETRY_INTERVAL_MS. Layout (little endian, version 1):
+//   u8 type, u8 version, u8 stage_count, u8 bucket_count,
+//   u32 uptime_ms, u32 period_ms,
+//   u32 frames_captured, frames_sent, invalid_frames, jpeg_failures, send_failures,
+//   u32 free_heap, min_free_heap, free_psram, min_free_psram, stream_stack_hwm,
+//   i8 rssi, u8 task_count,
+//   u16 histogram[stage_count][bucket_count], u32 stage_sum_ms[stage_count],
+//   task_count x { char name[TELEMETRY_TASK_NAME_LEN], u16 cpu_permille }
+// Version 2 appends the radio modes (see radio_mode_t) over the period:
+//   u8 mode_count, u8 current_mode,
+//   mode_count x { u32 time_ms, awake_ms, frames, bytes, latency_sum_ms, latency_max_ms }
+#define TELEMETRY_INTERVAL_MS 5000
+#define TELEMETRY_MSG_TYPE 0xA0
+#define TELEMETRY_VERSION 2
+#define TELEMETRY_MAX_TASKS 12
+#define TELEMETRY_TASK_NAME_LEN 12
+#define TELEMETRY_BUFFER_SIZE 512
+// Fixed part up to the histograms: 4 u8, 12 u32, i8 rssi, u8 task_count
+#define TELEMETRY_HEADER_SIZE (4 * 1 + 12 * 4 + 2 * 1)
+#define TELEMETRY_TASK_SIZE (TELEMETRY_TASK_NAME_LEN + 2)
+#define TELEMETRY_RADIO_MODE_SIZE (6 * 4)
+#define LATENCY_HIST_BUCKETS 12  // log2 ms buckets: <1, <2, <4 ... <1024, >=1024 ms
+
+// Per-stage latency histograms, reset after every telemetry message
+typedef enum {
+    STAGE_CAPTURE = 0,
+    STAGE_SEND,
+    STAGE_FRAME,
+    STAGE_CONNECT,
+    STAGE_TLS_HANDSHAKE,
+    STAGE_COUNT
+} latency_stage_t;
+
+static uint16_t latency_hist[STAGE_COUNT][LATENCY_HIST_BUCKETS];
+static uint32_t latency_sum_ms[STAGE_COUNT];
+
+// How frames leave the camera, and what it costs the radio; reset after every
+// telemetry message. Awake time is the time with power save off: the short
+// beacon wake-ups under power save are not counted.
+typedef enum {
+    RADIO_MODE_STREAM = 0,   // Frames sent as captured, power save off
+    RADIO_MODE_BURST,        // Frames batched, modem sleep between bursts
+    RADIO_MODE_IDLE,         // No viewers: snapshots only, modem sleep on
+    RADIO_MODE_COUNT
+} radio_mode_t;
+
+typedef struct {
+    uint32_t time_ms;
+    uint32_t awake_ms;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t latency_sum_ms; // Capture to sent
+    uint32_t latency_max_ms;
+} radio_mode_stats_t;
+
+static radio_mode_stats_t radio_stats[RADIO_MODE_COUNT];
+
 // Camera image size for QR code detection - optimized for speed
 #define IMG_WIDTH 320
 #define IMG_HEIGHT 240
@@ -123,17 +356,79 @@ static uint32_t jpeg_validation_failures = 0;
 #define SERVER_PORT 3000
 #define CAMERA_ID_PREFIX "ESP32S3_"
 
+// Transport security configuration
+// With SERVER_USE_TLS the camera registers over https:// and streams over wss://
+// to SERVER_TLS_PORT. The TLS context is set up once and every reconnect offers
+// the cached session (RAM, and NVS across reboots) for an abbreviated handshake.
+// Recommended sdkconfig: CONFIG_MBEDTLS_CLIENT_SSL_SESSION_TICKETS=y,
+// CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN=16384 (one record per WEBSOCKET_TX_CHUNK_SIZE)
+// and CONFIG_MBEDTLS_HARDWARE_AES=y for the AES-GCM suites below.
+#define SERVER_USE_TLS 0
+#define SERVER_TLS_PORT 3443
+#define SERVER_STREAM_PORT (SERVER_USE_TLS ? SERVER_TLS_PORT : SERVER_PORT)
+#define TLS_PERSIST_SESSION_NVS 1
+#define TLS_NVS_NAMESPACE "tls"
+#define TLS_SESSION_BLOB_MAX 1024
+#define TLS_HANDSHAKE_TIMEOUT_MS 10000
+// PEM of the server certificate (or its CA) for self-signed deployments;
+// leave empty to verify against the ESP x509 certificate bundle
+#define SERVER_CA_CERT_PEM ""
+
+// Payload staging buffer: a full TLS record, so encrypted writes carry no extra per-record overhead
+#define WEBSOCKET_TX_CHUNK_SIZE 16384
+
+// Wi-Fi provisioning cache
+// Credentials from the QR code are stored in NVS together with the BSSID and
+// channel of the AP that accepted them. On the next boot the camera skips the
+// QR phase and joins that AP directly on its channel, falling back to a normal
+// scan (same credentials) and finally to QR provisioning. Holding the BOOT
+// button during power-up forgets the stored network.
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_VERSION 1
+#define WIFI_DIRECTED_CONNECT_TIMEOUT_MS 3000  // Cached BSSID/channel; AP may have moved
+#define WIFI_SCAN_CONNECT_TIMEOUT_MS 10000
+#define WIFI_FORGET_BUTTON_GPIO GPIO_NUM_0
+
+typedef struct {
+    uint8_t version;
+    char ssid[33];
+    char password[65];
+    uint8_t authmode;        // wifi_auth_mode_t threshold from the QR T: field
+    uint8_t hidden;
+    uint8_t bssid_valid;     // bssid/channel filled in from the last successful join
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_credentials_t;
+
+// Boot-to-first-frame timeline (ms since app start), logged once per boot
+static struct {
+    uint32_t wifi_started;
+    uint32_t wifi_connected;
+    uint32_t camera_ready;
+    uint32_t stream_connected;
+    uint32_t first_frame;
+    bool rejoined;         // Came up from the stored network, no QR phase
+} boot_timing;
 
 static void processing_task(void *arg);
 static void main_task(void *arg);
 static esp_err_t init_camera(void);
 static esp_err_t init_camera_for_streaming(void);
 static esp_err_t init_wifi(void);
-static esp_err_t connect_to_wifi(const char *ssid, const char *password);
-static bool parse_wifi_qr_code(const char *qr_data, char *ssid, char *password);
+static esp_err_t connect_to_wifi(const wifi_credentials_t *creds, bool directed);
+static bool parse_wifi_qr_code(const char *qr_data, wifi_credentials_t *creds);
+static bool wifi_load_credentials(wifi_credentials_t *creds);
+static void wifi_save_credentials(wifi_credentials_t *creds);
+static bool wait_for_wifi(uint32_t timeout_ms);
+static void start_streaming(void);
 static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 static esp_err_t register_camera_with_server(const char *camera_id);
 static esp_err_t websocket_connect(const char *host, int port, const char *path);
+static int websocket_write_frame(uint8_t opcode, const uint8_t *prefix, size_t prefix_len,
+                                 const uint8_t *data, size_t len);
+static int transport_send(const void *buf, size_t len);
+static int transport_recv(void *buf, size_t len);
+static void transport_close(void);
 static void streaming_task(void *arg);
 static char* generate_camera_id(void);
 
@@ -146,8 +441,36 @@ static void print_diagnostic_summary(void);
 static bool check_jpeg_markers(const uint8_t *data, size_t len);
 static void log_camera_sensor_status(void);
 
+// Telemetry functions
+static void record_stage_latency(latency_stage_t stage, uint32_t ms);
+static size_t build_telemetry_message(uint8_t *buf, size_t cap, uint32_t period_ms);
+static int websocket_send_telemetry(uint32_t period_ms);
+static int websocket_send_substream(camera_fb_t *fb);
+static int websocket_send_clock_reply(uint32_t id, int64_t received_us);
+static void websocket_poll_control(void);
+static void handle_control_message(const char *json);
+static bool streaming_reconnect(const char *ws_path);
+static bool transport_wait_readable(uint32_t timeout_ms);
+static void apply_stream_idle_state(void);
+static void apply_bandwidth_budget(uint32_t kbps, uint32_t fps);
+static void budget_debit(size_t len);
+static uint32_t main_frame_pace_time(uint32_t now_ms, bool event_live);
+static void radio_account(uint32_t now_ms);
+static void radio_set_awake(bool awake);
+static void burst_configure(uint32_t interval_ms, uint32_t fps);
+static bool burst_store(const uint8_t *data, size_t len, uint8_t profile, uint32_t capture_ms);
+static bool burst_flush(void);
+static void preroll_configure(uint32_t seconds, uint32_t max_bytes, uint32_t post_ms);
+static void lan_server_start(void);
+static void lan_publish_frame(const camera_fb_t *fb);
+static bool lan_has_clients(void);
+static void motion_reset(void);
+static void ota_start(const cJSON *msg);
+static void ota_report_status(uint32_t now_ms);
+
 // WiFi connection status
-static bool wifi_connected = false;
+static volatile bool wifi_connected = false;
+static bool wifi_auto_reconnect = true;  // Off while connect_to_wifi swaps the config
 static char connected_ssid[64] = {0};
 static bool camera_stopped = false;  // Flag to indicate camera has been stopped
 
@@ -157,6 +480,164 @@ static bool streaming_active = false;
 static char camera_id[32] = {0};
 static TaskHandle_t main_task_handle = NULL;
 static TaskHandle_t processing_task_handle = NULL;
+static TaskHandle_t streaming_task_handle = NULL;
+
+// Stream profile state (written by control messages on the streaming task)
+static bool profile_main_enabled = true;
+static bool profile_sub_enabled = false;
+static radio_mode_t radio_mode = RADIO_MODE_STREAM;  // See apply_stream_idle_state
+static bool radio_awake = true;           // Power save off
+static uint32_t radio_accounted_until = 0;
+static bool capture_time_enabled = false; // Relay wants 0xA2 timed frames
+
+// Server clock mapping (streaming task only; see CLOCK_* above)
+static bool clock_synced = false;
+static uint32_t clock_ref_camera_ms = 0;
+static uint64_t clock_ref_server_ms = 0;
+static double clock_drift_ppm = 0;
+
+// Uplink budget state (streaming task only)
+static uint32_t budget_kbps = 0;
+static uint32_t budget_fps = 0;
+static int32_t budget_tokens = 0;          // bytes; negative after a frame larger than the balance
+static uint32_t budget_refill_time = 0;
+static uint32_t budget_next_frame_time = 0;
+static uint32_t budget_window_start = 0;
+static uint32_t budget_window_sent = 0;
+static uint32_t budget_window_skipped = 0;
+static int user_jpeg_quality = STREAM_JPEG_QUALITY;   // Set by camera_settings
+static int budget_jpeg_quality = STREAM_JPEG_QUALITY; // In effect while a budget applies
+static uint32_t relay_max_fps = 0;         // From "relay_load"; 0 = no limit
+static uint32_t relay_next_frame_time = 0;
+static uint8_t *substream_rgb = NULL;     // PSRAM, sized for the current frame size
+static size_t substream_rgb_size = 0;
+static uint8_t *substream_jpeg = NULL;    // PSRAM, SUBSTREAM_MAX_JPEG_SIZE
+static size_t substream_jpeg_len = 0;
+
+// Direct LAN viewing state; the published frame and client slots are guarded
+// by lan_frame_lock. lan_token stays empty unless the server is running.
+static char lan_token[LAN_MJPEG_TOKEN_LEN + 1] = {0};
+static SemaphoreHandle_t lan_frame_lock = NULL;
+static uint8_t *lan_frame = NULL;          // PSRAM, MAX_VALID_JPEG_SIZE: newest frame for LAN clients
+static size_t lan_frame_len = 0;
+static uint32_t lan_frame_seq = 0;         // Bumped per published frame; 0 = none yet
+static uint32_t lan_frame_capture_ms = 0;
+static uint32_t lan_frame_published_ms = 0;
+static TaskHandle_t lan_client_tasks[LAN_MJPEG_MAX_CLIENTS] = {0};
+static volatile int lan_client_count = 0;
+
+// Pre-event ring (streaming task only). Entries are in capture order starting
+// at preroll_head, and their bytes follow each other through the arena,
+// wrapping to the start when a frame does not fit before preroll_max_bytes.
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+    uint32_t capture_ms;
+} preroll_entry_t;
+static uint8_t *preroll_arena = NULL;     // PSRAM, PREROLL_ARENA_BYTES, allocated when first enabled
+static preroll_entry_t preroll_index[PREROLL_MAX_FRAMES];
+static uint32_t preroll_head = 0;
+static uint32_t preroll_count = 0;
+static uint32_t preroll_write_offset = 0;
+static uint32_t preroll_seconds = 0;
+static uint32_t preroll_max_bytes = 0;
+static uint32_t preroll_sent_until_ms = 0;  // Newest capture the relay already has as part of an event
+static uint32_t event_post_ms = PREROLL_POST_EVENT_MS;
+static bool event_pending = false;          // Trigger to handle before the next live frame
+static uint32_t event_live_until = 0;       // Live frames go out until then, viewers or not
+static uint32_t event_triggered_at = 0;
+static uint32_t motion_average_len = 0;
+static uint32_t motion_frames = 0;
+
+// Burst buffer (streaming task only): frames waiting for the next burst, in
+// capture order, their bytes packed one after the other from the start
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+    uint32_t capture_ms;
+    uint8_t profile;
+} burst_entry_t;
+static uint8_t *burst_buffer = NULL;      // PSRAM, BURST_BUFFER_BYTES, allocated when first enabled
+static burst_entry_t burst_index[BURST_MAX_FRAMES];
+static uint32_t burst_count = 0;
+static uint32_t burst_bytes = 0;
+static uint32_t burst_interval_ms = 0;    // 0 = off
+static uint32_t burst_fps = 0;
+static uint32_t burst_next_frame_time = 0;
+static uint32_t burst_next_send_time = 0;
+
+// Firmware update state. ota_state, ota_received, ota_written and ota_error
+// are written by the OTA tasks and read by the streaming task; an update only
+// starts from OTA_IDLE, which the streaming task restores after reporting a
+// failure.
+typedef enum {
+    OTA_IDLE = 0,
+    OTA_DOWNLOADING,
+    OTA_READY,      // New partition verified and set to boot
+    OTA_FAILED,
+} ota_state_t;
+typedef struct {
+    char url[OTA_URL_MAX];
+    uint32_t size;              // Download bytes
+    bool delta;
+    uint32_t target_size;
+    uint8_t target_sha256[32];
+} ota_request_t;
+typedef struct {
+    uint8_t *buf;               // NULL ends the update
+    size_t len;
+} ota_chunk_t;
+static ota_request_t ota_request;
+static volatile ota_state_t ota_state = OTA_IDLE;
+static volatile uint32_t ota_received = 0;
+static volatile uint32_t ota_written = 0;
+static const char *volatile ota_error = NULL;   // Sent with the failed status
+static ota_state_t ota_reported_state = OTA_IDLE;
+static uint32_t ota_next_status_time = 0;
+static QueueHandle_t ota_free_queue = NULL;   // Buffers the download may fill
+static QueueHandle_t ota_full_queue = NULL;   // Filled buffers, in order, for ota_flash_task
+static SemaphoreHandle_t ota_flash_done = NULL;
+static esp_err_t ota_flash_err = ESP_OK;
+// Download side (ota_task only)
+static uint8_t *ota_fill = NULL;              // Buffer being filled
+static size_t ota_fill_len = 0;
+static uint32_t ota_produced = 0;             // Target bytes made so far
+static mbedtls_sha256_context ota_target_sha;
+static const uint8_t *ota_source = NULL;      // Running partition, memory-mapped
+static uint32_t ota_source_size = 0;
+static tinfl_decompressor *ota_inflator = NULL;   // PSRAM, delta updates only
+static uint8_t *ota_window = NULL;             // PSRAM, TINFL_LZ_DICT_SIZE: inflate output, wrapping
+static size_t ota_window_pos = 0;
+static struct {
+    uint8_t op;                 // 'D', 'X' or 'E'
+    uint8_t header[9];
+    size_t header_len;          // Header bytes collected so far
+    uint32_t src_off;           // 'D': next source byte
+    uint32_t remaining;         // Body bytes still to come
+    bool done;                  // 'E' seen
+} ota_patch;
+
+#if SERVER_USE_TLS
+// TLS state, kept across reconnects
+static mbedtls_ssl_context tls_ssl;
+static mbedtls_ssl_config tls_conf;
+static mbedtls_entropy_context tls_entropy;
+static mbedtls_ctr_drbg_context tls_ctr_drbg;
+static mbedtls_x509_crt tls_cacert;
+static mbedtls_net_context tls_net;
+static bool tls_initialized = false;
+static uint8_t tls_session_blob[TLS_SESSION_BLOB_MAX];  // Serialized session offered on reconnect
+static size_t tls_session_blob_len = 0;
+static uint32_t tls_full_handshakes = 0;
+static uint32_t tls_resumed_handshakes = 0;
+
+// AES-GCM suites run on the ESP32-S3 AES accelerator
+static const int tls_ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    0
+};
+#endif
 
 // Frame validation and diagnostic functions implementation
 
@@ -324,6 +805,187 @@ static void print_diagnostic_summary(void)
     ESP_LOGI(TAG, "=== END DIAGNOSTIC SUMMARY ===");
 }
 
+/**
+ * Record a stage latency sample into its log2 millisecond histogram
+ */
+static void record_stage_latency(latency_stage_t stage, uint32_t ms)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_HIST_BUCKETS - 1 && ms >= (1U << bucket)) {
+        bucket++;
+    }
+    if (latency_hist[stage][bucket] < UINT16_MAX) {
+        latency_hist[stage][bucket]++;
+    }
+    latency_sum_ms[stage] += ms;
+}
+
+/**
+ * Count a frame that reached the relay under the current radio mode
+ */
+static void record_radio_frame(size_t len, uint32_t capture_ms, uint32_t sent_ms)
+{
+    radio_mode_stats_t *m = &radio_stats[radio_mode];
+    uint32_t latency = sent_ms - capture_ms;
+    m->frames++;
+    m->bytes += len;
+    m->latency_sum_ms += latency;
+    m->latency_max_ms = MAX(m->latency_max_ms, latency);
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+    return p + 4;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, (uint32_t)v);
+    return put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+#if defined(CONFIG_FREERTOS_USE_TRACE_FACILITY) && defined(CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS)
+// Previous run-time counters, used to turn FreeRTOS totals into per-period CPU shares
+static struct {
+    UBaseType_t task_number;
+    uint32_t run_time;
+} prev_task_runtime[TELEMETRY_MAX_TASKS * 2];
+static uint32_t prev_total_runtime = 0;
+
+/**
+ * Append per-task CPU usage (permille of the last period) to the telemetry buffer
+ */
+static uint8_t *put_task_cpu_stats(uint8_t *p, uint8_t *task_count_out)
+{
+    TaskStatus_t tasks[TELEMETRY_MAX_TASKS * 2];
+    uint32_t total_runtime = 0;
+    UBaseType_t n = uxTaskGetSystemState(tasks, TELEMETRY_MAX_TASKS * 2, &total_runtime);
+    uint32_t period_runtime = total_runtime - prev_total_runtime;
+    uint8_t written = 0;
+
+    for (UBaseType_t i = 0; i < n; i++) {
+        uint32_t prev = 0;
+        for (int j = 0; j < TELEMETRY_MAX_TASKS * 2; j++) {
+            if (prev_task_runtime[j].task_number == tasks[i].xTaskNumber) {
+                prev = prev_task_runtime[j].run_time;
+                break;
+            }
+        }
+
+        if (written < TELEMETRY_MAX_TASKS) {
+            uint32_t delta = tasks[i].ulRunTimeCounter - prev;
+            // Run-time totals are per core, so a busy task on a dual core chip tops out at 1000
+            uint16_t permille = period_runtime > 0
+                ? (uint16_t)MIN(1000ULL, (uint64_t)delta * 1000ULL * portNUM_PROCESSORS / period_runtime)
+                : 0;
+            memset(p, 0, TELEMETRY_TASK_NAME_LEN);
+            strncpy((char *)p, tasks[i].pcTaskName, TELEMETRY_TASK_NAME_LEN);
+            p = put_u16(p + TELEMETRY_TASK_NAME_LEN, permille);
+            written++;
+        }
+    }
+
+    memset(prev_task_runtime, 0, sizeof(prev_task_runtime));
+    for (UBaseType_t i = 0; i < n && i < TELEMETRY_MAX_TASKS * 2; i++) {
+        prev_task_runtime[i].task_number = tasks[i].xTaskNumber;
+        prev_task_runtime[i].run_time = tasks[i].ulRunTimeCounter;
+    }
+    prev_total_runtime = total_runtime;
+
+    *task_count_out = written;
+    return p;
+}
+#else
+static uint8_t *put_task_cpu_stats(uint8_t *p, uint8_t *task_count_out)
+{
+    // Enable CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS for per-task CPU
+    *task_count_out = 0;
+    return p;
+}
+#endif
+
+/**
+ * Serialize counters, heap watermarks, RSSI, task CPU and latency histograms
+ * Returns the message length, or 0 if the buffer is too small
+ */
+static size_t build_telemetry_message(uint8_t *buf, size_t cap, uint32_t period_ms)
+{
+    size_t needed = TELEMETRY_HEADER_SIZE + STAGE_COUNT * LATENCY_HIST_BUCKETS * 2 + STAGE_COUNT * 4 +
+                    TELEMETRY_MAX_TASKS * TELEMETRY_TASK_SIZE + 2 + RADIO_MODE_COUNT * TELEMETRY_RADIO_MODE_SIZE;
+    if (cap < needed) {
+        ESP_LOGW(TAG, "Telemetry buffer too small: %d < %d", cap, needed);
+        return 0;
+    }
+
+    wifi_ap_record_t ap_info;
+    int8_t rssi = 0;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+        rssi = ap_info.rssi;
+    }
+
+    uint8_t *p = buf;
+    *p++ = TELEMETRY_MSG_TYPE;
+    *p++ = TELEMETRY_VERSION;
+    *p++ = STAGE_COUNT;
+    *p++ = LATENCY_HIST_BUCKETS;
+    p = put_u32(p, esp_timer_get_time() / 1000);
+    p = put_u32(p, period_ms);
+    p = put_u32(p, total_frames_captured);
+    p = put_u32(p, valid_frames_sent);
+    p = put_u32(p, invalid_frames_detected);
+    p = put_u32(p, jpeg_validation_failures);
+    p = put_u32(p, websocket_send_failures);
+    p = put_u32(p, esp_get_free_heap_size());
+    p = put_u32(p, esp_get_minimum_free_heap_size());
+    p = put_u32(p, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    p = put_u32(p, heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+    p = put_u32(p, streaming_task_handle ? uxTaskGetStackHighWaterMark(streaming_task_handle) : 0);
+    *p++ = (uint8_t)rssi;
+    uint8_t *task_count = p++;
+    assert(p - buf == TELEMETRY_HEADER_SIZE);
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        for (int bucket = 0; bucket < LATENCY_HIST_BUCKETS; bucket++) {
+            p = put_u16(p, latency_hist[stage][bucket]);
+        }
+    }
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        p = put_u32(p, latency_sum_ms[stage]);
+    }
+    p = put_task_cpu_stats(p, task_count);
+
+    radio_account(esp_timer_get_time() / 1000);
+    *p++ = RADIO_MODE_COUNT;
+    *p++ = radio_mode;
+    for (int mode = 0; mode < RADIO_MODE_COUNT; mode++) {
+        const radio_mode_stats_t *m = &radio_stats[mode];
+        p = put_u32(p, m->time_ms);
+        p = put_u32(p, m->awake_ms);
+        p = put_u32(p, m->frames);
+        p = put_u32(p, m->bytes);
+        p = put_u32(p, m->latency_sum_ms);
+        p = put_u32(p, m->latency_max_ms);
+    }
+
+    // Histograms and radio modes cover one telemetry period only
+    memset(latency_hist, 0, sizeof(latency_hist));
+    memset(latency_sum_ms, 0, sizeof(latency_sum_ms));
+    memset(radio_stats, 0, sizeof(radio_stats));
+
+    return p - buf;
+}
+
 // Application entry point
 void app_main(void)
 {
@@ -444,8 +1106,8 @@ static esp_err_t init_camera_for_streaming(void)
         .ledc_timer = LEDC_TIMER_0,
         .pixel_format = PIXFORMAT_JPEG,       // JPEG for streaming
         .frame_size = FRAMESIZE_XGA,          // SVGA (800 x 600) for faster transmission
-        .jpeg_quality = 6,                   // Lower quality for faster transmission
-        .fb_count = 2,                        // Double buffer for smooth streaming
+        .jpeg_quality = STREAM_JPEG_QUALITY, // Lower quality for faster transmission
+        .fb_count = STREAM_FB_COUNT,          // Double buffer for smooth streaming
         .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
     };
 
@@ -523,6 +1185,7 @@ static esp_err_t init_wifi(void)
     
     // Start WiFi
     ESP_ERROR_CHECK(esp_wifi_start());
+    boot_timing.wifi_started = esp_timer_get_time() / 1000;
 
     ESP_LOGI(TAG, "WiFi initialized successfully");
     return ESP_OK;
@@ -534,83 +1197,234 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         ESP_LOGI(TAG, "WiFi station started");
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(TAG, "WiFi disconnected, trying to reconnect...");
         wifi_connected = false;
-        esp_wifi_connect();
+        if (wifi_auto_reconnect) {
+            ESP_LOGI(TAG, "WiFi disconnected, trying to reconnect...");
+            esp_wifi_connect();
+        }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        if (boot_timing.wifi_connected == 0) {
+            boot_timing.wifi_connected = esp_timer_get_time() / 1000;
+        }
         wifi_connected = true;
     }
 }
 
-// Connect to WiFi network
-static esp_err_t connect_to_wifi(const char *ssid, const char *password)
+/**
+ * Connect to a WiFi network
+ * With directed set, the cached BSSID and channel are used so the driver
+ * probes a single channel for a single AP instead of scanning all of them.
+ */
+static esp_err_t connect_to_wifi(const wifi_credentials_t *creds, bool directed)
 {
-    ESP_LOGI(TAG, "Connecting to WiFi: %s", ssid);
+    ESP_LOGI(TAG, "Connecting to WiFi: %s%s", creds->ssid, directed ? " (cached BSSID/channel)" : "");
     
     wifi_config_t wifi_config = {
         .sta = {
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .threshold.authmode = creds->authmode,
             .pmf_cfg = {
                 .capable = true,
                 .required = false
             },
+            .listen_interval = RADIO_LISTEN_INTERVAL,
         },
     };
     
     // Copy SSID and password
-    strncpy((char*)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid) - 1);
-    strncpy((char*)wifi_config.sta.password, password, sizeof(wifi_config.sta.password) - 1);
-    
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_connect());
+    strncpy((char*)wifi_config.sta.ssid, creds->ssid, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, creds->password, sizeof(wifi_config.sta.password));
+    
+    if (directed && creds->bssid_valid) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, creds->bssid, sizeof(creds->bssid));
+        wifi_config.sta.channel = creds->channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        // Strongest AP of the network, not the first one found
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    }
     
-    return ESP_OK;
+    // Drop any attempt in progress without the event handler restarting it
+    wifi_auto_reconnect = false;
+    esp_wifi_disconnect();
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    wifi_auto_reconnect = true;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set WiFi config: %s", esp_err_to_name(err));
+        return err;
+    }
+    return esp_wifi_connect();
+}
+
+static bool wait_for_wifi(uint32_t timeout_ms)
+{
+    uint32_t waited = 0;
+    while (!wifi_connected && waited < timeout_ms) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+        waited += 50;
+    }
+    return wifi_connected;
+}
+
+// Copy one field value up to its unescaped ';', undoing backslash escapes and
+// optional double quotes. Returns the position after the terminator, or NULL
+// if the value does not fit in cap-1 bytes.
+static const char *qr_copy_field(const char *src, char *dst, size_t cap)
+{
+    size_t n = 0;
+    bool quoted = (*src == '"');
+    if (quoted) src++;
+    while (*src && (quoted || *src != ';')) {
+        if (*src == '\\' && src[1]) {
+            src++;
+        } else if (quoted && *src == '"') {
+            quoted = false;
+            src++;
+            continue;
+        }
+        if (n + 1 >= cap) return NULL;
+        dst[n++] = *src++;
+    }
+    dst[n] = '\0';
+    return *src == ';' ? src + 1 : src;
 }
 
-// Parse WiFi QR code format: S:SSID;P:Password
-static bool parse_wifi_qr_code(const char *qr_data, char *ssid, char *password)
+/**
+ * Parse a WiFi QR code
+ * Accepts the standard WIFI:T:<auth>;S:<ssid>;P:<password>;H:<true|false>;;
+ * syntax (fields in any order, '\' escapes ; , : " and \) as well as the
+ * older bare S:<ssid>;P:<password> form.
+ */
+static bool parse_wifi_qr_code(const char *qr_data, wifi_credentials_t *creds)
 {
-    ESP_LOGI(TAG, "Parsing QR code: %s", qr_data);
+    memset(creds, 0, sizeof(*creds));
+    creds->version = WIFI_NVS_VERSION;
+    creds->authmode = WIFI_AUTH_WPA2_PSK;
+    
+    const char *p = qr_data;
+    if (strncmp(p, "WIFI:", 5) == 0) {
+        p += 5;
+    }
     
-    // Look for S: and P: patterns
-    const char *ssid_start = strstr(qr_data, "S:");
-    const char *pass_start = strstr(qr_data, "P:");
+    bool have_ssid = false;
+    bool have_auth = false;
+    char value[80];
+    while (*p) {
+        if (*p == ';') {
+            p++;  // Empty field, e.g. the closing ";;"
+            continue;
+        }
+        const char *colon = strchr(p, ':');
+        if (!colon) {
+            break;
+        }
+        size_t key_len = colon - p;
+        char key = (key_len == 1) ? *p : '\0';
+        p = qr_copy_field(colon + 1, value, sizeof(value));
+        if (!p) {
+            ESP_LOGW(TAG, "WiFi QR code field too long");
+            return false;
+        }
+        
+        if (key == 'S') {
+            if (strlen(value) >= sizeof(creds->ssid)) {
+                ESP_LOGW(TAG, "SSID longer than 32 bytes");
+                return false;
+            }
+            strcpy(creds->ssid, value);
+            have_ssid = creds->ssid[0] != '\0';
+        } else if (key == 'P') {
+            if (strlen(value) >= sizeof(creds->password)) {
+                ESP_LOGW(TAG, "Password longer than 64 bytes");
+                return false;
+            }
+            strcpy(creds->password, value);
+        } else if (key == 'T') {
+            have_auth = true;
+            if (strcasecmp(value, "nopass") == 0 || value[0] == '\0') {
+                creds->authmode = WIFI_AUTH_OPEN;
+            } else if (strcasecmp(value, "WEP") == 0) {
+                creds->authmode = WIFI_AUTH_WEP;
+            } else if (strcasecmp(value, "SAE") == 0 || strcasecmp(value, "WPA3") == 0) {
+                creds->authmode = WIFI_AUTH_WPA3_PSK;
+            } else {
+                // "WPA" covers WPA/WPA2 personal; the threshold is a minimum
+                creds->authmode = WIFI_AUTH_WPA_PSK;
+            }
+        } else if (key == 'H') {
+            creds->hidden = (strcasecmp(value, "true") == 0);
+        }
+        // Other fields (R:, I:, K: ...) are not needed for WPA2/WPA3 personal
+    }
     
-    if (!ssid_start || !pass_start) {
+    if (!have_ssid) {
         ESP_LOGW(TAG, "Invalid WiFi QR code format");
         return false;
     }
+    if (!have_auth && creds->password[0] == '\0') {
+        creds->authmode = WIFI_AUTH_OPEN;
+    }
     
-    // Extract SSID (skip "S:")
-    ssid_start += 2;
-    const char *ssid_end = strchr(ssid_start, ';');
-    if (!ssid_end) {
-        ESP_LOGW(TAG, "SSID not properly terminated");
+    ESP_LOGI(TAG, "Parsed SSID: %s (auth %d%s)", creds->ssid, creds->authmode, creds->hidden ? ", hidden" : "");
+    return true;
+}
+
+// Load the provisioned network; false if none is stored or it was forgotten
+static bool wifi_load_credentials(wifi_credentials_t *creds)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
         return false;
     }
     
-    int ssid_len = ssid_end - ssid_start;
-    if (ssid_len >= 64) ssid_len = 63;
-    strncpy(ssid, ssid_start, ssid_len);
-    ssid[ssid_len] = '\0';
-    
-    // Extract password (skip "P:")
-    pass_start += 2;
-    const char *pass_end = strchr(pass_start, ';');
-    if (!pass_end) {
-        // Password might be at the end without semicolon
-        pass_end = pass_start + strlen(pass_start);
+    gpio_set_direction(WIFI_FORGET_BUTTON_GPIO, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(WIFI_FORGET_BUTTON_GPIO, GPIO_PULLUP_ONLY);
+    if (gpio_get_level(WIFI_FORGET_BUTTON_GPIO) == 0) {
+        ESP_LOGW(TAG, "BOOT button held: forgetting stored WiFi network");
+        nvs_erase_key(nvs, "creds");
+        nvs_commit(nvs);
+        nvs_close(nvs);
+        return false;
     }
     
-    int pass_len = pass_end - pass_start;
-    if (pass_len >= 64) pass_len = 63;
-    strncpy(password, pass_start, pass_len);
-    password[pass_len] = '\0';
+    size_t len = sizeof(*creds);
+    esp_err_t err = nvs_get_blob(nvs, "creds", creds, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK || len != sizeof(*creds) || creds->version != WIFI_NVS_VERSION) {
+        return false;
+    }
+    creds->ssid[sizeof(creds->ssid) - 1] = '\0';
+    creds->password[sizeof(creds->password) - 1] = '\0';
+    return creds->ssid[0] != '\0';
+}
+
+// Record the AP we joined and store the credentials; flash is only written on change
+static void wifi_save_credentials(wifi_credentials_t *creds)
+{
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        memcpy(creds->bssid, ap.bssid, sizeof(creds->bssid));
+        creds->channel = ap.primary;
+        creds->bssid_valid = 1;
+    }
     
-    ESP_LOGI(TAG, "Parsed SSID: %s, Password: %s", ssid, password);
-    return true;
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    wifi_credentials_t stored;
+    size_t len = sizeof(stored);
+    if (nvs_get_blob(nvs, "creds", &stored, &len) != ESP_OK || len != sizeof(stored) ||
+        memcmp(&stored, creds, sizeof(stored)) != 0) {
+        if (nvs_set_blob(nvs, "creds", creds, sizeof(*creds)) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+            ESP_LOGI(TAG, "Stored WiFi network %s (BSSID " MACSTR ", channel %d)",
+                     creds->ssid, MAC2STR(creds->bssid), creds->channel);
+        }
+    }
+    nvs_close(nvs);
 }
 
 // Generate unique camera ID
@@ -629,12 +1443,36 @@ static esp_err_t register_camera_with_server(const char *camera_id)
     ESP_LOGI(TAG, "Registering camera with server: %s", camera_id);
     
     char url[128];
-    snprintf(url, sizeof(url), "http://%s:%d/api/camera/register", SERVER_IP, SERVER_PORT);
+    snprintf(url, sizeof(url), "%s://%s:%d/api/camera/register",
+             SERVER_USE_TLS ? "https" : "http", SERVER_IP, SERVER_STREAM_PORT);
     
     // Create JSON payload
     cJSON *json = cJSON_CreateObject();
     cJSON *camera_id_json = cJSON_CreateString(camera_id);
     cJSON_AddItemToObject(json, "cameraId", camera_id_json);
+    cJSON_AddStringToObject(json, "firmware", esp_app_get_description()->version);  // For OTA deltas
+
+    // AP we joined (the BSSID wifi_save_credentials stores); the relay groups
+    // cameras behind the same AP into one uplink site
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        char bssid[18];
+        snprintf(bssid, sizeof(bssid), MACSTR, MAC2STR(ap.bssid));
+        cJSON_AddStringToObject(json, "bssid", bssid);
+    }
+    
+    // Direct LAN endpoint, for dashboards on the same network
+    esp_netif_ip_info_t ip_info;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (lan_token[0] && netif && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
+        char ip[16];
+        snprintf(ip, sizeof(ip), IPSTR, IP2STR(&ip_info.ip));
+        cJSON *lan = cJSON_AddObjectToObject(json, "lan");
+        cJSON_AddStringToObject(lan, "ip", ip);
+        cJSON_AddNumberToObject(lan, "port", LAN_MJPEG_PORT);
+        cJSON_AddStringToObject(lan, "token", lan_token);
+        cJSON_AddNumberToObject(lan, "maxClients", LAN_MJPEG_MAX_CLIENTS);
+    }
     char *json_string = cJSON_Print(json);
     
     esp_http_client_config_t config = {
@@ -642,6 +1480,13 @@ static esp_err_t register_camera_with_server(const char *camera_id)
         .method = HTTP_METHOD_POST,
         .timeout_ms = 5000,
     };
+#if SERVER_USE_TLS
+    if (strlen(SERVER_CA_CERT_PEM) > 0) {
+        config.cert_pem = SERVER_CA_CERT_PEM;
+    } else {
+        config.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+#endif
     
     esp_http_client_handle_t client = esp_http_client_init(&config);
     esp_http_client_set_header(client, "Content-Type", "application/json");
@@ -663,10 +1508,270 @@ static esp_err_t register_camera_with_server(const char *camera_id)
     return err;
 }
 
+#if SERVER_USE_TLS
+/**
+ * One-time TLS setup: RNG, trust anchors and client config are kept across
+ * reconnects so only the handshake itself is repeated
+ */
+static esp_err_t tls_init_once(void)
+{
+    if (tls_initialized) {
+        return ESP_OK;
+    }
+
+    mbedtls_ssl_init(&tls_ssl);
+    mbedtls_ssl_config_init(&tls_conf);
+    mbedtls_entropy_init(&tls_entropy);
+    mbedtls_ctr_drbg_init(&tls_ctr_drbg);
+    mbedtls_x509_crt_init(&tls_cacert);
+    mbedtls_net_init(&tls_net);
+
+    int ret = mbedtls_ctr_drbg_seed(&tls_ctr_drbg, mbedtls_entropy_func, &tls_entropy, NULL, 0);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS: ctr_drbg_seed failed: -0x%04X", -ret);
+        return ESP_FAIL;
+    }
+
+    ret = mbedtls_ssl_config_defaults(&tls_conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS: config_defaults failed: -0x%04X", -ret);
+        return ESP_FAIL;
+    }
+
+    if (strlen(SERVER_CA_CERT_PEM) > 0) {
+        ret = mbedtls_x509_crt_parse(&tls_cacert, (const unsigned char *)SERVER_CA_CERT_PEM,
+                                     sizeof(SERVER_CA_CERT_PEM));
+        if (ret != 0) {
+            ESP_LOGE(TAG, "TLS: failed to parse SERVER_CA_CERT_PEM: -0x%04X", -ret);
+            return ESP_FAIL;
+        }
+        mbedtls_ssl_conf_ca_chain(&tls_conf, &tls_cacert, NULL);
+    } else if (esp_crt_bundle_attach(&tls_conf) != ESP_OK) {
+        ESP_LOGE(TAG, "TLS: failed to attach certificate bundle");
+        return ESP_FAIL;
+    }
+
+    mbedtls_ssl_conf_authmode(&tls_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&tls_conf, mbedtls_ctr_drbg_random, &tls_ctr_drbg);
+    mbedtls_ssl_conf_ciphersuites(&tls_conf, tls_ciphersuites);
+    // TLS 1.2 keeps resumption to a single round trip with a ticket we can serialize up front
+    mbedtls_ssl_conf_max_tls_version(&tls_conf, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_session_tickets(&tls_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+    ret = mbedtls_ssl_setup(&tls_ssl, &tls_conf);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS: ssl_setup failed: -0x%04X", -ret);
+        return ESP_FAIL;
+    }
+    ret = mbedtls_ssl_set_hostname(&tls_ssl, SERVER_IP);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS: set_hostname failed: -0x%04X", -ret);
+        return ESP_FAIL;
+    }
+
+    if (TLS_PERSIST_SESSION_NVS) {
+        nvs_handle_t nvs;
+        if (nvs_open(TLS_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+            size_t blob_len = sizeof(tls_session_blob);
+            if (nvs_get_blob(nvs, "session", tls_session_blob, &blob_len) == ESP_OK) {
+                tls_session_blob_len = blob_len;
+                ESP_LOGI(TAG, "TLS: loaded cached session from NVS (%d bytes)", blob_len);
+            }
+            nvs_close(nvs);
+        }
+    }
+
+    tls_initialized = true;
+    return ESP_OK;
+}
+
+/**
+ * Cache the negotiated session in RAM, and in NVS when it changed (a resumed
+ * session can still come back with a renewed ticket)
+ * Returns true when the server resumed the session: it echoed the session id
+ * the ClientHello offered (RFC 5246 7.4.1.3; with a ticket the id is the
+ * random one sent next to it, RFC 5077 3.4)
+ */
+static bool tls_cache_session(const uint8_t *offered_id, size_t offered_id_len)
+{
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    bool resumed = false;
+    uint8_t blob[TLS_SESSION_BLOB_MAX];
+    size_t blob_len = 0;
+    if (mbedtls_ssl_get_session(&tls_ssl, &session) == 0) {
+        resumed = offered_id_len > 0 && mbedtls_ssl_session_get_id_len(&session) == offered_id_len &&
+                  memcmp(mbedtls_ssl_session_get_id(&session), offered_id, offered_id_len) == 0;
+        bool changed = mbedtls_ssl_session_save(&session, blob, sizeof(blob), &blob_len) == 0 &&
+                       (blob_len != tls_session_blob_len || memcmp(blob, tls_session_blob, blob_len) != 0);
+        if (changed) {
+            memcpy(tls_session_blob, blob, blob_len);
+            tls_session_blob_len = blob_len;
+
+            if (TLS_PERSIST_SESSION_NVS) {
+                nvs_handle_t nvs;
+                if (nvs_open(TLS_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+                    nvs_set_blob(nvs, "session", blob, blob_len);
+                    nvs_commit(nvs);
+                    nvs_close(nvs);
+                }
+            }
+        }
+    }
+
+    mbedtls_ssl_session_free(&session);
+    return resumed;
+}
+
+// Handshake reads wait no later than this (esp_timer us), however many reads
+// the handshake takes; the socket itself blocks
+static int64_t tls_handshake_deadline_us = 0;
+
+static int tls_recv_until_deadline(void *ctx, unsigned char *buf, size_t len, uint32_t timeout_ms)
+{
+    (void)timeout_ms;  // conf read_timeout is unused; the deadline covers the whole handshake
+    int64_t remaining_ms = (tls_handshake_deadline_us - esp_timer_get_time()) / 1000;
+    if (remaining_ms <= 0) {
+        return MBEDTLS_ERR_SSL_TIMEOUT;
+    }
+    return mbedtls_net_recv_timeout(ctx, buf, len, (uint32_t)remaining_ms);
+}
+
+/**
+ * Run the TLS handshake on the already connected websocket_fd, offering the
+ * cached session for abbreviated resumption
+ */
+static esp_err_t tls_handshake(void)
+{
+    if (tls_init_once() != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    mbedtls_ssl_session_reset(&tls_ssl);
+    tls_net.fd = websocket_fd;
+    // A blocking recv only returns on data, close or SO_RCVTIMEO, so the
+    // handshake reads go through a select on the time left instead
+    int64_t start_us = esp_timer_get_time();
+    tls_handshake_deadline_us = start_us + TLS_HANDSHAKE_TIMEOUT_MS * 1000LL;
+    mbedtls_ssl_set_bio(&tls_ssl, &tls_net, mbedtls_net_send, NULL, tls_recv_until_deadline);
+
+    bool offered = false;
+    if (tls_session_blob_len > 0) {
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        if (mbedtls_ssl_session_load(&session, tls_session_blob, tls_session_blob_len) == 0 &&
+            mbedtls_ssl_set_session(&tls_ssl, &session) == 0) {
+            offered = true;
+        } else {
+            ESP_LOGW(TAG, "TLS: cached session rejected locally, doing a full handshake");
+            tls_session_blob_len = 0;
+        }
+        mbedtls_ssl_session_free(&session);
+    }
+
+    // Stepped so the session id the ClientHello carried can be read once it is written
+    uint8_t offered_id[32];
+    size_t offered_id_len = 0;
+    bool hello_written = false;
+    int ret = 0;
+    while (!mbedtls_ssl_is_handshake_over(&tls_ssl)) {
+        ret = mbedtls_ssl_handshake_step(&tls_ssl);
+        if (!hello_written && tls_ssl.MBEDTLS_PRIVATE(state) > MBEDTLS_SSL_CLIENT_HELLO) {
+            hello_written = true;
+            const mbedtls_ssl_session *hello = tls_ssl.MBEDTLS_PRIVATE(session_negotiate);
+            if (offered && hello->MBEDTLS_PRIVATE(id_len) <= sizeof(offered_id)) {
+                offered_id_len = hello->MBEDTLS_PRIVATE(id_len);
+                memcpy(offered_id, hello->MBEDTLS_PRIVATE(id), offered_id_len);
+            }
+        }
+        if (ret == 0) {
+            continue;
+        }
+        if (ret == MBEDTLS_ERR_SSL_TIMEOUT || esp_timer_get_time() > tls_handshake_deadline_us) {
+            ESP_LOGE(TAG, "TLS handshake timed out after %d ms", TLS_HANDSHAKE_TIMEOUT_MS);
+            return ESP_FAIL;
+        }
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            ESP_LOGE(TAG, "TLS handshake failed: -0x%04X", -ret);
+            if (offered) {
+                // Drop a stale ticket so the next attempt does a clean full handshake
+                tls_session_blob_len = 0;
+            }
+            return ESP_FAIL;
+        }
+    }
+    // Streaming reads block as before, bounded by the socket's SO_RCVTIMEO
+    mbedtls_ssl_set_bio(&tls_ssl, &tls_net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    uint32_t handshake_ms = (esp_timer_get_time() - start_us) / 1000;
+    bool resumed = tls_cache_session(offered_id, offered_id_len);
+    if (resumed) {
+        tls_resumed_handshakes++;
+    } else {
+        tls_full_handshakes++;
+    }
+    record_stage_latency(STAGE_TLS_HANDSHAKE, handshake_ms);
+    ESP_LOGI(TAG, "TLS %s handshake in %d ms (%s, full=%d resumed=%d)",
+             resumed ? "resumed" : "full", handshake_ms, mbedtls_ssl_get_ciphersuite(&tls_ssl),
+             tls_full_handshakes, tls_resumed_handshakes);
+    return ESP_OK;
+}
+#endif
+
+// Send on the streaming connection (TLS or plain TCP); sets errno to EAGAIN on would-block
+static int transport_send(const void *buf, size_t len)
+{
+#if SERVER_USE_TLS
+    int ret = mbedtls_ssl_write(&tls_ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "TLS write failed: -0x%04X", -ret);
+        errno = EIO;
+        return -1;
+    }
+    return ret;
+#else
+    return send(websocket_fd, buf, len, 0);
+#endif
+}
+
+// Receive from the streaming connection (TLS or plain TCP)
+static int transport_recv(void *buf, size_t len)
+{
+#if SERVER_USE_TLS
+    int ret = mbedtls_ssl_read(&tls_ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return ret < 0 ? -1 : ret;
+#else
+    return recv(websocket_fd, buf, len, 0);
+#endif
+}
+
+// Close the streaming connection; TLS state is kept for resumption
+static void transport_close(void)
+{
+    if (websocket_fd >= 0) {
+        close(websocket_fd);
+        websocket_fd = -1;
+    }
+#if SERVER_USE_TLS
+    tls_net.fd = -1;
+#endif
+}
+
 // Simple WebSocket handshake and connection
 static esp_err_t websocket_connect(const char *host, int port, const char *path)
 {
-    ESP_LOGI(TAG, "Connecting to WebSocket: %s:%d%s", host, port, path);
+    ESP_LOGI(TAG, "Connecting to WebSocket: %s://%s:%d%s", SERVER_USE_TLS ? "wss" : "ws", host, port, path);
+    uint32_t connect_start_time = esp_timer_get_time() / 1000;
     
     // Create socket
     websocket_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -694,8 +1799,7 @@ static esp_err_t websocket_connect(const char *host, int port, const char *path)
     struct hostent *server = gethostbyname(host);
     if (server == NULL) {
         ESP_LOGE(TAG, "Failed to resolve hostname");
-        close(websocket_fd);
-        websocket_fd = -1;
+        transport_close();
         return ESP_FAIL;
     }
     
@@ -708,10 +1812,16 @@ static esp_err_t websocket_connect(const char *host, int port, const char *path)
     
     if (connect(websocket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         ESP_LOGE(TAG, "Failed to connect to server");
-        close(websocket_fd);
-        websocket_fd = -1;
+        transport_close();
+        return ESP_FAIL;
+    }
+    
+#if SERVER_USE_TLS
+    if (tls_handshake() != ESP_OK) {
+        transport_close();
         return ESP_FAIL;
     }
+#endif
     
     // Send WebSocket handshake
     char handshake[512];
@@ -725,20 +1835,18 @@ static esp_err_t websocket_connect(const char *host, int port, const char *path)
         "\r\n",
         path, host, port);
     
-    if (send(websocket_fd, handshake, strlen(handshake), 0) < 0) {
+    if (transport_send(handshake, strlen(handshake)) < 0) {
         ESP_LOGE(TAG, "Failed to send handshake");
-        close(websocket_fd);
-        websocket_fd = -1;
+        transport_close();
         return ESP_FAIL;
     }
     
     // Read handshake response
     char response[1024];
-    int received = recv(websocket_fd, response, sizeof(response) - 1, 0);
+    int received = transport_recv(response, sizeof(response) - 1);
     if (received <= 0) {
         ESP_LOGE(TAG, "Failed to receive handshake response");
-        close(websocket_fd);
-        websocket_fd = -1;
+        transport_close();
         return ESP_FAIL;
     }
     
@@ -746,18 +1854,20 @@ static esp_err_t websocket_connect(const char *host, int port, const char *path)
     if (strstr(response, "101 Switching Protocols") == NULL) {
         ESP_LOGE(TAG, "WebSocket handshake failed");
         ESP_LOGE(TAG, "Response: %s", response);
-        close(websocket_fd);
-        websocket_fd = -1;
+        transport_close();
         return ESP_FAIL;
     }
     
     streaming_active = true;
-    ESP_LOGI(TAG, "WebSocket connected successfully");
+    uint32_t connect_time = esp_timer_get_time() / 1000 - connect_start_time;
+    record_stage_latency(STAGE_CONNECT, connect_time);
+    ESP_LOGI(TAG, "WebSocket connected successfully in %d ms", connect_time);
     return ESP_OK;
 }
 
-// Send binary data over WebSocket with comprehensive logging
-static int websocket_send_binary(const uint8_t *data, size_t len)
+// Send a JPEG over WebSocket with comprehensive logging
+// The optional prefix (see build_frame_prefix) goes out in the same message.
+static int websocket_send_binary(const uint8_t *data, size_t len, const uint8_t *prefix, size_t prefix_len)
 {
     if (websocket_fd < 0 || !streaming_active) {
         ESP_LOGW(TAG, "WebSocket send failed: fd=%d, active=%d", websocket_fd, streaming_active);
@@ -783,145 +1893,1619 @@ static int websocket_send_binary(const uint8_t *data, size_t len)
         return -1;
     }
     
-    // Create WebSocket frame header for binary data
-    uint8_t header[10];
+    int sent_total = websocket_write_frame(WS_OPCODE_BINARY, prefix, prefix_len, data, len);
+    if (sent_total == len) {
+        valid_frames_sent++;
+    }
+    return sent_total;
+}
+
+// Send one WebSocket frame (header, mask and chunked payload) without validation
+// An optional small prefix (message type / profile tag) is sent ahead of the data
+// as part of the same frame, so tagged frames need no copy of the JPEG.
+static int websocket_write_frame(uint8_t opcode, const uint8_t *prefix, size_t prefix_len,
+                                 const uint8_t *data, size_t len)
+{
+    // Header and masked payload are staged together so each write is one full
+    // TCP segment burst / TLS record instead of a tiny header record plus payload
+    static uint8_t tx_buf[WEBSOCKET_TX_CHUNK_SIZE];
+    
+    if (websocket_fd < 0 || !streaming_active) {
+        return -1;
+    }
+    
+    size_t payload_len = prefix_len + len;
+    
+    // Create WebSocket frame header (2 + 8 length + 4 mask bytes max)
+    uint8_t header[14];
     int header_len = 0;
     
-    header[0] = 0x82; // FIN=1, opcode=2 (binary)
+    header[0] = 0x80 | (opcode & 0x0F); // FIN=1 + opcode
     
-    uint32_t mask = 0x12345678;
+    uint32_t mask = WEBSOCKET_MASK_KEY;
+    bool xor_mask = WEBSOCKET_USE_MASKING && mask != 0;
+    uint8_t mask_bytes[4] = {(mask >> 24) & 0xFF, (mask >> 16) & 0xFF, (mask >> 8) & 0xFF, mask & 0xFF};
     
-    if (len < 126) {
-        header[1] = (WEBSOCKET_USE_MASKING ? 0x80 : 0x00) | len; // MASK bit + payload length
+    if (payload_len < 126) {
+        header[1] = (WEBSOCKET_USE_MASKING ? 0x80 : 0x00) | payload_len; // MASK bit + payload length
         header_len = 2;
-    } else if (len < 65536) {
+    } else if (payload_len < 65536) {
         header[1] = (WEBSOCKET_USE_MASKING ? 0x80 : 0x00) | 126; // MASK bit + extended payload length
-        header[2] = (len >> 8) & 0xFF;
-        header[3] = len & 0xFF;
+        header[2] = (payload_len >> 8) & 0xFF;
+        header[3] = payload_len & 0xFF;
         header_len = 4;
     } else {
         header[1] = (WEBSOCKET_USE_MASKING ? 0x80 : 0x00) | 127; // MASK bit + 64-bit extended payload length
         // For simplicity, we only use the lower 32 bits
         header[2] = 0; header[3] = 0; header[4] = 0; header[5] = 0;
-        header[6] = (len >> 24) & 0xFF;
-        header[7] = (len >> 16) & 0xFF;
-        header[8] = (len >> 8) & 0xFF;
-        header[9] = len & 0xFF;
+        header[6] = (payload_len >> 24) & 0xFF;
+        header[7] = (payload_len >> 16) & 0xFF;
+        header[8] = (payload_len >> 8) & 0xFF;
+        header[9] = payload_len & 0xFF;
         header_len = 10;
     }
     
     // Add masking key only if masking is enabled
     if (WEBSOCKET_USE_MASKING) {
-        header[header_len] = (mask >> 24) & 0xFF;
-        header[header_len + 1] = (mask >> 16) & 0xFF;
-        header[header_len + 2] = (mask >> 8) & 0xFF;
-        header[header_len + 3] = mask & 0xFF;
+        memcpy(&header[header_len], mask_bytes, 4);
         header_len += 4;
     }
     
     // Log WebSocket frame header details
     if (ENABLE_WEBSOCKET_DIAGNOSTICS) {
-        ESP_LOGI(TAG, "WebSocket frame header: %d bytes, payload: %d bytes", header_len, len);
+        ESP_LOGI(TAG, "WebSocket frame header: %d bytes, payload: %d bytes", header_len, payload_len);
         log_binary_data_inspection(header, header_len, "WebSocket Header");
     }
     
-    // Send header
-    int header_sent = send(websocket_fd, header, header_len, 0);
-    if (header_sent < 0) {
-        ESP_LOGE(TAG, "Failed to send WebSocket header: errno=%d (%s)", errno, strerror(errno));
-        log_websocket_transmission_details(header_len, header_sent, "HEADER_SEND_FAILED");
-        streaming_active = false;
-        return -1;
-    } else if (header_sent != header_len) {
-        ESP_LOGW(TAG, "Partial WebSocket header send: %d/%d bytes", header_sent, header_len);
-        log_websocket_transmission_details(header_len, header_sent, "HEADER_PARTIAL_SEND");
-    } else if (ENABLE_WEBSOCKET_DIAGNOSTICS) {
-        ESP_LOGI(TAG, "WebSocket header sent successfully: %d bytes", header_sent);
+    memcpy(tx_buf, header, header_len);
+    size_t fill = header_len;
+    for (size_t i = 0; i < prefix_len; i++) {
+        tx_buf[fill + i] = xor_mask ? prefix[i] ^ mask_bytes[i & 3] : prefix[i];
     }
-    
-    // Allocate buffer for masked payload
-    uint8_t *masked_payload = NULL;
-    const uint8_t *send_data = data;
-    size_t sent_total = 0;
-    
-    if (WEBSOCKET_USE_MASKING) {
-        // Allocate memory for masked payload
-        masked_payload = malloc(len);
-        if (!masked_payload) {
-            ESP_LOGE(TAG, "Failed to allocate memory for masked payload");
-            return -1;
+    fill += prefix_len;
+    size_t offset = 0;
+    
+    // Mask the payload chunk by chunk into the staging buffer and send it
+    do {
+        size_t take = MIN(len - offset, sizeof(tx_buf) - fill);
+        if (xor_mask) {
+            for (size_t i = 0; i < take; i++) {
+                tx_buf[fill + i] = data[offset + i] ^ mask_bytes[(prefix_len + offset + i) & 3];
+            }
+        } else {
+            memcpy(tx_buf + fill, data + offset, take);
         }
+        fill += take;
+        offset += take;
         
-        // Mask the entire payload at once
-        uint8_t mask_bytes[4] = {(mask >> 24) & 0xFF, (mask >> 16) & 0xFF, (mask >> 8) & 0xFF, mask & 0xFF};
-        for (size_t i = 0; i < len; i++) {
-            masked_payload[i] = data[i] ^ mask_bytes[i % 4];
+        size_t pos = 0;
+        while (pos < fill) {
+            int sent = transport_send(tx_buf + pos, fill - pos);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    ESP_LOGW(TAG, "WebSocket send would block, retrying at offset %d...", offset - fill + pos);
+                    log_websocket_transmission_details(fill - pos, sent, "WOULD_BLOCK_RETRY");
+                    vTaskDelay(pdMS_TO_TICKS(10));
+                    continue; // Retry this chunk
+                }
+                ESP_LOGE(TAG, "Failed to send WebSocket chunk at offset %d, errno: %d (%s)", 
+                         offset - fill + pos, errno, strerror(errno));
+                log_websocket_transmission_details(fill - pos, sent, "CHUNK_SEND_FAILED");
+                streaming_active = false;
+                return -1;
+            } else if (sent < fill - pos && ENABLE_WEBSOCKET_DIAGNOSTICS) {
+                ESP_LOGW(TAG, "Partial chunk send: %d/%d bytes", sent, fill - pos);
+            }
+            pos += sent;
         }
-        send_data = masked_payload;
         
-        // Log masking for debugging
         if (ENABLE_WEBSOCKET_DIAGNOSTICS) {
-            ESP_LOGI(TAG, "Payload masking - Original: %02X %02X %02X %02X, Masked: %02X %02X %02X %02X", 
-                     data[0], data[1], data[2], data[3],
-                     masked_payload[0], masked_payload[1], masked_payload[2], masked_payload[3]);
-            ESP_LOGI(TAG, "Mask key: %02X %02X %02X %02X", 
-                     mask_bytes[0], mask_bytes[1], mask_bytes[2], mask_bytes[3]);
+            ESP_LOGI(TAG, "Chunk progress: %d/%d bytes sent", offset, len);
         }
-    }
+        fill = 0;
+    } while (offset < len);
     
-    // Send payload in chunks to handle large frames
-    const size_t chunk_size = 4096; // Larger chunks since masking is done
-    for (size_t offset = 0; offset < len; ) {
-        size_t current_chunk = (len - offset > chunk_size) ? chunk_size : (len - offset);
-        
-        int sent = send(websocket_fd, send_data + offset, current_chunk, 0);
-        if (sent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                ESP_LOGW(TAG, "WebSocket send would block, retrying chunk at offset %d...", offset);
-                log_websocket_transmission_details(current_chunk, sent, "WOULD_BLOCK_RETRY");
-                vTaskDelay(pdMS_TO_TICKS(10));
-                continue; // Retry this chunk
-            } else {
-                ESP_LOGE(TAG, "Failed to send WebSocket payload chunk at offset %d, errno: %d (%s)", 
-                         offset, errno, strerror(errno));
-                log_websocket_transmission_details(current_chunk, sent, "CHUNK_SEND_FAILED");
-                streaming_active = false;
-                if (masked_payload) free(masked_payload);
-                return -1;
-            }
-        } else if (sent < current_chunk) {
-            if (ENABLE_WEBSOCKET_DIAGNOSTICS) {
-                ESP_LOGW(TAG, "Partial chunk send at offset %d: %d/%d bytes", offset, sent, current_chunk);
-                log_websocket_transmission_details(current_chunk, sent, "PARTIAL_CHUNK_SEND");
-            }
-            // Handle partial send by moving only the sent bytes
-            offset += sent;
-            sent_total += sent;
-        } else {
-            // Full chunk sent successfully
-            if (ENABLE_WEBSOCKET_DIAGNOSTICS && (offset % (chunk_size * 4) == 0)) {
-                ESP_LOGI(TAG, "Chunk progress: %d/%d bytes sent", offset + current_chunk, len);
-            }
-            offset += current_chunk;
-            sent_total += sent;
-        }
+    log_websocket_transmission_details(len, len, "SUCCESS");
+    return len;
+}
+
+// Send a telemetry message on the streaming connection
+static int websocket_send_telemetry(uint32_t period_ms)
+{
+    static uint8_t telemetry_buf[TELEMETRY_BUFFER_SIZE];
+
+    size_t len = build_telemetry_message(telemetry_buf, sizeof(telemetry_buf), period_ms);
+    if (len == 0) {
+        return -1;
     }
-    
-    // Clean up masked payload buffer
-    if (masked_payload) {
-        free(masked_payload);
+
+    int sent = websocket_write_frame(WS_OPCODE_BINARY, NULL, 0, telemetry_buf, len);
+    if (sent != len) {
+        ESP_LOGW(TAG, "Failed to send telemetry (%d/%d bytes)", sent, len);
+        return -1;
+    }
+    return sent;
+}
+
+// Answer a clock probe: when it was read and when this reply leaves
+static int websocket_send_clock_reply(uint32_t id, int64_t received_us)
+{
+    uint8_t reply[CLOCK_REPLY_LEN];
+    reply[0] = MSG_TYPE_CLOCK_REPLY;
+    put_u32(reply + 1, id);
+    put_u64(reply + 5, (uint64_t)received_us);
+    put_u64(reply + 13, (uint64_t)esp_timer_get_time());
+    return websocket_write_frame(WS_OPCODE_BINARY, NULL, 0, reply, sizeof(reply));
+}
+
+// JPEG writer for fmt2jpg_cb: append into the PSRAM substream buffer
+static size_t substream_jpeg_writer(void *arg, size_t index, const void *data, size_t len)
+{
+    if (index + len > SUBSTREAM_MAX_JPEG_SIZE) {
+        return 0;  // Abort the encode; the frame is skipped
+    }
+    memcpy(substream_jpeg + index, data, len);
+    substream_jpeg_len = index + len;
+    return len;
+}
+
+// Driver timestamp of the frame's capture (esp_timer based), wraps after ~49 days
+static uint32_t frame_capture_ms(const camera_fb_t *fb)
+{
+    return (uint32_t)fb->timestamp.tv_sec * 1000 + fb->timestamp.tv_usec / 1000;
+}
+
+// 0xA2/0xA3 prefix for a frame captured at capture_ms (ms since boot), in
+// server time once the clock is synchronised
+static size_t build_timed_prefix(uint8_t *prefix, uint8_t type, uint8_t profile, uint32_t capture_ms)
+{
+    prefix[0] = type;
+    prefix[1] = profile;
+    if (clock_synced) {
+        int32_t since_ref = (int32_t)(capture_ms - clock_ref_camera_ms);
+        int64_t server_ms = (int64_t)clock_ref_server_ms + since_ref + (int64_t)(since_ref * clock_drift_ppm / 1e6);
+        prefix[1] |= CAPTURE_CLOCK_SERVER;
+        capture_ms = (uint32_t)server_ms;
+    }
+    put_u32(prefix + 2, capture_ms);
+    return TIMED_FRAME_PREFIX_LEN;
+}
+
+// Message prefix for a frame of the given profile; returns its length
+// Untimed main frames go out as a bare JPEG, untimed substream frames as 0xA1.
+static size_t build_frame_prefix(uint8_t *prefix, uint8_t profile, const camera_fb_t *fb)
+{
+    if (capture_time_enabled) {
+        return build_timed_prefix(prefix, MSG_TYPE_TIMED_FRAME, profile, frame_capture_ms(fb));
+    }
+    if (profile == PROFILE_MAIN) {
+        return 0;
+    }
+    prefix[0] = MSG_TYPE_PROFILE_FRAME;
+    prefix[1] = profile;
+    return 2;
+}
+
+// Encode and send one substream frame from a captured main-profile JPEG
+// The main JPEG is decoded at 1/4 scale (the decoder skips the high-frequency
+// DCT work, so this is far cheaper than a full decode + resize) and re-encoded
+// into buffers that are allocated once and reused. In burst mode the frame
+// waits in the burst buffer instead.
+static int websocket_send_substream(camera_fb_t *fb)
+{
+    size_t width = fb->width / SUBSTREAM_SCALE_DIV;
+    size_t height = fb->height / SUBSTREAM_SCALE_DIV;
+    size_t rgb_size = width * height * 2;
+    
+    if (rgb_size > substream_rgb_size) {
+        // Only grows on a resolution change, never per frame
+        heap_caps_free(substream_rgb);
+        substream_rgb = heap_caps_malloc(rgb_size, MALLOC_CAP_SPIRAM);
+        substream_rgb_size = substream_rgb ? rgb_size : 0;
+    }
+    if (!substream_jpeg) {
+        substream_jpeg = heap_caps_malloc(SUBSTREAM_MAX_JPEG_SIZE, MALLOC_CAP_SPIRAM);
+    }
+    if (!substream_rgb || !substream_jpeg) {
+        ESP_LOGE(TAG, "Failed to allocate substream buffers");
+        return -1;
     }
     
-    // Log successful transmission
-    if (sent_total == len) {
-        log_websocket_transmission_details(len, sent_total, "SUCCESS");
-        valid_frames_sent++;
+    if (!jpg2rgb565(fb->buf, fb->len, substream_rgb, SUBSTREAM_SCALE)) {
+        ESP_LOGW(TAG, "Substream decode failed");
+        return -1;
+    }
+    substream_jpeg_len = 0;
+    if (!fmt2jpg_cb(substream_rgb, rgb_size, width, height, PIXFORMAT_RGB565,
+                    SUBSTREAM_JPEG_QUALITY, substream_jpeg_writer, NULL) || substream_jpeg_len == 0) {
+        ESP_LOGW(TAG, "Substream encode failed (%dx%d)", width, height);
+        return -1;
+    }
+    
+    if (radio_mode == RADIO_MODE_BURST) {
+        budget_debit(substream_jpeg_len);
+        return burst_store(substream_jpeg, substream_jpeg_len, PROFILE_SUB, frame_capture_ms(fb)) ? substream_jpeg_len : -1;
+    }
+    uint8_t prefix[TIMED_FRAME_PREFIX_LEN];
+    size_t prefix_len = build_frame_prefix(prefix, PROFILE_SUB, fb);
+    int sent = websocket_write_frame(WS_OPCODE_BINARY, prefix, prefix_len, substream_jpeg, substream_jpeg_len);
+    if (sent != substream_jpeg_len) {
+        ESP_LOGW(TAG, "Failed to send substream frame (%d bytes)", substream_jpeg_len);
+        return -1;
+    }
+    budget_debit(sent);
+    record_radio_frame(sent, frame_capture_ms(fb), esp_timer_get_time() / 1000);
+    return sent;
+}
+
+// Wait up to timeout_ms for the relay to send something; true when data is readable
+static bool transport_wait_readable(uint32_t timeout_ms)
+{
+    if (websocket_fd < 0) {
+        return false;
+    }
+#if SERVER_USE_TLS
+    if (mbedtls_ssl_get_bytes_avail(&tls_ssl) > 0) {
+        return true;
+    }
+#endif
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(websocket_fd, &readfds);
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    return select(websocket_fd + 1, &readfds, NULL, NULL, &tv) > 0;
+}
+
+// True when the relay has sent something we have not read yet
+static bool transport_rx_pending(void)
+{
+    return transport_wait_readable(0);
+}
+
+// Read exactly len bytes from the streaming connection
+static bool transport_recv_exact(uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len) {
+        int received = transport_recv(buf + got, len - got);
+        if (received <= 0) {
+            return false;
+        }
+        got += received;
+    }
+    return true;
+}
+
+// Read and handle all pending server->camera WebSocket frames without blocking
+// Text frames carry JSON control messages; pings are answered so the relay's
+// heartbeat keeps the connection alive.
+static void websocket_poll_control(void)
+{
+    static uint8_t control_buf[WS_CONTROL_MAX_PAYLOAD + 1];
+    
+    while (streaming_active && transport_rx_pending()) {
+        uint8_t header[2];
+        if (!transport_recv_exact(header, sizeof(header))) {
+            goto read_failed;
+        }
+        uint8_t opcode = header[0] & 0x0F;
+        bool masked = header[1] & 0x80;
+        uint64_t payload_len = header[1] & 0x7F;
+        
+        if (payload_len == 126) {
+            uint8_t ext[2];
+            if (!transport_recv_exact(ext, sizeof(ext))) {
+                goto read_failed;
+            }
+            payload_len = (ext[0] << 8) | ext[1];
+        } else if (payload_len == 127) {
+            uint8_t ext[8];
+            if (!transport_recv_exact(ext, sizeof(ext))) {
+                goto read_failed;
+            }
+            payload_len = 0;
+            for (int i = 0; i < 8; i++) {
+                payload_len = (payload_len << 8) | ext[i];
+            }
+        }
+        
+        uint8_t mask[4] = {0};
+        if (masked && !transport_recv_exact(mask, sizeof(mask))) {
+            goto read_failed;
+        }
+        
+        // Keep at most WS_CONTROL_MAX_PAYLOAD bytes and drain the rest
+        size_t keep = MIN(payload_len, WS_CONTROL_MAX_PAYLOAD);
+        if (!transport_recv_exact(control_buf, keep)) {
+            goto read_failed;
+        }
+        for (uint64_t drained = keep; drained < payload_len;) {
+            uint8_t discard[64];
+            size_t take = MIN(sizeof(discard), payload_len - drained);
+            if (!transport_recv_exact(discard, take)) {
+                goto read_failed;
+            }
+            drained += take;
+        }
+        if (masked) {
+            for (size_t i = 0; i < keep; i++) {
+                control_buf[i] ^= mask[i & 3];
+            }
+        }
+        control_buf[keep] = '\0';
+        
+        switch (opcode) {
+            case WS_OPCODE_TEXT:
+                if (keep < payload_len) {
+                    ESP_LOGW(TAG, "Dropping oversized control message (%llu bytes)", (unsigned long long)payload_len);
+                    break;
+                }
+                handle_control_message((const char *)control_buf);
+                break;
+            case WS_OPCODE_PING:
+                websocket_write_frame(WS_OPCODE_PONG, NULL, 0, control_buf, keep);
+                break;
+            case WS_OPCODE_CLOSE:
+                ESP_LOGW(TAG, "Server closed the WebSocket connection");
+                streaming_active = false;
+                break;
+            default:
+                break;  // Binary, pong and continuation frames are not used server->camera
+        }
+    }
+    return;
+    
+read_failed:
+    ESP_LOGW(TAG, "Failed to read from WebSocket, errno: %d (%s)", errno, strerror(errno));
+    streaming_active = false;
+}
+
+// Map a dashboard resolution name to a sensor frame size
+static bool framesize_from_name(const char *name, framesize_t *out)
+{
+    static const struct { const char *name; framesize_t size; } sizes[] = {
+        {"QVGA", FRAMESIZE_QVGA}, {"CIF", FRAMESIZE_CIF}, {"VGA", FRAMESIZE_VGA},
+        {"SVGA", FRAMESIZE_SVGA}, {"XGA", FRAMESIZE_XGA}, {"SXGA", FRAMESIZE_SXGA},
+        {"UXGA", FRAMESIZE_UXGA},
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (strcmp(name, sizes[i].name) == 0) {
+            *out = sizes[i].size;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Apply a JSON control message from the relay
+static void handle_control_message(const char *json)
+{
+    int64_t received_us = esp_timer_get_time(); // Probe receive time, before parsing
+    cJSON *root = cJSON_Parse(json);
+    if (!root) {
+        ESP_LOGW(TAG, "Ignoring malformed control message: %s", json);
+        return;
+    }
+    
+    const cJSON *type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        ESP_LOGW(TAG, "Control message without type");
+    } else if (strcmp(type->valuestring, "stream_profiles") == 0) {
+        const cJSON *main_profile = cJSON_GetObjectItem(root, "main");
+        const cJSON *sub_profile = cJSON_GetObjectItem(root, "sub");
+        const cJSON *capture_time = cJSON_GetObjectItem(root, "capture_time");
+        if (cJSON_IsBool(main_profile)) {
+            profile_main_enabled = cJSON_IsTrue(main_profile);
+        }
+        if (cJSON_IsBool(sub_profile)) {
+            profile_sub_enabled = cJSON_IsTrue(sub_profile);
+        }
+        capture_time_enabled = cJSON_IsTrue(capture_time);
+        ESP_LOGI(TAG, "Stream profiles: main=%s sub=%s",
+                 profile_main_enabled ? "on" : "off", profile_sub_enabled ? "on" : "off");
+        apply_stream_idle_state();
+    } else if (strcmp(type->valuestring, "camera_settings") == 0) {
+        sensor_t *s = esp_camera_sensor_get();
+        const cJSON *resolution = cJSON_GetObjectItem(root, "resolution");
+        const cJSON *quality = cJSON_GetObjectItem(root, "quality");
+        framesize_t size;
+        if (s && cJSON_IsString(resolution) && framesize_from_name(resolution->valuestring, &size)) {
+            s->set_framesize(s, size);
+            motion_reset();
+            ESP_LOGI(TAG, "Frame size set to %s", resolution->valuestring);
+        }
+        if (s && cJSON_IsNumber(quality) && quality->valueint >= 4 && quality->valueint <= 63) {
+            s->set_quality(s, quality->valueint);
+            user_jpeg_quality = quality->valueint;
+            budget_jpeg_quality = quality->valueint;
+            motion_reset();
+            ESP_LOGI(TAG, "JPEG quality set to %d", quality->valueint);
+        }
+    } else if (strcmp(type->valuestring, "bandwidth_budget") == 0) {
+        const cJSON *kbps = cJSON_GetObjectItem(root, "kbps");
+        const cJSON *fps = cJSON_GetObjectItem(root, "fps");
+        apply_bandwidth_budget(cJSON_IsNumber(kbps) && kbps->valueint > 0 ? kbps->valueint : 0,
+                               cJSON_IsNumber(fps) && fps->valueint > 0 ? fps->valueint : 0);
+    } else if (strcmp(type->valuestring, "relay_load") == 0) {
+        const cJSON *max_fps = cJSON_GetObjectItem(root, "max_fps");
+        uint32_t fps = cJSON_IsNumber(max_fps) && max_fps->valueint > 0 ? MIN(max_fps->valueint, RELAY_LOAD_MAX_FPS) : 0;
+        if (fps != relay_max_fps) {
+            if (fps) {
+                ESP_LOGW(TAG, "Relay overloaded: main stream limited to %u fps", fps);
+            } else {
+                ESP_LOGI(TAG, "Relay load back to normal: main stream limit lifted");
+            }
+        }
+        relay_max_fps = fps;
+    } else if (strcmp(type->valuestring, "burst_mode") == 0) {
+        const cJSON *interval_ms = cJSON_GetObjectItem(root, "interval_ms");
+        const cJSON *fps = cJSON_GetObjectItem(root, "fps");
+        burst_configure(cJSON_IsNumber(interval_ms) && interval_ms->valueint > 0 ? interval_ms->valueint : 0,
+                        cJSON_IsNumber(fps) && fps->valueint > 0 ? fps->valueint : 1);
+    } else if (strcmp(type->valuestring, "preroll") == 0) {
+        const cJSON *seconds = cJSON_GetObjectItem(root, "seconds");
+        const cJSON *max_kb = cJSON_GetObjectItem(root, "max_kb");
+        const cJSON *post_ms = cJSON_GetObjectItem(root, "post_ms");
+        preroll_configure(cJSON_IsNumber(seconds) && seconds->valueint > 0 ? seconds->valueint : 0,
+                          cJSON_IsNumber(max_kb) && max_kb->valueint > 0 ? max_kb->valueint * 1024 : PREROLL_ARENA_BYTES,
+                          cJSON_IsNumber(post_ms) && post_ms->valueint > 0 ? post_ms->valueint : PREROLL_POST_EVENT_MS);
+    } else if (strcmp(type->valuestring, "time_sync") == 0) {
+        const cJSON *id = cJSON_GetObjectItem(root, "id");
+        if (cJSON_IsNumber(id)) {
+            websocket_send_clock_reply((uint32_t)id->valuedouble, received_us);
+        }
+    } else if (strcmp(type->valuestring, "clock") == 0) {
+        const cJSON *camera_ms = cJSON_GetObjectItem(root, "camera_ms");
+        const cJSON *server_ms = cJSON_GetObjectItem(root, "server_ms");
+        const cJSON *drift_ppm = cJSON_GetObjectItem(root, "drift_ppm");
+        if (cJSON_IsNumber(camera_ms) && cJSON_IsNumber(server_ms) && server_ms->valuedouble > 0) {
+            double ppm = cJSON_IsNumber(drift_ppm) ? drift_ppm->valuedouble : 0;
+            if (!clock_synced) {
+                ESP_LOGI(TAG, "Clock synchronised with the relay (drift %.1f ppm)", ppm);
+            }
+            clock_ref_camera_ms = (uint32_t)(uint64_t)camera_ms->valuedouble;
+            clock_ref_server_ms = (uint64_t)server_ms->valuedouble;
+            clock_drift_ppm = MAX(-CLOCK_MAX_DRIFT_PPM, MIN(ppm, CLOCK_MAX_DRIFT_PPM));
+            clock_synced = true;
+        }
+    } else if (strcmp(type->valuestring, "ota") == 0) {
+        ota_start(root);
+    } else if (strcmp(type->valuestring, "event_trigger") == 0) {
+        ESP_LOGI(TAG, "Event triggered by the relay");
+        event_pending = true;
+    } else {
+        ESP_LOGW(TAG, "Unknown control message type: %s", type->valuestring);
+    }
+    
+    cJSON_Delete(root);
+}
+
+// Whether an event is streaming live (pre-roll sent, post-event time not over)
+static bool event_is_live(uint32_t now_ms)
+{
+    return event_live_until != 0 && (int32_t)(event_live_until - now_ms) > 0;
+}
+
+// Pick the radio mode when viewer interest (relay or LAN), an event or burst mode changes
+// With no viewers the camera only sends a snapshot every IDLE_SNAPSHOT_INTERVAL_MS
+// and lets the modem sleep between beacons; streaming turns power save off so
+// frames are not delayed by the DTIM interval. Burst mode (see BURST_*) sleeps
+// between bursts, and sends what it still holds before another mode takes over.
+static void apply_stream_idle_state(void)
+{
+    static const char *const mode_names[RADIO_MODE_COUNT] = {
+        "full rate, modem sleep off", "bursts, modem sleep between them", "idle snapshots, modem sleep on",
+    };
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    bool live = lan_has_clients() || event_is_live(now_ms);
+    radio_mode_t mode = RADIO_MODE_STREAM;
+    if (!profile_main_enabled && !profile_sub_enabled && !live) {
+        mode = RADIO_MODE_IDLE;
+    } else if (burst_interval_ms && !live) {
+        mode = RADIO_MODE_BURST;
+    }
+    if (mode == radio_mode) {
+        return;
+    }
+    if (radio_mode == RADIO_MODE_BURST) {
+        burst_flush();
+    }
+    radio_account(now_ms);
+    radio_mode = mode;
+    burst_next_send_time = now_ms + burst_interval_ms;
+    radio_set_awake(mode == RADIO_MODE_STREAM);
+    ESP_LOGI(TAG, "Radio mode: %s", mode_names[mode]);
+}
+
+// Charge the time since the last call to the current radio mode
+static void radio_account(uint32_t now_ms)
+{
+    uint32_t elapsed = radio_accounted_until ? now_ms - radio_accounted_until : 0;
+    radio_stats[radio_mode].time_ms += elapsed;
+    if (radio_awake) {
+        radio_stats[radio_mode].awake_ms += elapsed;
+    }
+    radio_accounted_until = now_ms;
+}
+
+// Power save off, or on the way the current mode sleeps: idle wakes for every
+// DTIM beacon, burst mode only every RADIO_LISTEN_INTERVAL beacons
+static void radio_set_awake(bool awake)
+{
+    awake = awake || ota_state == OTA_DOWNLOADING;  // Keeps the firmware download at full speed
+    radio_account(esp_timer_get_time() / 1000);
+    radio_awake = awake;
+    esp_wifi_set_ps(awake ? WIFI_PS_NONE : radio_mode == RADIO_MODE_BURST ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+}
+
+// Turn burst mode on (interval_ms > 0) or off; frames already buffered are kept
+static void burst_configure(uint32_t interval_ms, uint32_t fps)
+{
+    if (interval_ms && !burst_buffer) {
+        burst_buffer = heap_caps_malloc(BURST_BUFFER_BYTES, MALLOC_CAP_SPIRAM);
+        if (!burst_buffer) {
+            ESP_LOGE(TAG, "Burst mode disabled: cannot allocate %d KB of PSRAM", BURST_BUFFER_BYTES / 1024);
+            interval_ms = 0;
+        }
+    }
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    burst_interval_ms = interval_ms ? MAX(BURST_MIN_INTERVAL_MS, MIN(interval_ms, BURST_MAX_INTERVAL_MS)) : 0;
+    burst_fps = MAX(1, MIN(fps, BURST_MAX_FPS));
+    burst_next_frame_time = now_ms;
+    burst_next_send_time = now_ms + burst_interval_ms;
+    if (burst_interval_ms) {
+        ESP_LOGI(TAG, "Burst mode: %u fps, sent every %u ms", burst_fps, burst_interval_ms);
+    } else {
+        ESP_LOGI(TAG, "Burst mode off");
+    }
+    apply_stream_idle_state();
+}
+
+// Copy a frame into the burst buffer, sending the burst first if it is full
+// Returns false if that send failed.
+static bool burst_store(const uint8_t *data, size_t len, uint8_t profile, uint32_t capture_ms)
+{
+    if (len > BURST_BUFFER_BYTES) {
+        return true;
+    }
+    if ((burst_count == BURST_MAX_FRAMES || burst_bytes + len > BURST_BUFFER_BYTES) && !burst_flush()) {
+        return false;
+    }
+    memcpy(burst_buffer + burst_bytes, data, len);
+    burst_index[burst_count++] = (burst_entry_t){
+        .offset = burst_bytes,
+        .len = len,
+        .capture_ms = capture_ms,
+        .profile = profile,
+    };
+    burst_bytes += len;
+    return true;
+}
+
+// Send the buffered frames back to back with power save off, oldest first
+// Returns false if the connection failed.
+static bool burst_flush(void)
+{
+    uint32_t start_ms = esp_timer_get_time() / 1000;
+    burst_next_send_time = start_ms + burst_interval_ms;
+    if (burst_count == 0) {
+        return true;
+    }
+    radio_set_awake(true);
+    uint32_t frames = 0;
+    for (uint32_t i = 0; i < burst_count && streaming_active; i++) {
+        const burst_entry_t *entry = &burst_index[i];
+        uint8_t prefix[TIMED_FRAME_PREFIX_LEN];
+        build_timed_prefix(prefix, MSG_TYPE_TIMED_FRAME, entry->profile, entry->capture_ms);
+        int sent = entry->profile == PROFILE_MAIN
+            ? websocket_send_binary(burst_buffer + entry->offset, entry->len, prefix, sizeof(prefix))
+            : websocket_write_frame(WS_OPCODE_BINARY, prefix, sizeof(prefix), burst_buffer + entry->offset, entry->len);
+        if (sent >= 0) {
+            record_radio_frame(entry->len, entry->capture_ms, esp_timer_get_time() / 1000);
+            frames++;
+        }
+    }
+    ESP_LOGI(TAG, "Burst: %u frames (%u KB) sent in %u ms", frames, burst_bytes / 1024,
+             (uint32_t)(esp_timer_get_time() / 1000) - start_ms);
+    burst_count = 0;
+    burst_bytes = 0;
+    if (radio_mode == RADIO_MODE_BURST) {
+        radio_set_awake(false);
+    }
+    return streaming_active;
+}
+
+// Start enforcing a new uplink budget (0 kbps lifts it)
+static void apply_bandwidth_budget(uint32_t kbps, uint32_t fps)
+{
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    budget_kbps = kbps;
+    budget_fps = kbps ? fps : 0;
+    budget_tokens = (int32_t)(kbps * BUDGET_BURST_MS / 8);
+    budget_refill_time = now_ms;
+    budget_next_frame_time = now_ms;
+    budget_window_start = now_ms;
+    budget_window_sent = 0;
+    budget_window_skipped = 0;
+    if (kbps == 0 && budget_jpeg_quality != user_jpeg_quality) {
+        sensor_t *s = esp_camera_sensor_get();
+        if (s) {
+            s->set_quality(s, user_jpeg_quality);
+        }
+        budget_jpeg_quality = user_jpeg_quality;
+    }
+    if (kbps) {
+        ESP_LOGI(TAG, "Uplink budget: %u kbps, %u fps", kbps, budget_fps);
+    } else {
+        ESP_LOGI(TAG, "Uplink budget lifted");
+    }
+}
+
+// Add the budget earned since the last call, up to one burst
+static void budget_refill(uint32_t now_ms)
+{
+    uint32_t elapsed = MIN(now_ms - budget_refill_time, BUDGET_BURST_MS);
+    int32_t burst = (int32_t)(budget_kbps * BUDGET_BURST_MS / 8); // kbps / 8 = bytes per ms
+    budget_refill_time = now_ms;
+    budget_tokens = MIN(budget_tokens + (int32_t)(elapsed * budget_kbps / 8), burst);
+}
+
+// Whether a main-profile frame may go out now; debits the bucket if so
+// A positive balance admits a frame of any size so large frames are never
+// starved; the debt delays the next ones instead.
+static bool budget_admit(size_t len, uint32_t now_ms)
+{
+    if (budget_kbps == 0) {
+        return true;
+    }
+    budget_refill(now_ms);
+    if (budget_tokens <= 0) {
+        budget_window_skipped++;
+        return false;
+    }
+    budget_tokens -= (int32_t)len;
+    budget_window_sent++;
+    if (budget_fps) {
+        budget_next_frame_time = now_ms + 1000 / budget_fps;
+    }
+    return true;
+}
+
+// Bytes sent outside the main profile (substream, snapshots) still use the uplink
+static void budget_debit(size_t len)
+{
+    if (budget_kbps) {
+        budget_tokens -= (int32_t)len;
+    }
+}
+
+// Earliest time the next main-profile frame may be captured: the budget's
+// frame slot, the relay's overload limit, which does not hold back events, and
+// burst mode's rate
+static uint32_t main_frame_pace_time(uint32_t now_ms, bool event_live)
+{
+    uint32_t pace_time = budget_fps ? budget_next_frame_time : now_ms;
+    if (relay_max_fps && !event_live && (int32_t)(relay_next_frame_time - pace_time) > 0) {
+        pace_time = relay_next_frame_time;
+    }
+    if (radio_mode == RADIO_MODE_BURST && (int32_t)(burst_next_frame_time - pace_time) > 0) {
+        pace_time = burst_next_frame_time;
+    }
+    return pace_time;
+}
+
+// Trade JPEG quality for frame rate when the budget keeps refusing frames
+static void budget_adjust_quality(uint32_t now_ms)
+{
+    if (budget_kbps == 0 || now_ms - budget_window_start < BUDGET_ADJUST_INTERVAL_MS) {
+        return;
+    }
+    int quality = budget_jpeg_quality;
+    int32_t burst = (int32_t)(budget_kbps * BUDGET_BURST_MS / 8);
+    if (budget_window_skipped > budget_window_sent) {
+        quality = MIN(quality + BUDGET_QUALITY_STEP, BUDGET_QUALITY_MAX);
+    } else if (budget_window_skipped == 0 && budget_tokens > burst / 2) {
+        quality = MAX(quality - BUDGET_QUALITY_STEP, user_jpeg_quality);
+    }
+    if (quality != budget_jpeg_quality) {
+        sensor_t *s = esp_camera_sensor_get();
+        if (s) {
+            s->set_quality(s, quality);
+        }
+        ESP_LOGI(TAG, "Uplink budget: JPEG quality %d -> %d (%u sent, %u over budget)",
+                 budget_jpeg_quality, quality, budget_window_sent, budget_window_skipped);
+        budget_jpeg_quality = quality;
+        motion_reset();
+    }
+    budget_window_start = now_ms;
+    budget_window_sent = 0;
+    budget_window_skipped = 0;
+}
+
+// Turn pre-event recording on (seconds > 0) or off; the ring starts empty
+static void preroll_configure(uint32_t seconds, uint32_t max_bytes, uint32_t post_ms)
+{
+    event_post_ms = MIN(post_ms, PREROLL_POST_EVENT_MAX_MS);
+    seconds = MIN(seconds, PREROLL_MAX_SECONDS);
+    if (seconds && !preroll_arena) {
+        preroll_arena = heap_caps_malloc(PREROLL_ARENA_BYTES, MALLOC_CAP_SPIRAM);
+        if (!preroll_arena) {
+            ESP_LOGE(TAG, "Pre-roll disabled: cannot allocate %d KB of PSRAM", PREROLL_ARENA_BYTES / 1024);
+            seconds = 0;
+        }
+    }
+    preroll_seconds = seconds;
+    preroll_max_bytes = MIN(max_bytes, PREROLL_ARENA_BYTES);
+    preroll_head = 0;
+    preroll_count = 0;
+    preroll_write_offset = 0;
+    motion_reset();
+    if (seconds) {
+        ESP_LOGI(TAG, "Pre-roll: last %u s, up to %u KB", seconds, preroll_max_bytes / 1024);
+    } else {
+        ESP_LOGI(TAG, "Pre-roll off");
+    }
+}
+
+static void preroll_drop_oldest(void)
+{
+    preroll_head = (preroll_head + 1) % PREROLL_MAX_FRAMES;
+    preroll_count--;
+}
+
+// Copy a frame into the ring, overwriting the oldest frames it needs room from
+static void preroll_store(const camera_fb_t *fb, uint32_t capture_ms)
+{
+    if (fb->len > preroll_max_bytes) {
+        return;
+    }
+    uint32_t offset = preroll_write_offset;
+    if (offset + fb->len > preroll_max_bytes) {
+        // Wrap: the frames between here and the end are the oldest; drop them
+        while (preroll_count && preroll_index[preroll_head].offset >= offset) {
+            preroll_drop_oldest();
+        }
+        offset = 0;
+    }
+    // Then the oldest frames in the way, a full index, and anything too old
+    while (preroll_count) {
+        const preroll_entry_t *oldest = &preroll_index[preroll_head];
+        bool overlaps = oldest->offset < offset + fb->len && offset < oldest->offset + oldest->len;
+        bool expired = capture_ms - oldest->capture_ms > preroll_seconds * 1000;
+        if (!overlaps && !expired && preroll_count < PREROLL_MAX_FRAMES) {
+            break;
+        }
+        preroll_drop_oldest();
+    }
+    memcpy(preroll_arena + offset, fb->buf, fb->len);
+    preroll_index[(preroll_head + preroll_count) % PREROLL_MAX_FRAMES] = (preroll_entry_t){
+        .offset = offset,
+        .len = fb->len,
+        .capture_ms = capture_ms,
+    };
+    preroll_count++;
+    preroll_write_offset = offset + fb->len;
+}
+
+// Send the ring, oldest first, as fast as the connection takes it
+// Frames the relay already has from an earlier event are skipped. Returns
+// false if the connection failed.
+static bool preroll_upload(void)
+{
+    uint32_t start_ms = esp_timer_get_time() / 1000;
+    uint32_t frames = 0;
+    uint32_t bytes = 0;
+    uint32_t oldest_ms = 0;
+    for (uint32_t i = 0; i < preroll_count; i++) {
+        const preroll_entry_t *entry = &preroll_index[(preroll_head + i) % PREROLL_MAX_FRAMES];
+        if (preroll_sent_until_ms && (int32_t)(entry->capture_ms - preroll_sent_until_ms) <= 0) {
+            continue;
+        }
+        uint8_t prefix[TIMED_FRAME_PREFIX_LEN];
+        build_timed_prefix(prefix, MSG_TYPE_PREROLL_FRAME, PROFILE_MAIN, entry->capture_ms);
+        if (websocket_send_binary(preroll_arena + entry->offset, entry->len, prefix, sizeof(prefix)) < 0) {
+            if (!streaming_active) {
+                return false;
+            }
+            continue; // Failed validation; the connection is fine
+        }
+        budget_debit(entry->len);
+        if (frames == 0) {
+            oldest_ms = entry->capture_ms;
+        }
+        frames++;
+        bytes += entry->len;
+        preroll_sent_until_ms = entry->capture_ms;
+    }
+    uint32_t elapsed_ms = esp_timer_get_time() / 1000 - start_ms;
+    ESP_LOGI(TAG, "Pre-roll: %u frames (%u KB, %u ms of video) uploaded in %u ms", frames, bytes / 1024,
+             frames ? preroll_sent_until_ms - oldest_ms : 0, elapsed_ms);
+    return true;
+}
+
+static void motion_reset(void)
+{
+    motion_frames = 0;
+    motion_average_len = 0;
+}
+
+// Whether this frame's size jumped against the running average
+static bool motion_detect(size_t len)
+{
+    bool motion = false;
+    if (motion_frames >= MOTION_WARMUP_FRAMES) {
+        uint32_t delta = len > motion_average_len ? len - motion_average_len : motion_average_len - len;
+        motion = delta * 100 > motion_average_len * MOTION_SIZE_DELTA_PCT;
+    } else {
+        motion_frames++;
+    }
+    motion_average_len = motion_average_len ? (motion_average_len * 7 + len) / 8 : len;
+    return motion;
+}
+
+// Start an event (upload the pre-roll, then stream live) or extend the current one
+// The event streams live from here on, so the upload already goes out with
+// power save off and after anything held for a burst
+static bool event_start(uint32_t now_ms)
+{
+    bool ok = true;
+    event_live_until = now_ms + event_post_ms;
+    apply_stream_idle_state();
+    if (now_ms - event_triggered_at >= PREROLL_RETRIGGER_MS || event_triggered_at == 0) {
+        event_triggered_at = now_ms;
+        ok = streaming_active && preroll_upload();
+    }
+    return ok;
+}
+
+typedef struct {
+    int fd;
+    int slot;
+    bool snapshot;
+} lan_client_t;
+
+// Whether LAN clients are waiting for frames; the streaming task keeps
+// capturing for them even when the relay has no viewers
+static bool lan_has_clients(void)
+{
+    return lan_client_count > 0;
+}
+
+// Share a captured frame with the LAN clients (streaming task)
+static void lan_publish_frame(const camera_fb_t *fb)
+{
+    if (lan_client_count == 0 || fb->len > MAX_VALID_JPEG_SIZE) {
+        return;
+    }
+    xSemaphoreTake(lan_frame_lock, portMAX_DELAY);
+    memcpy(lan_frame, fb->buf, fb->len);
+    lan_frame_len = fb->len;
+    lan_frame_capture_ms = frame_capture_ms(fb);
+    lan_frame_published_ms = esp_timer_get_time() / 1000;
+    lan_frame_seq++;
+    for (int i = 0; i < LAN_MJPEG_MAX_CLIENTS; i++) {
+        if (lan_client_tasks[i]) {
+            xTaskNotifyGive(lan_client_tasks[i]);
+        }
+    }
+    xSemaphoreGive(lan_frame_lock);
+}
+
+// Copy the published frame if it is newer than *seq; returns its length, 0 if none
+// A client's first frame may come from before it connected, but only if it is recent.
+static size_t lan_take_frame(uint8_t *dst, uint32_t *seq, uint32_t *capture_ms)
+{
+    size_t len = 0;
+    xSemaphoreTake(lan_frame_lock, portMAX_DELAY);
+    uint32_t age_ms = esp_timer_get_time() / 1000 - lan_frame_published_ms;
+    if (lan_frame_seq != *seq && (*seq != 0 || age_ms <= LAN_MJPEG_SNAPSHOT_MAX_AGE_MS)) {
+        memcpy(dst, lan_frame, lan_frame_len);
+        len = lan_frame_len;
+        *seq = lan_frame_seq;
+        *capture_ms = lan_frame_capture_ms;
+    }
+    xSemaphoreGive(lan_frame_lock);
+    return len;
+}
+
+static bool lan_send_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        int n = send(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void lan_reply_status(int fd, const char *status)
+{
+    char reply[160];
+    int len = snprintf(reply, sizeof(reply),
+                       "HTTP/1.1 %s\r\nContent-Length: 0\r\nRetry-After: 5\r\nConnection: close\r\n\r\n", status);
+    lan_send_all(fd, reply, len);
+}
+
+// "?token=..." must carry lan_token; compared in constant time
+static bool lan_token_valid(const char *query)
+{
+    const char *value = query ? strstr(query, "token=") : NULL;
+    if (!value || lan_token[0] == '\0') {
+        return false;
+    }
+    value += strlen("token=");
+    uint8_t diff = 0;
+    for (int i = 0; i < LAN_MJPEG_TOKEN_LEN; i++) {
+        if (value[i] == '\0') {
+            return false;
+        }
+        diff |= value[i] ^ lan_token[i];
+    }
+    char end = value[LAN_MJPEG_TOKEN_LEN];
+    return diff == 0 && (end == '\0' || end == '&');
+}
+
+// Read one request; true for an authorized GET of /stream or /snapshot.
+// Anything else is answered here and the caller closes the connection.
+static bool lan_read_request(int fd, bool *snapshot)
+{
+    char request[LAN_MJPEG_REQUEST_MAX];
+    size_t len = 0;
+    request[0] = '\0';
+    // Only the request line matters; stop once the headers are complete
+    while (len < sizeof(request) - 1 && !strstr(request, "\r\n\r\n")) {
+        int n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        len += n;
+        request[len] = '\0';
+    }
+
+    char *target = strchr(request, ' ');
+    char *target_end = target ? strchr(target + 1, ' ') : NULL;
+    if (strncmp(request, "GET ", 4) != 0 || !target_end) {
+        lan_reply_status(fd, "405 Method Not Allowed");
+        return false;
+    }
+    *target_end = '\0';
+    char *path = target + 1;
+    char *query = strchr(path, '?');
+    if (query) {
+        *query++ = '\0';
+    }
+    *snapshot = strcmp(path, "/snapshot") == 0;
+    if (!*snapshot && strcmp(path, "/stream") != 0) {
+        lan_reply_status(fd, "404 Not Found");
+        return false;
+    }
+    if (!lan_token_valid(query)) {
+        lan_reply_status(fd, "403 Forbidden");
+        return false;
+    }
+    return true;
+}
+
+// One LAN client: reads and checks its request, then an MJPEG stream until it
+// disconnects, or a single snapshot. Runs from accept on, so a slow client
+// only holds up itself.
+static void lan_client_task(void *arg)
+{
+    lan_client_t client = *(lan_client_t *)arg;
+    free(arg);
+    uint8_t *frame = NULL;
+    char header[256];
+    uint32_t seq = 0;
+    uint32_t frames_sent = 0;
+    bool authorized = lan_read_request(client.fd, &client.snapshot);
+    if (authorized) {
+        frame = heap_caps_malloc(MAX_VALID_JPEG_SIZE, MALLOC_CAP_SPIRAM);
+        // Counted once authorized: capture keeps running for counted clients only
+        xSemaphoreTake(lan_frame_lock, portMAX_DELAY);
+        lan_client_count++;
+        xSemaphoreGive(lan_frame_lock);
+        ESP_LOGI(TAG, "LAN %s client connected (%d connected)", client.snapshot ? "snapshot" : "stream", lan_client_count);
+    }
+    bool ok = authorized && frame != NULL;
+    if (authorized && !frame) {
+        lan_reply_status(client.fd, "503 Service Unavailable");
+    } else if (!client.snapshot) {
+        int len = snprintf(header, sizeof(header),
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: multipart/x-mixed-replace; boundary=" LAN_MJPEG_BOUNDARY "\r\n"
+                           "Cache-Control: no-store\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n");
+        ok = lan_send_all(client.fd, header, len);
+    }
+
+    while (ok) {
+        uint32_t capture_ms = 0;
+        size_t frame_len = lan_take_frame(frame, &seq, &capture_ms);
+        if (frame_len == 0) {
+            // Woken by lan_publish_frame; a long silence means capture has stopped
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LAN_MJPEG_FRAME_WAIT_MS)) == 0) {
+                if (client.snapshot) {
+                    lan_reply_status(client.fd, "503 Service Unavailable");
+                }
+                break;
+            }
+            continue;
+        }
+        int len;
+        if (client.snapshot) {
+            len = snprintf(header, sizeof(header),
+                           "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %u\r\n"
+                           "Cache-Control: no-store\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+                           (unsigned)frame_len, capture_ms);
+        } else {
+            // X-Timestamp is the capture time, on the same clock as 0xA2 frames
+            len = snprintf(header, sizeof(header),
+                           "--" LAN_MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %u\r\n\r\n",
+                           (unsigned)frame_len, capture_ms);
+        }
+        ok = lan_send_all(client.fd, header, len) && lan_send_all(client.fd, frame, frame_len) &&
+             (client.snapshot || lan_send_all(client.fd, "\r\n", 2));
+        frames_sent++;
+        if (client.snapshot) {
+            break;
+        }
+    }
+
+    xSemaphoreTake(lan_frame_lock, portMAX_DELAY);
+    lan_client_tasks[client.slot] = NULL;
+    if (authorized) {
+        lan_client_count--;
+    }
+    xSemaphoreGive(lan_frame_lock);
+    if (authorized) {
+        ESP_LOGI(TAG, "LAN %s client left after %u frames (%d connected)",
+                 client.snapshot ? "snapshot" : "stream", frames_sent, lan_client_count);
+    }
+    close(client.fd);
+    free(frame);
+    vTaskDelete(NULL);
+}
+
+// Hand an accepted connection to a client task at once (or refuse it); the
+// task reads the request, so accept never waits on a client
+static void lan_accept_client(int fd)
+{
+    lan_client_t *client = malloc(sizeof(lan_client_t));
+    int slot = -1;
+    xSemaphoreTake(lan_frame_lock, portMAX_DELAY);
+    for (int i = 0; client && i < LAN_MJPEG_MAX_CLIENTS && slot < 0; i++) {
+        if (lan_client_tasks[i] == NULL) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        *client = (lan_client_t){ .fd = fd, .slot = slot, .snapshot = false };
+        // Created under the lock so the slot is filled before the next accept or publish
+        if (xTaskCreatePinnedToCore(&lan_client_task, "lan_client", 4096, client, 4,
+                                    &lan_client_tasks[slot], 0) != pdPASS) {
+            lan_client_tasks[slot] = NULL;
+            slot = -1;
+        }
+    }
+    xSemaphoreGive(lan_frame_lock);
+
+    if (slot < 0) {
+        ESP_LOGW(TAG, "LAN client refused: all %d slots in use", LAN_MJPEG_MAX_CLIENTS);
+        lan_reply_status(fd, "503 Service Unavailable");
+        close(fd);
+        free(client);
+    }
+}
+
+static void lan_server_task(void *arg)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(LAN_MJPEG_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 2) != 0) {
+        ESP_LOGE(TAG, "LAN MJPEG server failed to listen on port %d: errno %d", LAN_MJPEG_PORT, errno);
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        lan_token[0] = '\0';
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "LAN MJPEG server on port %d (up to %d clients)", LAN_MJPEG_PORT, LAN_MJPEG_MAX_CLIENTS);
+
+    while (true) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        struct timeval timeout = {
+            .tv_sec = LAN_MJPEG_SEND_TIMEOUT_MS / 1000,
+            .tv_usec = (LAN_MJPEG_SEND_TIMEOUT_MS % 1000) * 1000,
+        };
+        int nodelay = 1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        lan_accept_client(fd);
+    }
+}
+
+// Generate the access token and start listening; registration then advertises it
+static void lan_server_start(void)
+{
+    lan_frame = heap_caps_malloc(MAX_VALID_JPEG_SIZE, MALLOC_CAP_SPIRAM);
+    lan_frame_lock = xSemaphoreCreateMutex();
+    if (!lan_frame || !lan_frame_lock) {
+        ESP_LOGE(TAG, "LAN MJPEG server disabled: out of memory");
+        return;
+    }
+    uint8_t raw[LAN_MJPEG_TOKEN_LEN / 2];
+    esp_fill_random(raw, sizeof(raw));
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        snprintf(lan_token + i * 2, 3, "%02x", raw[i]);
+    }
+    xTaskCreatePinnedToCore(&lan_server_task, "lan_mjpeg", 4096, NULL, 4, NULL, 0);
+}
+
+// Little-endian u32 from a delta header or operation
+static uint32_t ota_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Firmware update, flash side: writes the filled buffers in order and hands
+// them back to the download. After the first write error the rest are only
+// drained; ota_task checks ota_flash_err.
+static void ota_flash_task(void *arg)
+{
+    esp_ota_handle_t handle = (esp_ota_handle_t)(uintptr_t)arg;
+    ota_chunk_t chunk;
+    while (xQueueReceive(ota_full_queue, &chunk, portMAX_DELAY) == pdTRUE && chunk.buf) {
+        if (ota_flash_err == ESP_OK) {
+            ota_flash_err = esp_ota_write(handle, chunk.buf, chunk.len);
+            if (ota_flash_err == ESP_OK) {
+                ota_written += chunk.len;
+            }
+        }
+        xQueueSend(ota_free_queue, &chunk.buf, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(OTA_WRITE_GAP_MS));
+    }
+    xSemaphoreGive(ota_flash_done);
+    vTaskDelete(NULL);
+}
+
+// Hand the buffer being filled to ota_flash_task
+static void ota_fill_submit(void)
+{
+    if (ota_fill && ota_fill_len) {
+        ota_chunk_t chunk = { ota_fill, ota_fill_len };
+        xQueueSend(ota_full_queue, &chunk, portMAX_DELAY);
+        ota_fill = NULL;
+        ota_fill_len = 0;
+    }
+}
+
+// Room left in the buffer being filled. When both buffers are full this waits
+// for the flash, which holds back the download (TCP flow control does the rest).
+static uint8_t *ota_fill_space(size_t *space)
+{
+    if (ota_fill_len == OTA_CHUNK_BYTES) {
+        ota_fill_submit();
+    }
+    if (!ota_fill) {
+        xQueueReceive(ota_free_queue, &ota_fill, portMAX_DELAY);
+    }
+    *space = OTA_CHUNK_BYTES - ota_fill_len;
+    return ota_fill + ota_fill_len;
+}
+
+// Count len new image bytes written at ota_fill_space()
+static void ota_fill_commit(size_t len)
+{
+    mbedtls_sha256_update(&ota_target_sha, ota_fill + ota_fill_len, len);
+    ota_fill_len += len;
+    ota_produced += len;
+}
+
+// Full image: copy the download into the buffers
+static const char *ota_copy(const uint8_t *data, size_t len)
+{
+    if (ota_produced + len > ota_request.target_size) {
+        return "format";
+    }
+    while (len > 0) {
+        size_t space;
+        uint8_t *out = ota_fill_space(&space);
+        size_t n = MIN(space, len);
+        memcpy(out, data, n);
+        ota_fill_commit(n);
+        data += n;
+        len -= n;
+    }
+    return NULL;
+}
+
+// Delta: run inflated operation bytes, which may split anywhere
+static bool ota_patch_feed(const uint8_t *data, size_t len)
+{
+    while (len > 0 && !ota_patch.done) {
+        if (ota_patch.remaining == 0) {
+            // Operation header
+            if (ota_patch.header_len == 0) {
+                ota_patch.op = data[0];
+            }
+            size_t need = ota_patch.op == 'D' ? 9 : ota_patch.op == 'X' ? 5 : ota_patch.op == 'E' ? 1 : 0;
+            if (!need) {
+                return false;
+            }
+            size_t take = MIN(need - ota_patch.header_len, len);
+            memcpy(ota_patch.header + ota_patch.header_len, data, take);
+            ota_patch.header_len += take;
+            data += take;
+            len -= take;
+            if (ota_patch.header_len < need) {
+                break;
+            }
+            ota_patch.header_len = 0;
+            if (ota_patch.op == 'E') {
+                ota_patch.done = true;
+                break;
+            }
+            ota_patch.remaining = ota_le32(ota_patch.header + need - 4);
+            if (ota_patch.op == 'D') {
+                ota_patch.src_off = ota_le32(ota_patch.header + 1);
+                if ((uint64_t)ota_patch.src_off + ota_patch.remaining > ota_source_size) {
+                    return false;
+                }
+            }
+            if ((uint64_t)ota_produced + ota_patch.remaining > ota_request.target_size) {
+                return false;
+            }
+            continue;
+        }
+        size_t space;
+        uint8_t *out = ota_fill_space(&space);
+        size_t n = MIN(MIN(space, len), ota_patch.remaining);
+        if (ota_patch.op == 'D') {
+            const uint8_t *src = ota_source + ota_patch.src_off;
+            for (size_t i = 0; i < n; i++) {
+                out[i] = src[i] + data[i];
+            }
+            ota_patch.src_off += n;
+        } else {
+            memcpy(out, data, n);
+        }
+        ota_fill_commit(n);
+        data += n;
+        len -= n;
+        ota_patch.remaining -= n;
+    }
+    return true;
+}
+
+// Delta: inflate downloaded bytes through the window and run what comes out
+static const char *ota_inflate(const uint8_t *in, size_t in_len)
+{
+    tinfl_status status;
+    do {
+        size_t in_bytes = in_len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - ota_window_pos;
+        status = tinfl_decompress(ota_inflator, in, &in_bytes, ota_window, ota_window + ota_window_pos, &out_bytes,
+                                  TINFL_FLAG_HAS_MORE_INPUT);
+        in += in_bytes;
+        in_len -= in_bytes;
+        if (!ota_patch_feed(ota_window + ota_window_pos, out_bytes)) {
+            return "format";
+        }
+        ota_window_pos = (ota_window_pos + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+    } while (status == TINFL_STATUS_HAS_MORE_OUTPUT);
+    return status < TINFL_STATUS_DONE ? "format" : NULL;
+}
+
+// Delta: check the header against the running image and the update request
+// Returns the reason to give up, or NULL; "source" tells the relay to send the
+// full image instead.
+static const char *ota_check_delta_header(const uint8_t *header)
+{
+    if (memcmp(header, "ZCCD", 4) != 0 || header[4] != OTA_DELTA_VERSION) {
+        return "format";
+    }
+    uint32_t source_size = ota_le32(header + 8);
+    uint8_t sha[32];
+    if (source_size > ota_source_size || mbedtls_sha256(ota_source, source_size, sha, 0) != 0 ||
+        memcmp(sha, header + 12, sizeof(sha)) != 0) {
+        return "source";
+    }
+    if (ota_le32(header + 44) != ota_request.target_size || memcmp(header + 48, ota_request.target_sha256, 32) != 0) {
+        return "target";
+    }
+    ota_source_size = source_size;
+    return NULL;
+}
+
+// Firmware update, download side: fetch ota_request.url, turn it into the new
+// image in the buffers, then verify and set the new partition to boot. Nothing
+// is erased until a delta's source has been checked.
+static void ota_task(void *arg)
+{
+    static uint8_t rx[OTA_HTTP_READ_BYTES];
+    uint8_t header[OTA_DELTA_HEADER_LEN];
+    size_t header_len = 0;
+    uint8_t *buffers[OTA_BUFFER_COUNT] = {0};
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    esp_partition_mmap_handle_t source_map;
+    bool mapped = false;
+    esp_http_client_handle_t client = NULL;
+    esp_ota_handle_t handle = 0;
+    bool begun = false;
+    bool writing = false;
+    const char *error = NULL;
+    int64_t started_us = esp_timer_get_time();
+
+    ota_fill = NULL;
+    ota_fill_len = 0;
+    ota_produced = 0;
+    ota_flash_err = ESP_OK;
+    memset(&ota_patch, 0, sizeof(ota_patch));
+    mbedtls_sha256_init(&ota_target_sha);
+    mbedtls_sha256_starts(&ota_target_sha, 0);
+
+    if (!update || ota_request.target_size > update->size) {
+        error = "partition";
+        goto done;
+    }
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        buffers[i] = heap_caps_malloc(OTA_CHUNK_BYTES, MALLOC_CAP_INTERNAL);
+        if (!buffers[i]) {
+            error = "memory";
+            goto done;
+        }
+        xQueueSend(ota_free_queue, &buffers[i], 0);
+    }
+    if (ota_request.delta) {
+        ota_inflator = heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_SPIRAM);
+        ota_window = heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_SPIRAM);
+        mapped = esp_partition_mmap(running, 0, running->size, ESP_PARTITION_MMAP_DATA,
+                                    (const void **)&ota_source, &source_map) == ESP_OK;
+        if (!ota_inflator || !ota_window || !mapped) {
+            error = "memory";
+            goto done;
+        }
+        ota_source_size = running->size;
+        ota_window_pos = 0;
+        tinfl_init(ota_inflator);
+    }
+
+    char url[OTA_URL_MAX + 48];
+    snprintf(url, sizeof(url), "%s://%s:%d%s",
+             SERVER_USE_TLS ? "https" : "http", SERVER_IP, SERVER_STREAM_PORT, ota_request.url);
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+    };
+#if SERVER_USE_TLS
+    if (strlen(SERVER_CA_CERT_PEM) > 0) {
+        config.cert_pem = SERVER_CA_CERT_PEM;
     } else {
-        ESP_LOGW(TAG, "WebSocket transmission incomplete: %d/%d bytes", sent_total, len);
-        log_websocket_transmission_details(len, sent_total, "INCOMPLETE");
+        config.crt_bundle_attach = esp_crt_bundle_attach;
     }
-    
-    return sent_total;
+#endif
+    client = esp_http_client_init(&config);
+    if (!client || esp_http_client_open(client, 0) != ESP_OK ||
+        esp_http_client_fetch_headers(client) != (int64_t)ota_request.size ||
+        esp_http_client_get_status_code(client) != 200) {
+        error = "download";
+        goto done;
+    }
+
+    while (ota_received < ota_request.size && !error) {
+        int n = esp_http_client_read(client, (char *)rx, MIN(sizeof(rx), ota_request.size - ota_received));
+        if (n <= 0) {
+            error = "download";
+            break;
+        }
+        ota_received += n;
+        const uint8_t *data = rx;
+        size_t len = n;
+        if (ota_request.delta && header_len < OTA_DELTA_HEADER_LEN) {
+            size_t take = MIN(len, OTA_DELTA_HEADER_LEN - header_len);
+            memcpy(header + header_len, data, take);
+            header_len += take;
+            data += take;
+            len -= take;
+            if (header_len < OTA_DELTA_HEADER_LEN || (error = ota_check_delta_header(header)) != NULL) {
+                continue;
+            }
+        }
+        if (!writing) {
+            begun = esp_ota_begin(update, OTA_WITH_SEQUENTIAL_WRITES, &handle) == ESP_OK;
+            writing = begun && xTaskCreatePinnedToCore(&ota_flash_task, "ota_flash", 4096, (void *)(uintptr_t)handle,
+                                                       OTA_TASK_PRIORITY, NULL, 0) == pdPASS;
+            if (!writing) {
+                error = begun ? "memory" : "flash";
+                break;
+            }
+        }
+        if (len > 0) {
+            error = ota_request.delta ? ota_inflate(data, len) : ota_copy(data, len);
+        }
+        if (ota_flash_err != ESP_OK) {
+            error = "flash";
+        }
+    }
+
+    // Let the writer finish what it was given before checking anything
+    if (writing) {
+        ota_chunk_t end = { NULL, 0 };
+        ota_fill_submit();
+        xQueueSend(ota_full_queue, &end, portMAX_DELAY);
+        xSemaphoreTake(ota_flash_done, portMAX_DELAY);
+    }
+    if (!error && ota_flash_err != ESP_OK) {
+        error = "flash";
+    }
+    if (!error && (ota_produced != ota_request.target_size || (ota_request.delta && !ota_patch.done))) {
+        error = "format";
+    }
+    if (!error) {
+        uint8_t sha[32];
+        mbedtls_sha256_finish(&ota_target_sha, sha);
+        if (memcmp(sha, ota_request.target_sha256, sizeof(sha)) != 0) {
+            error = "target";
+        }
+    }
+    if (begun) {
+        if (error) {
+            esp_ota_abort(handle);
+        } else if (esp_ota_end(handle) != ESP_OK) {
+            error = "image";  // esp_ota_end validates the app image
+        }
+    }
+    if (!error && esp_ota_set_boot_partition(update) != ESP_OK) {
+        error = "flash";
+    }
+
+done:
+    if (client) {
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+    }
+    if (mapped) {
+        esp_partition_munmap(source_map);
+    }
+    ota_source = NULL;
+    free(ota_inflator);
+    free(ota_window);
+    ota_inflator = NULL;
+    ota_window = NULL;
+    xQueueReset(ota_free_queue);
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        free(buffers[i]);
+    }
+    ota_fill = NULL;
+    mbedtls_sha256_free(&ota_target_sha);
+
+    uint32_t elapsed_ms = (esp_timer_get_time() - started_us) / 1000;
+    if (error) {
+        ESP_LOGE(TAG, "Firmware update failed (%s) after %u ms, %u of %u bytes received",
+                 error, elapsed_ms, ota_received, ota_request.size);
+    } else {
+        ESP_LOGI(TAG, "Firmware update ready in %u ms: %u bytes received, %u written to %s",
+                 elapsed_ms, ota_received, ota_written, update->label);
+    }
+    ota_error = error;
+    ota_state = error ? OTA_FAILED : OTA_READY;
+    vTaskDelete(NULL);
+}
+
+// Start an update from the "ota" control message; one runs at a time
+static void ota_start(const cJSON *msg)
+{
+    const cJSON *url = cJSON_GetObjectItem(msg, "url");
+    const cJSON *size = cJSON_GetObjectItem(msg, "size");
+    const cJSON *delta = cJSON_GetObjectItem(msg, "delta");
+    const cJSON *target_size = cJSON_GetObjectItem(msg, "target_size");
+    const cJSON *target_sha256 = cJSON_GetObjectItem(msg, "target_sha256");
+    if (ota_state != OTA_IDLE) {
+        ESP_LOGW(TAG, "Firmware update already running, ignoring another");
+        return;
+    }
+    if (!cJSON_IsString(url) || url->valuestring[0] != '/' || strlen(url->valuestring) >= OTA_URL_MAX ||
+        !cJSON_IsNumber(size) || size->valuedouble <= 0 || !cJSON_IsNumber(target_size) || target_size->valuedouble <= 0 ||
+        !cJSON_IsString(target_sha256) || strlen(target_sha256->valuestring) != 64) {
+        ESP_LOGW(TAG, "Ignoring malformed firmware update request");
+        return;
+    }
+    for (int i = 0; i < 32; i++) {
+        unsigned int byte;
+        if (sscanf(target_sha256->valuestring + i * 2, "%2x", &byte) != 1) {
+            ESP_LOGW(TAG, "Ignoring malformed firmware update request");
+            return;
+        }
+        ota_request.target_sha256[i] = byte;
+    }
+    strcpy(ota_request.url, url->valuestring);
+    ota_request.size = (uint32_t)size->valuedouble;
+    ota_request.delta = cJSON_IsTrue(delta);
+    ota_request.target_size = (uint32_t)target_size->valuedouble;
+
+    if (!ota_free_queue) {
+        ota_free_queue = xQueueCreate(OTA_BUFFER_COUNT, sizeof(uint8_t *));
+        ota_full_queue = xQueueCreate(OTA_BUFFER_COUNT + 1, sizeof(ota_chunk_t));  // + the end marker
+        ota_flash_done = xSemaphoreCreateBinary();
+    }
+    ota_received = 0;
+    ota_written = 0;
+    ota_error = NULL;
+    ota_state = OTA_DOWNLOADING;
+    radio_set_awake(true);  // Under power save the download would be paced by beacons
+    ESP_LOGI(TAG, "Firmware update: %s of %u bytes for a %u byte image",
+             ota_request.delta ? "delta" : "full image", ota_request.size, ota_request.target_size);
+    if (!ota_free_queue || !ota_full_queue || !ota_flash_done ||
+        xTaskCreatePinnedToCore(&ota_task, "ota", 8192, NULL, OTA_TASK_PRIORITY, NULL, 0) != pdPASS) {
+        ota_error = "memory";
+        ota_state = OTA_FAILED;
+    }
+}
+
+// Report update progress to the relay (streaming task). Once the download is
+// over the radio goes back to what the current mode wants; a failure is
+// reported once and clears the way for the next update.
+static void ota_report_status(uint32_t now_ms)
+{
+    static const char *const state_names[] = { "idle", "downloading", "rebooting", "failed" };
+    ota_state_t state = ota_state;
+    if (state == OTA_IDLE ||
+        (state == ota_reported_state && (state != OTA_DOWNLOADING || (int32_t)(now_ms - ota_next_status_time) < 0))) {
+        return;
+    }
+    char msg[160];
+    int len = snprintf(msg, sizeof(msg), "{\"type\":\"ota_status\",\"state\":\"%s\",\"received\":%u,\"written\":%u",
+                       state_names[state], ota_received, ota_written);
+    if (state == OTA_FAILED) {
+        len += snprintf(msg + len, sizeof(msg) - len, ",\"error\":\"%s\"", ota_error ? ota_error : "unknown");
+    }
+    len += snprintf(msg + len, sizeof(msg) - len, "}");
+    if (websocket_write_frame(WS_OPCODE_TEXT, NULL, 0, (const uint8_t *)msg, len) < 0) {
+        return;
+    }
+    if (state != OTA_DOWNLOADING) {
+        radio_set_awake(radio_mode == RADIO_MODE_STREAM);
+    }
+    ota_reported_state = state;
+    ota_next_status_time = now_ms + OTA_STATUS_INTERVAL_MS;
+    if (state == OTA_FAILED) {
+        ota_reported_state = OTA_IDLE;
+        ota_state = OTA_IDLE;
+    }
+}
+
+// Drop the current connection and open a new one
+// TLS reconnects resume the cached session. Profiles fall back to main-only
+// until the relay re-sends its demand for this camera.
+static bool streaming_reconnect(const char *ws_path)
+{
+    transport_close();
+    profile_main_enabled = true;
+    profile_sub_enabled = false;
+    capture_time_enabled = false;
+    burst_interval_ms = 0;
+    burst_count = 0;    // Lost with the connection
+    burst_bytes = 0;
+    apply_stream_idle_state();
+    apply_bandwidth_budget(0, 0);
+    relay_max_fps = 0;
+    return websocket_connect(SERVER_IP, SERVER_STREAM_PORT, ws_path) == ESP_OK;
 }
 
 // Streaming task
@@ -947,25 +3531,121 @@ static void streaming_task(void *arg)
     snprintf(ws_path, sizeof(ws_path), "/%s", cam_id);
     
     // Connect to WebSocket
-    if (websocket_connect(SERVER_IP, SERVER_PORT, ws_path) != ESP_OK) {
+    if (websocket_connect(SERVER_IP, SERVER_STREAM_PORT, ws_path) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to connect to WebSocket server");
         vTaskDelete(NULL);
         return;
     }
     
     ESP_LOGI(TAG, "WebSocket connected, starting video stream...");
+    boot_timing.stream_connected = esp_timer_get_time() / 1000;
     
     // Streaming loop with comprehensive diagnostics
     int frame_count = 0;
     int failed_captures = 0;
     uint32_t last_diagnostic_time = esp_timer_get_time() / 1000;
+    uint32_t last_telemetry_time = last_diagnostic_time;
+    uint32_t next_substream_time = last_diagnostic_time;
+    uint32_t next_snapshot_time = last_diagnostic_time;
+    uint32_t next_preroll_time = last_diagnostic_time;
     
     ESP_LOGI(TAG, "Starting streaming loop with diagnostics enabled");
     
-    while (streaming_active) {
+    // Any failed send (frame, substream, telemetry, control reply) clears
+    // streaming_active; the top of the loop then reconnects
+    while (true) {
+        if (!streaming_active) {
+            // Print diagnostic summary before reconnection attempt
+            print_diagnostic_summary();
+            if (!streaming_reconnect(ws_path)) {
+                ESP_LOGE(TAG, "Failed to reconnect WebSocket, stopping stream");
+                break;
+            }
+            ESP_LOGI(TAG, "WebSocket reconnected successfully");
+        }
+        
+        // Apply profile and settings changes from the relay before the next capture
+        websocket_poll_control();
+        if (!streaming_active) {
+            continue;
+        }
+        apply_stream_idle_state(); // LAN clients come and go between control messages
+        bool lan_due = lan_has_clients();
+        
+        // Periodic diagnostic summary (every 30 seconds)
+        uint32_t current_time = esp_timer_get_time() / 1000;
+        if (current_time - last_diagnostic_time > 30000) {
+            ESP_LOGI(TAG, "=== PERIODIC DIAGNOSTIC REPORT ===");
+            print_diagnostic_summary();
+            log_camera_sensor_status();
+            last_diagnostic_time = current_time;
+        }
+        
+        // Periodic binary telemetry on the streaming connection
+        if (current_time - last_telemetry_time >= TELEMETRY_INTERVAL_MS) {
+            websocket_send_telemetry(current_time - last_telemetry_time);
+            last_telemetry_time = current_time;
+        }
+        
+        // Firmware update: the stream runs until the new image is verified and
+        // the relay has been told; an event that is streaming finishes first
+        ota_report_status(current_time);
+        if (ota_state == OTA_READY && ota_reported_state == OTA_READY && !event_is_live(current_time)) {
+            ESP_LOGI(TAG, "Rebooting into the new firmware");
+            if (radio_mode == RADIO_MODE_BURST) {
+                burst_flush();
+            }
+            transport_close();
+            esp_restart();
+        }
+        
+        // Burst mode: send what has been buffered once the interval is up
+        if (radio_mode == RADIO_MODE_BURST && (int32_t)(current_time - burst_next_send_time) >= 0 && !burst_flush()) {
+            continue;
+        }
+        
         uint32_t frame_start_time = esp_timer_get_time() / 1000;
+        bool substream_due = profile_sub_enabled && (int32_t)(frame_start_time - next_substream_time) >= 0;
+        bool snapshot_due = radio_mode == RADIO_MODE_IDLE && (int32_t)(frame_start_time - next_snapshot_time) >= 0;
+        bool preroll_due = preroll_seconds && (int32_t)(frame_start_time - next_preroll_time) >= 0;
+        bool main_due = profile_main_enabled || event_pending || event_is_live(frame_start_time);
+        if (!main_due && !substream_due && !snapshot_due && !lan_due && !preroll_due) {
+            // Nothing due: sleep on the socket so a viewer arriving wakes us immediately
+            uint32_t next_due = profile_sub_enabled ? next_substream_time : next_snapshot_time;
+            if (preroll_seconds && (int32_t)(next_preroll_time - next_due) < 0) {
+                next_due = next_preroll_time;
+            }
+            uint32_t wait_ms = MIN(next_due - frame_start_time, IDLE_WAIT_MAX_MS);
+            wait_ms = MIN(wait_ms, last_telemetry_time + TELEMETRY_INTERVAL_MS - frame_start_time);
+            if (radio_mode == RADIO_MODE_BURST) {
+                wait_ms = MIN(wait_ms, burst_next_send_time - frame_start_time);
+            }
+            transport_wait_readable(wait_ms);
+            continue;
+        }
+        uint32_t pace_time = main_frame_pace_time(frame_start_time, event_is_live(frame_start_time));
+        if (!substream_due && !snapshot_due && !lan_due && !preroll_due && !event_pending &&
+            (int32_t)(frame_start_time - pace_time) < 0) {
+            // Paced by the uplink budget, the relay's load or burst mode: wait for
+            // the next frame slot (or the next burst)
+            uint32_t wait_ms = pace_time - frame_start_time;
+            if (radio_mode == RADIO_MODE_BURST) {
+                wait_ms = MIN(wait_ms, burst_next_send_time - frame_start_time);
+            }
+            transport_wait_readable(wait_ms);
+            continue;
+        }
         
         camera_fb_t *fb = esp_camera_fb_get();
+        if (snapshot_due) {
+            // Buffers filled before going idle are stale; cycle them for a current image
+            for (int i = 0; fb && i < STREAM_FB_COUNT; i++) {
+                esp_camera_fb_return(fb);
+                fb = esp_camera_fb_get();
+            }
+            next_snapshot_time = frame_start_time + IDLE_SNAPSHOT_INTERVAL_MS;
+        }
+        record_stage_latency(STAGE_CAPTURE, esp_timer_get_time() / 1000 - frame_start_time);
         if (!fb) {
             failed_captures++;
             ESP_LOGW(TAG, "Camera capture failed (%d consecutive failures)", failed_captures);
@@ -999,58 +3679,107 @@ static void streaming_task(void *arg)
             log_frame_diagnostics(fb->buf, fb->len, frame_count);
         }
         
-        // Send frame via WebSocket as binary data
-        uint32_t send_start_time = esp_timer_get_time() / 1000;
-        int sent = websocket_send_binary(fb->buf, fb->len);
-        uint32_t send_end_time = esp_timer_get_time() / 1000;
+        // LAN clients first: they are not behind the relay's uplink budget
+        lan_publish_frame(fb);
         
-        if (sent < 0) {
-            ESP_LOGW(TAG, "Failed to send frame #%d, attempting to reconnect...", frame_count);
-            esp_camera_fb_return(fb);
-            
-            // Print diagnostic summary before reconnection attempt
-            print_diagnostic_summary();
-            
-            // Try to reconnect WebSocket
-            if (websocket_fd >= 0) {
-                close(websocket_fd);
-                websocket_fd = -1;
+        // Pre-event ring and motion trigger. The pre-roll goes out before this
+        // frame, which then marks the event (see the PREROLL comment block).
+        uint32_t capture_ms = frame_capture_ms(fb);
+        bool event_frame = false;
+        if (preroll_due && motion_detect(fb->len)) {
+            ESP_LOGI(TAG, "Motion: %u byte frame against a running average of %u", fb->len, motion_average_len);
+            event_pending = true;
+        }
+        if (event_pending) {
+            event_pending = false;
+            if (!event_start(frame_start_time)) {
+                esp_camera_fb_return(fb);
+                continue;
             }
-            
-            //vTaskDelay(pdMS_TO_TICKS(5)); // Wait before reconnecting
-            
-            if (websocket_connect(SERVER_IP, SERVER_PORT, ws_path) == ESP_OK) {
-                ESP_LOGI(TAG, "WebSocket reconnected successfully");
-                continue; // Try again with next frame
-            } else {
-                ESP_LOGE(TAG, "Failed to reconnect WebSocket, stopping stream");
-                streaming_active = false;
-                break;
+            event_frame = true;
+        }
+        if (preroll_due) {
+            preroll_store(fb, capture_ms);
+            next_preroll_time = frame_start_time + PREROLL_CAPTURE_INTERVAL_MS;
+        }
+        bool event_live = event_is_live(frame_start_time);
+        
+        if (snapshot_due || event_frame) {
+            budget_debit(fb->len);
+        }
+        // Frames captured early for the substream, LAN or pre-roll are not main
+        // frames under the relay's limit or burst mode's rate until their next slot
+        bool relay_slot = !relay_max_fps || event_live || (int32_t)(frame_start_time - relay_next_frame_time) >= 0;
+        if (radio_mode == RADIO_MODE_BURST) {
+            // Kept for the next burst; an event has left burst mode before its first frame
+            if (profile_main_enabled && relay_slot && (int32_t)(frame_start_time - burst_next_frame_time) >= 0 &&
+                budget_admit(fb->len, frame_start_time)) {
+                if (relay_max_fps) {
+                    relay_next_frame_time = frame_start_time + 1000 / relay_max_fps;
+                }
+                burst_next_frame_time = frame_start_time + 1000 / burst_fps;
+                if (!burst_store(fb->buf, fb->len, PROFILE_MAIN, capture_ms)) {
+                    esp_camera_fb_return(fb);
+                    continue;
+                }
             }
-        } else {
-            frame_count++;
-            uint32_t frame_total_time = send_end_time - frame_start_time;
-            uint32_t send_time = send_end_time - send_start_time;
+        } else if (snapshot_due || event_frame ||
+            ((profile_main_enabled || event_live) && relay_slot && budget_admit(fb->len, frame_start_time))) {
+            if (relay_max_fps) {
+                relay_next_frame_time = frame_start_time + 1000 / relay_max_fps;
+            }
+            // Send frame via WebSocket as binary data
+            uint32_t send_start_time = esp_timer_get_time() / 1000;
+            uint8_t prefix[TIMED_FRAME_PREFIX_LEN];
+            size_t prefix_len = build_frame_prefix(prefix, PROFILE_MAIN, fb);
+            if (event_frame) {
+                prefix_len = build_timed_prefix(prefix, MSG_TYPE_PREROLL_FRAME, PROFILE_MAIN, capture_ms);
+            }
+            int sent = websocket_send_binary(fb->buf, fb->len, prefix, prefix_len);
+            uint32_t send_end_time = esp_timer_get_time() / 1000;
             
-            // Enhanced frame logging with timing information
-            if (frame_count % LOG_FRAME_DETAILS_EVERY_N == 0) {
-                ESP_LOGI(TAG, "Frame #%d: %d bytes sent, capture+send: %dms, send: %dms, heap: %d", 
-                         frame_count, sent, frame_total_time, send_time, esp_get_free_heap_size());
-                print_diagnostic_summary();
+            if (sent < 0) {
+                if (!streaming_active) {
+                    ESP_LOGW(TAG, "Failed to send frame #%d, attempting to reconnect...", frame_count);
+                    esp_camera_fb_return(fb);
+                    continue;
+                }
+                // Frame rejected by validation; the connection is fine
+            } else {
+                if (boot_timing.first_frame == 0) {
+                    boot_timing.first_frame = send_end_time;
+                    ESP_LOGI(TAG, "Boot to first frame: %u ms (%s; WiFi start %u, IP %u, camera %u, stream %u ms)",
+                             boot_timing.first_frame, boot_timing.rejoined ? "cached network" : "QR provisioning",
+                             boot_timing.wifi_started, boot_timing.wifi_connected,
+                             boot_timing.camera_ready, boot_timing.stream_connected);
+                }
+                frame_count++;
+                record_radio_frame(fb->len, capture_ms, send_end_time);
+                if (event_live) {
+                    preroll_sent_until_ms = capture_ms; // Part of this event's clip already
+                }
+                uint32_t frame_total_time = send_end_time - frame_start_time;
+                uint32_t send_time = send_end_time - send_start_time;
+                record_stage_latency(STAGE_SEND, send_time);
+                record_stage_latency(STAGE_FRAME, frame_total_time);
+                
+                // Enhanced frame logging with timing information
+                if (frame_count % LOG_FRAME_DETAILS_EVERY_N == 0) {
+                    ESP_LOGI(TAG, "Frame #%d: %d bytes sent, capture+send: %dms, send: %dms, heap: %d", 
+                             frame_count, sent, frame_total_time, send_time, esp_get_free_heap_size());
+                    print_diagnostic_summary();
+                }
             }
         }
         
-        esp_camera_fb_return(fb);
-        
-        // Periodic diagnostic summary (every 30 seconds)
-        uint32_t current_time = esp_timer_get_time() / 1000;
-        if (current_time - last_diagnostic_time > 30000) {
-            ESP_LOGI(TAG, "=== PERIODIC DIAGNOSTIC REPORT ===");
-            print_diagnostic_summary();
-            log_camera_sensor_status();
-            last_diagnostic_time = current_time;
+        if (substream_due) {
+            websocket_send_substream(fb);
+            next_substream_time = frame_start_time + SUBSTREAM_INTERVAL_MS;
         }
         
+        esp_camera_fb_return(fb);
+        budget_adjust_quality(frame_start_time);
+        
         // Control frame rate (approximately 10 FPS)
         vTaskDelay(pdMS_TO_TICKS(5));
     }
@@ -1060,8 +3789,7 @@ static void streaming_task(void *arg)
     print_diagnostic_summary();
     
     if (websocket_fd >= 0) {
-        close(websocket_fd);
-        websocket_fd = -1;
+        transport_close();
         ESP_LOGI(TAG, "WebSocket connection closed");
     }
     
@@ -1077,6 +3805,59 @@ static void flashOnceParsed() {
     vTaskDelay(20 / portTICK_PERIOD_MS); // Delay for 1 second
 }
 
+// Start the streaming task once the camera is in streaming mode
+static void start_streaming(void)
+{
+    boot_timing.camera_ready = esp_timer_get_time() / 1000;
+    ESP_LOGI(TAG, "Starting video streaming...");
+#if LAN_MJPEG_ENABLED
+    lan_server_start();
+#endif
+    xTaskCreatePinnedToCore(&streaming_task, "streaming", 16384, NULL, 5, &streaming_task_handle, 1);
+}
+
+/**
+ * Rejoin the stored network without the QR phase
+ * The directed connect runs while the camera initializes; if the AP is not on
+ * the cached BSSID/channel any more, a full scan with the same credentials is
+ * tried before giving up.
+ */
+static bool fast_rejoin(void)
+{
+    wifi_credentials_t creds;
+    if (!wifi_load_credentials(&creds)) {
+        ESP_LOGI(TAG, "No stored WiFi network, starting QR provisioning");
+        return false;
+    }
+    
+    if (connect_to_wifi(&creds, true) != ESP_OK) {
+        return false;
+    }
+    esp_err_t cam_err = init_camera_for_streaming();
+    bool joined = wait_for_wifi(creds.bssid_valid ? WIFI_DIRECTED_CONNECT_TIMEOUT_MS : WIFI_SCAN_CONNECT_TIMEOUT_MS);
+    if (!joined && creds.bssid_valid) {
+        ESP_LOGW(TAG, "Cached AP not reachable, scanning for %s", creds.ssid);
+        if (connect_to_wifi(&creds, false) == ESP_OK) {
+            joined = wait_for_wifi(WIFI_SCAN_CONNECT_TIMEOUT_MS);
+        }
+    }
+    
+    if (!joined || cam_err != ESP_OK) {
+        ESP_LOGW(TAG, "Fast rejoin failed (%s), starting QR provisioning", joined ? "camera" : "WiFi");
+        if (cam_err == ESP_OK) {
+            esp_camera_deinit();
+        }
+        return false;
+    }
+    
+    wifi_save_credentials(&creds);  // AP may have changed BSSID/channel
+    strncpy(connected_ssid, creds.ssid, sizeof(connected_ssid) - 1);
+    ESP_LOGI(TAG, "Rejoined %s without QR code", connected_ssid);
+    boot_timing.rejoined = true;
+    start_streaming();
+    return true;
+}
+
 // Main task: initializes the camera and starts the processing task
 static void main_task(void *arg)
 {
@@ -1086,6 +3867,9 @@ static void main_task(void *arg)
     esp_err_t wifi_err = init_wifi();
     if (wifi_err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize WiFi");
+    } else if (fast_rejoin()) {
+        vTaskDelete(NULL);
+        return;
     }
 
     // Initialize the camera with error handling
@@ -1182,30 +3966,24 @@ static void processing_task(void *arg)
                 ESP_LOGW(TAG, "Decoding failed: %s", quirc_strerror(err));
             } else {
                 ESP_LOGI(TAG, "Decoded in %d ms", esp_timer_get_time() / 1000);
-                ESP_LOGI(TAG, "QR code: %d bytes: '%s'", qr_data.payload_len, qr_data.payload);
+                // Length only: a WiFi payload carries the password in the clear
+                ESP_LOGI(TAG, "QR code: %d bytes", qr_data.payload_len);
                 
                 // Check if this is a WiFi QR code
-                char ssid[64] = {0};
-                char password[64] = {0};
+                wifi_credentials_t creds;
                 
-                if (parse_wifi_qr_code((const char*)qr_data.payload, ssid, password)) {
+                if (parse_wifi_qr_code((const char*)qr_data.payload, &creds)) {
                     flashOnceParsed();
-                    ESP_LOGI(TAG, "WiFi QR code detected! Attempting to connect...");
+                    ESP_LOGI(TAG, "WiFi QR code for %s detected! Attempting to connect...", creds.ssid);
                     
                     // Connect to WiFi
-                    esp_err_t connect_err = connect_to_wifi(ssid, password);
+                    esp_err_t connect_err = connect_to_wifi(&creds, false);
                     if (connect_err == ESP_OK) {
-                        ESP_LOGI(TAG, "WiFi connection initiated for: %s", ssid);
-                        
-                        // Wait for connection (up to 10 seconds)
-                        int attempts = 0;
-                        while (!wifi_connected && attempts < 100) {
-                            vTaskDelay(pdMS_TO_TICKS(100));
-                            attempts++;
-                        }
+                        ESP_LOGI(TAG, "WiFi connection initiated for: %s", creds.ssid);
                         
-                        if (wifi_connected) {
-                            strncpy(connected_ssid, ssid, sizeof(connected_ssid) - 1);
+                        if (wait_for_wifi(WIFI_SCAN_CONNECT_TIMEOUT_MS)) {
+                            wifi_save_credentials(&creds);
+                            strncpy(connected_ssid, creds.ssid, sizeof(connected_ssid) - 1);
                             ESP_LOGI(TAG, "Connected to %s WiFi!", connected_ssid);
                             ESP_LOGI(TAG, "QR code scanning stopped.");
                             
@@ -1226,8 +4004,7 @@ static void processing_task(void *arg)
                             // Initialize camera for streaming
                             esp_err_t stream_cam_err = init_camera_for_streaming();
                             if (stream_cam_err == ESP_OK) {
-                                ESP_LOGI(TAG, "Starting video streaming...");
-                                xTaskCreatePinnedToCore(&streaming_task, "streaming", 16384, NULL, 5, NULL, 1);
+                                start_streaming();
                             } else {
                                 ESP_LOGE(TAG, "Failed to initialize camera for streaming");
                             }
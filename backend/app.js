@@ -31,6 +31,9 @@ const wss = new WebSocket.Server({
 });
 
 const activeCameras = {}; // { cameraId: { name, userId, status }, ... }
+// What each camera sent with its last HTTP registration. A camera registers once
+// per boot, so this outlives the WebSocket sessions it reconnects with.
+const registrations = new Map(); // cameraId -> { lan, firmware, bssid }
 
 app.use(express.json());
 app.use(express.urlencoded({ extended: true }));
@@ -51,6 +54,46 @@ const { initDb } = require('./database/init.js');
 const createMainApiRouter = require('./routes');
 const initializeSocketIo = require('./services/socketManager.js');
 const initializeCameraSockets = require('./services/cameraEvents.js');
+const { createTelemetryStore } = require('./services/telemetry.js');
+const createMetricsRouter = require('./routes/metrics.js');
+const startTlsTermination = require('./services/tlsTermination.js');
+const { createStreamProfiles, profileRoom } = require('./services/streamProfiles.js');
+const { createTranscoder } = require('./services/transcoder.js');
+const { createMosaicService } = require('./services/mosaic.js');
+const { createStreamCapture } = require('./services/streamCapture.js');
+const { createBus } = require('./services/bus.js');
+const { createClusterRelay } = require('./services/cluster.js');
+const { createBandwidthAllocator } = require('./services/bandwidth.js');
+const { createEventClips } = require('./services/eventClips.js');
+const { createClockSync } = require('./services/clockSync.js');
+const { createActivityIndex } = require('./services/activityIndex.js');
+const { createOverloadControl } = require('./services/overload.js');
+const { createOtaUpdates } = require('./services/ota.js');
+const { createAnalytics } = require('./services/analytics.js');
+const { createTimelapse } = require('./services/timelapse.js');
+
+const telemetry = createTelemetryStore();
+const transcoder = createTranscoder(io, { telemetry, room: (cameraId) => profileRoom(cameraId, 'h264') });
+const overload = config.overload.enabled ? createOverloadControl(io, activeCameras, { telemetry }) : null;
+const streamProfiles = createStreamProfiles(io, activeCameras, { telemetry, transcoder, overload });
+const mosaics = createMosaicService(io, activeCameras, { streamProfiles, telemetry });
+streamProfiles.onFrame(mosaics.feed);
+const capture = createStreamCapture(config.capture);
+const cluster = config.cluster.enabled
+  ? createClusterRelay(io, activeCameras, createBus(config.cluster), {
+      nodeId: config.cluster.nodeId,
+      heartbeatMs: config.cluster.heartbeatMs,
+      streamProfiles,
+      telemetry,
+    })
+  : null;
+const bandwidth = config.bandwidth.enabled ? createBandwidthAllocator(activeCameras, { streamProfiles, telemetry }) : null;
+const events = config.events.prerollSeconds > 0 ? createEventClips(activeCameras, { telemetry }) : null;
+const clockSync = config.clockSync.enabled ? createClockSync(io, activeCameras, { cluster, telemetry }) : null;
+const activity = config.activity.enabled ? createActivityIndex() : null;
+const timelapse = config.timelapse.enabled ? createTimelapse({ telemetry }) : null;
+const ota = config.ota.enabled ? createOtaUpdates(activeCameras, { telemetry }) : null;
+const analytics = config.analytics.enabled ? createAnalytics(io, activeCameras, { telemetry, cluster, overload }) : null;
 
 // Pages
 app.get('/', (req, res) =>
@@ -63,13 +106,33 @@ app.get('/dashboard', (req, res) =>
   res.sendFile(path.join(frontendRoot, 'pages', 'dashboard.html'))
 );
 
+// Direct LAN endpoint a camera advertises at registration: { ip, port, token }
+// Only private IPv4 addresses are accepted, since dashboards load it from the LAN.
+function lanEndpoint(lan) {
+  if (!config.lanDirect.enabled || !lan || typeof lan !== 'object') return null;
+  const { ip, port, token } = lan;
+  const octets = typeof ip === 'string' ? ip.split('.').map(Number) : [];
+  const isPrivate =
+    octets.length === 4 &&
+    octets.every((o) => Number.isInteger(o) && o >= 0 && o <= 255) &&
+    (octets[0] === 10 || (octets[0] === 172 && octets[1] >= 16 && octets[1] <= 31) || (octets[0] === 192 && octets[1] === 168));
+  if (!isPrivate || !Number.isInteger(port) || port < 1 || port > 65535) return null;
+  if (typeof token !== 'string' || !/^[0-9a-f]{16,64}$/.test(token)) return null;
+  return { ip, port, token };
+}
+
 // Camera registration endpoint (no auth required - for ESP32 cameras)
 app.post('/api/camera/register', async (req, res) => {
   const { cameraId } = req.body;
+  const lan = lanEndpoint(req.body.lan);
+  const firmware = typeof req.body.firmware === 'string' ? req.body.firmware.slice(0, 32) : null;
+  // AP the camera is joined to, aa:bb:cc:dd:ee:ff; cameras sharing it share an uplink
+  const bssid = typeof req.body.bssid === 'string' && /^([0-9a-f]{2}:){5}[0-9a-f]{2}$/i.test(req.body.bssid) ? req.body.bssid.toLowerCase() : null;
 
   if (!cameraId) {
     return res.status(400).json({ error: 'Camera ID is required.' });
   }
+  registrations.set(cameraId, { lan, firmware, bssid });
 
   console.log(`📷 HTTP: Camera registration request from ${cameraId}`);
 
@@ -77,19 +140,25 @@ app.post('/api/camera/register', async (req, res) => {
     const { rows } = await query('SELECT * FROM cameras WHERE camera_id = $1', [cameraId]);
     const existingCamera = rows[0];
     if (existingCamera) {
-      // Camera already exists - just update status
+      // Camera already exists - just update status. A socket from before the
+      // camera restarted may still be open; its close handler cleans up after it.
       activeCameras[cameraId] = {
         name: existingCamera.name,
         userId: existingCamera.user_id,
         status: 'online',
+        lan,
+        firmware,
+        bssid,
+        ws: activeCameras[cameraId]?.ws,
       };
-      console.log(`📷 HTTP: Existing camera '${existingCamera.name}' reconnected`);
+      console.log(`📷 HTTP: Existing camera '${existingCamera.name}' reconnected${lan ? ` (LAN ${lan.ip}:${lan.port})` : ''}`);
 
       // Notify the owner's dashboard
       io.to(String(existingCamera.user_id)).emit('cameraStatusUpdate', {
         cameraId,
         status: 'online',
         name: existingCamera.name,
+        lan,
       });
 
       res.json({ status: 'reconnected', message: 'Camera reconnected successfully' });
@@ -99,6 +168,10 @@ app.post('/api/camera/register', async (req, res) => {
         name: `Camera ${cameraId.substring(0, 8)}`,
         userId: null,
         status: 'pending',
+        lan,
+        firmware,
+        bssid,
+        ws: activeCameras[cameraId]?.ws,
       };
       console.log(`📷 HTTP: New camera '${cameraId}' registered and waiting for auto-claim`);
 
@@ -116,9 +189,9 @@ app.post('/api/camera/register', async (req, res) => {
         const cameraName = `Camera ${cameraId.substring(0, 8)}`;
         try {
           await query('INSERT INTO cameras (camera_id, user_id, name, status) VALUES ($1, $2, $3, $4)', [cameraId, userId, cameraName, 'online']);
-          activeCameras[cameraId] = { name: cameraName, userId: userId, status: 'online' };
+          activeCameras[cameraId] = { name: cameraName, userId: userId, status: 'online', lan, firmware, bssid, ws: activeCameras[cameraId]?.ws };
           console.log(`✅ Camera '${cameraName}' auto-claimed by user ${recentUser.username}`);
-          io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status: 'online', name: cameraName });
+          io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status: 'online', name: cameraName, lan });
           io.to(String(userId)).emit('cameraAutoAdded', { cameraId, name: cameraName, message: `${cameraName} has been automatically added to your dashboard!` });
           res.json({ status: 'auto-claimed', message: 'Camera automatically added to dashboard' });
         } catch (dbErr) {
@@ -134,16 +207,29 @@ app.post('/api/camera/register', async (req, res) => {
   }
 });
 
+// Firmware download for a camera being updated (no auth - the link is a one-time token)
+if (ota) app.get('/ota/:token', ota.serveDownload);
+
 // API Routes
-const mainApiRouter = createMainApiRouter(io, activeCameras);
+const mainApiRouter = createMainApiRouter(io, activeCameras, { cluster, bandwidth, events, activity, overload, ota, timelapse });
 app.use('/api', mainApiRouter);
+app.use('/metrics', createMetricsRouter(activeCameras, telemetry));
 
 // Initialize Socket Handlers
-initializeSocketIo(io, activeCameras);
-initializeCameraSockets(server, wss, io, activeCameras);
+initializeSocketIo(io, activeCameras, { streamProfiles, mosaics, cluster, overload });
+initializeCameraSockets(server, wss, io, activeCameras, { registrations, telemetry, streamProfiles, capture, cluster, bandwidth, events, clockSync, activity, overload, ota, analytics, timelapse });
 
 process.on('SIGINT', () => {
   console.log('Shutting down gracefully...');
+  cluster?.close();
+  bandwidth?.close();
+  events?.close();
+  clockSync?.close();
+  activity?.close();
+  timelapse?.close();
+  overload?.close();
+  analytics?.close();
+  mosaics.close();
   end()
     .then(() => {
       console.log('Database connection closed.');
@@ -164,6 +250,9 @@ process.on('SIGINT', () => {
       console.log(`Local IP: ${config.server.address}` )
       console.log(`🌐 Accessible on the local network`);
     });
+    if (config.tls.keyPath && config.tls.certPath) {
+      startTlsTermination(server, config.tls, { telemetry });
+    }
   } catch (e) {
     console.error('Failed to initialize database:', e);
     process.exit(1);
@@ -43,6 +43,166 @@ const config = {
     maxCameras: parseInt(process.env.MAX_CAMERAS) || 10,
     streamTimeout: parseInt(process.env.STREAM_TIMEOUT) || 30000,
     qrCodeExpiry: parseInt(process.env.QR_CODE_EXPIRY) || 1800000, // 30 minutes
+    // Grid tiles get main-stream frames when a camera sends no substream for this long
+    substreamFallbackMs: parseInt(process.env.SUBSTREAM_FALLBACK_MS) || 3000,
+  },
+
+  // TLS termination (wss:// for cameras, https:// for dashboards)
+  // Enabled when both TLS_KEY_PATH and TLS_CERT_PATH are set
+  tls: {
+    port: parseInt(process.env.TLS_PORT) || 3443,
+    keyPath: process.env.TLS_KEY_PATH || '',
+    certPath: process.env.TLS_CERT_PATH || '',
+    // 48 bytes of hex; a fixed key lets session tickets survive restarts
+    ticketKeys: process.env.TLS_TICKET_KEYS || '',
+    sessionTimeout: parseInt(process.env.TLS_SESSION_TIMEOUT) || 24 * 60 * 60, // seconds
+  },
+
+  // On-demand H.264 transcoding for remote viewers (requires ffmpeg-static)
+  transcode: {
+    enabled: process.env.TRANSCODE_ENABLED !== 'false',
+    maxSessions: parseInt(process.env.TRANSCODE_MAX_SESSIONS) || 4, // concurrent encoders per relay
+    maxCpuPerCamera: parseFloat(process.env.TRANSCODE_MAX_CPU) || 0.5, // cores; input is decimated above this
+    maxFps: parseInt(process.env.TRANSCODE_MAX_FPS) || 10,
+    maxWidth: parseInt(process.env.TRANSCODE_MAX_WIDTH) || 1280,
+    bitrateKbps: parseInt(process.env.TRANSCODE_BITRATE_KBPS) || 800,
+    maxQueuedBytes: parseInt(process.env.TRANSCODE_MAX_QUEUED_BYTES) || 512 * 1024, // drop input beyond this
+    niceness: parseInt(process.env.TRANSCODE_NICENESS) || 10,
+  },
+
+  // Server-side grid mosaics (one composited stream per dashboard layout)
+  mosaic: {
+    fps: parseInt(process.env.MOSAIC_FPS) || 2,
+    // Even sizes; 128x96 is a 1/2 decode of the camera substream or 1/8 of XGA
+    tileWidth: parseInt(process.env.MOSAIC_TILE_WIDTH) || 128,
+    tileHeight: parseInt(process.env.MOSAIC_TILE_HEIGHT) || 96,
+    quality: parseInt(process.env.MOSAIC_QUALITY) || 5, // ffmpeg -q:v, 2 (best) to 31
+    maxCameras: parseInt(process.env.MOSAIC_MAX_CAMERAS) || 36,
+    // Compositing threads (mosaicWorker.js), started as mosaics need them
+    workers: parseInt(process.env.MOSAIC_WORKERS) || Math.max(1, os.cpus().length - 1),
+  },
+
+  // Wire-level capture of camera sessions for tools/replay-capture.js
+  // Enabled when CAMERA_CAPTURE_DIR is set; CAMERA_CAPTURE_IDS limits it to some cameras
+  capture: {
+    dir: process.env.CAMERA_CAPTURE_DIR || '',
+    cameras: (process.env.CAMERA_CAPTURE_IDS || '').split(',').map((id) => id.trim()).filter(Boolean),
+    maxBytes: parseInt(process.env.CAMERA_CAPTURE_MAX_BYTES) || 256 * 1024 * 1024, // per session
+  },
+
+  // Multi-node relay: nodes share camera presence and frames over a pub/sub bus
+  // 'memory' only links nodes in one process; 'tcp' uses tools/bus-broker.js
+  cluster: {
+    enabled: Boolean(process.env.CLUSTER_BUS),
+    bus: process.env.CLUSTER_BUS || 'memory',
+    nodeId: process.env.CLUSTER_NODE_ID || `${os.hostname()}-${process.pid}`,
+    brokerHost: process.env.CLUSTER_BROKER_HOST || '127.0.0.1',
+    brokerPort: parseInt(process.env.CLUSTER_BROKER_PORT) || 4100,
+    busSecret: process.env.CLUSTER_BUS_SECRET || '', // required for 'tcp'; the broker's --secret
+    heartbeatMs: parseInt(process.env.CLUSTER_HEARTBEAT_MS) || 5000,
+  },
+
+  // Direct LAN viewing: cameras serve MJPEG on the local network and the relay
+  // passes the endpoint (with its access token) to the owner's dashboards
+  lanDirect: {
+    enabled: process.env.LAN_DIRECT !== 'false',
+  },
+
+  // Per-site uplink budgets for cameras sharing an access point (bandwidth.js)
+  bandwidth: {
+    enabled: process.env.BANDWIDTH_BUDGETS !== 'false',
+    intervalMs: parseInt(process.env.BANDWIDTH_INTERVAL_MS) || 1000,
+    congestionDelayMs: parseInt(process.env.BANDWIDTH_CONGESTION_DELAY_MS) || 150, // median queueing delay
+    backoff: parseFloat(process.env.BANDWIDTH_BACKOFF) || 0.85, // capacity = ingest x backoff when congested
+    probeGain: parseFloat(process.env.BANDWIDTH_PROBE_GAIN) || 1.08, // per interval while budgets are used up
+    headroom: parseFloat(process.env.BANDWIDTH_HEADROOM) || 0.9, // share of the estimate handed out
+    resendRatio: 0.1, // push a budget when it moves by more than this
+    minKbps: parseInt(process.env.BANDWIDTH_MIN_KBPS) || 64,
+    maxKbps: parseInt(process.env.BANDWIDTH_MAX_KBPS) || 8000,
+  },
+
+  // Camera clock synchronisation, so capture times line up across cameras (clockSync.js)
+  clockSync: {
+    enabled: process.env.CLOCK_SYNC !== 'false',
+    intervalMs: parseInt(process.env.CLOCK_SYNC_INTERVAL_MS) || 30000, // between probe rounds once settled
+    fastIntervalMs: 2000, // first rounds after a camera connects
+    probes: parseInt(process.env.CLOCK_SYNC_PROBES) || 8, // per round; the fastest round trip counts
+    probeSpacingMs: 50,
+    replyTimeoutMs: 500,
+  },
+
+  // Relay overload control: shed frames in priority order when the event loop
+  // or dashboard send queues back up (overload.js)
+  overload: {
+    enabled: process.env.OVERLOAD_CONTROL !== 'false',
+    intervalMs: parseInt(process.env.OVERLOAD_INTERVAL_MS) || 500,
+    lagHighMs: parseInt(process.env.OVERLOAD_LAG_HIGH_MS) || 50, // event loop delay p99 that escalates
+    calmUtilization: parseFloat(process.env.OVERLOAD_CALM_UTILIZATION) || 0.6, // loop busy share under which it steps down
+    queueHighBytes: parseInt(process.env.OVERLOAD_QUEUE_HIGH_BYTES) || 32 * 1024 * 1024, // dashboard sockets that keep up
+    maxQueuedBytes: parseInt(process.env.OVERLOAD_MAX_QUEUED_BYTES) || 1024 * 1024, // one socket, then it is slow
+    calmIntervals: 6, // calm rounds before stepping down a level
+    backgroundIntervalMs: 2000, // frame interval per camera for slow viewers, and background ones while shedding
+    protectedPriority: parseInt(process.env.OVERLOAD_PROTECTED_PRIORITY) || 2, // cameras at or above keep their rate
+    throttleFps: parseInt(process.env.OVERLOAD_THROTTLE_FPS) || 4,
+    criticalFps: parseInt(process.env.OVERLOAD_CRITICAL_FPS) || 1,
+  },
+
+  // Per-camera activity index: scores per frame, kept per UTC day at several resolutions
+  activity: {
+    enabled: process.env.ACTIVITY_INDEX !== 'false',
+    dir: process.env.ACTIVITY_DIR || './activity',
+    flushIntervalMs: parseInt(process.env.ACTIVITY_FLUSH_MS) || 1000, // write-back of today's columns
+  },
+
+  // Time-lapse archives (timelapse.js): a frame per camera every intervalSeconds,
+  // appended to one archive and index per camera and UTC day. Off unless asked
+  // for: at 60 s with ~40 KB frames a camera-day is ~55 MB (330 MB at 10 s, see
+  // tools/bench-timelapse.js), ~0.8 GB per camera at the default retention
+  timelapse: {
+    enabled: process.env.TIMELAPSE === 'true',
+    dir: process.env.TIMELAPSE_DIR || './timelapse',
+    intervalSeconds: parseInt(process.env.TIMELAPSE_INTERVAL_SECONDS) || 60,
+    profile: process.env.TIMELAPSE_PROFILE === 'sub' ? 'sub' : 'main', // used while the camera sends it
+    retentionDays: parseInt(process.env.TIMELAPSE_RETENTION_DAYS ?? '14') || 0, // 0 keeps every day
+    playbackFps: parseInt(process.env.TIMELAPSE_PLAYBACK_FPS) || 24,
+  },
+
+  // Event clips: seconds of pre-event video kept on each camera and uploaded when
+  // motion or POST /api/camera/:id/event triggers (eventClips.js); 0 turns it off
+  events: {
+    prerollSeconds: parseInt(process.env.PREROLL_SECONDS) || 0,
+    prerollMaxKb: parseInt(process.env.PREROLL_MAX_KB) || 1536, // of the camera's 2 MB PSRAM arena
+    postEventMs: parseInt(process.env.EVENT_POST_MS) || 10000, // live video after the last trigger
+    clipsDir: process.env.EVENT_CLIPS_DIR || './event-clips',
+  },
+
+  // Firmware updates over the air (ota.js): images in dir as <version>.bin,
+  // deltas between them built on demand and kept in dir/deltas
+  ota: {
+    enabled: process.env.OTA !== 'false',
+    dir: process.env.OTA_DIR || './firmware',
+    linkTtlMs: parseInt(process.env.OTA_LINK_TTL_MS) || 15 * 60 * 1000, // download link lifetime
+  },
+
+  // Detection on relayed frames (analytics.js): frames sampled per camera under a
+  // relay-wide budget, run in batches through the detector on worker threads
+  analytics: {
+    enabled: process.env.ANALYTICS === 'true',
+    workers: parseInt(process.env.ANALYTICS_WORKERS) || Math.max(1, os.cpus().length - 1),
+    maxFps: parseFloat(process.env.ANALYTICS_MAX_FPS) || 20, // all cameras together
+    cameraMaxFps: parseFloat(process.env.ANALYTICS_CAMERA_MAX_FPS) || 2,
+    batchSize: parseInt(process.env.ANALYTICS_BATCH_SIZE) || 8,
+    batchWaitMs: parseInt(process.env.ANALYTICS_BATCH_WAIT_MS) || 50, // longest a frame waits for its batch to fill
+    // Detector input; frames are decoded at the smallest JPEG scale that covers it
+    inputWidth: parseInt(process.env.ANALYTICS_INPUT_WIDTH) || 160,
+    inputHeight: parseInt(process.env.ANALYTICS_INPUT_HEIGHT) || 120,
+    detector: process.env.ANALYTICS_DETECTOR || '', // module exporting createDetector(); empty for the built-in motion detector
+    minScore: parseFloat(process.env.ANALYTICS_MIN_SCORE) || 0.3,
+  },
+
+  // Telemetry and metrics configuration
+  metrics: {
+    token: process.env.METRICS_TOKEN || '', // Bearer token for /metrics; empty disables the endpoint
   },
 
   // File upload configuration
@@ -32,6 +32,13 @@ async function initDb() {
     );
   `);
 
+  // Uplink budget weight when cameras share an access point (1 = normal)
+  await query(`ALTER TABLE cameras ADD COLUMN IF NOT EXISTS priority INTEGER NOT NULL DEFAULT 1`);
+
+  // Low-rate burst mode: frames sent in bursts every burst_interval_ms (0 = off)
+  await query(`ALTER TABLE cameras ADD COLUMN IF NOT EXISTS burst_interval_ms INTEGER NOT NULL DEFAULT 0`);
+  await query(`ALTER TABLE cameras ADD COLUMN IF NOT EXISTS burst_fps INTEGER NOT NULL DEFAULT 1`);
+
   await query(`
     CREATE TABLE IF NOT EXISTS qr_codes (
       id SERIAL PRIMARY KEY,
@@ -3,7 +3,7 @@ const jwt = require('jsonwebtoken');
 const QRCode = require('qrcode');
 const { query } = require('../database/connection');
 
-function createCameraRouter(io, activeCameras) {
+function createCameraRouter(io, activeCameras, { cluster, bandwidth, events, activity, overload, ota, timelapse } = {}) {
   const router = express.Router();
 
   // Middleware to authenticate all requests to this router
@@ -104,6 +104,7 @@ function createCameraRouter(io, activeCameras) {
       if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
       await query('UPDATE cameras SET name = $1 WHERE camera_id = $2', [name.trim(), cameraId]);
       if (activeCameras[cameraId]) activeCameras[cameraId].name = name.trim();
+      cluster?.cameraUpdated(cameraId, name.trim());
       io.to(String(userId)).emit('cameraStatusUpdate', {
         cameraId,
         status: activeCameras[cameraId]?.status || 'offline',
@@ -115,6 +116,197 @@ function createCameraRouter(io, activeCameras) {
     }
   });
 
+  // PUT /api/camera/:id/priority - Weight of a camera in its site's uplink budget;
+  // cameras at OVERLOAD_PROTECTED_PRIORITY and above keep their rate when the relay is overloaded
+  router.put('/camera/:id/priority', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+    const priority = parseInt(req.body.priority);
+
+    if (!Number.isInteger(priority) || priority < 1 || priority > 10) {
+      return res.status(400).json({ error: 'Priority must be an integer from 1 to 10.' });
+    }
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      await query('UPDATE cameras SET priority = $1 WHERE camera_id = $2', [priority, cameraId]);
+      bandwidth?.setPriority(cameraId, priority);
+      overload?.setPriority(cameraId, priority);
+      res.status(200).json({ message: 'Camera priority updated.' });
+    } catch (err) {
+      return res.status(500).json({ error: 'Failed to update camera priority.' });
+    }
+  });
+
+  // PUT /api/camera/:id/burst - Low-rate burst mode: the camera captures at fps and
+  // sends its frames in one burst every intervalMs, letting its radio sleep in
+  // between; viewers see frames up to intervalMs late. intervalMs 0 turns it off.
+  router.put('/camera/:id/burst', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+    const intervalMs = parseInt(req.body.intervalMs);
+    const fps = req.body.fps === undefined ? 1 : parseInt(req.body.fps);
+
+    if (!Number.isInteger(intervalMs) || (intervalMs !== 0 && (intervalMs < 1000 || intervalMs > 30000))) {
+      return res.status(400).json({ error: 'intervalMs must be 0 (off) or from 1000 to 30000.' });
+    }
+    if (!Number.isInteger(fps) || fps < 1 || fps > 10) {
+      return res.status(400).json({ error: 'fps must be an integer from 1 to 10.' });
+    }
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      await query('UPDATE cameras SET burst_interval_ms = $1, burst_fps = $2 WHERE camera_id = $3', [intervalMs, fps, cameraId]);
+      // Sent to the camera wherever it is connected; an offline camera picks the
+      // setting up when it next connects
+      const camera = activeCameras[cameraId];
+      const message = JSON.stringify({ type: 'burst_mode', interval_ms: intervalMs, fps });
+      if (camera?.node && cluster) cluster.sendToCamera(cameraId, message);
+      else if (camera?.ws?.readyState === 1) camera.ws.send(message);
+      res.status(200).json({ message: intervalMs ? 'Burst mode on.' : 'Burst mode off.' });
+    } catch (err) {
+      return res.status(500).json({ error: 'Failed to update burst mode.' });
+    }
+  });
+
+  // POST /api/camera/:id/event - Record an event clip: pre-roll plus live video
+  router.post('/camera/:id/event', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+
+    if (!events) return res.status(503).json({ error: 'Event recording is not enabled.' });
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      if (!events.trigger(cameraId)) return res.status(409).json({ error: 'Camera is not connected to this relay.' });
+      res.status(202).json({ message: 'Event triggered.' });
+    } catch (err) {
+      return res.status(500).json({ error: 'Failed to trigger event.' });
+    }
+  });
+
+  // POST /api/camera/:id/ota { version } - Update the camera's firmware to an
+  // image in the relay's firmware directory; it streams until the final reboot
+  router.post('/camera/:id/ota', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+    const { version } = req.body;
+
+    if (!ota) return res.status(503).json({ error: 'Firmware updates are not enabled.' });
+    if (!ota.hasImage(version)) return res.status(400).json({ error: 'No firmware image for that version.' });
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      if (!activeCameras[cameraId]?.ws) return res.status(409).json({ error: 'Camera is not connected to this relay.' });
+      if (activeCameras[cameraId].firmware === version) return res.status(409).json({ error: 'Camera already runs that version.' });
+      const update = await ota.start(cameraId, version);
+      if (update.state === 'failed') return res.status(409).json({ error: 'Camera is not connected to this relay.' });
+      res.status(202).json(update);
+    } catch (err) {
+      console.error('Error starting firmware update:', err);
+      return res.status(500).json({ error: 'Failed to start firmware update.' });
+    }
+  });
+
+  // GET /api/camera/:id/ota - Progress of the camera's last firmware update
+  router.get('/camera/:id/ota', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+
+    if (!ota) return res.status(503).json({ error: 'Firmware updates are not enabled.' });
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      res.status(200).json({ firmware: activeCameras[cameraId]?.firmware || null, update: ota.status(cameraId) });
+    } catch (err) {
+      return res.status(500).json({ error: 'Failed to read firmware update status.' });
+    }
+  });
+
+  // GET /api/camera/:id/activity?date=YYYY-MM-DD&buckets=96 - Activity heatmap for one UTC day
+  router.get('/camera/:id/activity', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+    const date = req.query.date || new Date().toISOString().slice(0, 10);
+    const buckets = parseInt(req.query.buckets) || 96;
+
+    if (!activity) return res.status(503).json({ error: 'Activity index is not enabled.' });
+    if (!/^\d{4}-\d{2}-\d{2}$/.test(date)) return res.status(400).json({ error: 'Date must be YYYY-MM-DD.' });
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      const result = activity.heatmap(cameraId, date, buckets);
+      res.status(200).json(result || { date, bucketSeconds: null, buckets: [] });
+    } catch (err) {
+      return res.status(500).json({ error: 'Failed to read camera activity.' });
+    }
+  });
+
+  // GET /api/camera/:id/timelapse/days - Archived time-lapse days, with frames and bytes stored
+  router.get('/camera/:id/timelapse/days', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+
+    if (!timelapse) return res.status(503).json({ error: 'Time-lapse archives are not enabled.' });
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      res.status(200).json({ days: timelapse.days(cameraId) });
+    } catch (err) {
+      return res.status(500).json({ error: 'Failed to list time-lapse archives.' });
+    }
+  });
+
+  // GET /api/camera/:id/timelapse?from=&to=&fps=24 - Time-lapse of a range as a
+  // multipart/x-mixed-replace stream; from/to are ISO times or epoch ms
+  // (default: the last 24 hours), fps=0 sends it as fast as it is read
+  router.get('/camera/:id/timelapse', async (req, res) => {
+    const cameraId = req.params.id;
+    const userId = req.user.id;
+    const parseTime = (value) => (/^\d+$/.test(value) ? Number(value) : Date.parse(value));
+    const toMs = req.query.to ? parseTime(req.query.to) : Date.now();
+    const fromMs = req.query.from ? parseTime(req.query.from) : toMs - 24 * 60 * 60 * 1000;
+    const fps = req.query.fps === undefined ? undefined : Number(req.query.fps);
+
+    if (!timelapse) return res.status(503).json({ error: 'Time-lapse archives are not enabled.' });
+    if (Number.isNaN(fromMs) || Number.isNaN(toMs) || fromMs > toMs) return res.status(400).json({ error: 'Invalid time range.' });
+    if (toMs - fromMs > 366 * 24 * 60 * 60 * 1000) return res.status(400).json({ error: 'Range is longer than a year.' });
+    if (fps !== undefined && !(fps >= 0 && fps <= 60)) return res.status(400).json({ error: 'fps must be between 0 and 60.' });
+
+    try {
+      const { rows } = await query('SELECT user_id FROM cameras WHERE camera_id = $1', [cameraId]);
+      const row = rows[0];
+      if (!row) return res.status(404).json({ error: 'Camera not found.' });
+      if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
+      await timelapse.stream(req, res, cameraId, fromMs, toMs, { fps });
+    } catch (err) {
+      console.error('Error streaming time-lapse:', err);
+      if (!res.headersSent) return res.status(500).json({ error: 'Failed to stream time-lapse.' });
+      res.destroy();
+    }
+  });
+
   // DELETE /api/camera/:id - Delete a camera
   router.delete('/camera/:id', async (req, res) => {
     const cameraId = req.params.id;
@@ -127,6 +319,7 @@ function createCameraRouter(io, activeCameras) {
       if (row.user_id !== userId) return res.status(403).json({ error: 'Forbidden.' });
       await query('DELETE FROM cameras WHERE camera_id = $1', [cameraId]);
       if (activeCameras[cameraId]) delete activeCameras[cameraId];
+      cluster?.cameraRemoved(cameraId);
       io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status: 'deleted' });
       res.status(200).json({ message: 'Camera deleted successfully.' });
     } catch (err) {
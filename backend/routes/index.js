@@ -2,11 +2,11 @@ const express = require('express');
 const authRoutes = require('./authentication');
 const createCameraRouter = require('./cameras');
 
-function createMainApiRouter(io, activeCameras) {
+function createMainApiRouter(io, activeCameras, { cluster, bandwidth, events, activity, overload, ota, timelapse } = {}) {
   const router = express.Router();
 
   // Initialize the camera router which requires io and activeCameras
-  const cameraRouter = createCameraRouter(io, activeCameras);
+  const cameraRouter = createCameraRouter(io, activeCameras, { cluster, bandwidth, events, activity, overload, ota, timelapse });
 
   // Public authentication routes
   router.use('/auth', authRoutes);
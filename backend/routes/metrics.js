@@ -0,0 +1,28 @@
+const express = require('express');
+const crypto = require('crypto');
+const config = require('../config/app-config.js');
+
+function createMetricsRouter(activeCameras, telemetry) {
+  const router = express.Router();
+
+  // Bearer token for scrapers. Series are labelled with camera IDs, which
+  // cameras register and connect with, so there is no /metrics without one.
+  router.use((req, res, next) => {
+    if (!config.metrics.token) return res.sendStatus(404);
+    const authHeader = req.headers['authorization'];
+    const token = (authHeader && authHeader.split(' ')[1]) || '';
+    const digest = (s) => crypto.createHash('sha256').update(s).digest();
+    if (!crypto.timingSafeEqual(digest(token), digest(config.metrics.token))) return res.sendStatus(401);
+    next();
+  });
+
+  // GET /metrics - Fleet telemetry in Prometheus text format
+  router.get('/', (req, res) => {
+    res.set('Content-Type', 'text/plain; version=0.0.4; charset=utf-8');
+    res.send(telemetry.renderPrometheus(activeCameras));
+  });
+
+  return router;
+}
+
+module.exports = createMetricsRouter;
@@ -0,0 +1,234 @@
+// Per-camera activity index, built while frames are ingested
+// Every frame gets a cheap activity score: how far its JPEG size moved from
+// the camera's running average (a scene change changes how well it
+// compresses), or full scale for pre-roll/event frames (0xA3), which the
+// camera only sends when it saw motion or was triggered. Scores go into one
+// fixed-width file per camera and UTC day holding the day at several
+// resolutions (TIERS), each slot the maximum score in its bucket, so a day's
+// heatmap is a read of a few hundred bytes instead of a scan of everything
+// stored for the camera.
+//
+// File layout (big-endian header, then one byte per bucket, tier after tier):
+//   "ZCCACT" | u8 version | u8 tier count | f64 day start (epoch ms) | reserved
+//   tier 0: 86400 x 1 s | tier 1: 1440 x 1 min | tier 2: 96 x 15 min | tier 3: 24 x 1 h
+// A slot holds 0 when no frame arrived in its bucket, else 1 + score (0-254).
+// Today's file is held in memory as one buffer mirroring the file (written
+// in place, dirty ranges written back every flushIntervalMs, like an msync'd
+// mapping); earlier days are read straight from the tier that is needed.
+const fs = require('fs');
+const path = require('path');
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const MAGIC = Buffer.from('ZCCACT');
+const VERSION = 1;
+const HEADER_SIZE = 32;
+const DAY_MS = 24 * 60 * 60 * 1000;
+const TIERS = [1, 60, 900, 3600].map((seconds, i, all) => ({
+  seconds,
+  slots: 86400 / seconds,
+  offset: HEADER_SIZE + all.slice(0, i).reduce((sum, s) => sum + 86400 / s, 0),
+}));
+const FILE_SIZE = TIERS[TIERS.length - 1].offset + TIERS[TIERS.length - 1].slots;
+const MAX_SCORE = 254;
+const FULL_SCALE_CHANGE = 0.5; // Size change against the running average that scores MAX_SCORE
+const AVERAGE_WEIGHT = 1 / 8;
+
+function dayStart(ms) {
+  return ms - (ms % DAY_MS);
+}
+
+function dayName(startMs) {
+  return new Date(startMs).toISOString().slice(0, 10);
+}
+
+function encodeHeader(startMs) {
+  const header = Buffer.alloc(HEADER_SIZE);
+  MAGIC.copy(header, 0);
+  header.writeUInt8(VERSION, MAGIC.length);
+  header.writeUInt8(TIERS.length, MAGIC.length + 1);
+  header.writeDoubleBE(startMs, MAGIC.length + 2);
+  return header;
+}
+
+/**
+ * Score one frame against the running average size of its profile
+ * @param {{average: number}} state - Updated in place
+ * @returns {number} 0 to MAX_SCORE
+ */
+function scoreFrame(state, len, event) {
+  const average = state.average;
+  state.average = average ? average + (len - average) * AVERAGE_WEIGHT : len;
+  if (event) return MAX_SCORE;
+  if (!average) return 0;
+  return Math.min(MAX_SCORE, Math.round((Math.abs(len - average) / average / FULL_SCALE_CHANGE) * MAX_SCORE));
+}
+
+function createActivityIndex({ settings = config.activity, now = Date.now } = {}) {
+  const cameras = new Map(); // cameraId -> { day: { startMs, buf, fd, dirty: [from, to] per tier }, averages }
+  let timer = null;
+
+  function cameraDir(cameraId) {
+    return path.join(settings.dir, cameraId.replace(/[^\w-]/g, '_'));
+  }
+
+  function dayFile(cameraId, startMs) {
+    return path.join(cameraDir(cameraId), `${dayName(startMs)}.act`);
+  }
+
+  function closeDay(day) {
+    flushDay(day);
+    fs.closeSync(day.fd);
+  }
+
+  // Open (or create) the camera's file for the day starting at startMs
+  function openDay(cameraId, startMs) {
+    fs.mkdirSync(cameraDir(cameraId), { recursive: true });
+    const file = dayFile(cameraId, startMs);
+    const buf = Buffer.alloc(FILE_SIZE);
+    let fd;
+    try {
+      fd = fs.openSync(file, 'r+');
+      fs.readSync(fd, buf, 0, FILE_SIZE, 0);
+    } catch (err) {
+      if (err.code !== 'ENOENT') throw err;
+      fd = fs.openSync(file, 'w+');
+      encodeHeader(startMs).copy(buf, 0);
+      fs.writeSync(fd, buf, 0, FILE_SIZE, 0);
+    }
+    return { startMs, buf, fd, dirty: TIERS.map(() => null) };
+  }
+
+  function flushDay(day) {
+    day.dirty.forEach((range, i) => {
+      if (!range) return;
+      fs.writeSync(day.fd, day.buf, range[0], range[1] - range[0] + 1, range[0]);
+      day.dirty[i] = null;
+    });
+  }
+
+  function mark(day, tier, slot, value) {
+    const offset = TIERS[tier].offset + slot;
+    if (day.buf[offset] >= value) return;
+    day.buf[offset] = value;
+    const range = day.dirty[tier];
+    if (!range) day.dirty[tier] = [offset, offset];
+    else if (offset < range[0]) range[0] = offset;
+    else if (offset > range[1]) range[1] = offset;
+  }
+
+  /**
+   * Score and index one binary frame message from a camera
+   * @param {string} cameraId
+   * @param {Buffer} buf - Raw WebSocket payload, as given to streamProfiles.routeFrame
+   */
+  function recordFrame(cameraId, buf) {
+    const { profile, jpeg, captureMs, preroll, serverClock } = parseFrame(buf);
+    if (!profile) return;
+    let camera = cameras.get(cameraId);
+    if (!camera) {
+      camera = { day: null, averages: { main: { average: 0 }, sub: { average: 0 } } };
+      cameras.set(cameraId, camera);
+    }
+    const score = scoreFrame(camera.averages[profile], jpeg.length, preroll);
+
+    // Pre-roll frames are seconds old: file them under their capture time
+    const at = serverClock ? captureMs : now();
+    const startMs = dayStart(at);
+    if (!camera.day || startMs > camera.day.startMs) {
+      try {
+        if (camera.day) closeDay(camera.day);
+        camera.day = openDay(cameraId, startMs);
+      } catch (err) {
+        console.error(`❌ Activity index for camera ${cameraId}: ${err.message}`);
+        camera.day = null;
+        return;
+      }
+    } else if (startMs < camera.day.startMs) {
+      return; // Late frame from a day already rolled over
+    }
+    const second = Math.floor((at - startMs) / 1000);
+    TIERS.forEach((tier, i) => mark(camera.day, i, Math.floor(second / tier.seconds), score + 1));
+  }
+
+  function readTier(cameraId, startMs, tier) {
+    const today = cameras.get(cameraId)?.day;
+    if (today && today.startMs === startMs) {
+      return today.buf.subarray(TIERS[tier].offset, TIERS[tier].offset + TIERS[tier].slots);
+    }
+    const slots = Buffer.alloc(TIERS[tier].slots);
+    let fd;
+    try {
+      fd = fs.openSync(dayFile(cameraId, startMs), 'r');
+    } catch (err) {
+      if (err.code === 'ENOENT') return null;
+      throw err;
+    }
+    try {
+      fs.readSync(fd, slots, 0, slots.length, TIERS[tier].offset);
+    } finally {
+      fs.closeSync(fd);
+    }
+    return slots;
+  }
+
+  /**
+   * Activity heatmap of one camera for one UTC day
+   * @param {string} cameraId
+   * @param {string} date - YYYY-MM-DD
+   * @param {number} buckets - Requested buckets across the day (1 to 86400)
+   * @returns {{date: string, bucketSeconds: number, buckets: (number|null)[]}|null}
+   *   Each bucket is the highest score in it (0-254), or null when no frame
+   *   arrived; null when nothing was recorded that day
+   */
+  function heatmap(cameraId, date, buckets) {
+    const startMs = Date.parse(`${date}T00:00:00Z`);
+    if (Number.isNaN(startMs)) return null;
+    const bucketSeconds = Math.max(1, Math.ceil(86400 / Math.min(Math.max(1, buckets), 86400)));
+    // Coarsest tier that still resolves the requested bucket
+    let tier = 0;
+    while (tier + 1 < TIERS.length && TIERS[tier + 1].seconds <= bucketSeconds) tier++;
+    const slots = readTier(cameraId, startMs, tier);
+    if (!slots) return null;
+
+    const perBucket = Math.max(1, Math.round(bucketSeconds / TIERS[tier].seconds));
+    const result = new Array(Math.ceil(slots.length / perBucket));
+    for (let b = 0; b < result.length; b++) {
+      let max = 0;
+      const end = Math.min(slots.length, (b + 1) * perBucket);
+      for (let i = b * perBucket; i < end; i++) if (slots[i] > max) max = slots[i];
+      result[b] = max ? max - 1 : null;
+    }
+    return { date, bucketSeconds: perBucket * TIERS[tier].seconds, buckets: result };
+  }
+
+  function flush() {
+    for (const camera of cameras.values()) if (camera.day) flushDay(camera.day);
+  }
+
+  function cameraDisconnected(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (camera?.day) closeDay(camera.day);
+    cameras.delete(cameraId);
+  }
+
+  function close() {
+    clearInterval(timer);
+    for (const cameraId of [...cameras.keys()]) cameraDisconnected(cameraId);
+  }
+
+  // flushIntervalMs 0 leaves write-back to the caller (tools/bench-activity.js)
+  if (settings.flushIntervalMs > 0) {
+    timer = setInterval(flush, settings.flushIntervalMs);
+    timer.unref?.();
+  }
+
+  return { recordFrame, heatmap, flush, cameraDisconnected, close };
+}
+
+module.exports = {
+  TIERS,
+  FILE_SIZE,
+  scoreFrame,
+  createActivityIndex,
+};
@@ -0,0 +1,229 @@
+// Detection on relayed frames
+// Frames are sampled per camera as they are ingested: at most cameraMaxFps
+// per camera, and less as cameras are added so that all of them together stay
+// within maxFps. A camera that sends the substream is sampled from it (its
+// JPEGs decode in a fraction of the time); pre-roll frames are old and are
+// skipped, and sampling pauses while the relay is shedding load (overload.js
+// level 2 and up). Each camera is pinned to one of settings.workers detector
+// threads (analyticsWorker.js), which decodes at reduced scale and runs the
+// detector once for a whole batch of frames from its cameras. A batch goes
+// when the thread is free and batchSize frames are waiting, or the oldest has
+// waited batchWaitMs. Only the newest frame per camera waits: a thread that
+// falls behind drops frames rather than falling further behind.
+// Detections go to the camera owner's dashboards as
+//   'camera-detections' { cameraId, capturedAt, receivedAt, detectedAt, detections }
+// capturedAt is the capture time on the server clock (null when the camera's
+// clock is not synced), receivedAt when the relay got the frame.
+const path = require('path');
+const { Worker } = require('worker_threads');
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const WORKER_FILE = path.join(__dirname, 'analyticsWorker.js');
+const LATENCY_SAMPLES = 1024; // Latencies kept for the percentiles
+const RESPAWN_MS = 1000;
+
+function createAnalytics(io, activeCameras, { telemetry, cluster, overload, settings = config.analytics, now = Date.now } = {}) {
+  const cameras = new Map(); // cameraId -> { nextSampleAt, subSeenAt, worker }
+  const workers = []; // { thread, cameras, pending: Map cameraId -> sample, inFlight, timer }
+  const latencies = new Float64Array(LATENCY_SAMPLES);
+  const counts = { analysed: 0, dropped: 0, failed: 0, batches: 0, detections: 0 };
+  let latencyCount = 0;
+  let closed = false;
+
+  // Time between samples of one camera
+  function sampleIntervalMs() {
+    return Math.max(1000 / settings.cameraMaxFps, (cameras.size * 1000) / settings.maxFps);
+  }
+
+  function count(result, by = 1) {
+    counts[result] += by;
+    telemetry?.incrementRelay('zcc_relay_analytics_frames_total', { result }, by);
+  }
+
+  function spawn(worker) {
+    worker.thread = new Worker(WORKER_FILE, {
+      workerData: {
+        width: settings.inputWidth,
+        height: settings.inputHeight,
+        detector: settings.detector,
+        minScore: settings.minScore,
+      },
+    });
+    worker.thread.on('message', (msg) => finishBatch(worker, msg));
+    worker.thread.on('error', (err) => console.error('❌ Analytics worker error:', err.message));
+    worker.thread.on('exit', (code) => {
+      worker.thread = null;
+      if (worker.inFlight) count('failed', worker.inFlight.length);
+      worker.inFlight = null;
+      if (closed) return;
+      console.warn(`⚠️ Analytics worker exited with code ${code}, restarting`);
+      setTimeout(() => {
+        if (closed) return;
+        spawn(worker);
+        dispatch(worker);
+      }, RESPAWN_MS).unref?.();
+    });
+  }
+
+  function leastLoaded() {
+    return workers.reduce((best, w) => (w.cameras < best.cameras ? w : best));
+  }
+
+  /**
+   * Offer an ingested camera message; returns at once, the work is on the workers
+   */
+  function feed(cameraId, buf) {
+    const t = now();
+    let camera = cameras.get(cameraId);
+    if (!camera) {
+      camera = { nextSampleAt: 0, subSeenAt: -Infinity, worker: leastLoaded() };
+      camera.worker.cameras++;
+      cameras.set(cameraId, camera);
+    }
+    if (t < camera.nextSampleAt) return;
+    if (overload && overload.stats().level >= 2) return;
+
+    const frame = parseFrame(buf);
+    if (frame.preroll || !frame.profile) return;
+    const interval = sampleIntervalMs();
+    if (frame.profile === 'sub') camera.subSeenAt = t;
+    else if (t - camera.subSeenAt < 3 * interval) return;
+    camera.nextSampleAt = t + interval;
+
+    const worker = camera.worker;
+    if (worker.pending.has(cameraId)) count('dropped');
+    worker.pending.set(cameraId, {
+      cameraId,
+      jpeg: frame.jpeg,
+      capturedAt: frame.serverClock ? frame.captureMs : null,
+      receivedAt: t,
+    });
+    dispatch(worker);
+  }
+
+  function dispatch(worker) {
+    if (worker.inFlight || !worker.thread || worker.pending.size === 0) return;
+    const t = now();
+    let oldest = Infinity;
+    for (const sample of worker.pending.values()) oldest = Math.min(oldest, sample.receivedAt);
+    const waited = t - oldest;
+    if (worker.pending.size < settings.batchSize && waited < settings.batchWaitMs) {
+      if (!worker.timer) {
+        worker.timer = setTimeout(() => {
+          worker.timer = null;
+          dispatch(worker);
+        }, settings.batchWaitMs - waited);
+      }
+      return;
+    }
+    clearTimeout(worker.timer);
+    worker.timer = null;
+
+    const batch = [];
+    for (const [cameraId, sample] of worker.pending) {
+      batch.push(sample);
+      worker.pending.delete(cameraId);
+      if (batch.length === settings.batchSize) break;
+    }
+    // Copies, so the socket buffers they were sliced from are not held
+    // while the batch runs, and can be handed over to the thread
+    const jpegs = batch.map((sample) => new Uint8Array(sample.jpeg));
+    worker.inFlight = batch;
+    counts.batches++;
+    worker.thread.postMessage(
+      { cameraIds: batch.map((sample) => sample.cameraId), jpegs },
+      jpegs.map((jpeg) => jpeg.buffer)
+    );
+  }
+
+  function finishBatch(worker, { results, decodeMs, detectMs }) {
+    const batch = worker.inFlight;
+    worker.inFlight = null;
+    if (!batch) return;
+    const t = now();
+    batch.forEach((sample, i) => {
+      const detections = results[i];
+      if (!detections) {
+        count('failed');
+        return;
+      }
+      count('analysed');
+      latencies[latencyCount++ % LATENCY_SAMPLES] = t - sample.receivedAt;
+      if (detections.length) publish(sample, detections, t);
+    });
+    const latency = latencyPercentiles();
+    telemetry?.setRelayGauge('zcc_relay_analytics_latency_ms', { quantile: '0.5' }, latency.p50);
+    telemetry?.setRelayGauge('zcc_relay_analytics_latency_ms', { quantile: '0.99' }, latency.p99);
+    telemetry?.setRelayGauge('zcc_relay_analytics_batch_ms', { stage: 'decode' }, decodeMs);
+    telemetry?.setRelayGauge('zcc_relay_analytics_batch_ms', { stage: 'detect' }, detectMs);
+    dispatch(worker);
+  }
+
+  function publish(sample, detections, detectedAt) {
+    const userId = activeCameras[sample.cameraId]?.userId;
+    if (userId === undefined || userId === null) return;
+    counts.detections += detections.length;
+    for (const d of detections) telemetry?.incrementRelay('zcc_relay_analytics_detections_total', { label: d.label }, 1);
+    const event = {
+      cameraId: sample.cameraId,
+      capturedAt: sample.capturedAt,
+      receivedAt: sample.receivedAt,
+      detectedAt,
+      detections,
+    };
+    if (cluster) cluster.emitToUser(userId, 'camera-detections', event);
+    else io.to(String(userId)).emit('camera-detections', event);
+  }
+
+  function latencyPercentiles() {
+    const n = Math.min(latencyCount, LATENCY_SAMPLES);
+    if (n === 0) return { p50: 0, p99: 0 };
+    const sorted = latencies.slice(0, n).sort();
+    return { p50: sorted[Math.floor(n * 0.5)], p99: sorted[Math.min(n - 1, Math.floor(n * 0.99))] };
+  }
+
+  function cameraDisconnected(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    cameras.delete(cameraId);
+    camera.worker.cameras--;
+    camera.worker.pending.delete(cameraId);
+    camera.worker.thread?.postMessage({ forget: cameraId });
+  }
+
+  function stats() {
+    return {
+      cameras: cameras.size,
+      workers: workers.length,
+      sampleIntervalMs: sampleIntervalMs(),
+      ...counts,
+      latencyMs: latencyPercentiles(),
+    };
+  }
+
+  function close() {
+    closed = true;
+    for (const worker of workers) {
+      clearTimeout(worker.timer);
+      worker.thread?.terminate();
+    }
+  }
+
+  for (let i = 0; i < Math.max(1, settings.workers); i++) {
+    const worker = { thread: null, cameras: 0, pending: new Map(), inFlight: null, timer: null };
+    workers.push(worker);
+    spawn(worker);
+  }
+
+  return {
+    feed,
+    cameraDisconnected,
+    stats,
+    close,
+  };
+}
+
+module.exports = {
+  createAnalytics,
+};
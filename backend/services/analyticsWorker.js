@@ -0,0 +1,188 @@
+// Detector thread for analytics.js
+// Receives batches of camera JPEGs, decodes each at reduced scale
+// (jpegScaledDecoder.js, luma only) into one input tensor of
+// count x height x width floats in 0-1, and runs the detector once per batch.
+// The detector is the module named by settings.detector, or the built-in
+// motion detector below:
+//   createDetector({ width, height }) -> {
+//     detect({ input, count, width, height, cameraIds })
+//       -> one array per frame (or a Promise of them) of
+//          { label, score, box: [x, y, w, h] }, box as fractions of the frame
+//     forget(cameraId)   optional, the camera went offline
+//   }
+// A camera always goes to the same thread, so a detector can keep state per
+// camera.
+const path = require('path');
+const { parentPort, workerData } = require('worker_threads');
+const { performance } = require('perf_hooks');
+const { decodeScaled, chooseScale, readJpegSize } = require('./jpegScaledDecoder.js');
+
+const CELL = 8; // Motion grid cell, input pixels
+const CHANGE = 0.08; // Luma difference from the background that counts as changed
+const ACTIVE_CELL = 0.25; // Changed fraction of a cell that makes it active
+const MIN_CELLS = 2; // Smallest blob reported
+const GLOBAL_CHANGE = 0.6; // Active fraction of the frame taken as a lighting or exposure change
+const BACKGROUND_RATE = 0.05; // Background update per frame; changed pixels learn at a quarter of it
+
+// Moving objects against a running-average background, per camera: changed
+// pixels are counted on a coarse grid and 4-connected active cells are
+// reported as one box each. Scored by how much of the box changed.
+function createMotionDetector({ width, height }) {
+  const columns = Math.floor(width / CELL);
+  const rows = Math.floor(height / CELL);
+  const backgrounds = new Map(); // cameraId -> Float32Array
+  const changed = new Uint16Array(columns * rows);
+  const label = new Int32Array(columns * rows);
+  const stack = new Int32Array(columns * rows);
+
+  function detectOne(frame, background) {
+    changed.fill(0);
+    for (let y = 0; y < rows * CELL; y++) {
+      const row = y * width;
+      const cellRow = Math.floor(y / CELL) * columns;
+      for (let x = 0; x < columns * CELL; x++) {
+        const i = row + x;
+        const d = frame[i] - background[i];
+        if (d > CHANGE || d < -CHANGE) {
+          changed[cellRow + Math.floor(x / CELL)]++;
+          background[i] += d * (BACKGROUND_RATE / 4);
+        } else {
+          background[i] += d * BACKGROUND_RATE;
+        }
+      }
+    }
+
+    const activeMin = ACTIVE_CELL * CELL * CELL;
+    let active = 0;
+    for (let c = 0; c < changed.length; c++) if (changed[c] >= activeMin) active++;
+    if (active > GLOBAL_CHANGE * changed.length) {
+      background.set(frame);
+      return [];
+    }
+
+    const detections = [];
+    label.fill(0);
+    for (let c = 0; c < changed.length; c++) {
+      if (label[c] || changed[c] < activeMin) continue;
+      let x0 = columns;
+      let y0 = rows;
+      let x1 = 0;
+      let y1 = 0;
+      let cells = 0;
+      let pixels = 0;
+      let top = 0;
+      stack[top++] = c;
+      label[c] = 1;
+      while (top) {
+        const cell = stack[--top];
+        const cx = cell % columns;
+        const cy = Math.floor(cell / columns);
+        cells++;
+        pixels += changed[cell];
+        x0 = Math.min(x0, cx);
+        y0 = Math.min(y0, cy);
+        x1 = Math.max(x1, cx + 1);
+        y1 = Math.max(y1, cy + 1);
+        for (const next of [cx > 0 ? cell - 1 : -1, cx < columns - 1 ? cell + 1 : -1, cell - columns, cell + columns]) {
+          if (next < 0 || next >= changed.length || label[next] || changed[next] < activeMin) continue;
+          label[next] = 1;
+          stack[top++] = next;
+        }
+      }
+      if (cells < MIN_CELLS) continue;
+      detections.push({
+        label: 'motion',
+        score: pixels / (cells * CELL * CELL),
+        box: [x0 / columns, y0 / rows, (x1 - x0) / columns, (y1 - y0) / rows],
+      });
+    }
+    return detections;
+  }
+
+  function detect({ input, cameraIds }) {
+    const size = width * height;
+    return cameraIds.map((cameraId, n) => {
+      const frame = input.subarray(n * size, (n + 1) * size);
+      const background = backgrounds.get(cameraId);
+      if (!background) {
+        backgrounds.set(cameraId, Float32Array.from(frame));
+        return [];
+      }
+      return detectOne(frame, background);
+    });
+  }
+
+  function forget(cameraId) {
+    backgrounds.delete(cameraId);
+  }
+
+  return { detect, forget };
+}
+
+// Decode a JPEG's luma at the cheapest sufficient scale into input[offset..],
+// resampled to width x height; false if it cannot be decoded
+function decodeInto(jpeg, input, offset, width, height) {
+  let luma;
+  try {
+    const size = readJpegSize(jpeg);
+    if (!size) return false;
+    luma = decodeScaled(jpeg, chooseScale(size.width, size.height, width, height)).components[0];
+  } catch (err) {
+    return false;
+  }
+  for (let y = 0; y < height; y++) {
+    const srcRow = Math.min(luma.height - 1, Math.floor(((y + 0.5) * luma.height) / height)) * luma.stride;
+    const dstRow = offset + y * width;
+    for (let x = 0; x < width; x++) {
+      input[dstRow + x] = luma.plane[srcRow + Math.min(luma.width - 1, Math.floor(((x + 0.5) * luma.width) / width))] / 255;
+    }
+  }
+  return true;
+}
+
+if (parentPort) {
+  const { width, height, detector: detectorModule, minScore } = workerData;
+  const detector = detectorModule
+    ? require(path.resolve(detectorModule)).createDetector({ width, height })
+    : createMotionDetector({ width, height });
+  let input = new Float32Array(0);
+
+  parentPort.on('message', async (msg) => {
+    if (msg.forget !== undefined) {
+      detector.forget?.(msg.forget);
+      return;
+    }
+    const cameraIds = msg.cameraIds;
+    const jpegs = msg.jpegs.map((jpeg) => Buffer.from(jpeg.buffer, jpeg.byteOffset, jpeg.byteLength));
+    const t0 = performance.now();
+    if (input.length < jpegs.length * width * height) input = new Float32Array(jpegs.length * width * height);
+    const decoded = []; // Batch position of each frame that decoded
+    jpegs.forEach((jpeg, i) => {
+      if (decodeInto(jpeg, input, decoded.length * width * height, width, height)) decoded.push(i);
+    });
+    const t1 = performance.now();
+    const results = jpegs.map(() => null);
+    try {
+      const found = decoded.length
+        ? await detector.detect({
+            input: input.subarray(0, decoded.length * width * height),
+            count: decoded.length,
+            width,
+            height,
+            cameraIds: decoded.map((i) => cameraIds[i]),
+          })
+        : [];
+      decoded.forEach((i, n) => {
+        results[i] = (found[n] || []).filter((d) => d.score >= minScore);
+      });
+    } catch (err) {
+      console.error('❌ Analytics detector failed:', err.message);
+    }
+    parentPort.postMessage({ results, decodeMs: t1 - t0, detectMs: performance.now() - t1 });
+  });
+}
+
+module.exports = {
+  createMotionDetector,
+  decodeInto,
+};
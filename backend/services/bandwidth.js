@@ -0,0 +1,221 @@
+// Per-site uplink budgets
+// Cameras behind the same access point share its uplink; when each one picks
+// its own rate they saturate it together and all degrade. Cameras are grouped
+// into sites by the AP they report at registration (by the address they connect
+// from when they do not report one), and every interval the relay:
+//   1. measures each camera's ingest (bytes/s, smoothed) and queueing delay: arrival
+//      minus capture time (0xA2 timed frames), less the smallest transit seen
+//      in the last minute, so the camera/relay clock offset cancels out
+//   2. updates each site's capacity estimate: when the median delay across
+//      the site's cameras is over congestionDelayMs the uplink is full and
+//      capacity is what actually arrived, scaled by backoff, and it holds for
+//      HOLD_INTERVALS while the queue drains; otherwise, while cameras are
+//      using their budgets, it probes upwards by probeGain
+//   3. splits headroom x capacity across the site's cameras by weighted
+//      max-min fairness (water filling): weight is priority x (1 + viewers),
+//      and no camera gets more than it was sending before it had a budget
+//   4. sends each camera { type: 'bandwidth_budget', kbps, fps } when its
+//      budget moves by more than resendRatio; the firmware enforces it with a
+//      token bucket and, if it has to drop too many frames, lower JPEG quality
+// Sites that were never congested have no capacity estimate and no budgets.
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const TRANSIT_WINDOW_INTERVALS = 60;
+const HOLD_INTERVALS = 3;
+const RATE_SMOOTHING = 0.3; // Weight of the latest interval; JPEG frames make single intervals lumpy
+const DEMAND_DECAY = 0.98; // Per interval, so a camera that went quiet stops reserving its old rate
+
+function median(values) {
+  if (values.length === 0) return 0;
+  const sorted = values.slice().sort((a, b) => a - b);
+  return sorted[Math.floor(sorted.length / 2)];
+}
+
+/**
+ * Weighted max-min fair split of capacity
+ * @param {number} capacity
+ * @param {{weight: number, cap: number}[]} claims
+ * @returns {number[]} Allocation per claim, never above its cap
+ */
+function waterFill(capacity, claims) {
+  const alloc = new Array(claims.length).fill(0);
+  const order = claims.map((c, i) => i).sort((a, b) => claims[a].cap / claims[a].weight - claims[b].cap / claims[b].weight);
+  let remaining = capacity;
+  let weight = claims.reduce((sum, c) => sum + c.weight, 0);
+  for (let k = 0; k < order.length; k++) {
+    const i = order[k];
+    const share = (remaining * claims[i].weight) / weight;
+    if (claims[i].cap > share) {
+      // Everyone left is capped by the fair share, not by demand
+      for (const j of order.slice(k)) alloc[j] = (remaining * claims[j].weight) / weight;
+      return alloc;
+    }
+    alloc[i] = claims[i].cap;
+    remaining -= claims[i].cap;
+    weight -= claims[i].weight;
+  }
+  return alloc;
+}
+
+function createBandwidthAllocator(activeCameras, { streamProfiles, telemetry, settings = config.bandwidth, now = Date.now } = {}) {
+  const cameras = new Map(); // cameraId -> per-camera state
+  const sites = new Map(); // site -> { capacity, congested, hold }
+  let timer = null;
+  let lastRound = now();
+
+  function cameraConnected(cameraId, { site, priority = 1 }) {
+    cameras.set(cameraId, {
+      site,
+      priority: Math.max(1, priority),
+      bytes: 0,
+      frames: 0,
+      delays: [],
+      transitMins: [], // smallest transit per interval
+      intervalStarted: true,
+      averageFrame: 0,
+      rate: null, // bytes/s, smoothed
+      demand: 0, // bytes/s it sends unconstrained
+      budget: null, // bytes/s, null while unconstrained
+      sent: null, // budget last pushed, bytes/s
+    });
+    if (!sites.has(site)) sites.set(site, { capacity: null, congested: false, hold: 0 });
+  }
+
+  function cameraDisconnected(cameraId) {
+    const camera = cameras.get(cameraId);
+    cameras.delete(cameraId);
+    if (camera && ![...cameras.values()].some((c) => c.site === camera.site)) sites.delete(camera.site);
+  }
+
+  function setPriority(cameraId, priority) {
+    const camera = cameras.get(cameraId);
+    if (camera) camera.priority = Math.max(1, priority);
+  }
+
+  // Every binary frame message from a camera, as received
+  function recordFrame(cameraId, buf) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    camera.bytes += buf.length;
+    camera.frames++;
+    const { captureMs, preroll } = parseFrame(buf);
+    // Pre-roll frames are seconds old by design; their bytes count, their age does not
+    if (captureMs === null || preroll) return;
+    const transit = now() - captureMs;
+    const last = camera.transitMins.length - 1;
+    if (camera.intervalStarted) {
+      camera.transitMins.push(transit);
+      camera.intervalStarted = false;
+      if (camera.transitMins.length > TRANSIT_WINDOW_INTERVALS) camera.transitMins.shift();
+    } else if (transit < camera.transitMins[last]) {
+      camera.transitMins[last] = transit;
+    }
+    camera.delays.push(transit - Math.min(...camera.transitMins));
+  }
+
+  function send(cameraId, camera) {
+    const ws = activeCameras[cameraId]?.ws;
+    const { budget, averageFrame } = camera;
+    if (!ws || ws.readyState !== 1) return;
+    const changed =
+      camera.sent === null ? budget !== null : budget === null || Math.abs(budget - camera.sent) > camera.sent * settings.resendRatio;
+    if (!changed) return;
+    camera.sent = budget;
+    const kbps = budget === null ? 0 : Math.round((budget * 8) / 1000);
+    // Frame rate that fits the budget at the current frame size, so the camera
+    // spreads its frames evenly instead of bursting and then starving
+    const fps = budget === null || !averageFrame ? 0 : Math.max(1, Math.floor(budget / averageFrame));
+    ws.send(JSON.stringify({ type: 'bandwidth_budget', kbps, fps }));
+    console.log(`📶 Camera ${cameraId} budget: ${kbps ? `${kbps} kbps, ${fps} fps` : 'unlimited'}`);
+  }
+
+  // One estimation and allocation round; runs every settings.intervalMs
+  function allocate() {
+    const intervalMs = Math.max(1, now() - lastRound);
+    lastRound = now();
+    const bySite = new Map();
+    for (const [cameraId, camera] of cameras) {
+      const rate = (camera.bytes * 1000) / intervalMs;
+      camera.rate = camera.rate === null ? rate : camera.rate + (rate - camera.rate) * RATE_SMOOTHING;
+      camera.demand = camera.budget === null ? camera.rate : Math.max(camera.demand * DEMAND_DECAY, camera.rate);
+      camera.averageFrame = camera.frames ? camera.bytes / camera.frames : camera.averageFrame;
+      if (!bySite.has(camera.site)) bySite.set(camera.site, []);
+      bySite.get(camera.site).push([cameraId, camera]);
+    }
+
+    for (const [site, members] of bySite) {
+      const state = sites.get(site);
+      const ingest = members.reduce((sum, [, c]) => sum + c.rate, 0);
+      const delay = median(members.filter(([, c]) => c.delays.length).map(([, c]) => median(c.delays)));
+      state.congested = delay > settings.congestionDelayMs;
+      const saturated = members.some(([, c]) => c.budget !== null && c.rate >= c.budget * 0.9);
+
+      if (state.hold > 0) {
+        state.hold--;
+      } else if (state.congested) {
+        state.capacity = Math.max(ingest * settings.backoff, (settings.minKbps * 1000) / 8);
+        state.hold = HOLD_INTERVALS;
+      } else if (state.capacity !== null && saturated) {
+        state.capacity *= settings.probeGain;
+      }
+
+      if (state.capacity !== null) {
+        const claims = members.map(([cameraId, c]) => {
+          // A camera at its budget may want more, so let its claim grow; one
+          // below it keeps a claim on what it sent unconstrained, since its
+          // rate also drops when it lowers JPEG quality to fit the budget
+          const limited = c.budget !== null && c.rate >= c.budget * 0.9;
+          const want = Math.max(limited ? c.budget * 1.5 : c.rate * 1.2, c.demand);
+          return {
+            weight: c.priority * (1 + (streamProfiles?.viewerCount(cameraId) || 0)),
+            cap: Math.min(Math.max(want, (settings.minKbps * 1000) / 8), (settings.maxKbps * 1000) / 8),
+          };
+        });
+        const alloc = waterFill(state.capacity * settings.headroom, claims);
+        members.forEach(([, c], i) => (c.budget = alloc[i]));
+      }
+
+      for (const [cameraId, c] of members) {
+        send(cameraId, c);
+        telemetry?.incrementRelay('zcc_relay_ingest_bytes_total', { site }, c.bytes);
+        c.bytes = 0;
+        c.frames = 0;
+        c.delays = [];
+        c.intervalStarted = true;
+      }
+    }
+  }
+
+  function stats() {
+    const result = {};
+    for (const [site, state] of sites) {
+      result[site] = { capacityKbps: state.capacity === null ? null : (state.capacity * 8) / 1000, congested: state.congested, cameras: {} };
+    }
+    for (const [cameraId, c] of cameras) {
+      result[c.site].cameras[cameraId] = {
+        priority: c.priority,
+        rateKbps: (c.rate * 8) / 1000,
+        budgetKbps: c.budget === null ? null : (c.budget * 8) / 1000,
+      };
+    }
+    return result;
+  }
+
+  function close() {
+    clearInterval(timer);
+  }
+
+  // intervalMs 0 leaves the rounds to the caller (tools/bench-bandwidth.js)
+  if (settings.intervalMs > 0) {
+    timer = setInterval(() => allocate(), settings.intervalMs);
+    timer.unref?.();
+  }
+
+  return { cameraConnected, cameraDisconnected, setPriority, recordFrame, allocate, stats, close };
+}
+
+module.exports = {
+  waterFill,
+  createBandwidthAllocator,
+};
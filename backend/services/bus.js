@@ -0,0 +1,294 @@
+// Pub/sub bus between relay nodes
+// Channels carry Buffers. Two transports share one interface:
+//   memory - nodes in the same process (tests, benchmarks, single-box setups)
+//   tcp    - a small broker (createBusBroker, tools/bus-broker.js) standing in
+//            for Redis/NATS; only forwards a message to nodes subscribed to
+//            its channel. Nodes open with a hello carrying the shared secret
+//            and the broker drops any connection that does not.
+// Interface: publish(channel, payload), subscribe(channel, handler),
+// unsubscribe(channel, handler), close(). handler(payload, channel).
+const net = require('net');
+const crypto = require('crypto');
+const { EventEmitter } = require('events');
+
+const OP_SUBSCRIBE = 1;
+const OP_UNSUBSCRIBE = 2;
+const OP_PUBLISH = 3;
+const OP_HELLO = 4; // payload: the shared secret; first message on a connection
+const MAX_PENDING_BYTES = 8 * 1024 * 1024; // Publishes buffered while the broker is unreachable
+const MAX_SUBSCRIBER_BACKLOG = 16 * 1024 * 1024; // Unsent bytes before the broker drops a slow node
+const HELLO_TIMEOUT_MS = 5000;
+const MAX_HELLO_BYTES = 1024; // Read from a connection before its hello is accepted
+
+// Constant-time comparison of two secrets of any length
+function sameSecret(a, b) {
+  const digest = (s) => crypto.createHash('sha256').update(s).digest();
+  return crypto.timingSafeEqual(digest(a), digest(b));
+}
+
+// Wire format: u8 op | u16 channel length | channel | u32 payload length | payload
+function encodeMessage(op, channel, payload = Buffer.alloc(0)) {
+  const chan = Buffer.from(channel, 'utf8');
+  const head = Buffer.alloc(7 + chan.length);
+  head.writeUInt8(op, 0);
+  head.writeUInt16BE(chan.length, 1);
+  chan.copy(head, 3);
+  head.writeUInt32BE(payload.length, 3 + chan.length);
+  return [head, payload];
+}
+
+function createMessageReader(onMessage) {
+  let pending = Buffer.alloc(0);
+  return (chunk) => {
+    pending = pending.length ? Buffer.concat([pending, chunk]) : chunk;
+    while (pending.length >= 3) {
+      const chanLength = pending.readUInt16BE(1);
+      if (pending.length < 7 + chanLength) return;
+      const payloadLength = pending.readUInt32BE(3 + chanLength);
+      const end = 7 + chanLength + payloadLength;
+      if (pending.length < end) return;
+      onMessage(pending[0], pending.toString('utf8', 3, 3 + chanLength), pending.subarray(7 + chanLength, end));
+      pending = pending.subarray(end);
+    }
+  };
+}
+
+// Handlers per channel, shared by both transports
+function createSubscriptions() {
+  const handlers = new Map(); // channel -> Set(handler)
+  return {
+    add(channel, handler) {
+      if (!handlers.has(channel)) handlers.set(channel, new Set());
+      const set = handlers.get(channel);
+      const first = set.size === 0;
+      set.add(handler);
+      return first;
+    },
+    remove(channel, handler) {
+      const set = handlers.get(channel);
+      if (!set) return false;
+      set.delete(handler);
+      if (set.size > 0) return false;
+      handlers.delete(channel);
+      return true;
+    },
+    dispatch(channel, payload) {
+      for (const handler of handlers.get(channel) || []) handler(payload, channel);
+    },
+    channels: () => handlers.keys(),
+  };
+}
+
+const sharedHub = new EventEmitter();
+sharedHub.setMaxListeners(0);
+
+/**
+ * In-process bus; every bus created on the same hub sees the others' messages
+ * Delivery is deferred like a real broker's, so publishers never re-enter
+ * their own handlers.
+ */
+function createMemoryBus(hub = sharedHub) {
+  const subs = createSubscriptions();
+  const listeners = new Map(); // channel -> hub listener
+
+  return {
+    publish(channel, payload) {
+      if (hub.listenerCount(channel) === 0) return true;
+      setImmediate(() => hub.emit(channel, payload));
+      return true;
+    },
+    subscribe(channel, handler) {
+      if (!subs.add(channel, handler)) return;
+      const listener = (payload) => subs.dispatch(channel, payload);
+      listeners.set(channel, listener);
+      hub.on(channel, listener);
+    },
+    unsubscribe(channel, handler) {
+      if (!subs.remove(channel, handler)) return;
+      hub.removeListener(channel, listeners.get(channel));
+      listeners.delete(channel);
+    },
+    close() {
+      for (const [channel, listener] of listeners) hub.removeListener(channel, listener);
+      listeners.clear();
+    },
+  };
+}
+
+/**
+ * Bus client for the TCP broker
+ * Reconnects with backoff and restores its subscriptions; publishes made
+ * while disconnected are buffered up to MAX_PENDING_BYTES, then dropped.
+ */
+function createTcpBus({ host, port, secret }) {
+  if (!secret) throw new Error('The tcp cluster bus needs a shared secret (CLUSTER_BUS_SECRET)');
+  const subs = createSubscriptions();
+  let socket = null;
+  let connected = false;
+  let closed = false;
+  let retryMs = 100;
+  let pending = [];
+  let pendingBytes = 0;
+  const stats = { published: 0, received: 0, dropped: 0, bytesOut: 0, bytesIn: 0 };
+
+  function send(parts) {
+    const size = parts[0].length + parts[1].length;
+    if (!connected) {
+      if (pendingBytes + size > MAX_PENDING_BYTES) {
+        stats.dropped++;
+        return false;
+      }
+      pending.push(parts);
+      pendingBytes += size;
+      return true;
+    }
+    socket.write(parts[0]);
+    if (parts[1].length) socket.write(parts[1]);
+    stats.bytesOut += size;
+    return true;
+  }
+
+  function connect() {
+    socket = net.connect({ host, port });
+    socket.setNoDelay(true);
+    socket.on('connect', () => {
+      connected = true;
+      retryMs = 100;
+      send(encodeMessage(OP_HELLO, '', Buffer.from(secret)));
+      for (const channel of subs.channels()) send(encodeMessage(OP_SUBSCRIBE, channel));
+      const queued = pending;
+      pending = [];
+      pendingBytes = 0;
+      for (const parts of queued) send(parts);
+    });
+    socket.on(
+      'data',
+      createMessageReader((op, channel, payload) => {
+        if (op !== OP_PUBLISH) return;
+        stats.received++;
+        stats.bytesIn += payload.length;
+        subs.dispatch(channel, payload);
+      })
+    );
+    socket.on('error', () => {});
+    socket.on('close', () => {
+      connected = false;
+      if (closed) return;
+      console.warn(`⚠️ Bus broker ${host}:${port} unreachable, retrying in ${retryMs} ms`);
+      setTimeout(connect, retryMs);
+      retryMs = Math.min(retryMs * 2, 5000);
+    });
+  }
+
+  connect();
+
+  return {
+    publish(channel, payload) {
+      stats.published++;
+      return send(encodeMessage(OP_PUBLISH, channel, payload));
+    },
+    subscribe(channel, handler) {
+      if (subs.add(channel, handler) && connected) send(encodeMessage(OP_SUBSCRIBE, channel));
+    },
+    unsubscribe(channel, handler) {
+      if (subs.remove(channel, handler) && connected) send(encodeMessage(OP_UNSUBSCRIBE, channel));
+    },
+    close() {
+      closed = true;
+      socket.end();
+    },
+    stats: () => ({ ...stats, connected }),
+  };
+}
+
+/**
+ * Minimal broker: forwards each publish to the other connections subscribed
+ * to its channel
+ * A connection may only subscribe or publish after a hello with the secret.
+ * A subscriber that does not keep up is disconnected once MAX_SUBSCRIBER_BACKLOG
+ * bytes are waiting for it; its node reconnects and subscribes again.
+ */
+function createBusBroker(port, { host = '127.0.0.1', secret } = {}) {
+  if (!secret) throw new Error('The bus broker needs a shared secret');
+  const channels = new Map(); // channel -> Set(socket)
+  const stats = { connections: 0, messages: 0, bytes: 0, rejected: 0, slowDropped: 0 };
+
+  const server = net.createServer((socket) => {
+    stats.connections++;
+    socket.setNoDelay(true);
+    const joined = new Set();
+    let authenticated = false;
+    let unauthenticatedBytes = 0;
+    const reject = () => {
+      stats.rejected++;
+      socket.destroy();
+    };
+    const helloTimer = setTimeout(reject, HELLO_TIMEOUT_MS);
+    const read = createMessageReader((op, channel, payload) => {
+      if (socket.destroyed) return;
+      if (!authenticated) {
+        if (op !== OP_HELLO || !sameSecret(payload, secret)) return reject();
+        authenticated = true;
+        clearTimeout(helloTimer);
+        return;
+      }
+      if (op === OP_SUBSCRIBE) {
+        if (!channels.has(channel)) channels.set(channel, new Set());
+        channels.get(channel).add(socket);
+        joined.add(channel);
+      } else if (op === OP_UNSUBSCRIBE) {
+        channels.get(channel)?.delete(socket);
+        joined.delete(channel);
+      } else if (op === OP_PUBLISH) {
+        const targets = channels.get(channel);
+        if (!targets) return;
+        const [head] = encodeMessage(OP_PUBLISH, channel, payload);
+        for (const target of targets) {
+          if (target === socket || target.destroyed) continue;
+          if (target.writableLength > MAX_SUBSCRIBER_BACKLOG) {
+            stats.slowDropped++;
+            target.destroy();
+            continue;
+          }
+          target.write(head);
+          target.write(payload);
+          stats.messages++;
+          stats.bytes += payload.length;
+        }
+      }
+    });
+    socket.on('data', (chunk) => {
+      read(chunk);
+      // A hello is small; anything larger still waiting for one is not a node
+      if (!authenticated && (unauthenticatedBytes += chunk.length) > MAX_HELLO_BYTES) reject();
+    });
+    socket.on('error', () => {});
+    socket.on('close', () => {
+      clearTimeout(helloTimer);
+      stats.connections--;
+      for (const channel of joined) {
+        channels.get(channel)?.delete(socket);
+        if (channels.get(channel)?.size === 0) channels.delete(channel);
+      }
+    });
+  });
+  server.listen(port, host);
+  return { server, stats: () => ({ ...stats, channels: channels.size }) };
+}
+
+/**
+ * Bus for the configured transport
+ * @param {{bus: string, brokerHost: string, brokerPort: number, busSecret: string}} settings - config.cluster
+ */
+function createBus(settings) {
+  if (settings.bus === 'tcp') return createTcpBus({ host: settings.brokerHost, port: settings.brokerPort, secret: settings.busSecret });
+  if (settings.bus === 'memory') return createMemoryBus();
+  throw new Error(`Unknown cluster bus '${settings.bus}'`);
+}
+
+module.exports = {
+  createBus,
+  createMemoryBus,
+  createTcpBus,
+  createBusBroker,
+};
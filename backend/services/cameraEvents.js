@@ -1,8 +1,24 @@
 const url = require('url');
 const { query } = require('../database/connection');
+const { isTelemetryMessage } = require('./telemetry');
+const { isClockReply } = require('./clockSync');
 
-function initializeCameraSockets(server, wss, io, activeCameras) {
-  // Heartbeat mechanism to detect dead connections
+// View a ws message as a Buffer without copying (binary messages already are)
+function asBuffer(message) {
+  return Buffer.isBuffer(message) ? message : Buffer.from(message);
+}
+
+// Uplink site of a camera: the AP it reported joining at registration. A
+// camera that did not report one is keyed by the address it connects from,
+// which only groups cameras that share it (behind NAT)
+function siteOf(req, bssid) {
+  if (bssid) return `ap:${bssid}`;
+  return (req.socket.remoteAddress || 'unknown').replace(/^::ffff:/, '');
+}
+
+function initializeCameraSockets(server, wss, io, activeCameras, { registrations, telemetry, streamProfiles, capture, cluster, bandwidth, events, clockSync, activity, overload, ota, analytics, timelapse } = {}) {
+  // Heartbeat mechanism to detect dead connections. Any message counts as a
+  // sign of life: under load a pong can sit behind frames on the socket.
   const heartbeatInterval = setInterval(function ping() {
     wss.clients.forEach(function each(ws) {
       if (ws.isAlive === false) return ws.terminate();
@@ -36,9 +52,11 @@ function initializeCameraSockets(server, wss, io, activeCameras) {
 
     // Handle WebSocket upgrade with ESP32 compatibility
     try {
+      capture?.attach(cameraId, socket);
       wss.handleUpgrade(request, socket, head, (ws) => {
-        // Set ESP32-friendly options
-        ws.binaryType = 'arraybuffer';
+        // Frames as Buffers: one that arrived in a single socket read stays a
+        // view of it instead of being copied out into an ArrayBuffer
+        ws.binaryType = 'nodebuffer';
         wss.emit('connection', ws, request, { cameraId });
       });
     } catch (error) {
@@ -86,31 +104,70 @@ function initializeCameraSockets(server, wss, io, activeCameras) {
         const userId = existingCamera.user_id;
         const cameraName = existingCamera.name;
 
-        activeCameras[cameraId] = { name: cameraName, userId: userId, status: 'online' };
+        // LAN endpoint, firmware version and AP from the camera's last HTTP
+        // registration: a camera reconnecting after a dropped socket does not
+        // register again
+        const registration = registrations?.get(cameraId) || {};
+        const lan = registration.lan || null;
+        const firmware = registration.firmware || null;
+        const bssid = registration.bssid || null;
+        // WebSocket reference for camera control; also tells this session's
+        // close apart from a late one of the socket it replaced
+        activeCameras[cameraId] = { name: cameraName, userId: userId, status: 'online', lan, firmware, bssid, ws };
         console.log(`Camera '${cameraName}' reconnected for user ${userId}`);
 
         // Update status to online
         await query('UPDATE cameras SET status = $1 WHERE camera_id = $2', ['online', cameraId]);
 
         // Notify the owner's dashboard
-        io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status: 'online', name: cameraName });
-
-        // Store WebSocket reference for camera control
-        activeCameras[cameraId].ws = ws;
+        io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status: 'online', name: cameraName, lan });
+
+        streamProfiles?.cameraConnected(cameraId);
+        cluster?.cameraOnline(cameraId);
+        bandwidth?.cameraConnected(cameraId, { site: siteOf(req, bssid), priority: existingCamera.priority });
+        events?.cameraConnected(cameraId);
+        clockSync?.cameraConnected(cameraId);
+        overload?.cameraConnected(cameraId, { priority: existingCamera.priority });
+        ota?.cameraConnected(cameraId);
+        if (existingCamera.burst_interval_ms > 0) {
+          ws.send(
+            JSON.stringify({ type: 'burst_mode', interval_ms: existingCamera.burst_interval_ms, fps: existingCamera.burst_fps })
+          );
+        }
 
         // Handle streaming and control messages
-        ws.on('message', (message) => {
+        ws.on('message', (message, isBinary) => {
+          ws.isAlive = true;
           // Check if this is a text message (camera control response) or binary (video frame)
-          if (typeof message === 'string' || (message instanceof Buffer && message[0] < 0x80)) {
+          if (!isBinary) {
             // Text message - likely a control response or status update
             console.log(`📝 Control message from camera ${cameraId}:`, message.toString());
-
-            // Forward control responses to the dashboard
-            io.to(String(userId)).emit('camera-control-response', {
-              cameraId,
-              message: message.toString(),
-              timestamp: Date.now(),
-            });
+            ota?.handleStatus(cameraId, message.toString());
+
+            // Forward control responses to the dashboard, wherever it is connected
+            const response = { cameraId, message: message.toString(), timestamp: Date.now() };
+            if (cluster) cluster.emitToUser(userId, 'camera-control-response', response);
+            else io.to(String(userId)).emit('camera-control-response', response);
+          } else if (clockSync && isClockReply(asBuffer(message))) {
+            // Clock probe reply - timed on arrival, so handled before anything else
+            clockSync.handleReply(cameraId, asBuffer(message));
+          } else if (telemetry && isTelemetryMessage(asBuffer(message))) {
+            // Binary telemetry - aggregated for the /metrics endpoint, never forwarded
+            if (!telemetry.ingest(cameraId, asBuffer(message))) {
+              console.warn(`⚠️ Malformed telemetry from camera ${cameraId}`);
+            }
+          } else if (streamProfiles) {
+            // Binary message - video frame, delivered to the viewers of its profile
+            // here and, when they have viewers, on other relay nodes
+            bandwidth?.recordFrame(cameraId, asBuffer(message));
+            events?.feed(cameraId, asBuffer(message));
+            activity?.recordFrame(cameraId, asBuffer(message));
+            timelapse?.recordFrame(cameraId, asBuffer(message));
+            analytics?.feed(cameraId, asBuffer(message));
+            // Past this point frames only go to viewers, which an overloaded relay sheds first
+            if (overload && !overload.admitFrame(cameraId, asBuffer(message))) return;
+            cluster?.forwardFrame(cameraId, asBuffer(message));
+            streamProfiles.routeFrame(cameraId, asBuffer(message));
           } else {
             // Binary message - video frame
             const frameSize = message.byteLength || message.length || 0;
@@ -126,12 +183,20 @@ function initializeCameraSockets(server, wss, io, activeCameras) {
         });
 
         ws.on('close', async () => {
+          // A socket the camera has already replaced: the session is the new one's
+          if (activeCameras[cameraId]?.ws !== ws) return;
           console.log(`Camera '${cameraName}' disconnected.`);
-          // Clean up WebSocket reference
-          if (activeCameras[cameraId]) {
-            delete activeCameras[cameraId].ws;
-            delete activeCameras[cameraId];
-          }
+          delete activeCameras[cameraId];
+          telemetry?.remove(cameraId);
+          streamProfiles?.cameraDisconnected(cameraId);
+          cluster?.cameraOffline(cameraId);
+          bandwidth?.cameraDisconnected(cameraId);
+          events?.cameraDisconnected(cameraId);
+          clockSync?.cameraDisconnected(cameraId);
+          activity?.cameraDisconnected(cameraId);
+          timelapse?.cameraDisconnected(cameraId);
+          overload?.cameraDisconnected(cameraId);
+          analytics?.cameraDisconnected(cameraId);
           await query('UPDATE cameras SET status = $1 WHERE camera_id = $2', ['offline', cameraId]);
           io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status: 'offline', name: cameraName });
         });
@@ -151,10 +216,12 @@ function initializeCameraSockets(server, wss, io, activeCameras) {
             status: 'pending',
           };
         }
+        activeCameras[cameraId].ws = ws;
 
         // Don't broadcast again - HTTP registration already did this
 
         ws.on('close', () => {
+          if (activeCameras[cameraId]?.ws !== ws) return;
           console.log(`Unclaimed camera '${cameraId}' disconnected.`);
           delete activeCameras[cameraId];
         });
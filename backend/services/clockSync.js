@@ -0,0 +1,205 @@
+// Camera clock synchronisation (NTP-style, over each camera's WebSocket)
+// Capture times on a camera count from its boot, so frames of two cameras
+// cannot be lined up until the relay maps them onto its own clock. Each round
+// the relay sends a burst of probes ({ type: 'time_sync', id }) and the camera
+// answers each at once with a 0xA4 reply: when it read the probe (t2) and when
+// the reply left (t3). With the relay's send and receive times (t1, t4):
+//   offset = ((t2 - t1) + (t3 - t4)) / 2    camera minus relay clock
+//   delay  = (t4 - t1) - (t3 - t2)          round trip on the network
+// The probe with the smallest delay in a burst waited least in queues on the
+// way, so only its offset is kept. A least-squares line through the last
+// WINDOW_ROUNDS offsets gives offset and drift (rounds whose best delay is far
+// above the window's best are left out), and the camera gets
+//   { type: 'clock', camera_ms, server_ms, drift_ppm }
+// after which it stamps frames in server time (see parseFrame).
+// Sync error is measured every round, per camera: the distance between the
+// offset just measured and what the previous fit, the one the camera was
+// stamping with, predicted for that moment. Half the best delay bounds the
+// error of a single measurement.
+const { performance } = require('perf_hooks');
+const config = require('../config/app-config.js');
+
+const MSG_TYPE_CLOCK_REPLY = 0xa4; // u32 probe id, u64 receive us, u64 reply us (camera boot clock, LE)
+const CLOCK_REPLY_SIZE = 21;
+const WINDOW_ROUNDS = 16;
+const FAST_ROUNDS = 4; // First rounds run every fastIntervalMs to settle the drift quickly
+const MIN_DRIFT_SPAN_MS = 10000; // Offsets closer together than this give no usable drift
+const OUTLIER_DELAY_FACTOR = 2;
+const MAX_DRIFT_PPM = 500; // Same clamp as the firmware (CLOCK_MAX_DRIFT_PPM)
+
+function isClockReply(buf) {
+  return buf.length === CLOCK_REPLY_SIZE && buf[0] === MSG_TYPE_CLOCK_REPLY;
+}
+
+// Relay clock, epoch ms with sub-ms resolution
+function preciseNow() {
+  return performance.timeOrigin + performance.now();
+}
+
+/**
+ * Least-squares line through offset samples
+ * @param {{cameraMs: number, offsetMs: number}[]} points
+ * @returns {{at: function(number): number, slope: number}} offset at a camera time
+ */
+function fitOffset(points) {
+  const n = points.length;
+  const meanX = points.reduce((a, p) => a + p.cameraMs, 0) / n;
+  const meanY = points.reduce((a, p) => a + p.offsetMs, 0) / n;
+  const span = points[n - 1].cameraMs - points[0].cameraMs;
+  let slope = 0;
+  if (n >= 3 && span >= MIN_DRIFT_SPAN_MS) {
+    let sxy = 0;
+    let sxx = 0;
+    for (const p of points) {
+      sxy += (p.cameraMs - meanX) * (p.offsetMs - meanY);
+      sxx += (p.cameraMs - meanX) ** 2;
+    }
+    slope = Math.max(-MAX_DRIFT_PPM / 1e6, Math.min(sxy / sxx, MAX_DRIFT_PPM / 1e6));
+  }
+  return { at: (cameraMs) => meanY + slope * (cameraMs - meanX), slope };
+}
+
+function createClockSync(io, activeCameras, { cluster, telemetry, settings = config.clockSync, now = preciseNow } = {}) {
+  const cameras = new Map(); // cameraId -> per-camera state
+  let nextProbeId = 1;
+
+  function send(cameraId, message) {
+    const ws = activeCameras[cameraId]?.ws;
+    if (!ws || ws.readyState !== 1) return false;
+    ws.send(JSON.stringify(message));
+    return true;
+  }
+
+  // One probe of the current round
+  function probe(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    const id = nextProbeId++ >>> 0;
+    camera.pending.set(id, now());
+    if (!send(cameraId, { type: 'time_sync', id })) camera.pending.delete(id);
+  }
+
+  // A 0xA4 reply from the camera
+  function handleReply(cameraId, buf) {
+    const t4 = now();
+    const camera = cameras.get(cameraId);
+    if (!camera || !isClockReply(buf)) return;
+    const id = buf.readUInt32LE(1);
+    const t1 = camera.pending.get(id);
+    if (t1 === undefined) return; // From an earlier round
+    camera.pending.delete(id);
+    const t2 = Number(buf.readBigUInt64LE(5)) / 1000;
+    const t3 = Number(buf.readBigUInt64LE(13)) / 1000;
+    const sample = { cameraMs: (t2 + t3) / 2, offsetMs: (t2 - t1 + (t3 - t4)) / 2, delayMs: t4 - t1 - (t3 - t2) };
+    if (!camera.best || sample.delayMs < camera.best.delayMs) camera.best = sample;
+  }
+
+  // Close the round: keep its best probe, refit and push the new mapping
+  function finishRound(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    camera.pending.clear();
+    camera.rounds++;
+    const best = camera.best;
+    camera.best = null;
+    if (!best) return;
+
+    if (camera.fit) camera.errorMs = Math.abs(best.offsetMs - camera.fit.at(best.cameraMs));
+    camera.points.push(best);
+    if (camera.points.length > WINDOW_ROUNDS) camera.points.shift();
+    const minDelay = Math.min(...camera.points.map((p) => p.delayMs));
+    const usable = camera.points.filter((p) => p.delayMs <= minDelay * OUTLIER_DELAY_FACTOR + 1);
+    camera.fit = fitOffset(usable);
+    camera.delayMs = best.delayMs;
+
+    // Anchor at the newest sample; server = camera - offset, so the server
+    // clock runs (1 - slope) times as fast as the camera's
+    const cameraMs = Math.round(best.cameraMs);
+    const serverMs = Math.round(cameraMs - camera.fit.at(cameraMs));
+    camera.driftPpm = -camera.fit.slope * 1e6;
+    send(cameraId, { type: 'clock', camera_ms: cameraMs, server_ms: serverMs, drift_ppm: Number(camera.driftPpm.toFixed(3)) });
+    report(cameraId, camera);
+  }
+
+  function report(cameraId, camera) {
+    const labels = { camera: cameraId };
+    telemetry?.setRelayGauge('zcc_camera_clock_error_ms', labels, camera.errorMs);
+    telemetry?.setRelayGauge('zcc_camera_clock_round_trip_ms', labels, camera.delayMs);
+    telemetry?.setRelayGauge('zcc_camera_clock_drift_ppm', labels, camera.driftPpm);
+    const userId = activeCameras[cameraId]?.userId;
+    if (userId === undefined || userId === null) return;
+    const status = {
+      cameraId,
+      errorMs: camera.errorMs,
+      boundMs: camera.delayMs / 2,
+      driftPpm: camera.driftPpm,
+    };
+    if (cluster) cluster.emitToUser(userId, 'cameraClock', status);
+    else io.to(String(userId)).emit('cameraClock', status);
+  }
+
+  function schedule(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    for (let i = 0; i < settings.probes; i++) {
+      camera.timers.add(setTimeout(() => probe(cameraId), i * settings.probeSpacingMs));
+    }
+    const roundMs = settings.probes * settings.probeSpacingMs + settings.replyTimeoutMs;
+    camera.timers.add(
+      setTimeout(() => {
+        camera.timers.clear();
+        finishRound(cameraId);
+        const interval = camera.rounds < FAST_ROUNDS ? settings.fastIntervalMs : settings.intervalMs;
+        camera.timers.add(setTimeout(() => schedule(cameraId), Math.max(0, interval - roundMs)));
+      }, roundMs)
+    );
+  }
+
+  function cameraConnected(cameraId) {
+    cameraDisconnected(cameraId);
+    cameras.set(cameraId, {
+      pending: new Map(), // probe id -> t1
+      best: null, // lowest-delay sample of the current round
+      points: [], // best sample per round
+      fit: null,
+      rounds: 0,
+      errorMs: null,
+      delayMs: null,
+      driftPpm: 0,
+      timers: new Set(),
+    });
+    // intervalMs 0 leaves the rounds to the caller (tools/bench-clock.js)
+    if (settings.intervalMs > 0) schedule(cameraId);
+  }
+
+  function cameraDisconnected(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    camera.timers.forEach((t) => clearTimeout(t));
+    cameras.delete(cameraId);
+    for (const name of ['zcc_camera_clock_error_ms', 'zcc_camera_clock_round_trip_ms', 'zcc_camera_clock_drift_ppm']) {
+      telemetry?.setRelayGauge(name, { camera: cameraId }, null);
+    }
+  }
+
+  function stats() {
+    const result = {};
+    for (const [cameraId, c] of cameras) {
+      result[cameraId] = { rounds: c.rounds, errorMs: c.errorMs, roundTripMs: c.delayMs, driftPpm: c.driftPpm };
+    }
+    return result;
+  }
+
+  function close() {
+    for (const cameraId of [...cameras.keys()]) cameraDisconnected(cameraId);
+  }
+
+  return { cameraConnected, cameraDisconnected, probe, handleReply, finishRound, stats, close };
+}
+
+module.exports = {
+  MSG_TYPE_CLOCK_REPLY,
+  isClockReply,
+  fitOffset,
+  createClockSync,
+};
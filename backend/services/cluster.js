@@ -0,0 +1,357 @@
+// Multi-node relay
+// Cameras and dashboards may land on different relay nodes. Nodes share a
+// pub/sub bus (bus.js) and keep three things consistent over it:
+//   presence - every node knows which node each online camera is connected
+//              to (remote entries in activeCameras carry `node`); nodes
+//              heartbeat their camera lists and a silent node's cameras are
+//              dropped after a few missed beats
+//   demand   - a node with viewers for a remote camera tells the camera's
+//              node which profiles it needs; the owner folds that into the
+//              demand it announces to the camera (streamProfiles.addDemand)
+//   frames   - the owner publishes a camera's frames on frames:<cameraId>
+//              only while some other node has demand for them; subscribers
+//              route them to their local viewers with streamProfiles.routeFrame
+// Dashboard events that originate where the camera is (control responses)
+// are re-emitted on every node with emitToUser.
+// Dashboards need sticky sessions at the load balancer (socket.io polling).
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const PRESENCE_CHANNEL = 'presence';
+const USER_EVENTS_CHANNEL = 'user-events';
+const NODE_TIMEOUT_BEATS = 3;
+
+function nodeChannel(nodeId) {
+  return `node:${nodeId}`;
+}
+
+function framesChannel(cameraId) {
+  return `frames:${cameraId}`;
+}
+
+function encode(message) {
+  return Buffer.from(JSON.stringify(message));
+}
+
+function decode(payload) {
+  try {
+    return JSON.parse(payload.toString());
+  } catch (err) {
+    return null;
+  }
+}
+
+/**
+ * @param {Server} io - socket.io server of this node
+ * @param {object} activeCameras - Shared camera table; remote entries get a `node` field
+ * @param {object} bus - Pub/sub bus (bus.js)
+ * @param {{nodeId: string, heartbeatMs: number, streamProfiles: object, telemetry: object}} options
+ */
+function createClusterRelay(io, activeCameras, bus, { nodeId, heartbeatMs, streamProfiles, telemetry }) {
+  // cameraId -> Map(node -> { main, sub }) for local cameras watched from other nodes
+  const remoteDemand = new Map();
+  // cameraId -> { main, sub } last sent to the owner of a remote camera
+  const sentDemand = new Map();
+  // cameraId -> frames handler while subscribed to a remote camera's frames
+  const frameSubscriptions = new Map();
+  // cameraId -> time of the last forwarded substream frame
+  const lastSubForwardedAt = new Map();
+  // node -> time of its last heartbeat
+  const lastSeen = new Map();
+  const stats = { framesForwarded: 0, bytesForwarded: 0, framesReceived: 0, bytesReceived: 0 };
+
+  const isLocal = (cameraId) => Boolean(activeCameras[cameraId]?.ws);
+  const isRemote = (cameraId) => Boolean(activeCameras[cameraId]?.node);
+
+  function publish(channel, message) {
+    bus.publish(channel, encode(message));
+  }
+
+  function localCameraList() {
+    return Object.entries(activeCameras)
+      .filter(([, cam]) => cam.ws && cam.userId !== null)
+      .map(([cameraId, cam]) => ({ cameraId, name: cam.name, userId: cam.userId, status: cam.status, lan: cam.lan }));
+  }
+
+  function demandList() {
+    return [...sentDemand.entries()].map(([cameraId, d]) => ({ cameraId, node: activeCameras[cameraId]?.node, ...d }));
+  }
+
+  function heartbeat() {
+    publish(PRESENCE_CHANNEL, { type: 'heartbeat', node: nodeId, cameras: localCameraList(), demand: demandList() });
+  }
+
+  // ---- Demand: this node watching remote cameras ----
+
+  function sendDemand(cameraId, wanted) {
+    const camera = activeCameras[cameraId];
+    if (!camera?.node) return;
+    const previous = sentDemand.get(cameraId);
+    const want = { main: Boolean(wanted.main), sub: Boolean(wanted.sub) };
+    if (previous ? previous.main === want.main && previous.sub === want.sub : !want.main && !want.sub) return;
+
+    if (want.main || want.sub) sentDemand.set(cameraId, want);
+    else sentDemand.delete(cameraId);
+    publish(nodeChannel(camera.node), { type: 'demand', node: nodeId, cameraId, ...want });
+
+    if ((want.main || want.sub) && !frameSubscriptions.has(cameraId)) {
+      const handler = (payload) => {
+        if (!isRemote(cameraId)) return;
+        stats.framesReceived++;
+        stats.bytesReceived += payload.length;
+        streamProfiles.routeFrame(cameraId, payload);
+      };
+      frameSubscriptions.set(cameraId, handler);
+      bus.subscribe(framesChannel(cameraId), handler);
+    } else if (!want.main && !want.sub) {
+      stopFrames(cameraId);
+    }
+  }
+
+  function stopFrames(cameraId) {
+    const handler = frameSubscriptions.get(cameraId);
+    if (!handler) return;
+    frameSubscriptions.delete(cameraId);
+    bus.unsubscribe(framesChannel(cameraId), handler);
+  }
+
+  // ---- Demand: other nodes watching local cameras ----
+
+  function applyRemoteDemand(node, cameraId, wanted) {
+    if ((wanted.main || wanted.sub) && !isLocal(cameraId)) return;
+    let byNode = remoteDemand.get(cameraId);
+    if (!byNode) {
+      byNode = new Map();
+      remoteDemand.set(cameraId, byNode);
+    }
+    const previous = byNode.get(node) || { main: false, sub: false };
+    for (const profile of ['main', 'sub']) {
+      if (Boolean(wanted[profile]) !== previous[profile]) {
+        streamProfiles.addDemand(cameraId, profile, wanted[profile] ? 1 : -1);
+      }
+    }
+    if (wanted.main || wanted.sub) byNode.set(node, { main: Boolean(wanted.main), sub: Boolean(wanted.sub) });
+    else byNode.delete(node);
+    if (byNode.size === 0) remoteDemand.delete(cameraId);
+  }
+
+  function dropRemoteDemand(cameraId, node = null) {
+    const byNode = remoteDemand.get(cameraId);
+    if (!byNode) return;
+    for (const n of [...byNode.keys()]) {
+      if (node === null || n === node) applyRemoteDemand(n, cameraId, { main: false, sub: false });
+    }
+    remoteDemand.delete(cameraId);
+  }
+
+  /**
+   * Publish a local camera's frame if another node has demand for it
+   * @param {string} cameraId
+   * @param {Buffer} buf - Raw camera payload, as given to streamProfiles.routeFrame
+   */
+  function forwardFrame(cameraId, buf) {
+    const byNode = remoteDemand.get(cameraId);
+    if (!byNode) return;
+    let wantMain = false;
+    let wantSub = false;
+    for (const d of byNode.values()) {
+      wantMain = wantMain || d.main;
+      wantSub = wantSub || d.sub;
+    }
+
+    const { profile, preroll } = parseFrame(buf);
+    if (preroll) return; // Event clips are written where the camera is connected
+    let wanted;
+    if (profile === 'sub') {
+      lastSubForwardedAt.set(cameraId, Date.now());
+      wanted = wantSub;
+    } else {
+      // Remote grid tiles fall back to the main stream like local ones
+      const subStale = Date.now() - (lastSubForwardedAt.get(cameraId) || 0) > config.camera.substreamFallbackMs;
+      wanted = wantMain || (wantSub && subStale);
+    }
+    if (!wanted) return;
+
+    bus.publish(framesChannel(cameraId), buf);
+    stats.framesForwarded++;
+    stats.bytesForwarded += buf.length;
+    telemetry?.incrementRelay('zcc_relay_cluster_bytes_forwarded_total', {}, buf.length);
+  }
+
+  // ---- Presence ----
+
+  function emitStatus(userId, cameraId, status, name, lan) {
+    io.to(String(userId)).emit('cameraStatusUpdate', { cameraId, status, name, lan });
+  }
+
+  function setRemote(node, cam) {
+    const existing = activeCameras[cam.cameraId];
+    if (existing?.ws) return; // Connected here; the other node's entry is stale
+    const moved = existing?.node !== node;
+    const changed = moved || existing.status !== cam.status || existing.name !== cam.name;
+    activeCameras[cam.cameraId] = { name: cam.name, userId: cam.userId, status: cam.status, lan: cam.lan, node };
+    if (changed) emitStatus(cam.userId, cam.cameraId, cam.status, cam.name, cam.lan);
+    if (moved) {
+      // New owner: re-announce what local viewers need
+      sentDemand.delete(cam.cameraId);
+      sendDemand(cam.cameraId, streamProfiles.demand(cam.cameraId));
+    }
+  }
+
+  function removeRemote(cameraId, node, status = 'offline') {
+    const existing = activeCameras[cameraId];
+    if (!existing || existing.node !== node) return;
+    delete activeCameras[cameraId];
+    sentDemand.delete(cameraId);
+    stopFrames(cameraId);
+    streamProfiles.cameraDisconnected(cameraId);
+    emitStatus(existing.userId, cameraId, status, existing.name);
+  }
+
+  function dropNode(node) {
+    lastSeen.delete(node);
+    for (const [cameraId, cam] of Object.entries(activeCameras)) {
+      if (cam.node === node) removeRemote(cameraId, node);
+    }
+    for (const cameraId of [...remoteDemand.keys()]) dropRemoteDemand(cameraId, node);
+  }
+
+  function onPresence(payload) {
+    const msg = decode(payload);
+    if (!msg || msg.node === nodeId) return;
+    lastSeen.set(msg.node, Date.now());
+
+    if (msg.type === 'online') {
+      setRemote(msg.node, msg.camera);
+    } else if (msg.type === 'offline') {
+      removeRemote(msg.cameraId, msg.node);
+    } else if (msg.type === 'update' && activeCameras[msg.cameraId]) {
+      const cam = activeCameras[msg.cameraId];
+      cam.name = msg.name;
+      emitStatus(cam.userId, msg.cameraId, cam.status, cam.name, cam.lan);
+    } else if (msg.type === 'removed' && activeCameras[msg.cameraId]) {
+      const cam = activeCameras[msg.cameraId];
+      if (cam.node) removeRemote(msg.cameraId, cam.node, 'deleted');
+      else delete activeCameras[msg.cameraId];
+    } else if (msg.type === 'heartbeat') {
+      const listed = new Set(msg.cameras.map((cam) => cam.cameraId));
+      for (const cam of msg.cameras) setRemote(msg.node, cam);
+      for (const [cameraId, cam] of Object.entries(activeCameras)) {
+        if (cam.node === msg.node && !listed.has(cameraId)) removeRemote(cameraId, msg.node);
+      }
+      // Re-assert that node's demand on our cameras in case a message was lost
+      const wanted = new Map(msg.demand.filter((d) => d.node === nodeId).map((d) => [d.cameraId, d]));
+      for (const [cameraId, byNode] of remoteDemand) {
+        if (byNode.has(msg.node) && !wanted.has(cameraId)) applyRemoteDemand(msg.node, cameraId, { main: false, sub: false });
+      }
+      for (const [cameraId, d] of wanted) applyRemoteDemand(msg.node, cameraId, d);
+    } else if (msg.type === 'hello') {
+      heartbeat();
+    } else if (msg.type === 'bye') {
+      dropNode(msg.node);
+    }
+  }
+
+  function onNodeMessage(payload) {
+    const msg = decode(payload);
+    if (!msg) return;
+    if (msg.type === 'demand') {
+      applyRemoteDemand(msg.node, msg.cameraId, msg);
+    } else if (msg.type === 'camera-message') {
+      const camera = activeCameras[msg.cameraId];
+      if (camera?.ws && camera.ws.readyState === 1) camera.ws.send(msg.message);
+    }
+  }
+
+  function onUserEvent(payload) {
+    const msg = decode(payload);
+    if (!msg || msg.node === nodeId) return;
+    io.to(String(msg.userId)).emit(msg.event, msg.data);
+  }
+
+  // ---- Hooks for cameraEvents, socketManager and routes ----
+
+  function cameraOnline(cameraId) {
+    const cam = activeCameras[cameraId];
+    if (!cam || cam.userId === null) return;
+    publish(PRESENCE_CHANNEL, {
+      type: 'online',
+      node: nodeId,
+      camera: { cameraId, name: cam.name, userId: cam.userId, status: cam.status, lan: cam.lan },
+    });
+  }
+
+  function cameraOffline(cameraId) {
+    dropRemoteDemand(cameraId);
+    lastSubForwardedAt.delete(cameraId);
+    publish(PRESENCE_CHANNEL, { type: 'offline', node: nodeId, cameraId });
+  }
+
+  function cameraUpdated(cameraId, name) {
+    publish(PRESENCE_CHANNEL, { type: 'update', node: nodeId, cameraId, name });
+  }
+
+  function cameraRemoved(cameraId) {
+    publish(PRESENCE_CHANNEL, { type: 'removed', node: nodeId, cameraId });
+  }
+
+  // Send a control message to a camera connected to another node
+  function sendToCamera(cameraId, message) {
+    const camera = activeCameras[cameraId];
+    if (!camera?.node) return false;
+    publish(nodeChannel(camera.node), { type: 'camera-message', node: nodeId, cameraId, message });
+    return true;
+  }
+
+  // io.to(userId).emit on every node
+  function emitToUser(userId, event, data) {
+    io.to(String(userId)).emit(event, data);
+    publish(USER_EVENTS_CHANNEL, { node: nodeId, userId, event, data });
+  }
+
+  streamProfiles.onDemand((cameraId, wanted) => {
+    if (isRemote(cameraId)) sendDemand(cameraId, wanted);
+  });
+
+  bus.subscribe(PRESENCE_CHANNEL, onPresence);
+  bus.subscribe(nodeChannel(nodeId), onNodeMessage);
+  bus.subscribe(USER_EVENTS_CHANNEL, onUserEvent);
+  publish(PRESENCE_CHANNEL, { type: 'hello', node: nodeId });
+
+  const timer = setInterval(() => {
+    heartbeat();
+    const deadline = Date.now() - NODE_TIMEOUT_BEATS * heartbeatMs;
+    for (const [node, seen] of lastSeen) {
+      if (seen < deadline) {
+        console.warn(`⚠️ Relay node ${node} missed ${NODE_TIMEOUT_BEATS} heartbeats, dropping its cameras`);
+        dropNode(node);
+      }
+    }
+  }, heartbeatMs);
+  timer.unref?.();
+
+  function close() {
+    clearInterval(timer);
+    publish(PRESENCE_CHANNEL, { type: 'bye', node: nodeId });
+  }
+
+  console.log(`🛰️ Relay node ${nodeId} joined the cluster`);
+
+  return {
+    nodeId,
+    forwardFrame,
+    cameraOnline,
+    cameraOffline,
+    cameraUpdated,
+    cameraRemoved,
+    sendToCamera,
+    emitToUser,
+    isRemote,
+    close,
+    stats: () => ({ ...stats, nodes: lastSeen.size + 1, remoteCameras: Object.values(activeCameras).filter((c) => c.node).length }),
+  };
+}
+
+module.exports = {
+  createClusterRelay,
+};
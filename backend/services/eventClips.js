@@ -0,0 +1,130 @@
+// Event clips from the camera's pre-event ring
+// With pre-roll on (config.events.prerollSeconds), every camera is told to keep
+// the last seconds of video in PSRAM ('preroll' control message). When it sees
+// motion, or the relay sends 'event_trigger' (POST /api/camera/:id/event), it
+// uploads that ring as 0xA3 frames as fast as its link allows, marks the
+// triggering frame 0xA3 as well, and then streams live for postEventMs. Each
+// event becomes one multipart MJPEG file in clipsDir, written as frames arrive:
+// the pre-roll, then live main-profile frames until postEventMs after the last
+// 0xA3 frame. X-Timestamp on each part is the capture time: epoch ms once the
+// camera clock is synchronised (clockSync.js), else ms since it booted.
+const fs = require('fs');
+const path = require('path');
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const BOUNDARY = 'zccframe';
+const SWEEP_INTERVAL_MS = 1000; // Closes clips of cameras that stopped sending after the event
+
+function clipFileName(cameraId, startedAt) {
+  const stamp = new Date(startedAt).toISOString().replace(/[:.]/g, '-');
+  return `${cameraId.replace(/[^\w-]/g, '_')}-${stamp}.mjpeg`;
+}
+
+function createEventClips(activeCameras, { telemetry, settings = config.events, now = Date.now } = {}) {
+  const clips = new Map(); // cameraId -> { file, stream, openUntil, preroll, live, bytes, startedAt }
+  let timer = null;
+
+  function sendControl(cameraId, message) {
+    const ws = activeCameras[cameraId]?.ws;
+    if (!ws || ws.readyState !== 1) return false;
+    ws.send(JSON.stringify(message));
+    return true;
+  }
+
+  function cameraConnected(cameraId) {
+    if (settings.prerollSeconds > 0) {
+      sendControl(cameraId, {
+        type: 'preroll',
+        seconds: settings.prerollSeconds,
+        max_kb: settings.prerollMaxKb,
+        post_ms: settings.postEventMs,
+      });
+    }
+  }
+
+  function open(cameraId) {
+    fs.mkdirSync(settings.clipsDir, { recursive: true });
+    const startedAt = now();
+    const file = path.join(settings.clipsDir, clipFileName(cameraId, startedAt));
+    const stream = fs.createWriteStream(file);
+    stream.on('error', (err) => console.error(`❌ Event clip ${file}: ${err.message}`));
+    const clip = { file, stream, openUntil: 0, preroll: 0, live: 0, bytes: 0, startedAt };
+    clips.set(cameraId, clip);
+    console.log(`🎬 Event clip started for camera ${cameraId}: ${file}`);
+    return clip;
+  }
+
+  function close(cameraId) {
+    const clip = clips.get(cameraId);
+    if (!clip) return;
+    clips.delete(cameraId);
+    clip.stream.end(`--${BOUNDARY}--\r\n`);
+    telemetry?.incrementRelay('zcc_relay_event_clips_total', {}, 1);
+    console.log(
+      `🎬 Event clip closed for camera ${cameraId}: ${clip.preroll} pre-roll + ${clip.live} live frames, ` +
+        `${Math.round(clip.bytes / 1024)} KB, ${((now() - clip.startedAt) / 1000).toFixed(1)} s`
+    );
+  }
+
+  function append(clip, jpeg, captureMs) {
+    const timestamp = captureMs === null ? '' : `X-Timestamp: ${captureMs}\r\n`;
+    clip.stream.write(`--${BOUNDARY}\r\nContent-Type: image/jpeg\r\nContent-Length: ${jpeg.length}\r\n${timestamp}\r\n`);
+    clip.stream.write(jpeg);
+    clip.stream.write('\r\n');
+    clip.bytes += jpeg.length;
+  }
+
+  /**
+   * Every binary frame message from a camera, as received
+   * @param {string} cameraId
+   * @param {Buffer} buf - Raw WebSocket payload, as given to streamProfiles.routeFrame
+   */
+  function feed(cameraId, buf) {
+    const { profile, jpeg, captureMs, preroll } = parseFrame(buf);
+    let clip = clips.get(cameraId);
+    if (preroll) {
+      clip = clip || open(cameraId);
+      clip.openUntil = now() + settings.postEventMs;
+      clip.preroll++;
+      append(clip, jpeg, captureMs);
+      return;
+    }
+    if (!clip || profile !== 'main') return;
+    if (now() > clip.openUntil) {
+      close(cameraId);
+      return;
+    }
+    clip.live++;
+    append(clip, jpeg, captureMs);
+  }
+
+  // Ask the camera to start an event (or extend the current one)
+  function trigger(cameraId) {
+    return sendControl(cameraId, { type: 'event_trigger' });
+  }
+
+  function cameraDisconnected(cameraId) {
+    close(cameraId);
+  }
+
+  function sweep() {
+    for (const [cameraId, clip] of [...clips]) {
+      if (now() > clip.openUntil) close(cameraId);
+    }
+  }
+
+  function closeAll() {
+    clearInterval(timer);
+    for (const cameraId of [...clips.keys()]) close(cameraId);
+  }
+
+  timer = setInterval(sweep, SWEEP_INTERVAL_MS);
+  timer.unref?.();
+
+  return { cameraConnected, cameraDisconnected, feed, trigger, close: closeAll };
+}
+
+module.exports = {
+  createEventClips,
+};
@@ -0,0 +1,262 @@
+// Binary deltas between firmware images, for OTA updates (ota.js)
+// Two builds of the camera firmware are mostly the same code, shifted: a
+// change moves everything after it, and every absolute address that points
+// past it changes by the same amount. The delta is built the way bsdiff does
+// it: regions of the new image are matched against the old one, matches are
+// extended over the bytes that differ (the shifted addresses), and each match
+// is sent as the bytewise difference new - old, which is mostly zeros.
+// Bytes with no match are sent as they are. Unlike bsdiff, the operations are
+// written as one stream in target order, so the camera can apply them as the
+// download arrives, with nothing but a 32 KB inflate window in memory:
+//   header, uncompressed (HEADER_SIZE bytes, little-endian):
+//     'ZCCD', u8 version, 3 reserved, u32 source size, source sha256,
+//     u32 target size, target sha256
+//   raw deflate stream of operations:
+//     'D' u32 source offset, u32 length, length bytes (new - old mod 256)
+//     'X' u32 length, length bytes copied as they are
+//     'E' end
+// The camera checks the source hash against its running partition before it
+// writes anything, and the target hash before it boots the result.
+const crypto = require('crypto');
+const zlib = require('zlib');
+const { Worker, isMainThread, parentPort, workerData } = require('worker_threads');
+
+const MAGIC = 'ZCCD';
+const VERSION = 1;
+const HEADER_SIZE = 80;
+const OP_DIFF = 0x44; // 'D'
+const OP_EXTRA = 0x58; // 'X'
+const OP_END = 0x45; // 'E'
+const MIN_MATCH = 12; // Exact match that starts a diff region
+const SEED_BYTES = 8; // Bytes hashed per source position
+const HASH_BITS = 20;
+const MAX_CHAIN = 32; // Source candidates tried per target position
+const EXTEND_SLACK = 64; // Mismatches past the best point before an extension gives up
+
+function sha256(buf) {
+  return crypto.createHash('sha256').update(buf).digest();
+}
+
+function seedHash(buf, i) {
+  const a = buf.readUInt32LE(i);
+  const b = buf.readUInt32LE(i + 4);
+  return (Math.imul(a, 0x9e3779b1) ^ Math.imul(b ^ (a >>> 15), 0x85ebca77)) >>> (32 - HASH_BITS);
+}
+
+// Hash chains over every source position: head[hash] -> newest, prev[i] -> older
+function indexSource(source) {
+  const head = new Int32Array(1 << HASH_BITS).fill(-1);
+  const prev = new Int32Array(Math.max(source.length, 1));
+  for (let i = 0; i + SEED_BYTES <= source.length; i++) {
+    const h = seedHash(source, i);
+    prev[i] = head[h];
+    head[h] = i;
+  }
+  return { head, prev };
+}
+
+function exactLength(source, s, target, t) {
+  let n = 0;
+  while (s + n < source.length && t + n < target.length && source[s + n] === target[t + n]) n++;
+  return n;
+}
+
+// Longest exact match for target[t..], with the previous region's alignment
+// tried first: after a shifted address, the old code simply continues
+function findMatch(source, target, t, index, lastShift) {
+  let bestLen = 0;
+  let bestSrc = -1;
+  const aligned = t + lastShift;
+  if (aligned >= 0 && aligned < source.length) {
+    bestLen = exactLength(source, aligned, target, t);
+    bestSrc = aligned;
+  }
+  if (t + SEED_BYTES <= target.length) {
+    let s = index.head[seedHash(target, t)];
+    for (let chain = 0; s !== -1 && chain < MAX_CHAIN; chain++, s = index.prev[s]) {
+      const len = exactLength(source, s, target, t);
+      if (len > bestLen) {
+        bestLen = len;
+        bestSrc = s;
+      }
+    }
+  }
+  return bestLen >= MIN_MATCH ? { src: bestSrc, len: bestLen } : null;
+}
+
+// How far a match can grow over differing bytes: the point where matches minus
+// mismatches peaks, looking at most EXTEND_SLACK mismatches past it
+function extend(source, s, target, t, limit, step) {
+  let score = 0;
+  let best = 0;
+  let bestLen = 0;
+  for (let n = 1; n <= limit; n++) {
+    const si = s + step * (step > 0 ? n - 1 : n);
+    const ti = t + step * (step > 0 ? n - 1 : n);
+    if (si < 0 || si >= source.length) break;
+    score += source[si] === target[ti] ? 1 : -1;
+    if (score > best) {
+      best = score;
+      bestLen = n;
+    } else if (score < best - EXTEND_SLACK) {
+      break;
+    }
+  }
+  return bestLen;
+}
+
+/**
+ * Operation list turning source into target
+ * @returns {Array<{ op: 'D', src: number, start: number, len: number } | { op: 'X', start: number, len: number }>}
+ *   target ranges in order, covering all of target
+ */
+function diffOps(source, target) {
+  const index = indexSource(source);
+  const ops = [];
+  let extraStart = 0; // Target bytes not covered yet start here
+  let lastShift = 0; // source offset - target offset of the last diff region
+  let t = 0;
+  while (t < target.length) {
+    const match = findMatch(source, target, t, index, lastShift);
+    if (!match) {
+      t++;
+      continue;
+    }
+    const back = extend(source, match.src, target, t, t - extraStart, -1);
+    const start = t - back;
+    const src = match.src - back;
+    const end = t + match.len;
+    const forward = extend(source, match.src + match.len, target, end, target.length - end, 1);
+    if (start > extraStart) ops.push({ op: 'X', start: extraStart, len: start - extraStart });
+    ops.push({ op: 'D', src, start, len: end + forward - start });
+    lastShift = src - start;
+    t = extraStart = end + forward;
+  }
+  if (extraStart < target.length) ops.push({ op: 'X', start: extraStart, len: target.length - extraStart });
+  return ops;
+}
+
+function encodeOps(source, target, ops) {
+  const parts = [];
+  for (const o of ops) {
+    if (o.op === 'D') {
+      const head = Buffer.alloc(9);
+      head[0] = OP_DIFF;
+      head.writeUInt32LE(o.src, 1);
+      head.writeUInt32LE(o.len, 5);
+      const body = Buffer.allocUnsafe(o.len);
+      for (let i = 0; i < o.len; i++) body[i] = (target[o.start + i] - source[o.src + i]) & 0xff;
+      parts.push(head, body);
+    } else {
+      const head = Buffer.alloc(5);
+      head[0] = OP_EXTRA;
+      head.writeUInt32LE(o.len, 1);
+      parts.push(head, target.subarray(o.start, o.start + o.len));
+    }
+  }
+  parts.push(Buffer.from([OP_END]));
+  return Buffer.concat(parts);
+}
+
+function encodeHeader(source, target) {
+  const header = Buffer.alloc(HEADER_SIZE);
+  header.write(MAGIC, 0, 'latin1');
+  header[4] = VERSION;
+  header.writeUInt32LE(source.length, 8);
+  sha256(source).copy(header, 12);
+  header.writeUInt32LE(target.length, 44);
+  sha256(target).copy(header, 48);
+  return header;
+}
+
+function parseHeader(delta) {
+  if (delta.length < HEADER_SIZE || delta.toString('latin1', 0, 4) !== MAGIC || delta[4] !== VERSION) return null;
+  return {
+    sourceSize: delta.readUInt32LE(8),
+    sourceSha256: delta.subarray(12, 44),
+    targetSize: delta.readUInt32LE(44),
+    targetSha256: delta.subarray(48, 80),
+  };
+}
+
+/**
+ * Delta from one firmware image to another
+ * @param {Buffer} source - Image the camera is running
+ * @param {Buffer} target - Image to install
+ * @returns {Buffer} header + raw deflate operation stream
+ */
+function createDelta(source, target) {
+  const ops = diffOps(source, target);
+  const stream = zlib.deflateRawSync(encodeOps(source, target, ops), { level: 9, memLevel: 9 });
+  return Buffer.concat([encodeHeader(source, target), stream]);
+}
+
+/**
+ * Apply a delta the way the camera does; throws if it does not fit source or
+ * does not produce the image it was built for
+ */
+function applyDelta(source, delta) {
+  const header = parseHeader(delta);
+  if (!header) throw new Error('Not a firmware delta');
+  if (source.length !== header.sourceSize || !sha256(source).equals(header.sourceSha256)) {
+    throw new Error('Delta was built for another source image');
+  }
+  const ops = zlib.inflateRawSync(delta.subarray(HEADER_SIZE));
+  const target = Buffer.alloc(header.targetSize);
+  let t = 0;
+  let p = 0;
+  while (ops[p] !== OP_END) {
+    if (p >= ops.length) throw new Error('Delta ends without an end marker');
+    if (ops[p] === OP_DIFF) {
+      const src = ops.readUInt32LE(p + 1);
+      const len = ops.readUInt32LE(p + 5);
+      p += 9;
+      for (let i = 0; i < len; i++) target[t + i] = (source[src + i] + ops[p + i]) & 0xff;
+      t += len;
+      p += len;
+    } else if (ops[p] === OP_EXTRA) {
+      const len = ops.readUInt32LE(p + 1);
+      p += 5;
+      ops.copy(target, t, p, p + len);
+      t += len;
+      p += len;
+    } else {
+      throw new Error(`Unknown delta operation 0x${ops[p].toString(16)}`);
+    }
+  }
+  if (t !== header.targetSize || !sha256(target).equals(header.targetSha256)) {
+    throw new Error('Delta did not reproduce the target image');
+  }
+  return target;
+}
+
+/**
+ * createDelta on a worker thread: a 2 MB image takes long enough to stall the
+ * relay's event loop
+ * @returns {Promise<Buffer>}
+ */
+function createDeltaInWorker(source, target) {
+  return new Promise((resolve, reject) => {
+    const worker = new Worker(__filename, { workerData: { source, target } });
+    worker.once('message', (delta) => resolve(Buffer.from(delta.buffer, delta.byteOffset, delta.byteLength)));
+    worker.once('error', reject);
+    worker.once('exit', (code) => {
+      if (code !== 0) reject(new Error(`Delta worker exited with code ${code}`));
+    });
+  });
+}
+
+if (!isMainThread && workerData?.source) {
+  const delta = createDelta(Buffer.from(workerData.source), Buffer.from(workerData.target));
+  parentPort.postMessage(delta);
+}
+
+module.exports = {
+  HEADER_SIZE,
+  sha256,
+  parseHeader,
+  diffOps,
+  createDelta,
+  applyDelta,
+  createDeltaInWorker,
+};
@@ -0,0 +1,353 @@
+// Baseline JPEG decoder with DCT-domain downscaling
+// Decodes at 1/1, 1/2, 1/4 or 1/8 scale the way libjpeg's scaled IDCT does:
+// only the top-left NxN coefficients of each 8x8 block are kept and an N-point
+// IDCT produces NxN pixels, so a 1/8 decode is just the DC terms and never
+// runs a full IDCT. Output stays in the JPEG's own YCbCr planes (full range),
+// which is what the mosaic canvas uses, so there is no colour conversion.
+//
+// Supports baseline/extended sequential Huffman JPEGs with 8-bit samples,
+// any sampling factors and restart intervals (everything the OV cameras
+// produce). Progressive and arithmetic-coded files are rejected.
+
+const ZIGZAG = new Uint8Array([
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21,
+  28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61,
+  54, 47, 55, 62, 63,
+]);
+
+// IDCT_TABLES[N][j * N + u] = C(u)/2 * cos((2j + 1) u pi / 2N), sampling the
+// 8-point basis at the centres of N sub-blocks
+const IDCT_TABLES = {};
+for (const n of [1, 2, 4, 8]) {
+  const table = new Float32Array(n * n);
+  for (let j = 0; j < n; j++) {
+    for (let u = 0; u < n; u++) {
+      const c = u === 0 ? Math.SQRT1_2 : 1;
+      table[j * n + u] = (c / 2) * Math.cos(((2 * j + 1) * u * Math.PI) / (2 * n));
+    }
+  }
+  IDCT_TABLES[n] = table;
+}
+
+const LOOKAHEAD_BITS = 9;
+
+function buildHuffmanTable(counts, symbols) {
+  // Canonical codes: per length, the first code and the index of its symbol
+  const maxcode = new Int32Array(18).fill(-1);
+  const valptr = new Int32Array(17);
+  const mincode = new Int32Array(17);
+  // Codes up to LOOKAHEAD_BITS long resolve with one table lookup: (length << 8) | symbol
+  const lookup = new Uint16Array(1 << LOOKAHEAD_BITS);
+  let code = 0;
+  let k = 0;
+  for (let len = 1; len <= 16; len++) {
+    valptr[len] = k;
+    mincode[len] = code;
+    for (let i = 0; i < counts[len - 1]; i++, code++, k++) {
+      if (len <= LOOKAHEAD_BITS) {
+        const first = code << (LOOKAHEAD_BITS - len);
+        lookup.fill((len << 8) | symbols[k], first, first + (1 << (LOOKAHEAD_BITS - len)));
+      }
+    }
+    maxcode[len] = counts[len - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+  maxcode[17] = 0x7fffffff;
+  return { maxcode, valptr, mincode, symbols, lookup };
+}
+
+function createBitReader(buf, start) {
+  let pos = start;
+  let bits = 0;
+  let bitCount = 0;
+  let marker = false;
+
+  function fill() {
+    while (bitCount <= 24) {
+      let byte = 0;
+      if (!marker && pos < buf.length) {
+        byte = buf[pos];
+        if (byte === 0xff) {
+          const next = buf[pos + 1];
+          if (next === 0x00) {
+            pos += 2;
+          } else {
+            // A marker ends the entropy-coded segment; feed zeros past it
+            marker = true;
+            byte = 0;
+          }
+        } else {
+          pos++;
+        }
+      }
+      bits = (bits << 8) | byte;
+      bitCount += 8;
+    }
+  }
+
+  return {
+    readBit() {
+      if (bitCount === 0) fill();
+      bitCount--;
+      return (bits >>> bitCount) & 1;
+    },
+    receive(n) {
+      if (n === 0) return 0;
+      if (bitCount < n) fill();
+      bitCount -= n;
+      return (bits >>> bitCount) & ((1 << n) - 1);
+    },
+    decode(table) {
+      if (bitCount < LOOKAHEAD_BITS) fill();
+      const entry = table.lookup[(bits >>> (bitCount - LOOKAHEAD_BITS)) & ((1 << LOOKAHEAD_BITS) - 1)];
+      if (entry) {
+        bitCount -= entry >> 8;
+        return entry & 0xff;
+      }
+      // Longer code: walk the canonical table from the lookahead length
+      bitCount -= LOOKAHEAD_BITS;
+      let code = (bits >>> bitCount) & ((1 << LOOKAHEAD_BITS) - 1);
+      for (let len = LOOKAHEAD_BITS + 1; len <= 16; len++) {
+        code = (code << 1) | this.readBit();
+        if (code <= table.maxcode[len]) return table.symbols[table.valptr[len] + code - table.mincode[len]];
+      }
+      throw new Error('Corrupt Huffman code');
+    },
+    // Skip to just past the next RSTn marker and drop buffered bits
+    restart() {
+      bits = 0;
+      bitCount = 0;
+      marker = false;
+      while (pos + 1 < buf.length && !(buf[pos] === 0xff && buf[pos + 1] >= 0xd0 && buf[pos + 1] <= 0xd7)) pos++;
+      pos += 2;
+    },
+    // Position of the marker that ended the scan
+    end() {
+      while (pos + 1 < buf.length && !(buf[pos] === 0xff && buf[pos + 1] !== 0x00 && !(buf[pos + 1] >= 0xd0 && buf[pos + 1] <= 0xd7))) pos++;
+      return pos;
+    },
+  };
+}
+
+function extend(v, t) {
+  return v < 1 << (t - 1) ? v - (1 << t) + 1 : v;
+}
+
+/**
+ * Decode a JPEG at reduced scale
+ * @param {Buffer} buf - JPEG file
+ * @param {number} scale - Output pixels per 8x8 block edge: 8 (full), 4, 2 or 1
+ * @returns {{width, height, components: Array<{plane: Uint8Array, stride, width, height, h, v}>}}
+ *   width/height are the scaled image size; each component plane is at its own
+ *   subsampled resolution (width * h / maxH)
+ */
+function decodeScaled(buf, scale = 1) {
+  const n = scale;
+  const idct = IDCT_TABLES[n];
+  if (!idct) throw new Error(`Unsupported scale ${scale}`);
+  if (buf[0] !== 0xff || buf[1] !== 0xd8) throw new Error('Not a JPEG');
+
+  const quant = [];
+  const dcTables = [];
+  const acTables = [];
+  let frame = null;
+  let restartInterval = 0;
+  let pos = 2;
+
+  while (pos < buf.length) {
+    if (buf[pos] !== 0xff) {
+      pos++;
+      continue;
+    }
+    const marker = buf[pos + 1];
+    pos += 2;
+    if (marker === 0xd8 || marker === 0xff || (marker >= 0xd0 && marker <= 0xd7)) continue;
+    if (marker === 0xd9) break;
+    const len = buf.readUInt16BE(pos);
+    const seg = pos + 2;
+    const segEnd = pos + len;
+
+    if (marker === 0xdb) {
+      for (let p = seg; p < segEnd; ) {
+        const precision = buf[p] >> 4;
+        const id = buf[p] & 15;
+        const table = new Int32Array(64);
+        p++;
+        for (let k = 0; k < 64; k++) {
+          table[k] = precision ? buf.readUInt16BE(p + k * 2) : buf[p + k];
+        }
+        p += precision ? 128 : 64;
+        quant[id] = table;
+      }
+    } else if (marker === 0xc4) {
+      for (let p = seg; p < segEnd; ) {
+        const cls = buf[p] >> 4;
+        const id = buf[p] & 15;
+        const counts = buf.subarray(p + 1, p + 17);
+        const total = counts.reduce((a, c) => a + c, 0);
+        const table = buildHuffmanTable(counts, buf.subarray(p + 17, p + 17 + total));
+        (cls === 0 ? dcTables : acTables)[id] = table;
+        p += 17 + total;
+      }
+    } else if (marker === 0xc0 || marker === 0xc1) {
+      if (buf[seg] !== 8) throw new Error('Only 8-bit JPEGs are supported');
+      const height = buf.readUInt16BE(seg + 1);
+      const width = buf.readUInt16BE(seg + 3);
+      const count = buf[seg + 5];
+      const components = [];
+      for (let i = 0; i < count; i++) {
+        const o = seg + 6 + i * 3;
+        components.push({ id: buf[o], h: buf[o + 1] >> 4, v: buf[o + 1] & 15, tq: buf[o + 2], pred: 0 });
+      }
+      const maxH = Math.max(...components.map((c) => c.h));
+      const maxV = Math.max(...components.map((c) => c.v));
+      const mcusX = Math.ceil(width / (8 * maxH));
+      const mcusY = Math.ceil(height / (8 * maxV));
+      for (const c of components) {
+        c.blocksX = Math.ceil(Math.ceil((width * c.h) / maxH) / 8);
+        c.blocksY = Math.ceil(Math.ceil((height * c.v) / maxV) / 8);
+        c.stride = mcusX * c.h * n;
+        c.plane = new Uint8Array(c.stride * mcusY * c.v * n);
+        c.width = Math.ceil((Math.ceil((width * c.h) / maxH) * n) / 8);
+        c.height = Math.ceil((Math.ceil((height * c.v) / maxV) * n) / 8);
+      }
+      frame = { width, height, components, maxH, maxV, mcusX, mcusY };
+    } else if (marker >= 0xc2 && marker <= 0xcf && marker !== 0xc4 && marker !== 0xc8 && marker !== 0xcc) {
+      throw new Error('Progressive and arithmetic-coded JPEGs are not supported');
+    } else if (marker === 0xdd) {
+      restartInterval = buf.readUInt16BE(seg);
+    } else if (marker === 0xda) {
+      if (!frame) throw new Error('Scan before frame header');
+      const count = buf[seg];
+      const scanComponents = [];
+      for (let i = 0; i < count; i++) {
+        const c = frame.components.find((comp) => comp.id === buf[seg + 1 + i * 2]);
+        const tables = buf[seg + 2 + i * 2];
+        c.dc = dcTables[tables >> 4];
+        c.ac = acTables[tables & 15];
+        c.q = quant[c.tq];
+        c.pred = 0;
+        scanComponents.push(c);
+      }
+      pos = decodeScan(buf, segEnd, frame, scanComponents, restartInterval, n, idct);
+      continue;
+    }
+    pos = segEnd;
+  }
+
+  if (!frame) throw new Error('No frame header');
+  return {
+    width: Math.ceil((frame.width * n) / 8),
+    height: Math.ceil((frame.height * n) / 8),
+    maxH: frame.maxH,
+    maxV: frame.maxV,
+    components: frame.components.map(({ plane, stride, width, height, h, v }) => ({ plane, stride, width, height, h, v })),
+  };
+}
+
+function decodeScan(buf, start, frame, comps, restartInterval, n, idct) {
+  const reader = createBitReader(buf, start);
+  const coef = new Float32Array(64);
+  const tmp = new Float32Array(64);
+  const single = comps.length === 1;
+  const total = single ? comps[0].blocksX * comps[0].blocksY : frame.mcusX * frame.mcusY;
+
+  function decodeBlock(c, bx, by) {
+    for (let i = 0; i < 64; i++) coef[i] = 0;
+    const t = reader.decode(c.dc);
+    c.pred += t ? extend(reader.receive(t), t) : 0;
+    coef[0] = c.pred * c.q[0];
+    for (let k = 1; k < 64; ) {
+      const rs = reader.decode(c.ac);
+      const r = rs >> 4;
+      const s = rs & 15;
+      if (s === 0) {
+        if (r !== 15) break;
+        k += 16;
+        continue;
+      }
+      k += r;
+      if (k > 63) break;
+      const value = extend(reader.receive(s), s);
+      const z = ZIGZAG[k];
+      // Coefficients outside the top-left NxN only carry detail we drop
+      if ((z & 7) < n && z >> 3 < n) coef[z] = value * c.q[k];
+      k++;
+    }
+
+    // Separable N-point IDCT: rows then columns (all-zero rows are common)
+    for (let v = 0; v < n; v++) {
+      let nonzero = false;
+      for (let u = 0; u < n; u++) nonzero = nonzero || coef[v * 8 + u] !== 0;
+      if (!nonzero) {
+        for (let x = 0; x < n; x++) tmp[v * 8 + x] = 0;
+        continue;
+      }
+      for (let x = 0; x < n; x++) {
+        let sum = 0;
+        for (let u = 0; u < n; u++) sum += idct[x * n + u] * coef[v * 8 + u];
+        tmp[v * 8 + x] = sum;
+      }
+    }
+    const base = by * n * c.stride + bx * n;
+    for (let y = 0; y < n; y++) {
+      for (let x = 0; x < n; x++) {
+        let sum = 0;
+        for (let v = 0; v < n; v++) sum += idct[y * n + v] * tmp[v * 8 + x];
+        const px = Math.round(sum + 128);
+        c.plane[base + y * c.stride + x] = px < 0 ? 0 : px > 255 ? 255 : px;
+      }
+    }
+  }
+
+  for (let m = 0; m < total; m++) {
+    if (restartInterval && m > 0 && m % restartInterval === 0) {
+      reader.restart();
+      for (const c of comps) c.pred = 0;
+    }
+    if (single) {
+      const c = comps[0];
+      decodeBlock(c, m % c.blocksX, Math.floor(m / c.blocksX));
+    } else {
+      const mx = m % frame.mcusX;
+      const my = Math.floor(m / frame.mcusX);
+      for (const c of comps) {
+        for (let v = 0; v < c.v; v++) {
+          for (let h = 0; h < c.h; h++) decodeBlock(c, mx * c.h + h, my * c.v + v);
+        }
+      }
+    }
+  }
+  return reader.end();
+}
+
+/**
+ * Largest reduction that still yields at least minWidth x minHeight pixels
+ * @returns {number} Scale for decodeScaled (8, 4, 2 or 1)
+ */
+function chooseScale(width, height, minWidth, minHeight) {
+  for (const n of [1, 2, 4]) {
+    if ((width * n) / 8 >= minWidth && (height * n) / 8 >= minHeight) return n;
+  }
+  return 8;
+}
+
+// Read the frame size without decoding
+function readJpegSize(buf) {
+  let pos = 2;
+  while (pos + 9 < buf.length) {
+    if (buf[pos] !== 0xff) return null;
+    const marker = buf[pos + 1];
+    if (marker >= 0xc0 && marker <= 0xcf && marker !== 0xc4 && marker !== 0xc8 && marker !== 0xcc) {
+      return { height: buf.readUInt16BE(pos + 5), width: buf.readUInt16BE(pos + 7) };
+    }
+    pos += 2 + buf.readUInt16BE(pos + 2);
+  }
+  return null;
+}
+
+module.exports = {
+  decodeScaled,
+  chooseScale,
+  readJpegSize,
+};
@@ -0,0 +1,274 @@
+// Server-side grid mosaics
+// A dashboard in grid view can ask for one composited stream instead of a
+// stream per tile. Each mosaic keeps a YUV 4:2:0 canvas that is allocated
+// once, on one of settings.workers compositing threads (mosaicWorker.js); on
+// every tick the cameras with a new frame are sent to that thread, which
+// decodes them at reduced scale into their tiles and posts the finished
+// canvas back. The main thread only writes it to the mosaic's long-running
+// ffmpeg encoder. Dashboards showing the same layout share the mosaic.
+const path = require('path');
+const { spawn } = require('child_process');
+const { Worker } = require('worker_threads');
+const ffmpegPath = require('ffmpeg-static');
+const config = require('../config/app-config.js');
+
+const WORKER_FILE = path.join(__dirname, 'mosaicWorker.js');
+const RESPAWN_MS = 1000;
+
+function mosaicRoom(key) {
+  return `mosaic:${key}`;
+}
+
+const JPEG_SOI = Buffer.from([0xff, 0xd8]);
+const JPEG_EOI = Buffer.from([0xff, 0xd9]);
+
+// Split an MJPEG byte stream (ffmpeg's mjpeg muxer: bare JPEGs back to back) into frames
+function createJpegSplitter(onFrame) {
+  let pending = Buffer.alloc(0);
+  return (chunk) => {
+    pending = pending.length ? Buffer.concat([pending, chunk]) : chunk;
+    let start = pending.indexOf(JPEG_SOI);
+    while (start !== -1) {
+      const end = pending.indexOf(JPEG_EOI, start + 2);
+      if (end === -1) break;
+      onFrame(pending.subarray(start, end + 2));
+      pending = pending.subarray(end + 2);
+      start = pending.indexOf(JPEG_SOI);
+    }
+  };
+}
+
+function createMosaicService(io, activeCameras, { streamProfiles, telemetry } = {}) {
+  const settings = config.mosaic;
+  const mosaics = new Map(); // key -> mosaic
+  const byCamera = new Map(); // cameraId -> Set(mosaic)
+  const subscriptions = new Map(); // socket.id -> key
+  const workers = []; // { thread, mosaics: Set(mosaic) }, spawned as mosaics need them
+  const byId = new Map(); // mosaic id -> mosaic, for the threads' replies
+  let nextId = 0;
+  let closed = false;
+
+  function spawnWorker(worker) {
+    worker.thread = new Worker(WORKER_FILE);
+    worker.thread.on('message', finishTick);
+    worker.thread.on('error', (err) => console.error('❌ Mosaic worker error:', err.message));
+    worker.thread.on('exit', (code) => {
+      worker.thread = null;
+      for (const mosaic of worker.mosaics) mosaic.inFlight = false;
+      if (closed) return;
+      console.warn(`⚠️ Mosaic worker exited with code ${code}, restarting`);
+      setTimeout(() => {
+        if (closed) return;
+        spawnWorker(worker);
+        // The canvases went with the thread: allocate them again and redraw every tile
+        for (const mosaic of worker.mosaics) {
+          createOnWorker(mosaic);
+          for (const cameraId of mosaic.latest.keys()) mosaic.dirty.add(cameraId);
+        }
+      }, RESPAWN_MS).unref?.();
+    });
+  }
+
+  // A thread of its own while there are fewer than settings.workers, else the least loaded
+  function pickWorker() {
+    const idle = workers.find((w) => w.mosaics.size === 0);
+    if (idle) return idle;
+    if (workers.length < Math.max(1, settings.workers)) {
+      const worker = { thread: null, mosaics: new Set() };
+      workers.push(worker);
+      spawnWorker(worker);
+      return worker;
+    }
+    return workers.reduce((best, w) => (w.mosaics.size < best.mosaics.size ? w : best));
+  }
+
+  function createOnWorker(mosaic) {
+    mosaic.worker.thread?.postMessage({
+      create: mosaic.id,
+      columns: mosaic.columns,
+      rows: mosaic.rows,
+      tileWidth: settings.tileWidth,
+      tileHeight: settings.tileHeight,
+    });
+  }
+
+  function createMosaic(key, cameraIds, columns) {
+    const rows = Math.ceil(cameraIds.length / columns);
+    const width = columns * settings.tileWidth;
+    const height = rows * settings.tileHeight;
+    const encoder = spawn(ffmpegPath, [
+      '-loglevel', 'error',
+      '-f', 'rawvideo', '-pix_fmt', 'yuvj420p', '-s', `${width}x${height}`, '-i', 'pipe:0',
+      '-f', 'mjpeg', '-q:v', String(settings.quality), 'pipe:1',
+    ]);
+    const mosaic = {
+      id: ++nextId,
+      key,
+      cameraIds,
+      columns,
+      rows,
+      worker: pickWorker(),
+      inFlight: false,
+      encoder,
+      latest: new Map(), // cameraId -> { jpeg, profile }
+      dirty: new Set(),
+      viewers: 0,
+      timer: null,
+      stats: { ticks: 0, decodeMs: 0, tilesDrawn: 0 },
+    };
+    mosaic.worker.mosaics.add(mosaic);
+    byId.set(mosaic.id, mosaic);
+    createOnWorker(mosaic);
+
+    encoder.stdout.on(
+      'data',
+      createJpegSplitter((jpeg) => {
+        const room = mosaicRoom(key);
+        const viewers = io.sockets.adapter.rooms.get(room)?.size || 0;
+        io.to(room).emit('mosaic', { key, frame: jpeg, frameSize: jpeg.length, columns, rows, cameras: cameraIds });
+        telemetry?.incrementRelay('zcc_relay_bytes_delivered_total', { profile: 'mosaic' }, jpeg.length * viewers);
+      })
+    );
+    encoder.stdin.on('error', () => {});
+    encoder.on('exit', (code) => {
+      if (mosaics.get(key) === mosaic) {
+        console.error(`❌ Mosaic encoder for ${key} exited (${code})`);
+        destroyMosaic(mosaic);
+      }
+    });
+
+    mosaic.timer = setInterval(() => tick(mosaic), 1000 / settings.fps);
+    for (const cameraId of cameraIds) {
+      if (!byCamera.has(cameraId)) byCamera.set(cameraId, new Set());
+      byCamera.get(cameraId).add(mosaic);
+      streamProfiles?.addDemand(cameraId, 'sub', 1);
+    }
+    mosaics.set(key, mosaic);
+    console.log(`🧩 Mosaic ${key} started: ${cameraIds.length} cameras, ${width}x${height}`);
+    return mosaic;
+  }
+
+  function destroyMosaic(mosaic) {
+    mosaics.delete(mosaic.key);
+    byId.delete(mosaic.id);
+    clearInterval(mosaic.timer);
+    mosaic.worker.mosaics.delete(mosaic);
+    mosaic.worker.thread?.postMessage({ destroy: mosaic.id });
+    mosaic.encoder.stdin.end();
+    mosaic.encoder.kill();
+    for (const cameraId of mosaic.cameraIds) {
+      byCamera.get(cameraId)?.delete(mosaic);
+      if (byCamera.get(cameraId)?.size === 0) byCamera.delete(cameraId);
+      streamProfiles?.addDemand(cameraId, 'sub', -1);
+    }
+    console.log(`🧩 Mosaic ${mosaic.key} stopped`);
+  }
+
+  // Send the tiles that changed to the mosaic's thread to be redrawn
+  function tick(mosaic) {
+    if (mosaic.dirty.size === 0 || mosaic.inFlight || !mosaic.worker.thread) return;
+    if (mosaic.encoder.stdin.writableLength > 0) return; // Encoder still busy with the last tick
+
+    const tiles = [];
+    const jpegs = [];
+    for (const cameraId of mosaic.dirty) {
+      tiles.push(mosaic.cameraIds.indexOf(cameraId));
+      // Copies, so the socket buffers they were sliced from are not held
+      // and can be handed over to the thread
+      jpegs.push(new Uint8Array(mosaic.latest.get(cameraId).jpeg));
+    }
+    mosaic.dirty.clear();
+    mosaic.inFlight = true;
+    mosaic.worker.thread.postMessage({ id: mosaic.id, tiles, jpegs }, jpegs.map((jpeg) => jpeg.buffer));
+  }
+
+  // A canvas came back from a thread: encode it once
+  function finishTick({ id, frame, drawn, errors, composeMs }) {
+    const mosaic = byId.get(id);
+    if (!mosaic) return; // Stopped while the thread was drawing
+    mosaic.inFlight = false;
+    if (!frame) {
+      // No canvas on the thread (it restarted): allocate one and redraw every tile
+      createOnWorker(mosaic);
+      for (const cameraId of mosaic.latest.keys()) mosaic.dirty.add(cameraId);
+      return;
+    }
+    for (const { index, message } of errors) console.warn(`⚠️ Mosaic tile for camera ${mosaic.cameraIds[index]} not drawn:`, message);
+    mosaic.stats.decodeMs += composeMs;
+    mosaic.stats.tilesDrawn += drawn;
+    mosaic.stats.ticks++;
+    mosaic.encoder.stdin.write(Buffer.from(frame.buffer, frame.byteOffset, frame.byteLength));
+  }
+
+  /**
+   * Feed a camera frame; called for every frame the relay receives
+   * Substream frames are preferred; main frames only fill in until one arrives.
+   */
+  function feed(cameraId, profile, jpeg) {
+    const targets = byCamera.get(cameraId);
+    if (!targets) return;
+    for (const mosaic of targets) {
+      const current = mosaic.latest.get(cameraId);
+      if (profile !== 'sub' && current?.profile === 'sub' && Date.now() - current.at < config.camera.substreamFallbackMs) continue;
+      mosaic.latest.set(cameraId, { jpeg, profile, at: Date.now() });
+      mosaic.dirty.add(cameraId);
+    }
+  }
+
+  /**
+   * Subscribe a dashboard socket to the mosaic for a layout
+   * @param {Socket} socket - Authenticated dashboard socket
+   * @param {{cameras: string[], columns: number}} layout - Tile order and column count
+   * @returns {string|null} Mosaic key, or null if the layout is not allowed
+   */
+  function subscribe(socket, layout = {}) {
+    // One tile per camera: a repeated ID would map to the first one's tile
+    const cameraIds = Array.isArray(layout.cameras) ? [...new Set(layout.cameras.map(String))] : [];
+    const columns = Math.max(1, Math.min(parseInt(layout.columns) || 1, cameraIds.length));
+    if (cameraIds.length === 0 || cameraIds.length > settings.maxCameras) return null;
+    const owned = cameraIds.every((id) => String(activeCameras[id]?.userId) === String(socket.user.id));
+    if (!owned) return null;
+
+    const key = `${socket.user.id}:${columns}:${cameraIds.join(',')}`;
+    if (subscriptions.get(socket.id) === key) return key;
+    unsubscribe(socket);
+
+    const mosaic = mosaics.get(key) || createMosaic(key, cameraIds, columns);
+    mosaic.viewers++;
+    subscriptions.set(socket.id, key);
+    socket.join(mosaicRoom(key));
+    return key;
+  }
+
+  function unsubscribe(socket) {
+    const key = subscriptions.get(socket.id);
+    if (!key) return;
+    subscriptions.delete(socket.id);
+    socket.leave(mosaicRoom(key));
+    const mosaic = mosaics.get(key);
+    if (mosaic && --mosaic.viewers === 0) destroyMosaic(mosaic);
+  }
+
+  function stats() {
+    return [...mosaics.values()].map((m) => ({
+      key: m.key,
+      cameras: m.cameraIds.length,
+      viewers: m.viewers,
+      avgComposeMs: m.stats.ticks ? m.stats.decodeMs / m.stats.ticks : 0,
+      tilesDrawn: m.stats.tilesDrawn,
+    }));
+  }
+
+  function close() {
+    closed = true;
+    for (const mosaic of [...mosaics.values()]) destroyMosaic(mosaic);
+    for (const worker of workers) worker.thread?.terminate();
+  }
+
+  return { subscribe, unsubscribe, feed, stats, close };
+}
+
+module.exports = {
+  createJpegSplitter,
+  createMosaicService,
+};
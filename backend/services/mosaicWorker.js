@@ -0,0 +1,109 @@
+// Compositing thread for mosaic.js
+// Owns the canvases of the mosaics pinned to it. Each message carries the
+// tiles that changed since the last tick of one mosaic; they are decoded at
+// reduced scale (jpegScaledDecoder.js) into the canvas, and a copy of the
+// finished canvas goes back for the encoder. Tiles that did not change keep
+// what was drawn before.
+//   { create: id, columns, rows, tileWidth, tileHeight }
+//   { destroy: id }
+//   { id, tiles: [index], jpegs: [Uint8Array] }
+//     -> { id, frame: Uint8Array, drawn, errors: [{ index, message }], composeMs }
+//        frame is null when the thread has no canvas for the mosaic
+const { parentPort } = require('worker_threads');
+const { performance } = require('perf_hooks');
+const { decodeScaled, chooseScale, readJpegSize } = require('./jpegScaledDecoder.js');
+
+// Nearest-neighbour copy of one decoded plane into a tile of a canvas plane
+function blitPlane(src, srcStride, srcW, srcH, dst, dstStride, dstX, dstY, dstW, dstH) {
+  for (let y = 0; y < dstH; y++) {
+    const sy = Math.min(srcH - 1, Math.floor(((y + 0.5) * srcH) / dstH));
+    const srcRow = sy * srcStride;
+    const dstRow = (dstY + y) * dstStride + dstX;
+    for (let x = 0; x < dstW; x++) {
+      dst[dstRow + x] = src[srcRow + Math.min(srcW - 1, Math.floor(((x + 0.5) * srcW) / dstW))];
+    }
+  }
+}
+
+/**
+ * Composite canvas in yuvj420p layout (Y plane, then Cb, then Cr)
+ */
+function createCanvas(columns, rows, tileWidth, tileHeight) {
+  const width = columns * tileWidth;
+  const height = rows * tileHeight;
+  const lumaSize = width * height;
+  const chromaSize = lumaSize / 4;
+  const buffer = Buffer.alloc(lumaSize + chromaSize * 2);
+  buffer.fill(16, 0, lumaSize);
+  buffer.fill(128, lumaSize);
+  const planes = [
+    buffer.subarray(0, lumaSize),
+    buffer.subarray(lumaSize, lumaSize + chromaSize),
+    buffer.subarray(lumaSize + chromaSize),
+  ];
+
+  // Decode a camera JPEG at the cheapest sufficient scale into tile `index`
+  function drawTile(index, jpeg) {
+    const size = readJpegSize(jpeg);
+    if (!size) throw new Error('No JPEG frame header');
+    const image = decodeScaled(jpeg, chooseScale(size.width, size.height, tileWidth, tileHeight));
+    const tx = (index % columns) * tileWidth;
+    const ty = Math.floor(index / columns) * tileHeight;
+
+    const luma = image.components[0];
+    blitPlane(luma.plane, luma.stride, luma.width, luma.height, planes[0], width, tx, ty, tileWidth, tileHeight);
+    for (let c = 1; c <= 2; c++) {
+      const comp = image.components[c];
+      const dst = planes[c];
+      if (comp) {
+        blitPlane(comp.plane, comp.stride, comp.width, comp.height, dst, width / 2, tx / 2, ty / 2, tileWidth / 2, tileHeight / 2);
+      } else {
+        // Greyscale source
+        for (let y = 0; y < tileHeight / 2; y++) dst.fill(128, (ty / 2 + y) * (width / 2) + tx / 2, (ty / 2 + y) * (width / 2) + (tx + tileWidth) / 2);
+      }
+    }
+  }
+
+  return { width, height, buffer, drawTile };
+}
+
+if (parentPort) {
+  const canvases = new Map(); // mosaic id -> canvas
+
+  parentPort.on('message', (msg) => {
+    if (msg.create !== undefined) {
+      canvases.set(msg.create, createCanvas(msg.columns, msg.rows, msg.tileWidth, msg.tileHeight));
+      return;
+    }
+    if (msg.destroy !== undefined) {
+      canvases.delete(msg.destroy);
+      return;
+    }
+    const canvas = canvases.get(msg.id);
+    if (!canvas) {
+      // Always answer: the mosaic waits for a reply before its next tick
+      parentPort.postMessage({ id: msg.id, frame: null, drawn: 0, errors: [], composeMs: 0 });
+      return;
+    }
+    const t0 = performance.now();
+    let drawn = 0;
+    const errors = [];
+    msg.tiles.forEach((index, i) => {
+      const jpeg = msg.jpegs[i];
+      try {
+        canvas.drawTile(index, Buffer.from(jpeg.buffer, jpeg.byteOffset, jpeg.byteLength));
+        drawn++;
+      } catch (err) {
+        // Keep the previous tile contents; one bad frame should not blank it
+        errors.push({ index, message: err.message });
+      }
+    });
+    // A copy, so the canvas can be drawn on while the encoder takes this one
+    const frame = new Uint8Array(canvas.buffer);
+    parentPort.postMessage({ id: msg.id, frame, drawn, errors, composeMs: performance.now() - t0 }, [frame.buffer]);
+  });
+}
+
+module.exports = {
+  createCanvas,
+};
@@ -0,0 +1,195 @@
+// Firmware updates over the air
+// Images are kept in settings.dir as <version>.bin. Cameras report the version
+// they run when they register. POST /api/camera/:id/ota { version } sends the
+// camera { type: 'ota', url, size, delta, target_size, target_sha256 }: the
+// delta from its version to the new one (firmwareDelta.js) when the relay has
+// both images, else the whole image. Deltas are built on a worker thread the
+// first time a pair is asked for and kept in settings.dir/deltas.
+// The camera downloads from url (GET /ota/:token, a link that needs no login
+// and lasts until the update ends or linkTtlMs passes) on a task of its own and writes the inactive OTA partition while
+// it keeps streaming; it only goes offline for the final reboot. It reports
+// progress with { type: 'ota_status', state, received, written, error }:
+//   downloading -> rebooting, or failed
+// An update is done when the camera reconnects running the new version. A
+// delta that does not fit the image the camera runs (error 'source') is
+// retried once as a full image.
+const crypto = require('crypto');
+const fs = require('fs');
+const path = require('path');
+const config = require('../config/app-config.js');
+const { createDeltaInWorker } = require('./firmwareDelta.js');
+
+const VERSION_PATTERN = /^[\w.+-]{1,32}$/;
+const STATES = ['downloading', 'rebooting', 'failed'];
+
+function createOtaUpdates(activeCameras, { telemetry, settings = config.ota, now = Date.now } = {}) {
+  const updates = new Map(); // cameraId -> { from, to, delta, size, state, received, written, error, token, startedAt, rebootAt }
+  const downloads = new Map(); // token -> { file, cameraId, expiresAt }
+  const building = new Map(); // delta file -> Promise while a worker builds it
+
+  function imageFile(version) {
+    return VERSION_PATTERN.test(version || '') ? path.join(settings.dir, `${version}.bin`) : null;
+  }
+
+  function hasImage(version) {
+    const file = imageFile(version);
+    return !!file && fs.existsSync(file);
+  }
+
+  function sha256File(file) {
+    return crypto.createHash('sha256').update(fs.readFileSync(file)).digest('hex');
+  }
+
+  // Delta file from one version to another, built if it is not cached yet
+  async function deltaFile(from, to) {
+    const file = path.join(settings.dir, 'deltas', `${from}--${to}.zccd`);
+    if (fs.existsSync(file)) return file;
+    if (!building.has(file)) {
+      const build = (async () => {
+        const started = now();
+        const delta = await createDeltaInWorker(
+          await fs.promises.readFile(imageFile(from)),
+          await fs.promises.readFile(imageFile(to))
+        );
+        await fs.promises.mkdir(path.dirname(file), { recursive: true });
+        await fs.promises.writeFile(`${file}.tmp`, delta);
+        await fs.promises.rename(`${file}.tmp`, file);
+        console.log(`🧩 Firmware delta ${from} -> ${to}: ${(delta.length / 1024).toFixed(0)} KB, built in ${now() - started} ms`);
+        return file;
+      })().finally(() => building.delete(file));
+      building.set(file, build);
+    }
+    return building.get(file);
+  }
+
+  function sendControl(cameraId, message) {
+    const ws = activeCameras[cameraId]?.ws;
+    if (!ws || ws.readyState !== 1) return false;
+    ws.send(JSON.stringify(message));
+    return true;
+  }
+
+  function finish(cameraId, update, state, error = null) {
+    update.state = state;
+    update.error = error;
+    downloads.delete(update.token);
+    telemetry?.incrementRelay('zcc_relay_ota_updates_total', { result: state === 'failed' ? 'failed' : 'done' }, 1);
+    if (state === 'failed') console.warn(`⚠️ Firmware update of camera ${cameraId} to ${update.to} failed: ${error}`);
+  }
+
+  /**
+   * Send a camera the update to version; the camera must be connected here
+   * @param {boolean} [full] - Send the whole image even if a delta could be made
+   * @returns {Promise<object>} the update, as status() reports it
+   */
+  async function start(cameraId, version, { full = false } = {}) {
+    const from = activeCameras[cameraId]?.firmware || null;
+    const useDelta = !full && from !== null && from !== version && hasImage(from);
+    const file = useDelta ? await deltaFile(from, version) : imageFile(version);
+    const target = imageFile(version);
+    const previous = updates.get(cameraId);
+    if (previous) downloads.delete(previous.token);
+
+    const token = crypto.randomBytes(16).toString('hex');
+    const size = fs.statSync(file).size;
+    downloads.set(token, { file, cameraId, expiresAt: now() + settings.linkTtlMs });
+    const update = {
+      from,
+      to: version,
+      delta: useDelta,
+      size,
+      state: 'downloading',
+      received: 0,
+      written: 0,
+      error: null,
+      token,
+      startedAt: now(),
+      rebootAt: null,
+    };
+    updates.set(cameraId, update);
+    const sent = sendControl(cameraId, {
+      type: 'ota',
+      url: `/ota/${token}`,
+      size,
+      delta: useDelta,
+      target_size: fs.statSync(target).size,
+      target_sha256: sha256File(target),
+    });
+    if (!sent) finish(cameraId, update, 'failed', 'camera disconnected');
+    else console.log(`📦 Firmware update of camera ${cameraId}: ${from || 'unknown'} -> ${version}, ${useDelta ? 'delta' : 'full image'} of ${(size / 1024).toFixed(0)} KB`);
+    return status(cameraId);
+  }
+
+  // { type: 'ota_status' } from the camera; returns false for other messages
+  function handleStatus(cameraId, text) {
+    let msg;
+    try {
+      msg = JSON.parse(text);
+    } catch (err) {
+      return false;
+    }
+    if (msg?.type !== 'ota_status') return false;
+    const update = updates.get(cameraId);
+    if (!update || update.state !== 'downloading' || !STATES.includes(msg.state)) return true;
+    update.received = Number(msg.received) || update.received;
+    update.written = Number(msg.written) || update.written;
+    if (msg.state === 'rebooting') {
+      update.state = 'rebooting';
+      update.rebootAt = now();
+      downloads.delete(update.token);
+      telemetry?.setRelayGauge('zcc_camera_ota_duration_seconds', { camera: cameraId }, (update.rebootAt - update.startedAt) / 1000);
+      console.log(`🔁 Camera ${cameraId} installed ${update.to} in ${((update.rebootAt - update.startedAt) / 1000).toFixed(1)} s, rebooting`);
+    } else if (msg.state === 'failed') {
+      const error = String(msg.error || 'unknown');
+      finish(cameraId, update, 'failed', error);
+      if (error === 'source' && update.delta) start(cameraId, update.to, { full: true }).catch(() => {});
+    }
+    return true;
+  }
+
+  // The camera is back on its stream; after a reboot, check what it runs
+  function cameraConnected(cameraId) {
+    const update = updates.get(cameraId);
+    if (!update || update.state !== 'rebooting') return;
+    const firmware = activeCameras[cameraId]?.firmware;
+    if (firmware !== update.to) {
+      finish(cameraId, update, 'failed', `came back running ${firmware || 'an unknown version'}`);
+      return;
+    }
+    const downtime = (now() - update.rebootAt) / 1000;
+    finish(cameraId, update, 'done');
+    telemetry?.setRelayGauge('zcc_camera_ota_stream_downtime_seconds', { camera: cameraId }, downtime);
+    console.log(`✅ Camera ${cameraId} runs ${update.to}; stream was down ${downtime.toFixed(1)} s`);
+  }
+
+  function status(cameraId) {
+    const update = updates.get(cameraId);
+    if (!update) return null;
+    const { token, ...rest } = update;
+    return rest;
+  }
+
+  // GET /ota/:token - The download the camera was sent
+  function serveDownload(req, res) {
+    const download = downloads.get(req.params.token);
+    if (!download || download.expiresAt < now()) return res.status(404).json({ error: 'Unknown or expired download.' });
+    res.sendFile(path.resolve(download.file), (err) => {
+      if (err) return;
+      const update = updates.get(download.cameraId);
+      telemetry?.incrementRelay('zcc_relay_ota_bytes_served_total', { kind: update?.delta ? 'delta' : 'full' }, fs.statSync(download.file).size);
+    });
+  }
+
+  return {
+    hasImage,
+    start,
+    handleStatus,
+    cameraConnected,
+    status,
+    serveDownload,
+  };
+}
+
+module.exports = {
+  createOtaUpdates,
+};
@@ -0,0 +1,235 @@
+// Relay overload control
+// Frame fan-out is nearly all of the relay's work. When it outgrows one core
+// everything else queues behind it: heartbeat pongs wait behind frames on the
+// camera's socket and healthy cameras are terminated, control messages and
+// REST requests time out. Every intervalMs the relay measures the event loop's
+// delay (p99 over the interval) and utilization, and the bytes queued on
+// dashboard sockets. It moves up one level when the loop is both late (over
+// lagHighMs) and busy (over calmUtilization) - a late loop that is mostly idle
+// had one long task, which shedding frames would not help - or when the
+// queues of the sockets that are keeping up total over queueHighBytes:
+//   0 normal
+//   1 background viewers (dashboards that reported themselves unfocused) get
+//     a frame per camera every backgroundIntervalMs
+//   2 cameras below protectedPriority are delivered at throttleFps and asked
+//     to capture no faster ({ type: 'relay_load', max_fps })
+//   3 the same at criticalFps, and new main/H.264 viewers are refused, so
+//     dashboards fall back to the substream
+// It steps back down a level once the loop has been busy less than
+// calmUtilization of the time for calmIntervals rounds in a row (loop delay
+// alone stays high on a busy but keeping-up relay). A level that had to be
+// re-entered soon after stepping down waits twice as long the next time.
+// Sockets with more than maxQueuedBytes waiting to be sent are slow at any
+// level and get the background rate until half of that has drained; they
+// would only receive stale frames.
+// Only frames are shed. Control messages, heartbeats, telemetry, clock probes
+// and event clips are never touched; shedding frames is what leaves the loop
+// time for them.
+const { monitorEventLoopDelay, performance } = require('perf_hooks');
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const BACKGROUND_ROOM = 'viewers:background';
+const SLOW_ROOM = 'viewers:slow';
+const LEVELS = ['normal', 'background', 'throttle', 'critical'];
+const MAX_LEVEL = LEVELS.length - 1;
+const LOOP_DELAY_RESOLUTION_MS = 10;
+const MAX_CALM_FACTOR = 16; // Longest wait before stepping down, in calmIntervals
+
+// Bytes written to a dashboard socket and not yet sent; polling transports report 0
+function queuedBytes(socket) {
+  return socket.conn?.transport?.socket?.bufferedAmount || 0;
+}
+
+function createOverloadControl(io, activeCameras, { telemetry, settings = config.overload, now = Date.now } = {}) {
+  const cameras = new Map(); // cameraId -> { priority, nextFrameAt, sentFps, backgroundAt }
+  const loopDelay = monitorEventLoopDelay({ resolution: LOOP_DELAY_RESOLUTION_MS });
+  let level = 0;
+  let calm = 0; // calm rounds in a row
+  let calmNeeded = settings.calmIntervals;
+  let sinceStepDown = Infinity; // rounds
+  let utilization = 0;
+  let loopUsage = performance.eventLoopUtilization();
+  let lagMs = 0;
+  let queued = 0;
+  let timer = null;
+
+  function protectedCamera(camera) {
+    return camera.priority >= settings.protectedPriority;
+  }
+
+  // Delivery rate cap for unprotected cameras at the current level; 0 for none
+  function throttleFps() {
+    if (level >= 3) return settings.criticalFps;
+    if (level >= 2) return settings.throttleFps;
+    return 0;
+  }
+
+  function signal(cameraId, camera) {
+    const fps = protectedCamera(camera) ? 0 : throttleFps();
+    if (fps === camera.sentFps) return;
+    const ws = activeCameras[cameraId]?.ws;
+    if (!ws || ws.readyState !== 1) return;
+    camera.sentFps = fps;
+    ws.send(JSON.stringify({ type: 'relay_load', max_fps: fps }));
+  }
+
+  function cameraConnected(cameraId, { priority = 1 } = {}) {
+    const camera = { priority, nextFrameAt: 0, sentFps: 0, backgroundAt: 0 };
+    cameras.set(cameraId, camera);
+    signal(cameraId, camera);
+  }
+
+  function cameraDisconnected(cameraId) {
+    cameras.delete(cameraId);
+  }
+
+  function setPriority(cameraId, priority) {
+    const camera = cameras.get(cameraId);
+    if (!camera) return;
+    camera.priority = priority;
+    signal(cameraId, camera);
+  }
+
+  // Dashboard focus, as reported by the page ('viewer-state')
+  function setBackground(socket, background) {
+    if (background) socket.join(BACKGROUND_ROOM);
+    else socket.leave(BACKGROUND_ROOM);
+  }
+
+  /**
+   * Whether a camera frame is delivered to viewers (here and on other nodes)
+   * @param {string} cameraId
+   * @param {Buffer} buf - Raw WebSocket payload, as given to streamProfiles.routeFrame
+   * @returns {boolean} false when the camera's delivery rate is being throttled
+   */
+  function admitFrame(cameraId, buf) {
+    const fps = throttleFps();
+    const camera = cameras.get(cameraId);
+    if (!fps || !camera || protectedCamera(camera)) return true;
+    const { profile, preroll } = parseFrame(buf);
+    if (profile !== 'main' || preroll) return true;
+    const t = now();
+    if (t < camera.nextFrameAt) {
+      telemetry?.incrementRelay('zcc_relay_frames_shed_total', { reason: 'throttle' }, 1);
+      return false;
+    }
+    // Keeps the average at fps when frames arrive a little early or late
+    const interval = 1000 / fps;
+    camera.nextFrameAt = Math.max(camera.nextFrameAt + interval, t - interval);
+    return true;
+  }
+
+  /**
+   * Rooms whose sockets skip this frame of the camera, or null to deliver to all
+   * Background and slow viewers still get one frame every backgroundIntervalMs
+   */
+  function excludedRooms(cameraId) {
+    const camera = cameras.get(cameraId);
+    const t = now();
+    if (!camera || t - camera.backgroundAt >= settings.backgroundIntervalMs) {
+      if (camera) camera.backgroundAt = t;
+      return null;
+    }
+    return level >= 1 ? [SLOW_ROOM, BACKGROUND_ROOM] : [SLOW_ROOM];
+  }
+
+  // Record frames not delivered to background and slow viewers (counted by the caller)
+  function countShed(recipients) {
+    if (recipients > 0) telemetry?.incrementRelay('zcc_relay_frames_shed_total', { reason: 'viewer' }, recipients);
+  }
+
+  // New viewers of the expensive profiles are refused at the critical level
+  function admitViewer(profile) {
+    return level < 3 || profile === null || profile === 'sub';
+  }
+
+  function setLevel(next) {
+    if (next === level) return;
+    console.log(
+      `${next > level ? '🔥' : '🧊'} Relay load: ${LEVELS[level]} -> ${LEVELS[next]} ` +
+        `(loop delay ${lagMs.toFixed(0)} ms, ${(utilization * 100).toFixed(0)}% busy, ${(queued / 1048576).toFixed(1)} MB queued)`
+    );
+    level = next;
+    for (const [cameraId, camera] of cameras) signal(cameraId, camera);
+  }
+
+  // One measurement round; runs every settings.intervalMs
+  function evaluate() {
+    lagMs = loopDelay.count ? loopDelay.percentile(99) / 1e6 : 0;
+    loopDelay.reset();
+    const usage = performance.eventLoopUtilization();
+    utilization = performance.eventLoopUtilization(usage, loopUsage).utilization;
+    loopUsage = usage;
+    queued = 0;
+    let slowQueued = 0; // Already shed; more shedding would not drain it
+    for (const socket of io.sockets.sockets.values()) {
+      const bytes = queuedBytes(socket);
+      if (bytes > settings.maxQueuedBytes) socket.join(SLOW_ROOM);
+      else if (bytes < settings.maxQueuedBytes / 2) socket.leave(SLOW_ROOM);
+      if (socket.rooms.has(SLOW_ROOM)) slowQueued += bytes;
+      else queued += bytes;
+    }
+
+    sinceStepDown++;
+    if ((lagMs > settings.lagHighMs && utilization > settings.calmUtilization) || queued > settings.queueHighBytes) {
+      calm = 0;
+      if (level < MAX_LEVEL && sinceStepDown <= calmNeeded) {
+        calmNeeded = Math.min(calmNeeded * 2, settings.calmIntervals * MAX_CALM_FACTOR);
+      }
+      setLevel(Math.min(level + 1, MAX_LEVEL));
+    } else if (utilization < settings.calmUtilization && queued < settings.queueHighBytes / 2) {
+      calm++;
+      if (level > 0 && calm >= calmNeeded) {
+        calm = 0;
+        sinceStepDown = 0;
+        setLevel(level - 1);
+      } else if (level === 0 && calm >= calmNeeded) {
+        calmNeeded = settings.calmIntervals; // Settled
+      }
+    } else {
+      calm = 0;
+    }
+    telemetry?.setRelayGauge('zcc_relay_overload_level', {}, level);
+    telemetry?.setRelayGauge('zcc_relay_event_loop_delay_ms', {}, lagMs);
+    telemetry?.setRelayGauge('zcc_relay_event_loop_utilization', {}, utilization);
+    telemetry?.setRelayGauge('zcc_relay_dashboard_queued_bytes', { viewers: 'keeping_up' }, queued);
+    telemetry?.setRelayGauge('zcc_relay_dashboard_queued_bytes', { viewers: 'slow' }, slowQueued);
+  }
+
+  function stats() {
+    return { level, state: LEVELS[level], loopDelayMs: lagMs, utilization, queuedBytes: queued, throttleFps: throttleFps() };
+  }
+
+  function close() {
+    clearInterval(timer);
+    loopDelay.disable();
+  }
+
+  loopDelay.enable();
+  // intervalMs 0 leaves the rounds to the caller
+  if (settings.intervalMs > 0) {
+    timer = setInterval(evaluate, settings.intervalMs);
+    timer.unref?.();
+  }
+
+  return {
+    cameraConnected,
+    cameraDisconnected,
+    setPriority,
+    setBackground,
+    admitFrame,
+    excludedRooms,
+    countShed,
+    admitViewer,
+    evaluate,
+    stats,
+    close,
+  };
+}
+
+module.exports = {
+  BACKGROUND_ROOM,
+  SLOW_ROOM,
+  createOverloadControl,
+};
@@ -1,6 +1,7 @@
 const jwt = require('jsonwebtoken');
+const { performance } = require('perf_hooks');
 
-function initializeSocketIo(io, activeCameras) {
+function initializeSocketIo(io, activeCameras, { streamProfiles, mosaics, cluster, overload } = {}) {
   // Middleware for authenticating socket connections
   io.use((socket, next) => {
     const token = socket.handshake.auth.token;
@@ -22,10 +23,16 @@ function initializeSocketIo(io, activeCameras) {
     for (const cameraId in activeCameras) {
       if (activeCameras[cameraId].userId === userId) {
         const cam = activeCameras[cameraId];
-        socket.emit('cameraStatusUpdate', { cameraId, status: cam.status, name: cam.name });
+        socket.emit('cameraStatusUpdate', { cameraId, status: cam.status, name: cam.name, lan: cam.lan });
       }
     }
 
+    // Dashboard clock estimate: the relay's time (epoch ms) for the dashboard
+    // to line up capture times with its own clock (see dashboard/playout.js)
+    socket.on('clockSync', (ack) => {
+      if (typeof ack === 'function') ack(performance.timeOrigin + performance.now());
+    });
+
     // Handle request for pending cameras
     socket.on('getPendingCameras', () => {
       const pendingCameras = Object.entries(activeCameras)
@@ -60,8 +67,9 @@ function initializeSocketIo(io, activeCameras) {
         return;
       }
 
-      // Check if camera WebSocket is available
-      if (!camera.ws || camera.ws.readyState !== 1) {
+      // Check if camera WebSocket is available (here or on another relay node)
+      const remote = Boolean(camera.node && cluster);
+      if (!remote && (!camera.ws || camera.ws.readyState !== 1)) {
         console.log(`❌ Camera ${cameraId} WebSocket not available for control (readyState: ${camera.ws?.readyState})`);
         socket.emit('camera-control-error', { cameraId, error: 'Camera not connected. Please wait for camera to reconnect.' });
         return;
@@ -78,8 +86,9 @@ function initializeSocketIo(io, activeCameras) {
           message = JSON.stringify({ type: command, ...settings });
         }
 
-        console.log(`📤 Sending control message to camera ${cameraId}:`, message);
-        camera.ws.send(message);
+        console.log(`📤 Sending control message to camera ${cameraId}${remote ? ` via node ${camera.node}` : ''}:`, message);
+        if (remote) cluster.sendToCamera(cameraId, message);
+        else camera.ws.send(message);
 
         // Acknowledge to dashboard
         socket.emit('camera-control-sent', { cameraId, command, settings, timestamp: Date.now() });
@@ -89,8 +98,40 @@ function initializeSocketIo(io, activeCameras) {
       }
     });
 
+    // Choose which stream profile this client receives for a camera
+    // ('main' full resolution, 'sub' low-res grid tile, null for none)
+    socket.on('stream-profile', (data = {}) => {
+      const { cameraId, profile = null } = data;
+      // An overloaded relay takes no new full-resolution viewers; the dashboard falls back to the substream
+      if (overload && !overload.admitViewer(profile)) {
+        socket.emit('stream-profile-rejected', { cameraId, profile, reason: 'overloaded' });
+        return;
+      }
+      if (!streamProfiles?.setViewerProfile(socket, cameraId, profile)) {
+        console.log(`❌ Rejected stream profile '${profile}' for camera ${cameraId} from user ${socket.user.id}`);
+        socket.emit('stream-profile-rejected', { cameraId, profile });
+      }
+    });
+
+    // Whether the dashboard has focus; unfocused ones are shed first under load
+    socket.on('viewer-state', (data = {}) => {
+      overload?.setBackground(socket, data.background);
+    });
+
+    // Grid view as one composited stream: { cameras: [...], columns }
+    socket.on('mosaic-subscribe', (layout, ack) => {
+      const key = mosaics?.subscribe(socket, layout) || null;
+      if (typeof ack === 'function') ack({ key });
+    });
+
+    socket.on('mosaic-unsubscribe', () => {
+      mosaics?.unsubscribe(socket);
+    });
+
     socket.on('disconnect', () => {
       console.log(`Dashboard client disconnected: ${socket.id}`);
+      streamProfiles?.removeViewer(socket);
+      mosaics?.unsubscribe(socket);
     });
   });
 }
@@ -0,0 +1,140 @@
+// Wire-level capture of camera WebSocket sessions
+// Records the bytes a camera sends after the HTTP upgrade exactly as they
+// arrive on the socket (WebSocket frame headers, masking and TCP chunking
+// included) with their arrival times, so tools/replay-capture.js can play a
+// session back into a relay with the original timing.
+//
+// File layout (big-endian), one session per file:
+//   header: "ZCCCAP" | u8 version | u8 reserved | u64 start (epoch ms)
+//           | u16 id length | camera id (utf8)
+//   record: u64 offset since session start (us) | u32 length | bytes
+const fs = require('fs');
+const path = require('path');
+
+const CAPTURE_MAGIC = Buffer.from('ZCCCAP');
+const CAPTURE_VERSION = 1;
+const RECORD_HEADER_SIZE = 12;
+
+function encodeHeader(cameraId, startMs) {
+  const id = Buffer.from(cameraId, 'utf8');
+  const header = Buffer.alloc(CAPTURE_MAGIC.length + 12 + id.length);
+  CAPTURE_MAGIC.copy(header, 0);
+  let off = CAPTURE_MAGIC.length;
+  header.writeUInt8(CAPTURE_VERSION, off);
+  header.writeBigUInt64BE(BigInt(startMs), off + 2);
+  header.writeUInt16BE(id.length, off + 10);
+  id.copy(header, off + 12);
+  return header;
+}
+
+function encodeRecord(offsetUs, chunk) {
+  const head = Buffer.alloc(RECORD_HEADER_SIZE);
+  head.writeBigUInt64BE(offsetUs, 0);
+  head.writeUInt32BE(chunk.length, 8);
+  return head;
+}
+
+/**
+ * Parse a capture file
+ * @param {Buffer} buf - Whole file contents
+ * @returns {{cameraId: string, startMs: number, records: {offsetUs: number, data: Buffer}[], truncated: boolean}}
+ */
+function readCapture(buf) {
+  if (buf.length < CAPTURE_MAGIC.length + 12 || !buf.subarray(0, CAPTURE_MAGIC.length).equals(CAPTURE_MAGIC)) {
+    throw new Error('Not a camera capture file');
+  }
+  let off = CAPTURE_MAGIC.length;
+  const version = buf.readUInt8(off);
+  if (version !== CAPTURE_VERSION) throw new Error(`Unsupported capture version ${version}`);
+  const startMs = Number(buf.readBigUInt64BE(off + 2));
+  const idLength = buf.readUInt16BE(off + 10);
+  off += 12;
+  const cameraId = buf.toString('utf8', off, off + idLength);
+  off += idLength;
+
+  const records = [];
+  let truncated = false;
+  while (off < buf.length) {
+    if (off + RECORD_HEADER_SIZE > buf.length) {
+      truncated = true;
+      break;
+    }
+    const offsetUs = Number(buf.readBigUInt64BE(off));
+    const length = buf.readUInt32BE(off + 8);
+    off += RECORD_HEADER_SIZE;
+    if (off + length > buf.length) {
+      // Relay stopped mid-write; keep what is complete
+      truncated = true;
+      break;
+    }
+    records.push({ offsetUs, data: buf.subarray(off, off + length) });
+    off += length;
+  }
+  return { cameraId, startMs, records, truncated };
+}
+
+/**
+ * Capture sessions of selected cameras into settings.dir
+ * @param {{dir: string, cameras: string[], maxBytes: number}} settings - Empty dir disables capture
+ */
+function createStreamCapture(settings) {
+  const enabled = Boolean(settings.dir);
+  if (enabled) fs.mkdirSync(settings.dir, { recursive: true });
+
+  function wants(cameraId) {
+    return enabled && (settings.cameras.length === 0 || settings.cameras.includes(cameraId));
+  }
+
+  /**
+   * Start recording an upgraded camera socket
+   * Call in the same tick as wss.handleUpgrade so no chunk is missed; bytes the
+   * HTTP parser read past the upgrade are unshifted by ws and arrive as data.
+   */
+  function attach(cameraId, socket) {
+    if (!wants(cameraId)) return;
+    const startMs = Date.now();
+    const start = process.hrtime.bigint();
+    const file = path.join(settings.dir, `${cameraId.replace(/[^\w.-]/g, '_')}-${startMs}.zcap`);
+    const out = fs.createWriteStream(file);
+    let written = 0;
+    let stopped = false;
+
+    out.on('error', (err) => {
+      console.error(`❌ Capture for camera ${cameraId} failed:`, err.message);
+      stop();
+    });
+
+    function record(chunk) {
+      if (stopped) return;
+      if (written + RECORD_HEADER_SIZE + chunk.length > settings.maxBytes) {
+        console.warn(`⚠️ Capture for camera ${cameraId} reached ${settings.maxBytes} bytes, stopping`);
+        return stop();
+      }
+      const offsetUs = (process.hrtime.bigint() - start) / 1000n;
+      out.write(encodeRecord(offsetUs, chunk));
+      out.write(chunk);
+      written += RECORD_HEADER_SIZE + chunk.length;
+    }
+
+    function stop() {
+      if (stopped) return;
+      stopped = true;
+      socket.removeListener('data', record);
+      out.end();
+      console.log(`🎞️ Capture for camera ${cameraId} closed: ${file} (${written} bytes)`);
+    }
+
+    out.write(encodeHeader(cameraId, startMs));
+    socket.on('data', record);
+    socket.once('close', stop);
+    console.log(`🎞️ Capturing camera ${cameraId} to ${file}`);
+  }
+
+  return { attach };
+}
+
+module.exports = {
+  CAPTURE_MAGIC,
+  readCapture,
+  createStreamCapture,
+};
@@ -0,0 +1,312 @@
+// Dual-profile stream routing
+// Cameras produce a full-resolution main stream and, on request, a low-res
+// substream (binary message type 0xA1, see websocket_send_substream in
+// ESP/ESP32_S3.c). Each dashboard socket picks a profile per camera and joins
+// the matching socket.io room; the relay tells every camera which profiles
+// currently have viewers so it only encodes what someone is watching.
+// The 'h264' profile is produced by the relay itself (see transcoder.js) from
+// the main stream. A camera nobody watches is told to turn both profiles off
+// and only sends an occasional snapshot. The latest frame of each profile is
+// cached so a new viewer, or a dashboard tile scrolled back into view, gets a
+// first frame immediately.
+// When the relay asks for it (capture_time in stream_profiles) the camera tags
+// every frame with its capture time (0xA2 timed frame); it is passed to the
+// dashboard as captureTs so tiles can pace playout by capture spacing.
+// Pre-roll frames (0xA3, same layout) are the buffered seconds before an event,
+// uploaded in a burst; they go to the event clip writer (eventClips.js), never
+// to live viewers.
+// Once clockSync.js has synchronised a camera, its capture times are in server
+// time (flag CAPTURE_CLOCK_SERVER on the profile byte) and parseFrame widens
+// them back to full epoch ms, so frames of different cameras line up.
+// Slow dashboards, and while the relay is overloaded (overload.js) background
+// ones, are left out of most frames.
+const config = require('../config/app-config.js');
+
+const MSG_TYPE_PROFILE_FRAME = 0xa1;
+const MSG_TYPE_TIMED_FRAME = 0xa2; // u8 profile id, u32 capture ms (camera clock, LE), JPEG
+const MSG_TYPE_PREROLL_FRAME = 0xa3; // as 0xA2, from the camera's pre-event ring
+const TIMED_FRAME_HEADER_SIZE = 6;
+const CAPTURE_CLOCK_SERVER = 0x80; // Profile byte flag: capture ms is server time, low 32 bits
+const U32 = 2 ** 32;
+const PROFILES = ['main', 'sub', 'h264'];
+const PROFILE_BY_ID = ['main', 'sub'];
+
+function profileRoom(cameraId, profile) {
+  return `cam:${cameraId}:${profile}`;
+}
+
+function isProfileFrame(buf) {
+  return buf.length > 2 && buf[0] === MSG_TYPE_PROFILE_FRAME;
+}
+
+// Epoch ms nearest to now whose low 32 bits are low32
+function widenServerMs(low32, now = Date.now()) {
+  let diff = (now - low32) % U32;
+  if (diff > U32 / 2) diff -= U32;
+  return now - diff;
+}
+
+/**
+ * Split a camera's binary frame message into profile, JPEG and capture time
+ * @param {Buffer} buf - Raw WebSocket payload: bare main JPEG, 0xA1, 0xA2 or 0xA3 frame
+ * @returns {{profile: string|undefined, jpeg: Buffer, captureMs: number|null, preroll: boolean, serverClock: boolean}}
+ *   profile is undefined for an unknown profile id; captureMs is epoch ms when
+ *   serverClock, else ms since the camera booted
+ */
+function parseFrame(buf) {
+  if (isProfileFrame(buf)) {
+    return { profile: PROFILE_BY_ID[buf[1]], jpeg: buf.subarray(2), captureMs: null, preroll: false, serverClock: false };
+  }
+  if (buf.length > TIMED_FRAME_HEADER_SIZE && (buf[0] === MSG_TYPE_TIMED_FRAME || buf[0] === MSG_TYPE_PREROLL_FRAME)) {
+    const serverClock = (buf[1] & CAPTURE_CLOCK_SERVER) !== 0;
+    const captureMs = buf.readUInt32LE(2);
+    return {
+      profile: PROFILE_BY_ID[buf[1] & ~CAPTURE_CLOCK_SERVER],
+      jpeg: buf.subarray(TIMED_FRAME_HEADER_SIZE),
+      captureMs: serverClock ? widenServerMs(captureMs) : captureMs,
+      preroll: buf[0] === MSG_TYPE_PREROLL_FRAME,
+      serverClock,
+    };
+  }
+  return { profile: 'main', jpeg: buf, captureMs: null, preroll: false, serverClock: false };
+}
+
+function createStreamProfiles(io, activeCameras, { telemetry, transcoder, overload } = {}) {
+  // socket.id -> Map(cameraId -> profile)
+  const viewers = new Map();
+  // cameraId -> { main, sub } last sent to the camera
+  const announced = new Map();
+  // cameraId -> time of the last substream frame, for cameras that never send one
+  const lastSubFrameAt = new Map();
+  // cameraId -> { main, sub } latest JPEG per profile and when it arrived, shown
+  // to new viewers while the camera ramps up
+  const lastFrames = new Map();
+  // cameraId -> { profile: count } for relay-side consumers such as mosaics
+  const internalDemand = new Map();
+  const frameListeners = [];
+  const demandListeners = [];
+
+  function roomSize(room) {
+    return io.sockets.adapter.rooms.get(room)?.size || 0;
+  }
+
+  function demand(cameraId) {
+    const main = roomSize(profileRoom(cameraId, 'main'));
+    const sub = roomSize(profileRoom(cameraId, 'sub'));
+    const h264 = roomSize(profileRoom(cameraId, 'h264'));
+    const internal = internalDemand.get(cameraId) || {};
+    return { main: main > 0 || h264 > 0 || internal.main > 0, sub: sub > 0 || internal.sub > 0, h264: h264 > 0 };
+  }
+
+  // Tell the camera which profiles to produce; only sends on change unless forced
+  function sync(cameraId, force = false) {
+    const { main, sub, h264 } = demand(cameraId);
+    transcoder?.setDemand(cameraId, h264);
+    for (const listener of demandListeners) listener(cameraId, { main, sub });
+
+    const camera = activeCameras[cameraId];
+    if (!camera?.ws || camera.ws.readyState !== 1) return;
+
+    const wanted = { main, sub };
+    const previous = announced.get(cameraId);
+    if (!force && previous && previous.main === wanted.main && previous.sub === wanted.sub) return;
+
+    announced.set(cameraId, wanted);
+    camera.ws.send(JSON.stringify({ type: 'stream_profiles', ...wanted, capture_time: true }));
+    console.log(`🎚️ Camera ${cameraId} profiles: main=${wanted.main} sub=${wanted.sub}`);
+  }
+
+  /**
+   * Select the profile a dashboard socket receives for a camera
+   * @param {Socket} socket - Authenticated dashboard socket
+   * @param {string} cameraId - Camera to watch
+   * @param {string|null} profile - 'main', 'sub', 'h264', or null to stop receiving
+   * @returns {boolean} false if the camera is not the user's or the profile is unavailable
+   */
+  function setViewerProfile(socket, cameraId, profile) {
+    const camera = activeCameras[cameraId];
+    if (!camera || String(camera.userId) !== String(socket.user.id)) return false;
+    if (profile !== null && !PROFILES.includes(profile)) return false;
+    if (profile === 'h264' && !transcoder?.canStart(cameraId)) return false;
+
+    let selections = viewers.get(socket.id);
+    if (!selections) {
+      selections = new Map();
+      viewers.set(socket.id, selections);
+    }
+    if ((selections.get(cameraId) || null) === profile) return true;
+
+    for (const p of PROFILES) socket.leave(profileRoom(cameraId, p));
+    if (profile) {
+      socket.join(profileRoom(cameraId, profile));
+      selections.set(cameraId, profile);
+    } else {
+      selections.delete(cameraId);
+    }
+    sync(cameraId);
+    if (profile === 'h264') {
+      transcoder.sendInit(socket, cameraId);
+    } else if (profile) {
+      sendCachedFrame(socket, cameraId);
+    }
+    return true;
+  }
+
+  // Newest cached frame of either profile; a recent substream frame beats a
+  // main frame from before the camera switched profiles, and vice versa
+  function sendCachedFrame(socket, cameraId) {
+    const cached = lastFrames.get(cameraId);
+    if (!cached) return;
+    const newest = ['main', 'sub'].reduce((best, p) => (cached[p] && (!best || cached[p].at > best.at) ? cached[p] : best), null);
+    if (!newest) return;
+    socket.emit('stream', {
+      cameraId,
+      profile: newest.profile,
+      frame: newest.frame,
+      frameType: 'binary',
+      frameSize: newest.frame.length,
+      timestamp: Date.now(),
+      cached: true,
+    });
+  }
+
+  // Dashboards watching a camera in any profile plus relay-side consumers
+  function viewerCount(cameraId) {
+    const internal = Object.values(internalDemand.get(cameraId) || {}).reduce((sum, n) => sum + Math.max(0, n), 0);
+    return PROFILES.reduce((sum, p) => sum + roomSize(profileRoom(cameraId, p)), internal);
+  }
+
+  // Register or release demand from inside the relay (delta +1 / -1)
+  function addDemand(cameraId, profile, delta) {
+    const internal = internalDemand.get(cameraId) || {};
+    internal[profile] = (internal[profile] || 0) + delta;
+    internalDemand.set(cameraId, internal);
+    sync(cameraId);
+  }
+
+  // Listen to every camera frame: listener(cameraId, profile, jpeg)
+  function onFrame(listener) {
+    frameListeners.push(listener);
+  }
+
+  // Listen to demand recomputations: listener(cameraId, { main, sub }), not deduplicated
+  function onDemand(listener) {
+    demandListeners.push(listener);
+  }
+
+  // socket.io drops the rooms itself; recompute demand for what it watched
+  function removeViewer(socket) {
+    const selections = viewers.get(socket.id);
+    viewers.delete(socket.id);
+    if (!selections) return;
+    for (const cameraId of selections.keys()) sync(cameraId);
+  }
+
+  function cameraConnected(cameraId) {
+    announced.delete(cameraId);
+    lastSubFrameAt.delete(cameraId);
+    sync(cameraId, true);
+  }
+
+  function cameraDisconnected(cameraId) {
+    transcoder?.stop(cameraId);
+    announced.delete(cameraId);
+    lastSubFrameAt.delete(cameraId);
+    lastFrames.delete(cameraId);
+  }
+
+  function cacheFrame(cameraId, profile, frame) {
+    let cached = lastFrames.get(cameraId);
+    if (!cached) {
+      cached = { main: null, sub: null };
+      lastFrames.set(cameraId, cached);
+    }
+    cached[profile] = { profile, frame, at: Date.now() };
+  }
+
+  // Sockets of the rooms that are also in one of the excluded rooms
+  function excludedCount(rooms, excluded) {
+    const members = excluded.map((room) => io.sockets.adapter.rooms.get(room)).filter(Boolean);
+    if (members.length === 0) return 0;
+    return rooms.reduce((n, room) => {
+      for (const id of io.sockets.adapter.rooms.get(room) || []) if (members.some((m) => m.has(id))) n++;
+      return n;
+    }, 0);
+  }
+
+  function emitFrame(rooms, cameraId, profile, frame, frameSize, captureMs, serverClock) {
+    let recipients = rooms.reduce((n, room) => n + roomSize(room), 0);
+    if (recipients === 0) return;
+    let target = io.to(rooms);
+    const excluded = overload?.excludedRooms(cameraId);
+    if (excluded) {
+      const skipped = excludedCount(rooms, excluded);
+      overload.countShed(skipped);
+      recipients -= skipped;
+      if (recipients === 0) return;
+      target = target.except(excluded);
+    }
+    target.emit('stream', {
+      cameraId,
+      profile,
+      frame,
+      frameType: 'binary',
+      frameSize,
+      timestamp: Date.now(),
+      captureTs: captureMs,
+      captureClock: serverClock ? 'server' : 'camera',
+    });
+    telemetry?.incrementRelay('zcc_relay_frames_delivered_total', { profile }, recipients);
+    telemetry?.incrementRelay('zcc_relay_bytes_delivered_total', { profile }, recipients * frameSize);
+  }
+
+  /**
+   * Route one binary frame from a camera to the viewers of its profile
+   * @param {string} cameraId
+   * @param {Buffer} buf - Raw WebSocket payload (main JPEG, 0xA1 profile or 0xA2 timed frame)
+   */
+  function routeFrame(cameraId, buf) {
+    const mainRoom = profileRoom(cameraId, 'main');
+    const subRoom = profileRoom(cameraId, 'sub');
+    const { profile, jpeg, captureMs, preroll, serverClock } = parseFrame(buf);
+    if (!profile || preroll) return;
+
+    cacheFrame(cameraId, profile, jpeg);
+    for (const listener of frameListeners) listener(cameraId, profile, jpeg);
+    if (profile === 'sub') {
+      lastSubFrameAt.set(cameraId, Date.now());
+      emitFrame([subRoom], cameraId, profile, jpeg, jpeg.length, captureMs, serverClock);
+      return;
+    }
+
+    transcoder?.push(cameraId, jpeg);
+
+    // Cameras without substream support keep grid tiles fed from the main stream
+    const subStale = Date.now() - (lastSubFrameAt.get(cameraId) || 0) > config.camera.substreamFallbackMs;
+    emitFrame(subStale ? [mainRoom, subRoom] : [mainRoom], cameraId, 'main', jpeg, jpeg.length, captureMs, serverClock);
+  }
+
+  return {
+    setViewerProfile,
+    removeViewer,
+    addDemand,
+    onFrame,
+    onDemand,
+    cameraConnected,
+    cameraDisconnected,
+    routeFrame,
+    demand,
+    viewerCount,
+  };
+}
+
+module.exports = {
+  MSG_TYPE_PROFILE_FRAME,
+  MSG_TYPE_TIMED_FRAME,
+  MSG_TYPE_PREROLL_FRAME,
+  CAPTURE_CLOCK_SERVER,
+  profileRoom,
+  isProfileFrame,
+  parseFrame,
+  createStreamProfiles,
+};
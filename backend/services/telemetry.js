@@ -0,0 +1,359 @@
+// Camera telemetry decoding and fleet aggregation
+// Cameras send a compact binary telemetry message (type 0xA0) over their
+// streaming WebSocket every few seconds. Layout mirrors build_telemetry_message
+// in ESP/ESP32_S3.c (little endian, versions 1 and 2; version 2 adds the
+// radio modes: time, awake time, frames, bytes and latency per mode).
+
+const TELEMETRY_MSG_TYPE = 0xa0;
+const TELEMETRY_VERSION = 2;
+// Fixed part up to the histograms: 4 u8, 12 u32, i8 rssi, u8 task_count
+const TELEMETRY_HEADER_SIZE = 4 * 1 + 12 * 4 + 2 * 1;
+const TASK_NAME_LEN = 12;
+const RADIO_MODE_SIZE = 6 * 4;
+
+const STAGE_NAMES = ['capture', 'send', 'frame', 'connect', 'tls_handshake'];
+const RADIO_MODES = ['stream', 'burst', 'idle'];
+
+// Camera histogram buckets are log2 milliseconds: <1, <2, <4 ... up to an open last bucket
+function bucketUpperBoundsMs(bucketCount) {
+  const bounds = [];
+  for (let i = 0; i < bucketCount - 1; i++) bounds.push(2 ** i);
+  return bounds;
+}
+
+function isTelemetryMessage(buf) {
+  return buf.length >= TELEMETRY_HEADER_SIZE && buf[0] === TELEMETRY_MSG_TYPE;
+}
+
+/**
+ * Decode a telemetry message
+ * @param {Buffer} buf - Raw WebSocket payload starting with the type byte
+ * @returns {object|null} - Decoded sample, or null if malformed
+ */
+function decodeTelemetry(buf) {
+  const version = buf[1];
+  if (!isTelemetryMessage(buf) || version < 1 || version > TELEMETRY_VERSION) return null;
+
+  const stageCount = buf[2];
+  const bucketCount = buf[3];
+  let off = 4;
+  const u32 = () => {
+    const v = buf.readUInt32LE(off);
+    off += 4;
+    return v;
+  };
+
+  const sample = {
+    uptimeMs: u32(),
+    periodMs: u32(),
+    framesCaptured: u32(),
+    framesSent: u32(),
+    invalidFrames: u32(),
+    jpegValidationFailures: u32(),
+    sendFailures: u32(),
+    freeHeap: u32(),
+    minFreeHeap: u32(),
+    freePsram: u32(),
+    minFreePsram: u32(),
+    streamStackHighWater: u32(),
+    rssi: buf.readInt8(off),
+    stages: {},
+    tasks: [],
+    radio: null,
+  };
+  const taskCount = buf[off + 1];
+  off += 2;
+
+  const needed = off + stageCount * bucketCount * 2 + stageCount * 4 + taskCount * (TASK_NAME_LEN + 2);
+  if (buf.length < needed) return null;
+
+  for (let s = 0; s < stageCount; s++) {
+    const counts = [];
+    for (let b = 0; b < bucketCount; b++) {
+      counts.push(buf.readUInt16LE(off));
+      off += 2;
+    }
+    sample.stages[STAGE_NAMES[s] || `stage${s}`] = { counts, sumMs: 0 };
+  }
+  for (let s = 0; s < stageCount; s++) {
+    sample.stages[STAGE_NAMES[s] || `stage${s}`].sumMs = u32();
+  }
+  for (let t = 0; t < taskCount; t++) {
+    const raw = buf.subarray(off, off + TASK_NAME_LEN);
+    const nul = raw.indexOf(0);
+    const name = raw.subarray(0, nul === -1 ? TASK_NAME_LEN : nul).toString('latin1');
+    sample.tasks.push({ name, cpuPermille: buf.readUInt16LE(off + TASK_NAME_LEN) });
+    off += TASK_NAME_LEN + 2;
+  }
+  if (version >= 2) {
+    if (buf.length < off + 2 || buf.length < off + 2 + buf[off] * RADIO_MODE_SIZE) return null;
+    const modeCount = buf[off];
+    sample.radio = { mode: RADIO_MODES[buf[off + 1]] || `mode${buf[off + 1]}`, modes: {} };
+    off += 2;
+    for (let m = 0; m < modeCount; m++) {
+      sample.radio.modes[RADIO_MODES[m] || `mode${m}`] = {
+        timeMs: u32(),
+        awakeMs: u32(),
+        frames: u32(),
+        bytes: u32(),
+        latencySumMs: u32(),
+        latencyMaxMs: u32(),
+      };
+    }
+  }
+  sample.bucketBoundsMs = bucketUpperBoundsMs(bucketCount);
+  return sample;
+}
+
+function escapeLabel(value) {
+  return String(value).replace(/\\/g, '\\\\').replace(/"/g, '\\"').replace(/\n/g, '\\n');
+}
+
+/**
+ * Create a telemetry store that aggregates samples per camera and renders
+ * them in the Prometheus text exposition format
+ */
+function createTelemetryStore() {
+  // { cameraId: { latest, receivedAt, histograms: { stage: { counts, sumMs, count } }, radio: { mode: totals } } }
+  const cameras = new Map();
+  // Relay-side counters and gauges: { name: Map(labelString -> value) }
+  const relayCounters = new Map();
+  const relayGauges = new Map();
+
+  function record(cameraId, sample) {
+    let entry = cameras.get(cameraId);
+    if (!entry) {
+      entry = { latest: null, receivedAt: 0, samples: 0, histograms: {}, radio: {} };
+      cameras.set(cameraId, entry);
+    }
+    entry.latest = sample;
+    entry.receivedAt = Date.now();
+    entry.samples++;
+
+    // Camera histograms are per period; accumulate them into cumulative ones
+    for (const [stage, { counts, sumMs }] of Object.entries(sample.stages)) {
+      let hist = entry.histograms[stage];
+      if (!hist || hist.counts.length !== counts.length) {
+        hist = { counts: new Array(counts.length).fill(0), sumMs: 0, count: 0 };
+        entry.histograms[stage] = hist;
+      }
+      for (let i = 0; i < counts.length; i++) {
+        hist.counts[i] += counts[i];
+        hist.count += counts[i];
+      }
+      hist.sumMs += sumMs;
+    }
+
+    // Radio modes are per period too
+    for (const [mode, period] of Object.entries(sample.radio?.modes || {})) {
+      let totals = entry.radio[mode];
+      if (!totals) {
+        totals = { timeMs: 0, awakeMs: 0, frames: 0, bytes: 0, latencySumMs: 0, latencyMaxMs: 0 };
+        entry.radio[mode] = totals;
+      }
+      totals.timeMs += period.timeMs;
+      totals.awakeMs += period.awakeMs;
+      totals.frames += period.frames;
+      totals.bytes += period.bytes;
+      totals.latencySumMs += period.latencySumMs;
+      totals.latencyMaxMs = Math.max(totals.latencyMaxMs, period.latencyMaxMs);
+    }
+  }
+
+  // Decode and record a raw message; returns the sample or null
+  function ingest(cameraId, buf) {
+    const sample = decodeTelemetry(buf);
+    if (sample) record(cameraId, sample);
+    return sample;
+  }
+
+  function labelKey(labels) {
+    return Object.entries(labels)
+      .map(([k, v]) => `${k}="${escapeLabel(v)}"`)
+      .join(',');
+  }
+
+  function incrementRelay(name, labels = {}, by = 1) {
+    let series = relayCounters.get(name);
+    if (!series) {
+      series = new Map();
+      relayCounters.set(name, series);
+    }
+    const key = labelKey(labels);
+    series.set(key, (series.get(key) || 0) + by);
+  }
+
+  // Latest value of a relay-side gauge; null removes the series
+  function setRelayGauge(name, labels = {}, value) {
+    let series = relayGauges.get(name);
+    if (!series) {
+      series = new Map();
+      relayGauges.set(name, series);
+    }
+    if (value === null || value === undefined) series.delete(labelKey(labels));
+    else series.set(labelKey(labels), value);
+  }
+
+  // Drop a relay-side counter series, e.g. one labelled with a camera that left
+  function removeRelay(name, labels = {}) {
+    relayCounters.get(name)?.delete(labelKey(labels));
+  }
+
+  function remove(cameraId) {
+    cameras.delete(cameraId);
+  }
+
+  function get(cameraId) {
+    return cameras.get(cameraId) || null;
+  }
+
+  function renderPrometheus(activeCameras = {}) {
+    const lines = [];
+    const metric = (name, type, help) => {
+      lines.push(`# HELP ${name} ${help}`);
+      lines.push(`# TYPE ${name} ${type}`);
+    };
+
+    const gauges = [
+      ['zcc_camera_uptime_seconds', 'gauge', 'Camera uptime', (s) => s.uptimeMs / 1000],
+      ['zcc_camera_frames_captured_total', 'counter', 'Frames captured since boot', (s) => s.framesCaptured],
+      ['zcc_camera_frames_sent_total', 'counter', 'Frames sent since boot', (s) => s.framesSent],
+      ['zcc_camera_invalid_frames_total', 'counter', 'Frames dropped by validation', (s) => s.invalidFrames],
+      ['zcc_camera_jpeg_validation_failures_total', 'counter', 'JPEG validation failures', (s) => s.jpegValidationFailures],
+      ['zcc_camera_send_failures_total', 'counter', 'WebSocket send failures', (s) => s.sendFailures],
+      ['zcc_camera_free_heap_bytes', 'gauge', 'Free internal heap', (s) => s.freeHeap],
+      ['zcc_camera_min_free_heap_bytes', 'gauge', 'Lowest free heap since boot', (s) => s.minFreeHeap],
+      ['zcc_camera_free_psram_bytes', 'gauge', 'Free PSRAM', (s) => s.freePsram],
+      ['zcc_camera_min_free_psram_bytes', 'gauge', 'Lowest free PSRAM since boot', (s) => s.minFreePsram],
+      ['zcc_camera_stream_stack_high_water_bytes', 'gauge', 'Unused stack of the streaming task', (s) => s.streamStackHighWater],
+      ['zcc_camera_wifi_rssi_dbm', 'gauge', 'Wi-Fi RSSI of the associated AP', (s) => s.rssi],
+    ];
+
+    for (const [name, type, help, read] of gauges) {
+      metric(name, type, help);
+      for (const [cameraId, entry] of cameras) {
+        lines.push(`${name}{camera="${escapeLabel(cameraId)}"} ${read(entry.latest)}`);
+      }
+    }
+
+    metric('zcc_camera_task_cpu_ratio', 'gauge', 'Per-task CPU share over the last telemetry period');
+    for (const [cameraId, entry] of cameras) {
+      for (const task of entry.latest.tasks) {
+        lines.push(
+          `zcc_camera_task_cpu_ratio{camera="${escapeLabel(cameraId)}",task="${escapeLabel(task.name)}"} ${task.cpuPermille / 1000}`
+        );
+      }
+    }
+
+    // Radio modes since the camera connected: how much of the time the modem was
+    // kept awake, what went out and how late frames were when they did
+    metric('zcc_camera_radio_mode', 'gauge', 'Current radio mode (1 for the mode in use)');
+    for (const [cameraId, entry] of cameras) {
+      if (!entry.latest.radio) continue;
+      for (const mode of RADIO_MODES) {
+        lines.push(`zcc_camera_radio_mode{camera="${escapeLabel(cameraId)}",mode="${mode}"} ${entry.latest.radio.mode === mode ? 1 : 0}`);
+      }
+    }
+    const radioSeries = [
+      ['zcc_camera_radio_mode_seconds_total', 'counter', 'Time spent in each radio mode', (t) => t.timeMs / 1000],
+      ['zcc_camera_radio_duty_cycle_ratio', 'gauge', 'Share of the time in the mode with modem power save off', (t) => t.awakeMs / t.timeMs],
+      ['zcc_camera_radio_throughput_bits_per_second', 'gauge', 'Frame bytes sent per second in the mode', (t) => (t.bytes * 8000) / t.timeMs],
+      ['zcc_camera_radio_frame_latency_seconds', 'gauge', 'Mean time from capture to sent in the mode', (t) => (t.frames ? t.latencySumMs / t.frames / 1000 : 0)],
+      ['zcc_camera_radio_frame_latency_max_seconds', 'gauge', 'Longest time from capture to sent in the mode', (t) => t.latencyMaxMs / 1000],
+    ];
+    for (const [name, type, help, read] of radioSeries) {
+      metric(name, type, help);
+      for (const [cameraId, entry] of cameras) {
+        for (const [mode, totals] of Object.entries(entry.radio)) {
+          if (totals.timeMs === 0) continue;
+          lines.push(`${name}{camera="${escapeLabel(cameraId)}",mode="${mode}"} ${read(totals)}`);
+        }
+      }
+    }
+
+    // Per-camera and fleet-wide latency histograms
+    const fleet = {};
+    metric('zcc_camera_stage_latency_seconds', 'histogram', 'Per-stage frame latency on the camera');
+    for (const [cameraId, entry] of cameras) {
+      const bounds = entry.latest.bucketBoundsMs;
+      for (const [stage, hist] of Object.entries(entry.histograms)) {
+        const labels = `camera="${escapeLabel(cameraId)}",stage="${stage}"`;
+        lines.push(...renderHistogram('zcc_camera_stage_latency_seconds', labels, bounds, hist));
+
+        let agg = fleet[stage];
+        if (!agg) {
+          agg = { bounds, counts: new Array(hist.counts.length).fill(0), sumMs: 0, count: 0 };
+          fleet[stage] = agg;
+        }
+        if (agg.counts.length === hist.counts.length) {
+          hist.counts.forEach((c, i) => (agg.counts[i] += c));
+          agg.sumMs += hist.sumMs;
+          agg.count += hist.count;
+        }
+      }
+    }
+
+    metric('zcc_fleet_stage_latency_seconds', 'histogram', 'Per-stage frame latency across all cameras');
+    for (const [stage, agg] of Object.entries(fleet)) {
+      lines.push(...renderHistogram('zcc_fleet_stage_latency_seconds', `stage="${stage}"`, agg.bounds, agg));
+    }
+
+    const latest = [...cameras.values()].map((e) => e.latest);
+    const sum = (read) => latest.reduce((acc, s) => acc + read(s), 0);
+    // Cameras connected to other relay nodes are reported by those nodes
+    const statuses = Object.values(activeCameras).filter((c) => !c.node);
+
+    metric('zcc_fleet_cameras', 'gauge', 'Cameras connected to this relay by status');
+    for (const status of ['online', 'pending']) {
+      lines.push(`zcc_fleet_cameras{status="${status}"} ${statuses.filter((c) => c.status === status).length}`);
+    }
+    metric('zcc_fleet_cameras_reporting', 'gauge', 'Cameras with telemetry');
+    lines.push(`zcc_fleet_cameras_reporting ${cameras.size}`);
+    metric('zcc_fleet_frames_captured_total', 'counter', 'Frames captured across reporting cameras');
+    lines.push(`zcc_fleet_frames_captured_total ${sum((s) => s.framesCaptured)}`);
+    metric('zcc_fleet_frames_sent_total', 'counter', 'Frames sent across reporting cameras');
+    lines.push(`zcc_fleet_frames_sent_total ${sum((s) => s.framesSent)}`);
+    metric('zcc_fleet_send_failures_total', 'counter', 'WebSocket send failures across reporting cameras');
+    lines.push(`zcc_fleet_send_failures_total ${sum((s) => s.sendFailures)}`);
+    metric('zcc_fleet_min_free_heap_bytes', 'gauge', 'Lowest heap watermark across reporting cameras');
+    lines.push(`zcc_fleet_min_free_heap_bytes ${latest.length ? Math.min(...latest.map((s) => s.minFreeHeap)) : 0}`);
+
+    for (const [name, series] of relayCounters) {
+      metric(name, 'counter', 'Relay counter');
+      for (const [labels, value] of series) {
+        lines.push(labels ? `${name}{${labels}} ${value}` : `${name} ${value}`);
+      }
+    }
+    for (const [name, series] of relayGauges) {
+      if (series.size === 0) continue;
+      metric(name, 'gauge', 'Relay gauge');
+      for (const [labels, value] of series) {
+        lines.push(labels ? `${name}{${labels}} ${value}` : `${name} ${value}`);
+      }
+    }
+
+    return lines.join('\n') + '\n';
+  }
+
+  return { ingest, record, remove, get, incrementRelay, removeRelay, setRelayGauge, renderPrometheus };
+}
+
+function renderHistogram(name, labels, boundsMs, hist) {
+  const lines = [];
+  let cumulative = 0;
+  for (let i = 0; i < boundsMs.length; i++) {
+    cumulative += hist.counts[i];
+    lines.push(`${name}_bucket{${labels},le="${boundsMs[i] / 1000}"} ${cumulative}`);
+  }
+  lines.push(`${name}_bucket{${labels},le="+Inf"} ${hist.count}`);
+  lines.push(`${name}_sum{${labels}} ${hist.sumMs / 1000}`);
+  lines.push(`${name}_count{${labels}} ${hist.count}`);
+  return lines;
+}
+
+module.exports = {
+  TELEMETRY_MSG_TYPE,
+  isTelemetryMessage,
+  decodeTelemetry,
+  createTelemetryStore,
+};
@@ -0,0 +1,318 @@
+// Time-lapse archives, built while frames are ingested
+// One frame per camera every intervalSeconds (the first frame of each
+// wall-clock slot, so cameras line up) is appended to the camera's archive for
+// the UTC day. The settings.profile stream is used while the camera sends it,
+// else whichever profile it does send; pre-roll frames are left to event
+// clips. Two files per camera and day:
+//   YYYY-MM-DD.mjpeg  the frames as multipart MJPEG parts, ready to send
+//                     (X-Timestamp: capture time, epoch ms)
+//   YYYY-MM-DD.idx    "ZCCTLI" | u8 version | u8 reserved | f64 day start
+//                     (epoch ms), then one 16-byte record per frame:
+//                     u32 ms since day start | u32 part length | f64 part offset
+// (big-endian). A range is found by binary search in the index and read from
+// the archive by offset; nothing is rescanned or re-encoded. The part is
+// written before its index record, so after a crash the archive is cut back to
+// the last indexed part. Today's index is also held in memory.
+const fs = require('fs');
+const path = require('path');
+const { once } = require('events');
+const config = require('../config/app-config.js');
+const { parseFrame } = require('./streamProfiles.js');
+
+const MAGIC = Buffer.from('ZCCTLI');
+const VERSION = 1;
+const HEADER_SIZE = 16;
+const RECORD_SIZE = 16;
+const DAY_MS = 24 * 60 * 60 * 1000;
+const BOUNDARY = 'zccframe';
+const CRLF = Buffer.from('\r\n');
+
+function dayStart(ms) {
+  return ms - (ms % DAY_MS);
+}
+
+function dayName(startMs) {
+  return new Date(startMs).toISOString().slice(0, 10);
+}
+
+function encodeHeader(startMs) {
+  const header = Buffer.alloc(HEADER_SIZE);
+  MAGIC.copy(header, 0);
+  header.writeUInt8(VERSION, MAGIC.length);
+  header.writeDoubleBE(startMs, MAGIC.length + 2);
+  return header;
+}
+
+// First record at or after ms since day start
+function lowerBound(index, count, ms) {
+  let lo = 0;
+  let hi = count;
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1;
+    if (index.readUInt32BE(mid * RECORD_SIZE) < ms) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+function createTimelapse({ telemetry, settings = config.timelapse, now = Date.now } = {}) {
+  const cameras = new Map(); // cameraId -> { day, nextAt, seen: { main, sub } }
+  const intervalMs = settings.intervalSeconds * 1000;
+
+  function cameraDir(cameraId) {
+    return path.join(settings.dir, cameraId.replace(/[^\w-]/g, '_'));
+  }
+
+  function dayFiles(cameraId, startMs) {
+    const base = path.join(cameraDir(cameraId), dayName(startMs));
+    return { data: `${base}.mjpeg`, index: `${base}.idx` };
+  }
+
+  // Index records of a day's file, up to the ones whose parts are complete
+  function readIndex(file, dataSize) {
+    const buf = fs.readFileSync(file);
+    if (buf.length < HEADER_SIZE || !buf.subarray(0, MAGIC.length).equals(MAGIC)) {
+      throw new Error(`${file} is not a time-lapse index`);
+    }
+    let count = Math.floor((buf.length - HEADER_SIZE) / RECORD_SIZE);
+    const records = buf.subarray(HEADER_SIZE, HEADER_SIZE + count * RECORD_SIZE);
+    while (count > 0) {
+      const at = (count - 1) * RECORD_SIZE;
+      if (records.readDoubleBE(at + 8) + records.readUInt32BE(at + 4) <= dataSize) break;
+      count--;
+    }
+    return { records, count };
+  }
+
+  // Open (or create) the camera's archive for the day starting at startMs
+  function openDay(cameraId, startMs) {
+    fs.mkdirSync(cameraDir(cameraId), { recursive: true });
+    const files = dayFiles(cameraId, startMs);
+    let index = Buffer.alloc(RECORD_SIZE * 64);
+    let count = 0;
+    let dataSize = 0;
+    let dataFd;
+    let indexFd;
+    if (fs.existsSync(files.index)) {
+      dataFd = fs.openSync(files.data, fs.existsSync(files.data) ? 'r+' : 'w+');
+      const existing = readIndex(files.index, fs.fstatSync(dataFd).size);
+      count = existing.count;
+      index = Buffer.alloc(Math.max(index.length, count * 2 * RECORD_SIZE));
+      existing.records.copy(index, 0, 0, count * RECORD_SIZE);
+      if (count > 0) dataSize = index.readDoubleBE((count - 1) * RECORD_SIZE + 8) + index.readUInt32BE((count - 1) * RECORD_SIZE + 4);
+      // Drop a part written after the last record
+      fs.ftruncateSync(dataFd, dataSize);
+      indexFd = fs.openSync(files.index, 'r+');
+      fs.ftruncateSync(indexFd, HEADER_SIZE + count * RECORD_SIZE);
+    } else {
+      dataFd = fs.openSync(files.data, 'w+');
+      indexFd = fs.openSync(files.index, 'w+');
+      fs.writeSync(indexFd, encodeHeader(startMs), 0, HEADER_SIZE, 0);
+    }
+    prune(cameraId, startMs);
+    return { startMs, dataFd, indexFd, dataSize, index, count };
+  }
+
+  function closeDay(day) {
+    fs.closeSync(day.dataFd);
+    fs.closeSync(day.indexFd);
+  }
+
+  // Delete the camera's days that are past retentionDays (0 keeps them all)
+  function prune(cameraId, todayMs) {
+    if (!(settings.retentionDays > 0)) return;
+    const oldest = dayName(todayMs - settings.retentionDays * DAY_MS);
+    for (const name of fs.readdirSync(cameraDir(cameraId))) {
+      if (/^\d{4}-\d{2}-\d{2}\.(mjpeg|idx)$/.test(name) && name.slice(0, 10) < oldest) {
+        fs.unlinkSync(path.join(cameraDir(cameraId), name));
+      }
+    }
+  }
+
+  function append(day, jpeg, atMs) {
+    const head = Buffer.from(`--${BOUNDARY}\r\nContent-Type: image/jpeg\r\nContent-Length: ${jpeg.length}\r\nX-Timestamp: ${atMs}\r\n\r\n`);
+    const length = head.length + jpeg.length + CRLF.length;
+    fs.writevSync(day.dataFd, [head, jpeg, CRLF], day.dataSize);
+
+    if ((day.count + 1) * RECORD_SIZE > day.index.length) {
+      const grown = Buffer.alloc(day.index.length * 2);
+      day.index.copy(grown);
+      day.index = grown;
+    }
+    const at = day.count * RECORD_SIZE;
+    day.index.writeUInt32BE(atMs - day.startMs, at);
+    day.index.writeUInt32BE(length, at + 4);
+    day.index.writeDoubleBE(day.dataSize, at + 8);
+    fs.writeSync(day.indexFd, day.index, at, RECORD_SIZE, HEADER_SIZE + at);
+    day.count++;
+    day.dataSize += length;
+    telemetry?.incrementRelay('zcc_relay_timelapse_frames_total', {}, 1);
+    telemetry?.incrementRelay('zcc_relay_timelapse_bytes_total', {}, length + RECORD_SIZE);
+  }
+
+  /**
+   * Every binary frame message from a camera; keeps one per interval
+   * @param {string} cameraId
+   * @param {Buffer} buf - Raw WebSocket payload, as given to streamProfiles.routeFrame
+   */
+  function recordFrame(cameraId, buf) {
+    const t = now();
+    let camera = cameras.get(cameraId);
+    if (!camera) {
+      camera = { day: null, nextAt: 0, seen: { main: -Infinity, sub: -Infinity } };
+      cameras.set(cameraId, camera);
+    }
+    if (t < camera.nextAt) return;
+
+    const { profile, jpeg, captureMs, preroll, serverClock } = parseFrame(buf);
+    if (!profile || preroll) return;
+    camera.seen[profile] = t;
+    if (profile !== settings.profile && t - camera.seen[settings.profile] < 2 * intervalMs) return;
+    camera.nextAt = (Math.floor(t / intervalMs) + 1) * intervalMs;
+
+    const startMs = dayStart(serverClock ? captureMs : t);
+    if (!camera.day || startMs > camera.day.startMs) {
+      try {
+        if (camera.day) closeDay(camera.day);
+        camera.day = openDay(cameraId, startMs);
+      } catch (err) {
+        console.error(`❌ Time-lapse archive for camera ${cameraId}: ${err.message}`);
+        camera.day = null;
+        return;
+      }
+    } else if (startMs < camera.day.startMs) {
+      return; // Late frame from a day already rolled over
+    }
+    const day = camera.day;
+    // Records stay in time order for the binary search
+    const last = day.count > 0 ? day.startMs + day.index.readUInt32BE((day.count - 1) * RECORD_SIZE) : day.startMs;
+    try {
+      append(day, jpeg, Math.max(serverClock ? captureMs : t, last));
+    } catch (err) {
+      console.error(`❌ Time-lapse archive for camera ${cameraId}: ${err.message}`);
+    }
+  }
+
+  // { file, records, count } of one day, or null when nothing was recorded
+  function loadDay(cameraId, startMs) {
+    const today = cameras.get(cameraId)?.day;
+    const files = dayFiles(cameraId, startMs);
+    if (today && today.startMs === startMs) return { file: files.data, records: today.index, count: today.count };
+    if (!fs.existsSync(files.index) || !fs.existsSync(files.data)) return null;
+    return { file: files.data, ...readIndex(files.index, fs.statSync(files.data).size) };
+  }
+
+  /**
+   * Archived frames of a camera between two times, located through the indexes
+   * @returns {Array<{file: string, offset: number, length: number, atMs: number}>} one per frame, in order
+   */
+  function frames(cameraId, fromMs, toMs) {
+    const result = [];
+    for (let startMs = dayStart(fromMs); startMs <= toMs; startMs += DAY_MS) {
+      const day = loadDay(cameraId, startMs);
+      if (!day) continue;
+      const end = lowerBound(day.records, day.count, toMs - startMs + 1);
+      for (let i = lowerBound(day.records, day.count, Math.max(0, fromMs - startMs)); i < end; i++) {
+        const at = i * RECORD_SIZE;
+        result.push({
+          file: day.file,
+          offset: day.records.readDoubleBE(at + 8),
+          length: day.records.readUInt32BE(at + 4),
+          atMs: startMs + day.records.readUInt32BE(at),
+        });
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Send a range as multipart/x-mixed-replace, fps frames per second (0 for as
+   * fast as the client reads, e.g. to save it as an .mjpeg file)
+   * @returns {Promise<number>} frames sent
+   */
+  async function stream(req, res, cameraId, fromMs, toMs, { fps = settings.playbackFps } = {}) {
+    const list = frames(cameraId, fromMs, toMs);
+    let closed = false;
+    req.on('close', () => {
+      closed = true;
+    });
+    res.writeHead(200, {
+      'Content-Type': `multipart/x-mixed-replace; boundary=${BOUNDARY}`,
+      'Cache-Control': 'no-store',
+      'X-Frame-Count': String(list.length),
+    });
+    const started = now();
+    let sent = 0;
+    let handle = null;
+    let openFile = null;
+    try {
+      for (const frame of list) {
+        if (closed) break;
+        if (frame.file !== openFile) {
+          await handle?.close();
+          handle = await fs.promises.open(frame.file, 'r');
+          openFile = frame.file;
+        }
+        const part = Buffer.allocUnsafe(frame.length);
+        await handle.read(part, 0, frame.length, frame.offset);
+        if (!res.write(part)) await Promise.race([once(res, 'drain'), once(res, 'close')]);
+        sent++;
+        if (fps > 0) {
+          const wait = started + (sent * 1000) / fps - now();
+          if (wait > 0) await new Promise((resolve) => setTimeout(resolve, wait));
+        }
+      }
+    } finally {
+      await handle?.close();
+    }
+    telemetry?.incrementRelay('zcc_relay_timelapse_served_frames_total', {}, sent);
+    res.end(`--${BOUNDARY}--\r\n`);
+    return sent;
+  }
+
+  /**
+   * Archived days of a camera
+   * @returns {Array<{date: string, frames: number, bytes: number}>} bytes counts archive and index
+   */
+  function days(cameraId) {
+    let names;
+    try {
+      names = fs.readdirSync(cameraDir(cameraId));
+    } catch (err) {
+      if (err.code === 'ENOENT') return [];
+      throw err;
+    }
+    return names
+      .filter((name) => /^\d{4}-\d{2}-\d{2}\.idx$/.test(name))
+      .sort()
+      .map((name) => {
+        const date = name.slice(0, 10);
+        const indexBytes = fs.statSync(path.join(cameraDir(cameraId), name)).size;
+        const data = path.join(cameraDir(cameraId), `${date}.mjpeg`);
+        return {
+          date,
+          frames: Math.floor((indexBytes - HEADER_SIZE) / RECORD_SIZE),
+          bytes: indexBytes + (fs.existsSync(data) ? fs.statSync(data).size : 0),
+        };
+      });
+  }
+
+  function cameraDisconnected(cameraId) {
+    const camera = cameras.get(cameraId);
+    if (camera?.day) closeDay(camera.day);
+    cameras.delete(cameraId);
+  }
+
+  function close() {
+    for (const cameraId of [...cameras.keys()]) cameraDisconnected(cameraId);
+  }
+
+  return { recordFrame, frames, stream, days, cameraDisconnected, close };
+}
+
+module.exports = {
+  BOUNDARY,
+  HEADER_SIZE,
+  RECORD_SIZE,
+  createTimelapse,
+};
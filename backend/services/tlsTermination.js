@@ -0,0 +1,51 @@
+const fs = require('fs');
+const tls = require('tls');
+
+// Terminate TLS on a separate port and hand the decrypted sockets to the
+// existing HTTP server, so Express routes, socket.io and camera WebSocket
+// upgrades behave exactly as they do on the plaintext port.
+function startTlsTermination(server, tlsConfig, { telemetry } = {}) {
+  const options = {
+    key: fs.readFileSync(tlsConfig.keyPath),
+    cert: fs.readFileSync(tlsConfig.certPath),
+    sessionTimeout: tlsConfig.sessionTimeout,
+    ALPNProtocols: ['http/1.1'],
+  };
+  if (tlsConfig.ticketKeys) {
+    options.ticketKeys = Buffer.from(tlsConfig.ticketKeys, 'hex');
+  }
+
+  const tlsServer = tls.createServer(options, (tlsSocket) => {
+    const resumed = tlsSocket.isSessionReused();
+    telemetry?.incrementRelay('zcc_relay_tls_handshakes_total', { resumed: String(resumed) });
+    tlsSocket.setNoDelay(true);
+    server.emit('connection', tlsSocket);
+  });
+
+  // Session-id resumption for clients built without session ticket support;
+  // tickets need no server state and are handled by Node itself
+  const sessionCache = new Map();
+  const maxCachedSessions = 1000;
+  tlsServer.on('newSession', (id, data, cb) => {
+    if (sessionCache.size >= maxCachedSessions) {
+      sessionCache.delete(sessionCache.keys().next().value);
+    }
+    sessionCache.set(id.toString('hex'), data);
+    cb();
+  });
+  tlsServer.on('resumeSession', (id, cb) => {
+    cb(null, sessionCache.get(id.toString('hex')) || null);
+  });
+
+  tlsServer.on('tlsClientError', (err) => {
+    console.error('TLS handshake failed:', err.message);
+  });
+
+  tlsServer.listen(tlsConfig.port, '0.0.0.0', () => {
+    console.log(`🔒 TLS listening on port ${tlsConfig.port}`);
+  });
+
+  return tlsServer;
+}
+
+module.exports = startTlsTermination;
@@ -0,0 +1,221 @@
+// On-demand MJPEG -> H.264 transcoding for remote viewers
+// One ffmpeg process per camera, started while at least one dashboard watches
+// the camera's 'h264' profile and shared by all of them. Output is fragmented
+// MP4 (one fragment per keyframe) that browsers play through Media Source
+// Extensions. Each encoder runs niced, single threaded and frame-rate capped;
+// its CPU use is sampled and input frames are decimated when it exceeds
+// config.transcode.maxCpuPerCamera, so encoding cannot starve ingest.
+const fs = require('fs');
+const { PassThrough } = require('stream');
+const ffmpeg = require('fluent-ffmpeg');
+const ffmpegPath = require('ffmpeg-static');
+const config = require('../config/app-config.js');
+
+ffmpeg.setFfmpegPath(ffmpegPath);
+
+const CPU_SAMPLE_MS = 2000;
+const CLOCK_TICKS_PER_SECOND = 100; // USER_HZ on Linux
+const MAX_FRAME_STRIDE = 8;
+// Per-camera series, removed when the camera's session ends
+const CAMERA_COUNTERS = [
+  'zcc_relay_transcode_bytes_in_total',
+  'zcc_relay_transcode_bytes_out_total',
+  'zcc_relay_transcode_cpu_seconds_total',
+  'zcc_relay_transcode_dropped_frames_total',
+];
+
+// Split an MP4 byte stream into top-level boxes
+function createBoxParser(onBox) {
+  let pending = Buffer.alloc(0);
+  return (chunk) => {
+    pending = pending.length ? Buffer.concat([pending, chunk]) : chunk;
+    let off = 0;
+    while (pending.length - off >= 8) {
+      const size = pending.readUInt32BE(off);
+      if (size < 8) throw new Error(`Unsupported MP4 box size ${size}`);
+      if (pending.length - off < size) break;
+      onBox(pending.toString('latin1', off + 4, off + 8), pending.subarray(off, off + size));
+      off += size;
+    }
+    pending = pending.subarray(off);
+  };
+}
+
+// CPU seconds used by a process so far (Linux only; null elsewhere)
+function readProcessCpuSeconds(pid) {
+  try {
+    const stat = fs.readFileSync(`/proc/${pid}/stat`, 'latin1');
+    // Fields after the parenthesised command name; utime and stime are 14 and 15
+    const fields = stat.slice(stat.lastIndexOf(')') + 2).split(' ');
+    return (Number(fields[11]) + Number(fields[12])) / CLOCK_TICKS_PER_SECOND;
+  } catch (err) {
+    return null;
+  }
+}
+
+function createTranscoder(io, { telemetry, room } = {}) {
+  const settings = config.transcode;
+  const sessions = new Map(); // cameraId -> session
+
+  function start(cameraId) {
+    const input = new PassThrough();
+    const session = {
+      cameraId,
+      input,
+      command: null,
+      pid: null,
+      init: null,
+      moof: null,
+      frameStride: 1,
+      frameCounter: 0,
+      lastCpuSeconds: 0,
+      cpuRatio: 0,
+      cpuTimer: null,
+    };
+
+    const parse = createBoxParser((type, box) => {
+      if (type === 'ftyp') {
+        session.init = box;
+      } else if (type === 'moov') {
+        session.init = Buffer.concat([session.init || Buffer.alloc(0), box]);
+        io.to(room(cameraId)).emit('stream-h264', { cameraId, init: true, data: session.init });
+      } else if (type === 'moof') {
+        session.moof = box;
+      } else if (type === 'mdat' && session.moof) {
+        const fragment = Buffer.concat([session.moof, box]);
+        session.moof = null;
+        io.to(room(cameraId)).emit('stream-h264', { cameraId, init: false, data: fragment });
+        telemetry?.incrementRelay('zcc_relay_transcode_bytes_out_total', { camera: cameraId }, fragment.length);
+      }
+    });
+
+    session.command = ffmpeg(input)
+      .inputFormat('mjpeg')
+      .inputOptions(['-use_wallclock_as_timestamps 1', '-fflags nobuffer'])
+      .noAudio()
+      .videoCodec('libx264')
+      .outputOptions([
+        '-preset ultrafast',
+        '-tune zerolatency',
+        '-profile:v baseline',
+        '-pix_fmt yuv420p',
+        '-threads 1',
+        `-r ${settings.maxFps}`,
+        // One-second GOPs so each fragment starts on a keyframe and late joiners start fast
+        `-g ${settings.maxFps}`,
+        `-vf scale='min(${settings.maxWidth},iw)':-2`,
+        `-b:v ${settings.bitrateKbps}k`,
+        `-maxrate ${settings.bitrateKbps}k`,
+        `-bufsize ${settings.bitrateKbps * 2}k`,
+        '-movflags frag_keyframe+empty_moov+default_base_moof',
+      ])
+      .format('mp4')
+      .renice(settings.niceness)
+      .on('start', () => {
+        session.pid = session.command.ffmpegProc?.pid || null;
+        console.log(`🎞️ Transcoder started for camera ${cameraId} (pid ${session.pid})`);
+      })
+      .on('error', (err) => {
+        // Killing the process on stop also lands here
+        if (sessions.get(cameraId) === session) {
+          console.error(`❌ Transcoder for camera ${cameraId} failed:`, err.message);
+          stop(cameraId);
+        }
+      });
+
+    const output = session.command.pipe();
+    output.on('data', (chunk) => {
+      if (sessions.get(cameraId) !== session) return; // Output still draining after stop
+      try {
+        parse(chunk);
+      } catch (err) {
+        console.error(`❌ Bad transcoder output for camera ${cameraId}:`, err.message);
+        stop(cameraId);
+      }
+    });
+
+    session.cpuTimer = setInterval(() => sampleCpu(session), CPU_SAMPLE_MS);
+    sessions.set(cameraId, session);
+    return session;
+  }
+
+  // Measure encoder CPU and adapt the input frame stride to stay under the cap
+  function sampleCpu(session) {
+    if (!session.pid) return;
+    const cpuSeconds = readProcessCpuSeconds(session.pid);
+    if (cpuSeconds === null) return;
+
+    const used = cpuSeconds - session.lastCpuSeconds;
+    session.lastCpuSeconds = cpuSeconds;
+    session.cpuRatio = used / (CPU_SAMPLE_MS / 1000);
+    telemetry?.incrementRelay('zcc_relay_transcode_cpu_seconds_total', { camera: session.cameraId }, used);
+
+    if (session.cpuRatio > settings.maxCpuPerCamera && session.frameStride < MAX_FRAME_STRIDE) {
+      session.frameStride *= 2;
+      console.warn(`⚠️ Transcoder for camera ${session.cameraId} at ${(session.cpuRatio * 100).toFixed(0)}% CPU, encoding every ${session.frameStride} frames`);
+    } else if (session.cpuRatio < settings.maxCpuPerCamera / 2 && session.frameStride > 1) {
+      session.frameStride /= 2;
+    }
+  }
+
+  function stop(cameraId) {
+    const session = sessions.get(cameraId);
+    if (!session) return;
+    sessions.delete(cameraId);
+    clearInterval(session.cpuTimer);
+    session.input.end();
+    session.command.kill('SIGKILL');
+    for (const name of CAMERA_COUNTERS) telemetry?.removeRelay(name, { camera: cameraId });
+    console.log(`🎞️ Transcoder stopped for camera ${cameraId}`);
+  }
+
+  /**
+   * Start or stop the encoder for a camera
+   * @returns {boolean} false when a new encoder would exceed maxSessions
+   */
+  function setDemand(cameraId, wanted) {
+    if (!wanted) {
+      stop(cameraId);
+      return true;
+    }
+    if (sessions.has(cameraId)) return true;
+    if (sessions.size >= settings.maxSessions) return false;
+    start(cameraId);
+    return true;
+  }
+
+  function canStart(cameraId) {
+    return settings.enabled && (sessions.has(cameraId) || sessions.size < settings.maxSessions);
+  }
+
+  // Feed one main-profile JPEG; dropped when decimating or when ffmpeg lags
+  function push(cameraId, jpeg) {
+    const session = sessions.get(cameraId);
+    if (!session) return;
+    if (session.frameCounter++ % session.frameStride !== 0) return;
+    if (session.input.writableLength > settings.maxQueuedBytes) {
+      telemetry?.incrementRelay('zcc_relay_transcode_dropped_frames_total', { camera: cameraId });
+      return;
+    }
+    session.input.write(jpeg);
+    telemetry?.incrementRelay('zcc_relay_transcode_bytes_in_total', { camera: cameraId }, jpeg.length);
+  }
+
+  // A viewer joining a running encode needs the init segment first
+  function sendInit(socket, cameraId) {
+    const init = sessions.get(cameraId)?.init;
+    if (init) socket.emit('stream-h264', { cameraId, init: true, data: init });
+  }
+
+  function stats() {
+    return [...sessions.values()].map((s) => ({ cameraId: s.cameraId, cpuRatio: s.cpuRatio, frameStride: s.frameStride }));
+  }
+
+  return { setDemand, canStart, push, sendInit, stop, stats };
+}
+
+module.exports = {
+  createBoxParser,
+  readProcessCpuSeconds,
+  createTranscoder,
+};
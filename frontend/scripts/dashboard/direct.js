@@ -0,0 +1,94 @@
+(function () {
+  // Direct LAN viewing: full-size tiles load the camera's own MJPEG endpoint
+  // (multipart/x-mixed-replace into the <img>) instead of relay frames, when
+  // the user turned it on and the camera advertised an endpoint. The browser
+  // must be able to reach the camera: same network, and a page served over
+  // http (an https page cannot load http images). A camera that cannot be
+  // reached, or has no free client slot, falls back to the relay.
+  const FIRST_FRAME_TIMEOUT_MS = 3000;
+
+  const endpoints = new Map(); // cameraId -> { ip, port, token }
+  const failed = new Set(); // cameras that did not answer directly since the last toggle
+  const attached = new Map(); // cameraId -> first-frame timer
+
+  function enabled() {
+    return localStorage.getItem('streamDirect') === 'lan' && window.location.protocol === 'http:';
+  }
+
+  function setEndpoint(cameraId, lan) {
+    if (lan) endpoints.set(cameraId, lan);
+    else endpoints.delete(cameraId);
+    failed.delete(cameraId);
+  }
+
+  function isAvailable(cameraId) {
+    return enabled() && endpoints.has(cameraId) && !failed.has(cameraId);
+  }
+
+  function streamUrl(lan) {
+    return `http://${lan.ip}:${lan.port}/stream?token=${encodeURIComponent(lan.token)}`;
+  }
+
+  function fail(cameraId, reason) {
+    console.warn(`Direct LAN stream for camera ${cameraId} unavailable (${reason}), using the relay`);
+    failed.add(cameraId);
+    detach(cameraId);
+    window.DashboardStreamProfiles?.update();
+  }
+
+  function attach(cameraId) {
+    const img = document.getElementById(`video-${cameraId}`);
+    const lan = endpoints.get(cameraId);
+    if (!img || !lan) return fail(cameraId, 'no endpoint');
+    detach(cameraId);
+    if (img.src.startsWith('blob:')) URL.revokeObjectURL(img.src);
+    img.onload = () => {
+      clearTimeout(attached.get(cameraId));
+      const statusEl = document.getElementById(`status-${cameraId}`);
+      if (statusEl) {
+        statusEl.textContent = 'streaming (LAN)';
+        statusEl.className = 'camera-status status-streaming';
+      }
+    };
+    img.onerror = () => fail(cameraId, 'connection refused or busy');
+    img.src = streamUrl(lan);
+    attached.set(
+      cameraId,
+      setTimeout(() => img.naturalWidth === 0 && fail(cameraId, 'no frame'), FIRST_FRAME_TIMEOUT_MS)
+    );
+  }
+
+  // Clearing src closes the connection and frees the camera's client slot
+  function detach(cameraId) {
+    if (!attached.has(cameraId)) return;
+    clearTimeout(attached.get(cameraId));
+    attached.delete(cameraId);
+    const img = document.getElementById(`video-${cameraId}`);
+    if (img && img.src.startsWith('http:')) {
+      img.onload = null;
+      img.onerror = null;
+      img.removeAttribute('src');
+    }
+  }
+
+  function bindButton() {
+    const button = document.getElementById('stream-direct-lan');
+    if (!button) return;
+    button.classList.toggle('active', localStorage.getItem('streamDirect') === 'lan');
+    button.addEventListener('click', () => {
+      const on = localStorage.getItem('streamDirect') !== 'lan';
+      localStorage.setItem('streamDirect', on ? 'lan' : 'relay');
+      button.classList.toggle('active', on);
+      failed.clear();
+      window.DashboardStreamProfiles?.update();
+    });
+  }
+
+  window.DashboardDirect = {
+    setEndpoint,
+    isAvailable,
+    attach,
+    detach,
+    bindButton,
+  };
+})();
@@ -2,8 +2,12 @@
   window.handleCameraStatusUpdate = function (data) {
     const container = document.getElementById('camerasContainer');
     let card = document.getElementById(`camera-${data.cameraId}`);
+    // Renames carry no endpoint; an offline camera's endpoint is gone
+    if (data.status === 'offline' || data.status === 'deleted') window.DashboardDirect?.setEndpoint(data.cameraId, null);
+    else if (data.lan !== undefined) window.DashboardDirect?.setEndpoint(data.cameraId, data.lan);
     if (data.status === 'deleted') {
       if (card) card.remove();
+      window.DashboardStreamProfiles?.release(data.cameraId);
       if (window.DashboardSettings?.saveCameraSettings) {
         // Remove stored settings for deleted camera
         // Load, delete, save using provided API
@@ -41,6 +45,7 @@
       if (cards.length === 1) container.classList.add('single-camera');
       else if (cards.length === 2) container.classList.add('two-cameras');
       if (localStorage.getItem('dashboardView') === 'full') window.DashboardUI.setupCarousel();
+      window.DashboardStreamProfiles?.update();
     }, 100);
   };
 
@@ -48,14 +53,26 @@
     console.log('✅ DASHBOARD: Camera auto-added:', data);
   };
 
-  window.handleStreamData = async function (data) {
+  window.handleStreamData = function (data) {
+    if (!document.getElementById(`video-${data.cameraId}`)) return;
+    if (window.DashboardStreamProfiles && !window.DashboardStreamProfiles.isSubscribed(data.cameraId)) return;
+    // Paced by the tile's jitter buffer when capture times are available
+    if (window.DashboardPlayout) window.DashboardPlayout.push(data, paintStreamFrame);
+    else paintStreamFrame(data);
+  };
+
+  async function paintStreamFrame(data) {
     const videoElement = document.getElementById(`video-${data.cameraId}`);
     if (!videoElement) return;
     try {
+      const receivedAt = performance.now();
       const url = await window.FrameProcessor.processBinaryFrame(data.frame, data.cameraId);
       if (videoElement.src && videoElement.src.startsWith('blob:')) URL.revokeObjectURL(videoElement.src);
       videoElement.src = url;
-      videoElement.onload = () => URL.revokeObjectURL(url);
+      videoElement.onload = () => {
+        URL.revokeObjectURL(url);
+        window.DashboardStreamProfiles?.recordFrame(data, performance.now() - receivedAt);
+      };
       videoElement.onerror = (error) => {
         console.error(`Error displaying frame for camera ${data.cameraId}:`, error);
         URL.revokeObjectURL(url);
@@ -73,7 +90,7 @@
         statusEl.className = 'camera-status status-error';
       }
     }
-  };
+  }
 
   window.handleCameraControlSent = function (data) {
     window.DashboardUI.showCameraMessage(data.cameraId, 'Settings applied successfully!', 'success');
@@ -19,8 +19,14 @@
         socket?.on('cameraStatusUpdate', window.handleCameraStatusUpdate);
         socket?.on('cameraAutoAdded', window.handleCameraAutoAdded);
         socket?.on('stream', window.handleStreamData);
+        socket?.on('connect', window.DashboardStreamProfiles.reset);
+        socket?.on('stream-h264', window.H264Player.append);
+        socket?.on('mosaic', window.DashboardMosaic.handleFrame);
+        socket?.on('stream-profile-rejected', window.DashboardStreamProfiles.handleRejected);
         socket?.on('camera-control-sent', window.handleCameraControlSent);
         socket?.on('camera-control-error', window.handleCameraControlError);
+        socket?.on('cameraClock', window.DashboardPlayout.setCameraClock);
+        window.DashboardPlayout.startClockSync(socket);
       } else {
         throw new Error('SocketManager not available');
       }
@@ -38,8 +44,14 @@
       socket.on('cameraStatusUpdate', window.handleCameraStatusUpdate);
       socket.on('cameraAutoAdded', window.handleCameraAutoAdded);
       socket.on('stream', window.handleStreamData);
+      socket.on('connect', window.DashboardStreamProfiles.reset);
+      socket.on('stream-h264', window.H264Player.append);
+      socket.on('mosaic', window.DashboardMosaic.handleFrame);
+      socket.on('stream-profile-rejected', window.DashboardStreamProfiles.handleRejected);
       socket.on('camera-control-sent', window.handleCameraControlSent);
       socket.on('camera-control-error', window.handleCameraControlError);
+      socket.on('cameraClock', window.DashboardPlayout.setCameraClock);
+      window.DashboardPlayout.startClockSync(socket);
     }
   }
 
@@ -72,6 +84,9 @@
     window.DashboardSettings.loadCameraSettings();
     const savedView = localStorage.getItem('dashboardView') || 'grid';
     window.DashboardUI.bindViewButtons();
+    window.DashboardStreamProfiles.bindCodecButton();
+    window.DashboardDirect.bindButton();
+    window.DashboardPlayout.bindButtons();
     window.DashboardUI.bindDeleteModalEvents();
     window.DashboardUI.setView(savedView);
     window.DashboardSettings.addCameraSettingsStyles();
@@ -0,0 +1,128 @@
+(function () {
+  // Grid view as one server-composited stream: the relay decodes each camera
+  // at reduced scale into a single mosaic JPEG, and every tile shows its cell
+  // of that image as a CSS sprite, so the browser decodes one small image per
+  // tick instead of one per camera
+  const MIN_TILES = 4;
+
+  let layoutKey = null; // layout requested from the server
+  let mosaicKey = null; // key of the mosaic we receive
+  let cameraIds = [];
+  let columns = 1;
+  let rows = 1;
+  let currentUrl = null;
+  let rejected = false;
+
+  function enabled() {
+    return localStorage.getItem('gridMosaic') !== 'off' && !rejected;
+  }
+
+  // Mosaic only pays off for a grid of small tiles
+  function isEligible(tiles) {
+    const container = document.getElementById('camerasContainer');
+    return (
+      enabled() &&
+      container?.classList.contains('grid-view') &&
+      tiles.length >= MIN_TILES &&
+      tiles.every((t) => t.profile === 'sub')
+    );
+  }
+
+  // Columns of the rendered grid: cards on the same row as the first one
+  function countColumns(cards) {
+    const top = cards[0].offsetTop;
+    return Math.max(1, cards.filter((c) => c.offsetTop === top).length);
+  }
+
+  function show(cards, ids) {
+    const cols = countColumns(cards);
+    const requested = `${cols}:${ids.join(',')}`;
+    if (requested === layoutKey || !window.socket) return;
+    // Tiles that left the mosaic (scrolled away) drop their sprite
+    const kept = new Set(ids);
+    const dropped = cameraIds.filter((cameraId) => !kept.has(cameraId));
+    cameraIds = dropped;
+    clearTiles();
+    layoutKey = requested;
+    cameraIds = ids;
+    columns = cols;
+    rows = Math.ceil(ids.length / cols);
+    window.socket.emit('mosaic-subscribe', { cameras: ids, columns: cols }, (res) => {
+      if (layoutKey !== requested) return;
+      mosaicKey = res?.key || null;
+      if (!mosaicKey) {
+        // Not allowed for this layout; go back to per-tile streams
+        rejected = true;
+        hide();
+        window.DashboardStreamProfiles?.update();
+      }
+    });
+  }
+
+  function clearTiles() {
+    cameraIds.forEach((cameraId) => {
+      const container = document.querySelector(`#camera-${cameraId} .video-container`);
+      const img = document.getElementById(`video-${cameraId}`);
+      if (container) container.style.backgroundImage = '';
+      if (img) img.style.display = '';
+    });
+  }
+
+  function hide() {
+    if (!layoutKey) return;
+    window.socket?.emit('mosaic-unsubscribe');
+    clearTiles();
+    if (currentUrl) URL.revokeObjectURL(currentUrl);
+    currentUrl = null;
+    layoutKey = null;
+    mosaicKey = null;
+    cameraIds = [];
+  }
+
+  // Subscriptions are lost when the socket reconnects
+  function reset() {
+    clearTiles();
+    layoutKey = null;
+    mosaicKey = null;
+    rejected = false;
+  }
+
+  function paint(url) {
+    cameraIds.forEach((cameraId, index) => {
+      const container = document.querySelector(`#camera-${cameraId} .video-container`);
+      const img = document.getElementById(`video-${cameraId}`);
+      if (!container) return;
+      const col = index % columns;
+      const row = Math.floor(index / columns);
+      if (img) img.style.display = 'none';
+      container.style.backgroundImage = `url(${url})`;
+      container.style.backgroundSize = `${columns * 100}% ${rows * 100}%`;
+      container.style.backgroundPosition = `${columns > 1 ? (col / (columns - 1)) * 100 : 0}% ${rows > 1 ? (row / (rows - 1)) * 100 : 0}%`;
+      container.style.backgroundRepeat = 'no-repeat';
+    });
+  }
+
+  function handleFrame(data) {
+    if (!mosaicKey || data.key !== mosaicKey) return;
+    const receivedAt = performance.now();
+    const url = URL.createObjectURL(new Blob([data.frame], { type: 'image/jpeg' }));
+    const img = new Image();
+    img.onload = () => {
+      if (data.key !== mosaicKey) return URL.revokeObjectURL(url);
+      paint(url);
+      if (currentUrl) URL.revokeObjectURL(currentUrl);
+      currentUrl = url;
+      window.DashboardStreamProfiles?.recordFrame({ profile: 'mosaic', frameSize: data.frameSize }, performance.now() - receivedAt);
+    };
+    img.onerror = () => URL.revokeObjectURL(url);
+    img.src = url;
+  }
+
+  window.DashboardMosaic = {
+    isEligible,
+    show,
+    hide,
+    reset,
+    handleFrame,
+  };
+})();
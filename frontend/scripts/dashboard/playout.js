@@ -0,0 +1,174 @@
+(function () {
+  // Per-tile playout: MJPEG frames go through a jitter buffer (see
+  // streaming/jitterBuffer.js) unless the user picked lowest latency.
+  // Frames without a capture time (older firmware, cached first frames) are
+  // painted on arrival either way.
+  // Synchronised playout lines tiles up by capture time: cameras the relay has
+  // synchronised stamp frames in relay time (captureClock 'server'), this page
+  // estimates the relay clock from socket.io round trips, and every such tile
+  // is played at the same latency, the largest any of them needs.
+  const OVERLAY_REFRESH_MS = 1000;
+  const CLOCK_PROBES = 5;
+  const CLOCK_PROBE_SPACING_MS = 200;
+  const CLOCK_REFRESH_MS = 60000;
+
+  const buffers = new Map(); // cameraId -> jitter buffer
+  const aligned = new Set(); // cameraIds whose last frame was in relay time
+  const cameraClocks = new Map(); // cameraId -> { errorMs, boundMs, driftPpm } from the relay
+  const clock = { offsetMs: null, roundTripMs: Infinity }; // relay epoch ms - performance.now()
+  let overlayTimer = null;
+  let clockTimer = null;
+
+  function lowLatency() {
+    return localStorage.getItem('playoutMode') === 'low-latency';
+  }
+
+  function synced() {
+    return localStorage.getItem('playoutSync') === 'on';
+  }
+
+  // Fastest of a few round trips; the relay answers with its clock
+  function syncClock(socket) {
+    let best = Infinity;
+    for (let i = 0; i < CLOCK_PROBES; i++) {
+      setTimeout(() => {
+        const sent = performance.now();
+        socket.emit('clockSync', (relayMs) => {
+          const received = performance.now();
+          const roundTrip = received - sent;
+          if (roundTrip >= best) return;
+          best = roundTrip;
+          clock.offsetMs = relayMs - (sent + received) / 2;
+          clock.roundTripMs = roundTrip;
+        });
+      }, i * CLOCK_PROBE_SPACING_MS);
+    }
+  }
+
+  function startClockSync(socket) {
+    if (!socket) return;
+    clearInterval(clockTimer);
+    syncClock(socket);
+    clockTimer = setInterval(() => syncClock(socket), CLOCK_REFRESH_MS);
+  }
+
+  function setCameraClock(status) {
+    cameraClocks.set(status.cameraId, status);
+  }
+
+  // Same latency for every aligned tile: the largest one needs
+  function updateFloors() {
+    let shared = 0;
+    aligned.forEach((cameraId) => (shared = Math.max(shared, buffers.get(cameraId)?.latency() || 0)));
+    aligned.forEach((cameraId) => buffers.get(cameraId)?.setFloor(shared));
+  }
+
+  function push(data, paint) {
+    let buffer = buffers.get(data.cameraId);
+    if (!buffer) {
+      buffer = window.JitterBuffer.create(paint);
+      buffer.setBypass(lowLatency());
+      buffers.set(data.cameraId, buffer);
+    }
+    let captureMs = data.cached ? null : data.captureTs ?? null;
+    const align = captureMs !== null && synced() && data.captureClock === 'server' && clock.offsetMs !== null;
+    if (align) {
+      captureMs -= clock.offsetMs; // Onto this page's clock
+      aligned.add(data.cameraId);
+    } else if (aligned.delete(data.cameraId)) {
+      buffer.setFloor(0);
+    }
+    buffer.push(data, captureMs);
+    if (align) updateFloors();
+  }
+
+  // Tile unsubscribed or removed: drop queued frames and start over
+  function reset(cameraId) {
+    buffers.get(cameraId)?.reset();
+    aligned.delete(cameraId);
+    document.querySelector(`#camera-${cameraId} .playout-stats`)?.remove();
+  }
+
+  function clockLine(cameraId) {
+    if (!synced()) return '';
+    if (!aligned.has(cameraId)) return '\nnot aligned (camera clock not synchronised)';
+    const camera = cameraClocks.get(cameraId);
+    const cameraError = camera?.errorMs != null ? `camera ±${camera.errorMs.toFixed(1)} ms` : 'camera ±?';
+    return `\naligned: ${cameraError}, dashboard ±${(clock.roundTripMs / 2).toFixed(1)} ms`;
+  }
+
+  function renderOverlays() {
+    buffers.forEach((buffer, cameraId) => {
+      const container = document.querySelector(`#camera-${cameraId} .video-container`);
+      if (!container) return;
+      let overlay = container.querySelector('.playout-stats');
+      if (!overlay) {
+        overlay = document.createElement('div');
+        overlay.className = 'playout-stats';
+        container.appendChild(overlay);
+      }
+      const s = buffer.stats();
+      overlay.textContent =
+        `${s.mode}  depth ${s.depthMs.toFixed(0)} ms  +${s.addedLatencyMs.toFixed(0)} ms\n` +
+        `interval sd: arrival ${s.arrivalJitterMs.toFixed(1)} ms, paint ${s.paintJitterMs.toFixed(1)} ms\n` +
+        `queued ${s.queued}  skipped ${s.dropped}` +
+        clockLine(cameraId);
+    });
+  }
+
+  function setOverlay(on) {
+    clearInterval(overlayTimer);
+    overlayTimer = null;
+    if (on) {
+      renderOverlays();
+      overlayTimer = setInterval(renderOverlays, OVERLAY_REFRESH_MS);
+    } else {
+      document.querySelectorAll('.playout-stats').forEach((el) => el.remove());
+    }
+  }
+
+  function bindButtons() {
+    const latencyButton = document.getElementById('playout-low-latency');
+    if (latencyButton) {
+      latencyButton.classList.toggle('active', lowLatency());
+      latencyButton.addEventListener('click', () => {
+        const on = !lowLatency();
+        localStorage.setItem('playoutMode', on ? 'low-latency' : 'smooth');
+        latencyButton.classList.toggle('active', on);
+        buffers.forEach((buffer) => buffer.setBypass(on));
+      });
+    }
+    const syncButton = document.getElementById('playout-sync');
+    if (syncButton) {
+      syncButton.classList.toggle('active', synced());
+      syncButton.addEventListener('click', () => {
+        const on = !synced();
+        localStorage.setItem('playoutSync', on ? 'on' : 'off');
+        syncButton.classList.toggle('active', on);
+        // Capture times change clock: start every tile over
+        buffers.forEach((buffer) => buffer.reset());
+        aligned.clear();
+      });
+    }
+    const statsButton = document.getElementById('playout-stats');
+    if (statsButton) {
+      const on = localStorage.getItem('playoutStats') === 'on';
+      statsButton.classList.toggle('active', on);
+      setOverlay(on);
+      statsButton.addEventListener('click', () => {
+        const show = localStorage.getItem('playoutStats') !== 'on';
+        localStorage.setItem('playoutStats', show ? 'on' : 'off');
+        statsButton.classList.toggle('active', show);
+        setOverlay(show);
+      });
+    }
+  }
+
+  window.DashboardPlayout = {
+    push,
+    reset,
+    bindButtons,
+    startClockSync,
+    setCameraClock,
+  };
+})();
@@ -0,0 +1,222 @@
+(function () {
+  // Tiles rendered wider than this (device pixels) get the full-resolution
+  // main stream; smaller grid/list tiles use the camera's low-res substream
+  const SUBSTREAM_MAX_TILE_PX = 640;
+  const STATS_WINDOW_MS = 10000;
+  // Tiles this close to the viewport count as visible, so a tile scrolled in
+  // slowly is already subscribed when it appears
+  const VIEWPORT_MARGIN_PX = 100;
+  // An overloaded relay refuses full-resolution viewers; ask again after this
+  const OVERLOAD_RETRY_MS = 30000;
+
+  const selected = new Map(); // cameraId -> profile sent to the server
+  const h264Rejected = new Set(); // cameras the relay cannot transcode right now
+  const overloaded = new Map(); // cameraId -> when the relay refused a full-resolution profile
+  let updateScheduled = false;
+
+  // card -> whether it intersects the viewport, as last reported by the observer
+  const inView = new WeakMap();
+  const observed = new WeakSet();
+  const observer =
+    'IntersectionObserver' in window
+      ? new IntersectionObserver(
+          (entries) => {
+            entries.forEach((e) => inView.set(e.target, e.isIntersecting));
+            update();
+          },
+          { rootMargin: `${VIEWPORT_MARGIN_PX}px` }
+        )
+      : null;
+
+  function observe(card) {
+    if (!observer || observed.has(card)) return;
+    observed.add(card);
+    observer.observe(card);
+  }
+
+  // Scrolled out of view, collapsed or hidden (carousel cards other than the
+  // active one are display: none and never intersect). Until the observer first
+  // reports on a card, its layout box decides.
+  function isVisible(card) {
+    if (card.getClientRects().length === 0) return false;
+    if (inView.has(card)) return inView.get(card);
+    const rect = card.getBoundingClientRect();
+    return (
+      rect.bottom >= -VIEWPORT_MARGIN_PX &&
+      rect.top <= window.innerHeight + VIEWPORT_MARGIN_PX &&
+      rect.right >= -VIEWPORT_MARGIN_PX &&
+      rect.left <= window.innerWidth + VIEWPORT_MARGIN_PX
+    );
+  }
+
+  // Full-size tiles use the camera's own LAN stream when it is reachable
+  // (see direct.js), or the relay's H.264 encode instead of MJPEG when the
+  // user prefers it (remote viewing) and the browser can play it
+  function fullProfile(cameraId) {
+    if (window.DashboardDirect?.isAvailable(cameraId)) return 'lan';
+    if (performance.now() - (overloaded.get(cameraId) ?? -Infinity) < OVERLOAD_RETRY_MS) return 'sub';
+    const wantsH264 = localStorage.getItem('streamCodec') === 'h264';
+    return wantsH264 && window.H264Player?.isSupported() && !h264Rejected.has(cameraId) ? 'h264' : 'main';
+  }
+
+  function profileForCard(card, cameraId) {
+    // A background tab is not watching; the camera can idle until it is shown again
+    if (document.hidden || !isVisible(card)) return null;
+    const container = document.getElementById('camerasContainer');
+    if (container?.classList.contains('full-view')) {
+      return card.classList.contains('active') ? fullProfile(cameraId) : null;
+    }
+    const img = card.querySelector('img');
+    const width = (img?.clientWidth || card.clientWidth) * (window.devicePixelRatio || 1);
+    return width > SUBSTREAM_MAX_TILE_PX ? fullProfile(cameraId) : 'sub';
+  }
+
+  function detachProfile(cameraId, profile) {
+    if (profile === 'h264') window.H264Player?.detach(cameraId);
+    if (profile === 'lan') window.DashboardDirect?.detach(cameraId);
+  }
+
+  function select(cameraId, profile) {
+    if ((selected.get(cameraId) || null) === profile || !window.socket) return;
+    detachProfile(cameraId, selected.get(cameraId));
+    if (!profile || profile === 'lan') window.DashboardPlayout?.reset(cameraId);
+    selected.set(cameraId, profile);
+    // A direct LAN tile needs nothing from the relay
+    window.socket.emit('stream-profile', { cameraId, profile: profile === 'lan' ? null : profile });
+    if (profile === 'lan') window.DashboardDirect.attach(cameraId);
+  }
+
+  function applyAll() {
+    const cards = Array.from(document.querySelectorAll('#camerasContainer .camera-card'));
+    cards.forEach(observe);
+    const tiles = cards.map((card) => {
+      const cameraId = card.id.replace(/^camera-/, '');
+      return { cameraId, profile: profileForCard(card, cameraId) };
+    });
+
+    // Small grid tiles come from one server-side mosaic instead of per-tile
+    // streams; it only covers the tiles on screen
+    const mosaic = window.DashboardMosaic;
+    const visible = tiles.filter((t) => t.profile !== null);
+    if (mosaic?.isEligible(visible)) {
+      mosaic.show(cards, visible.map((t) => t.cameraId));
+      tiles.forEach((t) => select(t.cameraId, null));
+      return;
+    }
+    mosaic?.hide();
+    tiles.forEach((t) => select(t.cameraId, t.profile));
+  }
+
+  // Re-evaluate every tile after layout settles; cheap to call often
+  function update() {
+    // Hidden tabs get no animation frames, so release immediately
+    if (document.hidden) return applyAll();
+    if (updateScheduled) return;
+    updateScheduled = true;
+    requestAnimationFrame(() => {
+      updateScheduled = false;
+      applyAll();
+    });
+  }
+
+  function release(cameraId) {
+    if (!selected.has(cameraId)) return;
+    detachProfile(cameraId, selected.get(cameraId));
+    window.DashboardPlayout?.reset(cameraId);
+    selected.delete(cameraId);
+    window.socket?.emit('stream-profile', { cameraId, profile: null });
+  }
+
+  // Frames still in flight after an unsubscribe are dropped before decoding
+  function isSubscribed(cameraId) {
+    const profile = selected.get(cameraId);
+    return Boolean(profile) && profile !== 'lan';
+  }
+
+  // An overloaded relay sheds frames to unfocused dashboards first
+  function reportFocus() {
+    window.socket?.emit('viewer-state', { background: !document.hasFocus() });
+  }
+
+  // Server-side rooms are lost when the socket reconnects
+  function reset() {
+    selected.forEach((profile, cameraId) => detachProfile(cameraId, profile));
+    selected.clear();
+    h264Rejected.clear();
+    overloaded.clear();
+    window.DashboardMosaic?.reset();
+    reportFocus();
+    update();
+  }
+
+  // The relay refused a profile: all encoders busy (fall back to MJPEG) or
+  // overloaded (fall back to the substream for a while)
+  function handleRejected(data) {
+    if (data.reason === 'overloaded') {
+      overloaded.set(data.cameraId, performance.now());
+      detachProfile(data.cameraId, selected.get(data.cameraId));
+      selected.delete(data.cameraId);
+      update();
+      setTimeout(update, OVERLOAD_RETRY_MS);
+      return;
+    }
+    if (data.profile !== 'h264') return;
+    h264Rejected.add(data.cameraId);
+    if (selected.get(data.cameraId) === 'h264') {
+      window.H264Player?.detach(data.cameraId);
+      selected.delete(data.cameraId);
+    }
+    update();
+  }
+
+  function bindCodecButton() {
+    const button = document.getElementById('codec-h264');
+    if (!button) return;
+    button.classList.toggle('active', localStorage.getItem('streamCodec') === 'h264');
+    button.addEventListener('click', () => {
+      const h264 = localStorage.getItem('streamCodec') !== 'h264';
+      localStorage.setItem('streamCodec', h264 ? 'h264' : 'mjpeg');
+      button.classList.toggle('active', h264);
+      h264Rejected.clear();
+      update();
+    });
+  }
+
+  // Received-frame accounting for comparing grid bandwidth and decode cost
+  const samples = [];
+
+  function recordFrame(data, decodeMs) {
+    const now = performance.now();
+    samples.push({ at: now, profile: data.profile || 'main', bytes: data.frameSize || 0, decodeMs });
+    while (samples.length && now - samples[0].at > STATS_WINDOW_MS) samples.shift();
+  }
+
+  function stats() {
+    const seconds = STATS_WINDOW_MS / 1000;
+    const result = {};
+    for (const s of samples) {
+      const p = (result[s.profile] = result[s.profile] || { fps: 0, kbps: 0, avgDecodeMs: 0 });
+      p.fps += 1 / seconds;
+      p.kbps += (s.bytes * 8) / 1000 / seconds;
+      p.avgDecodeMs += s.decodeMs;
+    }
+    for (const p of Object.values(result)) p.avgDecodeMs /= p.fps * seconds;
+    return result;
+  }
+
+  window.addEventListener('resize', update);
+  document.addEventListener('visibilitychange', update);
+  window.addEventListener('focus', reportFocus);
+  window.addEventListener('blur', reportFocus);
+
+  window.DashboardStreamProfiles = {
+    update,
+    release,
+    isSubscribed,
+    reset,
+    handleRejected,
+    bindCodecButton,
+    recordFrame,
+    stats,
+  };
+})();
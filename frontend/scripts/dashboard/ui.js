@@ -94,6 +94,7 @@
     if (view !== 'full') removeCarousel();
     currentView = view;
     localStorage.setItem('dashboardView', view);
+    window.DashboardStreamProfiles?.update();
   }
 
   function setupCarousel() {
@@ -138,6 +139,7 @@
     cards[carouselIndex].classList.remove('active');
     carouselIndex = (carouselIndex + direction + cards.length) % cards.length;
     cards[carouselIndex].classList.add('active');
+    window.DashboardStreamProfiles?.update();
   }
 
   async function editCameraName(cameraId, currentName) {
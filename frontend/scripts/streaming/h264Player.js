@@ -0,0 +1,97 @@
+(function () {
+  // Plays the relay's fragmented MP4 (H.264 profile) through Media Source
+  // Extensions in a <video> placed over the camera's MJPEG <img>
+  const MIME = 'video/mp4; codecs="avc1.42E01F"'; // Constrained baseline, matches the relay encoder
+  const MAX_LIVE_LAG_S = 2;
+  const BUFFER_KEEP_S = 10;
+
+  const players = new Map(); // cameraId -> player
+
+  function isSupported() {
+    return !!window.MediaSource && MediaSource.isTypeSupported(MIME);
+  }
+
+  function attach(cameraId) {
+    const img = document.getElementById(`video-${cameraId}`);
+    if (!img) return null;
+    const video = document.createElement('video');
+    video.id = `h264-${cameraId}`;
+    video.className = 'video-element';
+    video.muted = true;
+    video.autoplay = true;
+    video.playsInline = true;
+    const mediaSource = new MediaSource();
+    video.src = URL.createObjectURL(mediaSource);
+    img.style.display = 'none';
+    img.after(video);
+
+    const player = { video, mediaSource, sourceBuffer: null, queue: [], hasInit: false };
+    mediaSource.addEventListener(
+      'sourceopen',
+      () => {
+        player.sourceBuffer = mediaSource.addSourceBuffer(MIME);
+        player.sourceBuffer.addEventListener('updateend', () => pump(player));
+        pump(player);
+      },
+      { once: true }
+    );
+    players.set(cameraId, player);
+    return player;
+  }
+
+  function detach(cameraId) {
+    const player = players.get(cameraId);
+    if (!player) return;
+    players.delete(cameraId);
+    URL.revokeObjectURL(player.video.src);
+    player.video.remove();
+    const img = document.getElementById(`video-${cameraId}`);
+    if (img) img.style.display = '';
+  }
+
+  // Append queued segments one at a time, then stay near the live edge
+  function pump(player) {
+    const sb = player.sourceBuffer;
+    if (!sb || sb.updating) return;
+    if (player.queue.length) {
+      sb.appendBuffer(player.queue.shift());
+      return;
+    }
+    const { video } = player;
+    if (!sb.buffered.length) return;
+    const start = sb.buffered.start(0);
+    const end = sb.buffered.end(sb.buffered.length - 1);
+    if (end - video.currentTime > MAX_LIVE_LAG_S || video.currentTime < start) {
+      video.currentTime = Math.max(start, end - 0.2);
+    }
+    if (video.currentTime - start > BUFFER_KEEP_S) {
+      sb.remove(start, video.currentTime - 2);
+    }
+    if (video.paused) video.play().catch(() => {});
+  }
+
+  /**
+   * Handle a 'stream-h264' message from the relay
+   * @param {{cameraId: string, init: boolean, data: ArrayBuffer}} msg
+   */
+  function append(msg) {
+    let player = players.get(msg.cameraId);
+    // A new init segment means the encoder restarted with a fresh timeline
+    if (player && msg.init && player.hasInit) {
+      detach(msg.cameraId);
+      player = null;
+    }
+    player = player || attach(msg.cameraId);
+    if (!player) return;
+    if (!msg.init && !player.hasInit) return; // Wait for the init segment
+    player.hasInit = player.hasInit || msg.init;
+    player.queue.push(msg.data);
+    pump(player);
+  }
+
+  window.H264Player = {
+    isSupported,
+    append,
+    detach,
+  };
+})();
@@ -0,0 +1,174 @@
+(function () {
+  // Adaptive playout buffer for one camera tile
+  // Frames carry the camera's capture time. Each is painted at
+  //   capture time + base transit + depth
+  // where base transit is the fastest recent arrival (it absorbs the offset
+  // between the camera and browser clocks) and depth covers the arrival jitter
+  // seen over the last JITTER_WINDOW frames. Depth grows at once when the
+  // network gets burstier and shrinks slowly when it calms down, so Wi-Fi
+  // bursts turn into evenly spaced paints at the cost of a little latency.
+  // For synchronised playout the caller passes capture times already on the
+  // browser clock, so base transit is the real latency, and sets a floor: the
+  // largest latency among the tiles being lined up (see dashboard/playout.js).
+  const JITTER_WINDOW = 60;
+  const JITTER_PERCENTILE = 0.95;
+  const MAX_DEPTH_MS = 400;
+  const DEPTH_SHRINK = 0.02; // Fraction of the excess depth given back per frame
+  const RESYNC_GAP_MS = 3000; // Capture clock jumped: camera restarted or wrapped
+  const MAX_QUEUED = 30;
+  const STATS_WINDOW = 60;
+
+  function percentile(values, p) {
+    const sorted = values.slice().sort((a, b) => a - b);
+    return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+  }
+
+  function intervalStdDev(times) {
+    if (times.length < 3) return 0;
+    const intervals = [];
+    for (let i = 1; i < times.length; i++) intervals.push(times[i] - times[i - 1]);
+    const mean = intervals.reduce((a, b) => a + b, 0) / intervals.length;
+    return Math.sqrt(intervals.reduce((a, b) => a + (b - mean) ** 2, 0) / intervals.length);
+  }
+
+  function pushWindow(list, value, size) {
+    list.push(value);
+    if (list.length > size) list.shift();
+  }
+
+  /**
+   * @param {function(*)} paint - Shows one frame
+   */
+  function create(paint) {
+    const queue = []; // { frame, captureMs, arrival, due }, oldest capture first
+    const transit = []; // recent arrival - capture, in ms
+    const arrivals = [];
+    const paints = [];
+    const addedLatency = [];
+    let depth = 0;
+    let lastCaptureMs = null;
+    let timer = null;
+    let bypass = false;
+    let dropped = 0;
+    let floor = 0;
+
+    function show(entry, now) {
+      paint(entry.frame);
+      pushWindow(paints, now, STATS_WINDOW);
+      pushWindow(addedLatency, now - entry.arrival, STATS_WINDOW);
+    }
+
+    // Paint the frame that is due; frames overtaken by a newer due frame are skipped
+    function tick() {
+      timer = null;
+      const now = performance.now();
+      while (queue.length > 1 && queue[1].due <= now) {
+        queue.shift();
+        dropped++;
+      }
+      if (queue.length && queue[0].due <= now + 1) show(queue.shift(), now);
+      schedule();
+    }
+
+    function schedule() {
+      if (timer !== null || queue.length === 0) return;
+      timer = setTimeout(tick, Math.max(0, queue[0].due - performance.now()));
+    }
+
+    function flush() {
+      if (timer !== null) clearTimeout(timer);
+      timer = null;
+      const newest = queue.pop();
+      dropped += queue.length;
+      queue.length = 0;
+      if (newest) show(newest, performance.now());
+    }
+
+    function resync() {
+      flush();
+      transit.length = 0;
+      depth = 0;
+    }
+
+    /**
+     * Queue a frame for playout
+     * @param {*} frame - Passed to paint
+     * @param {number|null} captureMs - Camera capture time; null paints at once
+     */
+    function push(frame, captureMs) {
+      const now = performance.now();
+      pushWindow(arrivals, now, STATS_WINDOW);
+      if (bypass || captureMs === null || captureMs === undefined) {
+        flush();
+        show({ frame, arrival: now }, now);
+        return;
+      }
+      if (lastCaptureMs !== null && Math.abs(captureMs - lastCaptureMs) > RESYNC_GAP_MS) resync();
+      if (lastCaptureMs !== null && captureMs < lastCaptureMs) {
+        dropped++; // Arrived after a newer frame was queued
+        return;
+      }
+      lastCaptureMs = captureMs;
+
+      pushWindow(transit, now - captureMs, JITTER_WINDOW);
+      const base = Math.min(...transit);
+      const target = Math.min(MAX_DEPTH_MS, percentile(transit.map((t) => t - base), JITTER_PERCENTILE));
+      depth = target > depth ? target : depth - (depth - target) * DEPTH_SHRINK;
+
+      queue.push({ frame, captureMs, arrival: now, due: captureMs + Math.max(base + depth, floor) });
+      if (queue.length > MAX_QUEUED) {
+        queue.shift();
+        dropped++;
+      }
+      schedule();
+    }
+
+    // Lowest latency: paint every frame on arrival
+    function setBypass(on) {
+      bypass = on;
+      if (on) flush();
+    }
+
+    // Latency this buffer needs on its own: base transit plus depth
+    function latency() {
+      return transit.length ? Math.min(...transit) + depth : null;
+    }
+
+    // Paint no earlier than capture + ms (0: no floor)
+    function setFloor(ms) {
+      floor = ms;
+    }
+
+    function reset() {
+      if (timer !== null) clearTimeout(timer);
+      timer = null;
+      queue.length = 0;
+      transit.length = 0;
+      arrivals.length = 0;
+      paints.length = 0;
+      addedLatency.length = 0;
+      depth = 0;
+      lastCaptureMs = null;
+      dropped = 0;
+      floor = 0;
+    }
+
+    // Smoothness is the spread of the intervals between paints; compare it with
+    // the spread between arrivals to see what the buffer removed
+    function stats() {
+      return {
+        mode: bypass ? 'lowest latency' : 'smooth',
+        depthMs: depth,
+        queued: queue.length,
+        dropped,
+        arrivalJitterMs: intervalStdDev(arrivals),
+        paintJitterMs: intervalStdDev(paints),
+        addedLatencyMs: addedLatency.length ? addedLatency.reduce((a, b) => a + b, 0) / addedLatency.length : 0,
+      };
+    }
+
+    return { push, setBypass, setFloor, latency, reset, stats };
+  }
+
+  window.JitterBuffer = { create };
+})();
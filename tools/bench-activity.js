@@ -0,0 +1,128 @@
+// Activity index: ingest overhead and heatmap query time
+// Feeds a simulated day of one camera (10 fps, mostly a still scene with a
+// few busy periods and motion events) through the relay's activity index
+// (backend/services/activityIndex.js), then asks for the day's heatmap. The
+// baseline is the scan the index replaces: the same day kept as a per-frame
+// log (one JSON line per frame with time and size) and read end to end to
+// build the same heatmap.
+//
+// Reported: ingest cost per frame next to parsing the frame alone, write-back
+// cost, heatmap query time from the open day's in-memory column and from a
+// closed day's file, and the log scan.
+//
+// Usage: node tools/bench-activity.js [--fps 10] [--buckets 96] [--queries 200]
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { performance } = require('perf_hooks');
+const { parseFrame } = require('../backend/services/streamProfiles.js');
+const { createActivityIndex, FILE_SIZE } = require('../backend/services/activityIndex.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const FPS = arg('fps', 10);
+const BUCKETS = arg('buckets', 96);
+const QUERIES = arg('queries', 200);
+const DAY_MS = 86400000;
+const CAMERA_ID = 'cam0';
+
+const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'zcc-activity-'));
+const yesterday = Date.now() - (Date.now() % DAY_MS) - DAY_MS;
+
+// One frame message per capture: 0xA2 in server time, sizes from a still scene
+// with busy hours, and a motion event (0xA3 burst) every ~40 minutes
+const payload = Buffer.alloc(6 + 120000);
+function frameAt(ms, i) {
+  const hour = Math.floor((ms - yesterday) / 3600000) % 24;
+  const busy = hour === 8 || hour === 12 || hour === 17;
+  const event = i % (FPS * 2400) < FPS * 20;
+  const size = Math.round(40000 * (1 + (busy ? 0.4 * Math.sin(i / 7) : 0.02 * Math.sin(i))));
+  payload[0] = event ? 0xa3 : 0xa2;
+  payload[1] = 0x80; // main profile, capture time in server time
+  payload.writeUInt32LE(ms % 2 ** 32, 2);
+  return payload.subarray(0, 6 + size);
+}
+
+const frames = 86400 * FPS;
+const times = new Float64Array(frames);
+for (let i = 0; i < frames; i++) times[i] = yesterday + (i * 1000) / FPS;
+
+// Parsing alone, for scale: the relay does this for every frame anyway
+let t0 = performance.now();
+let sink = 0;
+for (let i = 0; i < frames; i++) sink += parseFrame(frameAt(times[i], i)).jpeg.length;
+const parseNs = ((performance.now() - t0) * 1e6) / frames;
+
+const index = createActivityIndex({ settings: { dir, flushIntervalMs: 0 } });
+t0 = performance.now();
+let flushMs = 0;
+for (let i = 0; i < frames; i++) {
+  index.recordFrame(CAMERA_ID, frameAt(times[i], i));
+  if (i % FPS === FPS - 1) {
+    // Write-back once a simulated second, as the relay's flush timer does
+    const f0 = performance.now();
+    index.flush();
+    flushMs += performance.now() - f0;
+  }
+}
+const ingestNs = ((performance.now() - t0 - flushMs) * 1e6) / frames - parseNs;
+const flushUsPerSecond = (flushMs * 1000) / 86400;
+
+function timeQueries(run) {
+  const t = performance.now();
+  let result;
+  for (let q = 0; q < QUERIES; q++) result = run();
+  return { ms: (performance.now() - t) / QUERIES, result };
+}
+
+const date = new Date(yesterday).toISOString().slice(0, 10);
+const inMemory = timeQueries(() => index.heatmap(CAMERA_ID, date, BUCKETS));
+index.close();
+const reader = createActivityIndex({ settings: { dir, flushIntervalMs: 0 } });
+const fromFile = timeQueries(() => reader.heatmap(CAMERA_ID, date, BUCKETS));
+const fineFromFile = timeQueries(() => reader.heatmap(CAMERA_ID, date, 1440));
+
+// Baseline: per-frame log scanned end to end
+const logFile = path.join(dir, 'frames.jsonl');
+const fd = fs.openSync(logFile, 'w');
+let lines = [];
+for (let i = 0; i < frames; i++) {
+  const buf = frameAt(times[i], i);
+  lines.push(JSON.stringify({ t: times[i], size: buf.length - 6, event: buf[0] === 0xa3 }));
+  if (lines.length === 10000) {
+    fs.writeSync(fd, lines.join('\n') + '\n');
+    lines = [];
+  }
+}
+fs.writeSync(fd, lines.join('\n') + '\n');
+fs.closeSync(fd);
+const scanStart = performance.now();
+const bucketMs = DAY_MS / BUCKETS;
+const scanned = new Array(BUCKETS).fill(null);
+let average = 0;
+for (const line of fs.readFileSync(logFile, 'utf8').split('\n')) {
+  if (!line) continue;
+  const { t, size, event } = JSON.parse(line);
+  const score = event ? 254 : average ? Math.min(254, Math.round((Math.abs(size - average) / average / 0.5) * 254)) : 0;
+  average = average ? average + (size - average) / 8 : size;
+  const b = Math.floor((t - yesterday) / bucketMs);
+  scanned[b] = Math.max(scanned[b] ?? 0, score);
+}
+const scanMs = performance.now() - scanStart;
+const logBytes = fs.statSync(logFile).size;
+
+const same = JSON.stringify(scanned) === JSON.stringify(fromFile.result.buckets);
+console.log(`one camera, ${FPS} fps, ${frames} frames over ${date}; heatmap of ${BUCKETS} buckets`);
+console.log('');
+console.log(`ingest              ${ingestNs.toFixed(0).padStart(8)} ns/frame  (on top of building and parsing the message: ${parseNs.toFixed(0)} ns)`);
+console.log(`write-back          ${flushUsPerSecond.toFixed(1).padStart(8)} us per second of video`);
+console.log(`index size          ${(FILE_SIZE / 1024).toFixed(1).padStart(8)} KB per camera-day`);
+console.log(`query, open day     ${inMemory.ms.toFixed(3).padStart(8)} ms  (in-memory column)`);
+console.log(`query, closed day   ${fromFile.ms.toFixed(3).padStart(8)} ms  (1440 buckets: ${fineFromFile.ms.toFixed(3)} ms)`);
+console.log(`full log scan       ${scanMs.toFixed(0).padStart(8)} ms  over ${(logBytes / 1048576).toFixed(1)} MB`);
+console.log(`heatmaps agree      ${same ? 'yes' : 'NO'}`);
+fs.rmSync(dir, { recursive: true, force: true });
+if (sink < 0) console.log(sink);
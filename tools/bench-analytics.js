@@ -0,0 +1,159 @@
+// Analytics on relayed frames: frames/s per core and detection latency
+// Cameras send --jpeg at --fps each into the relay's analytics service
+// (backend/services/analytics.js), which samples them, batches them and runs
+// decode + detection on its worker threads. Each run lasts --seconds; the
+// whole process's CPU time (event loop and workers) gives frames analysed per
+// CPU-second, i.e. per core. Latency is from the frame reaching the relay to
+// its detections being published.
+//   inline        - decode and detect one frame on the event loop, the cost
+//                   every frame would add to the relay without the workers
+//   batch N       - all frames offered (no sampling budget), batches of up to
+//                   N: what the pool sustains and how batching changes it
+//   budget        - the configured budget (ANALYTICS_MAX_FPS, _CAMERA_MAX_FPS)
+// The built-in motion detector is then checked on a block moving across the
+// decoded frame.
+//
+// Usage: node tools/bench-analytics.js --jpeg frame.jpg [--cameras 16] [--fps 10] [--seconds 5]
+//          [--workers N]
+const fs = require('fs');
+const os = require('os');
+const { performance } = require('perf_hooks');
+const config = require('../backend/config/app-config.js');
+const { createAnalytics } = require('../backend/services/analytics.js');
+const { createMotionDetector, decodeInto } = require('../backend/services/analyticsWorker.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const CAMERAS = Number(arg('cameras', 16));
+const FPS = Number(arg('fps', 10));
+const SECONDS = Number(arg('seconds', 5));
+const WORKERS = Number(arg('workers', config.analytics.workers));
+const jpegPath = arg('jpeg');
+if (!jpegPath) {
+  console.error('Usage: node tools/bench-analytics.js --jpeg frame.jpg [--cameras 16] [--fps 10] [--seconds 5] [--workers N]');
+  process.exit(1);
+}
+const jpeg = fs.readFileSync(jpegPath);
+const { inputWidth: width, inputHeight: height } = config.analytics;
+const BLOCK_W = 16; // Moving block for the detector check, input pixels
+const BLOCK_H = 40;
+
+// Published events are counted, not sent anywhere
+const io = { to: () => ({ emit: () => {} }) };
+const activeCameras = {};
+for (let c = 0; c < CAMERAS; c++) activeCameras[`cam${c}`] = { userId: 1 };
+
+function inlineMs() {
+  const detector = createMotionDetector({ width, height });
+  const input = new Float32Array(width * height);
+  const runs = 50;
+  const once = () => {
+    decodeInto(jpeg, input, 0, width, height);
+    detector.detect({ input, count: 1, width, height, cameraIds: ['cam0'] });
+  };
+  once();
+  const t0 = performance.now();
+  for (let i = 0; i < runs; i++) once();
+  return (performance.now() - t0) / runs;
+}
+
+async function run(name, overrides) {
+  const settings = { ...config.analytics, workers: WORKERS, ...overrides };
+  const analytics = createAnalytics(io, activeCameras, { settings });
+  await new Promise((resolve) => setTimeout(resolve, 300)); // Let the threads start
+
+  const cpu0 = process.cpuUsage();
+  const t0 = performance.now();
+  let offered = 0;
+  let feedMs = 0;
+  const next = new Array(CAMERAS).fill(t0);
+  await new Promise((resolve) => {
+    const timer = setInterval(() => {
+      const t = performance.now();
+      if (t - t0 >= SECONDS * 1000) {
+        clearInterval(timer);
+        resolve();
+        return;
+      }
+      for (let c = 0; c < CAMERAS; c++) {
+        while (next[c] <= t) {
+          const f0 = performance.now();
+          analytics.feed(`cam${c}`, jpeg);
+          feedMs += performance.now() - f0;
+          next[c] += 1000 / FPS;
+          offered++;
+        }
+      }
+    }, 1);
+  });
+  const wallS = (performance.now() - t0) / 1000;
+  const cpu = process.cpuUsage(cpu0);
+  const cpuS = (cpu.user + cpu.system) / 1e6;
+  const stats = analytics.stats();
+  analytics.close();
+  return { name, offered, wallS, cpuS, feedMs, ...stats };
+}
+
+function movingBlock() {
+  const detector = createMotionDetector({ width, height });
+  const background = new Float32Array(width * height);
+  decodeInto(jpeg, background, 0, width, height);
+  const input = new Float32Array(width * height);
+  let found = 0;
+  let iouSum = 0;
+  const frames = 30;
+  detector.detect({ input: background, count: 1, width, height, cameraIds: ['cam'] });
+  for (let f = 0; f < frames; f++) {
+    input.set(background);
+    const x = 8 + Math.round(((width - BLOCK_W - 16) * f) / frames);
+    const y = Math.round((height - BLOCK_H) / 2);
+    for (let yy = y; yy < y + BLOCK_H; yy++) {
+      for (let xx = x; xx < x + BLOCK_W; xx++) input[yy * width + xx] = input[yy * width + xx] > 0.5 ? 0.1 : 0.9;
+    }
+    const [detections] = detector.detect({ input, count: 1, width, height, cameraIds: ['cam'] });
+    const truth = [x / width, y / height, BLOCK_W / width, BLOCK_H / height];
+    let best = 0;
+    for (const d of detections) {
+      const ix = Math.max(0, Math.min(d.box[0] + d.box[2], truth[0] + truth[2]) - Math.max(d.box[0], truth[0]));
+      const iy = Math.max(0, Math.min(d.box[1] + d.box[3], truth[1] + truth[3]) - Math.max(d.box[1], truth[1]));
+      const inter = ix * iy;
+      best = Math.max(best, inter / (d.box[2] * d.box[3] + truth[2] * truth[3] - inter));
+    }
+    if (best > 0.3) found++;
+    iouSum += best;
+  }
+  return { found, frames, iou: iouSum / frames };
+}
+
+(async () => {
+  const inline = inlineMs();
+  const runs = [];
+  for (const batchSize of [1, 4, 8, 16]) {
+    runs.push(await run(`batch ${batchSize}`, { batchSize, maxFps: Infinity, cameraMaxFps: Infinity }));
+  }
+  runs.push(await run(`budget ${config.analytics.maxFps}/s`, {}));
+  const motion = movingBlock();
+
+  console.log(
+    `${CAMERAS} cameras x ${FPS} fps of ${jpegPath} (${(jpeg.length / 1024).toFixed(0)} KB), ` +
+      `detector input ${width}x${height}, ${WORKERS} worker(s) on ${os.cpus().length} core(s), ${SECONDS} s per run`
+  );
+  console.log(`inline: ${inline.toFixed(2)} ms of event loop per frame (${(1000 / inline).toFixed(0)} frames/s per core)`);
+  console.log('');
+  console.log('                offered  analysed/s  dropped  frames/s/core  latency p50    p99   loop ms/s');
+  for (const r of runs) {
+    console.log(
+      `${r.name.padEnd(14)} ${(r.offered / r.wallS).toFixed(0).padStart(8)} ${(r.analysed / r.wallS).toFixed(1).padStart(11)} ` +
+        `${String(r.dropped).padStart(8)} ${(r.analysed / r.cpuS).toFixed(0).padStart(14)} ` +
+        `${r.latencyMs.p50.toFixed(0).padStart(9)} ms ${r.latencyMs.p99.toFixed(0).padStart(5)} ms ${(r.feedMs / r.wallS).toFixed(1).padStart(9)}`
+    );
+  }
+  console.log('');
+  console.log(
+    `motion detector: ${BLOCK_W}x${BLOCK_H} block moving over the frame found in ${motion.found}/${motion.frames} frames, ` +
+      `mean IoU ${motion.iou.toFixed(2)}`
+  );
+})();
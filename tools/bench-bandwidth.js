@@ -0,0 +1,198 @@
+// Shared-uplink simulation: per-site budgets vs every camera for itself
+// Simulates cameras behind one access point whose uplink is shared as a
+// fluid (active uploads split it equally, like competing TCP flows). Camera
+// sends block until the frame is out, as in the firmware, so a congested
+// link shows up as long transit and fewer frames. Cameras differ in frame
+// size, priority and viewer count. In the budgeted run the relay's allocator
+// (backend/services/bandwidth.js) sees every frame as it arrives and pushes
+// budgets, which simulated cameras enforce with the firmware's token bucket,
+// frame pacing and quality steps. Cameras come online a couple of seconds
+// apart, as after a site power cut, so the relay sees the uplink before it
+// fills up.
+//
+// Reported per run: goodput (frames arriving within --deadline ms of capture),
+// p95 transit, Jain's fairness index over goodput per unit of weight
+// (priority x (1 + viewers)), and per camera delivered fps and kbps.
+//
+// Usage: node tools/bench-bandwidth.js [--cameras 10] [--uplink-kbps 6000]
+//          [--seconds 120] [--deadline 500]
+const config = require('../backend/config/app-config.js');
+const { createBandwidthAllocator } = require('../backend/services/bandwidth.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const CAMERAS = arg('cameras', 10);
+const UPLINK_BYTES_PER_MS = (arg('uplink-kbps', 6000) * 1000) / 8 / 1000;
+const SECONDS = arg('seconds', 120);
+const DEADLINE_MS = arg('deadline', 500);
+const BASE_TRANSIT_MS = 15;
+const CAMERA_FPS = 10;
+const QUALITY_DEFAULT = 6;
+const START_STAGGER_MS = 2000;
+
+// Firmware constants (ESP/ESP32_S3.c)
+const BUDGET_BURST_MS = 500;
+const BUDGET_ADJUST_INTERVAL_MS = 2000;
+const BUDGET_QUALITY_STEP = 4;
+const BUDGET_QUALITY_MAX = 40;
+
+function simulate(budgeted) {
+  let now = 0;
+  const cameras = [];
+  for (let i = 0; i < CAMERAS; i++) {
+    cameras.push({
+      id: `cam${i}`,
+      // Frame size at the default quality: a mix of XGA and SVGA cameras
+      baseBytes: i % 3 === 0 ? 90000 : i % 3 === 1 ? 60000 : 35000,
+      priority: i === 0 ? 3 : i < 3 ? 2 : 1,
+      viewers: i === 0 ? 3 : i < 5 ? 1 : i % 2,
+      quality: QUALITY_DEFAULT,
+      sending: null, // { remaining, captureMs, bytes }
+      nextCapture: i * START_STAGGER_MS,
+      budget: { kbps: 0, fps: 0, tokens: 0, refillAt: 0, nextFrame: 0, windowStart: 0, sent: 0, skipped: 0 },
+      delivered: [], // { captureMs, arrival, bytes }
+    });
+  }
+  const byId = new Map(cameras.map((c) => [c.id, c]));
+
+  const activeCameras = {};
+  for (const c of cameras) {
+    activeCameras[c.id] = {
+      ws: { readyState: 1, send: (msg) => applyBudget(c, JSON.parse(msg)) },
+    };
+  }
+  const allocator = budgeted
+    ? createBandwidthAllocator(activeCameras, {
+        streamProfiles: { viewerCount: (id) => byId.get(id).viewers },
+        settings: { ...config.bandwidth, intervalMs: 0 },
+        now: () => now,
+      })
+    : null;
+  cameras.forEach((c) => allocator?.cameraConnected(c.id, { site: 'site', priority: c.priority }));
+
+  function applyBudget(c, { kbps, fps }) {
+    const b = c.budget;
+    Object.assign(b, { kbps, fps: kbps ? fps : 0, tokens: (kbps * BUDGET_BURST_MS) / 8, refillAt: now, nextFrame: now, windowStart: now, sent: 0, skipped: 0 });
+    if (!kbps) c.quality = QUALITY_DEFAULT;
+  }
+
+  function admit(c, len) {
+    const b = c.budget;
+    if (!b.kbps) return true;
+    const elapsed = Math.min(now - b.refillAt, BUDGET_BURST_MS);
+    b.refillAt = now;
+    b.tokens = Math.min(b.tokens + (elapsed * b.kbps) / 8, (b.kbps * BUDGET_BURST_MS) / 8);
+    if (b.tokens <= 0) {
+      b.skipped++;
+      return false;
+    }
+    b.tokens -= len;
+    b.sent++;
+    if (b.fps) b.nextFrame = now + Math.floor(1000 / b.fps);
+    return true;
+  }
+
+  function adjustQuality(c) {
+    const b = c.budget;
+    if (!b.kbps || now - b.windowStart < BUDGET_ADJUST_INTERVAL_MS) return;
+    if (b.skipped > b.sent) c.quality = Math.min(c.quality + BUDGET_QUALITY_STEP, BUDGET_QUALITY_MAX);
+    else if (b.skipped === 0 && b.tokens > (b.kbps * BUDGET_BURST_MS) / 16) c.quality = Math.max(c.quality - BUDGET_QUALITY_STEP, QUALITY_DEFAULT);
+    b.windowStart = now;
+    b.sent = 0;
+    b.skipped = 0;
+  }
+
+  const message = Buffer.alloc(6 + 200000);
+  message[0] = 0xa2;
+
+  for (now = 0; now < SECONDS * 1000; now++) {
+    // Cameras: capture when the loop is free (sends block), the frame slot has
+    // come and the budget lets the frame out
+    for (const c of cameras) {
+      if (c.sending || now < c.nextCapture) continue;
+      if (c.budget.fps && now < c.budget.nextFrame) continue;
+      c.nextCapture = now + 1000 / CAMERA_FPS;
+      const bytes = Math.round((c.baseBytes * QUALITY_DEFAULT) / c.quality);
+      if (admit(c, bytes)) c.sending = { remaining: bytes, captureMs: now, bytes };
+      adjustQuality(c);
+    }
+
+    // Uplink: active uploads share it equally
+    const active = cameras.filter((c) => c.sending);
+    const share = UPLINK_BYTES_PER_MS / Math.max(1, active.length);
+    for (const c of active) {
+      c.sending.remaining -= share;
+      if (c.sending.remaining > 0) continue;
+      const { captureMs, bytes } = c.sending;
+      c.sending = null;
+      const arrival = now + BASE_TRANSIT_MS;
+      c.delivered.push({ captureMs, arrival, bytes });
+      if (allocator) {
+        message.writeUInt32LE(captureMs, 2);
+        const saved = now;
+        now = arrival; // The relay sees it after the last hop
+        allocator.recordFrame(c.id, message.subarray(0, 6 + bytes));
+        now = saved;
+      }
+    }
+
+    if (allocator && now % 1000 === 999) allocator.allocate();
+  }
+
+  // Measure the second half, once every camera is up and the allocator has settled
+  const from = Math.max(CAMERAS * START_STAGGER_MS, (SECONDS * 1000) / 2);
+  const span = (SECONDS * 1000 - from) / 1000;
+  const transits = [];
+  const perCamera = cameras.map((c) => {
+    const frames = c.delivered.filter((d) => d.captureMs >= from);
+    frames.forEach((d) => transits.push(d.arrival - d.captureMs));
+    const fresh = frames.filter((d) => d.arrival - d.captureMs <= DEADLINE_MS);
+    return {
+      id: c.id,
+      weight: c.priority * (1 + c.viewers),
+      fps: fresh.length / span,
+      kbps: (fresh.reduce((a, d) => a + d.bytes, 0) * 8) / 1000 / span,
+      quality: c.quality,
+    };
+  });
+  transits.sort((a, b) => a - b);
+  const normalized = perCamera.map((p) => p.kbps / p.weight);
+  const jain = normalized.reduce((a, b) => a + b, 0) ** 2 / (normalized.length * normalized.reduce((a, b) => a + b * b, 0) || 1);
+  return {
+    goodputKbps: perCamera.reduce((a, p) => a + p.kbps, 0),
+    goodFps: perCamera.reduce((a, p) => a + p.fps, 0),
+    p95TransitMs: transits[Math.floor(transits.length * 0.95)] || 0,
+    jain,
+    perCamera,
+  };
+}
+
+const print = console.log;
+console.log = () => {}; // Keep the allocator's budget logging out of the report
+
+const runs = [
+  ['each camera for itself', simulate(false)],
+  ['per-site budgets', simulate(true)],
+];
+print(`${CAMERAS} cameras, uplink ${(UPLINK_BYTES_PER_MS * 8).toFixed(0)} kbps, deadline ${DEADLINE_MS} ms, ${SECONDS} s`);
+print('');
+print('run                      goodput_kbps  fresh_fps  p95_transit_ms  jain_weighted');
+for (const [name, r] of runs) {
+  print(
+    `${name.padEnd(23)}  ${r.goodputKbps.toFixed(0).padStart(12)}  ${r.goodFps.toFixed(1).padStart(9)}  ` +
+      `${r.p95TransitMs.toFixed(0).padStart(14)}  ${r.jain.toFixed(3).padStart(13)}`
+  );
+}
+print('');
+print('camera  weight  ' + runs.map(([name]) => `${name.split(' ')[0]}: fps  kbps  q`.padStart(26)).join('  '));
+for (let i = 0; i < CAMERAS; i++) {
+  const cols = runs.map(([, r]) => {
+    const p = r.perCamera[i];
+    return `${p.fps.toFixed(1).padStart(13)}  ${p.kbps.toFixed(0).padStart(5)}  ${String(p.quality).padStart(2)}`;
+  });
+  const p = runs[0][1].perCamera[i];
+  print(`${p.id.padEnd(6)}  ${String(p.weight).padStart(6)}  ${cols.join('  ')}`);
+}
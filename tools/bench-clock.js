@@ -0,0 +1,165 @@
+// Camera clock synchronisation accuracy under Wi-Fi-like delays
+// Simulates cameras whose boot clocks start at random times and run fast or
+// slow by up to --drift-ppm, connected over links with asymmetric, bursty
+// delay: a base transit plus exponential queueing each way, and a camera that
+// is often in the middle of sending a frame when a probe arrives, so it reads
+// the probe late. The relay's estimator (backend/services/clockSync.js) runs
+// on simulated time, and the camera maps capture times with the firmware's
+// formula (build_timed_prefix in ESP/ESP32_S3.c).
+//
+// Reported per camera, after the first minute: true error of the server-time
+// stamps (stamp minus true server time at capture), the error the relay
+// measured and would report, and the fitted drift against the real one. The
+// first line is the baseline the request started from: frames stamped by the
+// relay on arrival, whose error is the frame's upload delay.
+//
+// Usage: node tools/bench-clock.js [--cameras 4] [--minutes 30] [--drift-ppm 40]
+//          [--jitter-ms 8] [--busy 0.5]
+const { createClockSync } = require('../backend/services/clockSync.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const CAMERAS = arg('cameras', 4);
+const MINUTES = arg('minutes', 30);
+const DRIFT_PPM = arg('drift-ppm', 40);
+const JITTER_MS = arg('jitter-ms', 8); // mean queueing delay per direction
+const BUSY_SHARE = arg('busy', 0.5); // share of probes arriving while the camera sends a frame
+const BASE_MS = 2;
+const FRAME_SEND_MS = 60; // longest a probe waits behind a frame send
+const FRAME_UPLOAD_MEAN_MS = 45; // arrival stamping baseline: 40 KB JPEG over a busy link
+const PROCESSING_MS = 0.3; // probe read to reply sent
+const SETTLE_MS = 60000;
+
+// Deterministic runs (mulberry32)
+let seed = 42;
+function random() {
+  seed = (seed + 0x6d2b79f5) | 0;
+  let t = Math.imul(seed ^ (seed >>> 15), 1 | seed);
+  t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t;
+  return ((t ^ (t >>> 14)) >>> 0) / 2 ** 32;
+}
+const exponential = (mean) => -Math.log(1 - random()) * mean;
+
+let now = 1.7e12;
+const events = []; // { at, fn }, kept sorted
+function at(time, fn) {
+  let i = events.length;
+  while (i > 0 && events[i - 1].at > time) i--;
+  events.splice(i, 0, { at: time, fn });
+}
+
+const cameras = [];
+const activeCameras = {};
+const settings = { intervalMs: 0, probes: 8, probeSpacingMs: 50, replyTimeoutMs: 500 };
+const clock = createClockSync(null, activeCameras, { settings, now: () => now });
+
+for (let i = 0; i < CAMERAS; i++) {
+  const camera = {
+    id: `cam${i}`,
+    bootAt: now - 1000 * (60 + random() * 86400), // booted up to a day ago
+    drift: ((random() * 2 - 1) * DRIFT_PPM) / 1e6, // camera clock rate - 1
+    mapping: null, // { cameraMs, serverMs, ppm } as last sent by the relay
+    errors: [],
+    measured: [],
+  };
+  // Camera clock (ms since boot) at a server time, and back
+  camera.cameraMs = (t) => (t - camera.bootAt) * (1 + camera.drift);
+  camera.stamp = (cameraMs) => {
+    const m = camera.mapping;
+    const since = cameraMs - m.cameraMs;
+    return m.serverMs + since + (since * m.ppm) / 1e6;
+  };
+  cameras.push(camera);
+  activeCameras[camera.id] = {
+    ws: {
+      readyState: 1,
+      send: (text) => {
+        const msg = JSON.parse(text);
+        if (msg.type === 'clock') {
+          camera.mapping = { cameraMs: msg.camera_ms, serverMs: msg.server_ms, ppm: msg.drift_ppm };
+          return;
+        }
+        // Probe: out over the link, read late if a frame send is in progress
+        const busy = random() < BUSY_SHARE ? random() * FRAME_SEND_MS : 0;
+        const readAt = now + BASE_MS + exponential(JITTER_MS) + busy;
+        at(readAt, () => {
+          const t2 = camera.cameraMs(now);
+          const t3 = camera.cameraMs(now + PROCESSING_MS);
+          const reply = Buffer.alloc(21);
+          reply[0] = 0xa4;
+          reply.writeUInt32LE(msg.id, 1);
+          reply.writeBigUInt64LE(BigInt(Math.round(t2 * 1000)), 5);
+          reply.writeBigUInt64LE(BigInt(Math.round(t3 * 1000)), 13);
+          at(now + PROCESSING_MS + BASE_MS + exponential(JITTER_MS), () => clock.handleReply(camera.id, reply));
+        });
+      },
+    },
+  };
+}
+
+// Rounds as the relay schedules them: a few quick ones, then every 30 s
+function scheduleRounds(camera, start) {
+  let t = start;
+  for (let round = 0; t < now + MINUTES * 60000; round++) {
+    const roundStart = t;
+    for (let p = 0; p < settings.probes; p++) at(roundStart + p * settings.probeSpacingMs, () => clock.probe(camera.id));
+    at(roundStart + settings.probes * settings.probeSpacingMs + settings.replyTimeoutMs, () => {
+      clock.finishRound(camera.id);
+      const e = clock.stats()[camera.id].errorMs;
+      if (now - start > SETTLE_MS && e !== null) camera.measured.push(e);
+    });
+    t += round < 4 ? 2000 : 30000;
+  }
+}
+
+const start = now;
+const baseline = [];
+for (const camera of cameras) {
+  clock.cameraConnected(camera.id);
+  scheduleRounds(camera, start + random() * 1000);
+}
+// A capture every 100 ms per camera once settled: true stamp error
+for (let t = start + SETTLE_MS; t < start + MINUTES * 60000; t += 100) {
+  at(t, () => {
+    for (const camera of cameras) {
+      if (!camera.mapping) continue;
+      camera.errors.push(Math.abs(camera.stamp(camera.cameraMs(now)) - now));
+      baseline.push(BASE_MS + exponential(FRAME_UPLOAD_MEAN_MS));
+    }
+  });
+}
+
+while (events.length) {
+  const e = events.shift();
+  now = e.at;
+  e.fn();
+}
+
+function summary(values) {
+  const sorted = values.slice().sort((a, b) => a - b);
+  const p = (q) => sorted[Math.min(sorted.length - 1, Math.floor(q * sorted.length))] || 0;
+  return { p50: p(0.5), p95: p(0.95), max: sorted[sorted.length - 1] || 0 };
+}
+
+const print = (label, s, extra = '') =>
+  console.log(`${label.padEnd(22)}  ${s.p50.toFixed(2).padStart(7)}  ${s.p95.toFixed(2).padStart(7)}  ${s.max.toFixed(2).padStart(7)}  ${extra}`);
+
+console.log(`${CAMERAS} cameras, ${MINUTES} min, drift up to ${DRIFT_PPM} ppm, queueing ${JITTER_MS} ms mean each way, ${BUSY_SHARE * 100}% probes read late`);
+console.log('');
+console.log('stamp error (ms)            p50      p95      max');
+print('arrival stamping', summary(baseline));
+const stats = clock.stats();
+for (const camera of cameras) {
+  const fitted = stats[camera.id].driftPpm;
+  // Server ticks (1 - drift) as fast as the camera: that is what the fit estimates
+  const real = (1 / (1 + camera.drift) - 1) * 1e6;
+  print(`${camera.id} synced`, summary(camera.errors), `drift ${fitted.toFixed(1)} ppm (real ${real.toFixed(1)})`);
+  print(`${camera.id} reported`, summary(camera.measured));
+}
+const all = summary(cameras.flatMap((c) => c.errors));
+console.log('');
+print('all cameras synced', all);
+console.log(`cross-camera alignment p95 (two cameras, worst case): ${(2 * all.p95).toFixed(2)} ms`);
@@ -0,0 +1,211 @@
+// Multi-node relay scale-out: aggregate delivery vs node count
+// For each node count, starts a TCP bus broker and N relay node processes.
+// Each node hosts the same number of cameras (synthetic frames at a fixed
+// rate) and dashboard viewers; a share of each camera's viewers sit on the
+// next node so their frames cross the bus. Viewer sockets are simulated: each
+// delivery copies the frame into a per-socket packet like a WebSocket write.
+// Reports delivered frames/s, CPU per node and for the broker, cross-node
+// traffic, and the delivery rate each node could sustain at one full core.
+//
+// Usage: node tools/bench-cluster.js [--nodes 1,2,4] [--cameras 8] [--fps 10]
+//          [--viewers 4] [--remote 0.25] [--frame-kb 30] [--seconds 5]
+const { fork } = require('child_process');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const BROKER_PORT = 4199;
+const BUS_SECRET = 'bench-cluster';
+const settings = {
+  cameras: Number(arg('cameras', 8)), // per node
+  fps: Number(arg('fps', 10)),
+  viewers: Number(arg('viewers', 4)), // per camera
+  remote: Number(arg('remote', 0.25)), // share of viewers on another node
+  frameBytes: Number(arg('frame-kb', 30)) * 1024,
+  seconds: Number(arg('seconds', 5)),
+};
+
+// ---- Child roles ----
+
+function cpuSeconds() {
+  const { user, system } = process.cpuUsage();
+  return (user + system) / 1e6;
+}
+
+function runBroker() {
+  const { createBusBroker } = require('../backend/services/bus.js');
+  const broker = createBusBroker(BROKER_PORT, { secret: BUS_SECRET });
+  broker.server.on('listening', () => process.send({ ready: true }));
+  let cpuStart = 0;
+  process.on('message', (msg) => {
+    if (msg.start) cpuStart = cpuSeconds();
+    if (msg.report) process.send({ cpu: cpuSeconds() - cpuStart, ...broker.stats() });
+  });
+}
+
+function mockIo(onDeliver) {
+  const rooms = new Map();
+  const header = Buffer.alloc(16);
+  return {
+    sockets: { adapter: { rooms } },
+    to: (target) => ({
+      emit: (event, data) => {
+        if (event !== 'stream') return;
+        for (const room of [].concat(target)) {
+          for (const id of rooms.get(room) || []) {
+            onDeliver(Buffer.concat([header, data.frame]), id);
+          }
+        }
+      },
+    }),
+  };
+}
+
+function mockSocket(io, id, userId) {
+  return {
+    id,
+    user: { id: userId },
+    join: (room) => {
+      if (!io.sockets.adapter.rooms.has(room)) io.sockets.adapter.rooms.set(room, new Set());
+      io.sockets.adapter.rooms.get(room).add(id);
+    },
+    leave: (room) => io.sockets.adapter.rooms.get(room)?.delete(id),
+    emit: () => {},
+  };
+}
+
+function runNode(index, nodes) {
+  process.env.CLUSTER_BUS = 'tcp';
+  process.env.CLUSTER_BROKER_PORT = String(BROKER_PORT);
+  console.log = () => {}; // Keep per-event relay logging out of the measurement
+  const { createStreamProfiles } = require('../backend/services/streamProfiles.js');
+  const { createClusterRelay } = require('../backend/services/cluster.js');
+  const { createTcpBus } = require('../backend/services/bus.js');
+
+  let delivered = 0;
+  let deliveredBytes = 0;
+  const io = mockIo((packet) => {
+    delivered++;
+    deliveredBytes += packet.length;
+  });
+  const activeCameras = {};
+  const streamProfiles = createStreamProfiles(io, activeCameras, {});
+  const bus = createTcpBus({ host: '127.0.0.1', port: BROKER_PORT, secret: BUS_SECRET });
+  const cluster = createClusterRelay(io, activeCameras, bus, { nodeId: `node${index}`, heartbeatMs: 1000, streamProfiles });
+
+  const cameraIds = [];
+  for (let c = 0; c < settings.cameras; c++) {
+    const cameraId = `n${index}c${c}`;
+    cameraIds.push(cameraId);
+    activeCameras[cameraId] = { name: cameraId, userId: 1, status: 'online', ws: { readyState: 1, send: () => {} } };
+    streamProfiles.cameraConnected(cameraId);
+    cluster.cameraOnline(cameraId);
+  }
+
+  const frame = Buffer.alloc(settings.frameBytes, 0x55);
+  frame[0] = 0xff;
+  frame[1] = 0xd8;
+  let timers = [];
+  let cpuStart = 0;
+
+  process.on('message', (msg) => {
+    if (msg.viewers) {
+      // Viewers of every node's cameras that this node hosts
+      let n = 0;
+      for (let owner = 0; owner < nodes; owner++) {
+        for (let c = 0; c < settings.cameras; c++) {
+          for (let v = 0; v < settings.viewers; v++) {
+            const remote = nodes > 1 && v < Math.round(settings.viewers * settings.remote);
+            const host = remote ? (owner + 1) % nodes : owner;
+            if (host !== index) continue;
+            streamProfiles.setViewerProfile(mockSocket(io, `v${n++}`, 1), `n${owner}c${c}`, 'main');
+          }
+        }
+      }
+      setTimeout(() => process.send({ viewers: n }), 500);
+    } else if (msg.start) {
+      delivered = 0;
+      deliveredBytes = 0;
+      cpuStart = cpuSeconds();
+      timers = cameraIds.map((cameraId) =>
+        setInterval(() => {
+          cluster.forwardFrame(cameraId, frame);
+          streamProfiles.routeFrame(cameraId, frame);
+        }, 1000 / settings.fps)
+      );
+    } else if (msg.report) {
+      timers.forEach(clearInterval);
+      process.send({ delivered, deliveredBytes, cpu: cpuSeconds() - cpuStart, cluster: cluster.stats() });
+    }
+  });
+  setTimeout(() => process.send({ ready: true }), 1500); // Let presence settle
+}
+
+// ---- Parent ----
+
+function request(child, msg) {
+  return new Promise((resolve) => {
+    child.once('message', resolve);
+    child.send(msg);
+  });
+}
+
+function spawnRole(role, extra = []) {
+  const child = fork(__filename, [...process.argv.slice(2), '--role', role, ...extra], { stdio: ['ignore', 'inherit', 'inherit', 'ipc'] });
+  return new Promise((resolve) => child.once('message', () => resolve(child)));
+}
+
+async function runTrial(nodes) {
+  const broker = await spawnRole('broker');
+  const workers = await Promise.all([...Array(nodes).keys()].map((i) => spawnRole('node', ['--index', String(i), '--node-count', String(nodes)])));
+  await Promise.all(workers.map((w) => request(w, { viewers: true })));
+  await new Promise((r) => setTimeout(r, 1500)); // Demand reaches the owners
+
+  broker.send({ start: true });
+  workers.forEach((w) => w.send({ start: true }));
+  await new Promise((r) => setTimeout(r, settings.seconds * 1000));
+  const reports = await Promise.all(workers.map((w) => request(w, { report: true })));
+  const brokerReport = await request(broker, { report: true });
+  workers.forEach((w) => w.kill());
+  broker.kill();
+
+  const seconds = settings.seconds;
+  const delivered = reports.reduce((a, r) => a + r.delivered, 0) / seconds;
+  const maxCpu = Math.max(...reports.map((r) => r.cpu / seconds));
+  const capacity = reports.reduce((a, r) => a + r.delivered / seconds / Math.max(r.cpu / seconds, 1e-6), 0);
+  const crossMBs = reports.reduce((a, r) => a + r.cluster.bytesForwarded, 0) / seconds / 1e6;
+  return {
+    nodes,
+    cameras: nodes * settings.cameras,
+    offered: nodes * settings.cameras * settings.viewers * settings.fps,
+    delivered,
+    maxCpu,
+    brokerCpu: brokerReport.cpu / seconds,
+    crossMBs,
+    capacity,
+  };
+}
+
+async function main() {
+  const counts = arg('nodes', '1,2,4').split(',').map(Number);
+  console.log(
+    `cameras/node=${settings.cameras} fps=${settings.fps} viewers/camera=${settings.viewers} ` +
+      `remote=${settings.remote} frame=${settings.frameBytes / 1024}KB seconds=${settings.seconds}`
+  );
+  console.log('nodes  cameras  offered_fps  delivered_fps  max_node_cpu  broker_cpu  cross_MB/s  capacity_fps@1core/node');
+  for (const nodes of counts) {
+    const r = await runTrial(nodes);
+    console.log(
+      `${String(r.nodes).padStart(5)}  ${String(r.cameras).padStart(7)}  ${String(r.offered).padStart(11)}  ` +
+        `${r.delivered.toFixed(0).padStart(13)}  ${(r.maxCpu * 100).toFixed(1).padStart(11)}%  ` +
+        `${(r.brokerCpu * 100).toFixed(1).padStart(9)}%  ${r.crossMBs.toFixed(2).padStart(10)}  ${r.capacity.toFixed(0).padStart(23)}`
+    );
+  }
+}
+
+const role = arg('role', null);
+if (role === 'broker') runBroker();
+else if (role === 'node') runNode(Number(arg('index', 0)), Number(arg('node-count', 1)));
+else main();
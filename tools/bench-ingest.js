@@ -0,0 +1,131 @@
+// Camera ingest: WebSocket parsing and unmasking cost per megabyte
+// Builds a camera session the way the firmware writes it (masked binary
+// frames of timed JPEG-sized payloads), cuts it into socket reads of
+// --read-kb, and feeds it through the ws receiver the relay's camera server
+// uses, up to the relay's frame parsing. Three ways the relay and firmware
+// can be set up:
+//   before  - mask key 0x12345678 (firmware until now), binaryType
+//             'arraybuffer': every byte is unmasked on the event loop, and a
+//             frame that arrived within one read is copied out of it
+//   buffers - same key, binaryType 'nodebuffer': the frame stays a view of
+//             the read
+//   zero    - all-zero mask key as well: frames are still masked as the
+//             protocol requires, but XOR with zero is the identity, so the
+//             firmware copies instead of masking and ws skips the unmask
+// ws uses the native bufferutil module for unmasking when it is installed;
+// the output says whether it was.
+//
+// Usage: node tools/bench-ingest.js [--mb 256] [--frame-kb 40] [--read-kb 64] [--rounds 5]
+const { performance } = require('perf_hooks');
+const { Receiver } = require('ws');
+const { parseFrame } = require('../backend/services/streamProfiles.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const TOTAL_BYTES = arg('mb', 256) * 1048576;
+const FRAME_BYTES = arg('frame-kb', 40) * 1024;
+const READ_BYTES = arg('read-kb', 64) * 1024;
+const ROUNDS = arg('rounds', 5);
+const FIRMWARE_KEY = Buffer.from([0x12, 0x34, 0x56, 0x78]);
+const ZERO_KEY = Buffer.alloc(4);
+
+let bufferutil = 'not installed';
+if (!process.env.WS_NO_BUFFER_UTIL) {
+  try {
+    require.resolve('bufferutil');
+    bufferutil = 'installed';
+  } catch (err) {
+    // ws falls back to its JavaScript unmask
+  }
+}
+
+// One binary frame as websocket_write_frame sends it: 0xA2 timed prefix + JPEG
+function cameraFrame(payloadLen, key, seq) {
+  const payload = Buffer.allocUnsafe(payloadLen);
+  for (let i = 0; i < payloadLen; i++) payload[i] = (seq * 31 + i * 40503) >>> 7;
+  payload[0] = 0xa2;
+  payload[1] = 0x00;
+  payload.writeUInt32LE(seq * 100, 2);
+  payload[6] = 0xff;
+  payload[7] = 0xd8;
+  const header = payloadLen < 65536 ? Buffer.alloc(8) : Buffer.alloc(14);
+  header[0] = 0x82; // FIN + binary
+  if (payloadLen < 65536) {
+    header[1] = 0x80 | 126;
+    header.writeUInt16BE(payloadLen, 2);
+    key.copy(header, 4);
+  } else {
+    header[1] = 0x80 | 127;
+    header.writeUInt32BE(payloadLen, 6);
+    key.copy(header, 10);
+  }
+  for (let i = 0; i < payloadLen; i++) payload[i] ^= key[i & 3];
+  return Buffer.concat([header, payload]);
+}
+
+// The session as the relay's socket reads it: fresh buffers of up to READ_BYTES
+function session(key) {
+  const frames = [];
+  let bytes = 0;
+  for (let seq = 0; bytes < TOTAL_BYTES; seq++) {
+    // JPEG sizes vary frame to frame
+    const len = Math.round(FRAME_BYTES * (0.75 + ((seq * 7919) % 500) / 1000));
+    frames.push(cameraFrame(len, key, seq));
+    bytes += len;
+  }
+  const stream = Buffer.concat(frames);
+  const reads = [];
+  for (let off = 0; off < stream.length; off += READ_BYTES) {
+    reads.push(Buffer.from(stream.subarray(off, off + READ_BYTES)));
+  }
+  return { reads, payloadBytes: bytes, frames: frames.length };
+}
+
+// Feed a copy of the reads (unmasking works in place) through a receiver
+function run(name, key, binaryType) {
+  const { reads, payloadBytes, frames } = session(key);
+  const times = [];
+  let received = 0;
+  let checksum = 0;
+  for (let round = 0; round < ROUNDS; round++) {
+    const copies = reads.map((r) => Buffer.from(r));
+    const receiver = new Receiver({ binaryType, isServer: true, maxPayload: 1024 * 1024, skipUTF8Validation: true });
+    receiver.on('message', (message) => {
+      // As cameraEvents.js: view as a Buffer, then the relay's frame parse
+      const buf = Buffer.isBuffer(message) ? message : Buffer.from(message);
+      const { jpeg } = parseFrame(buf);
+      checksum ^= jpeg[jpeg.length - 1];
+      received++;
+    });
+    const t0 = performance.now();
+    for (const chunk of copies) receiver.write(chunk);
+    times.push(performance.now() - t0);
+  }
+  times.sort((a, b) => a - b);
+  const ms = times[Math.floor(times.length / 2)];
+  if (received !== frames * ROUNDS) throw new Error(`${name}: ${received} of ${frames * ROUNDS} frames parsed`);
+  return { name, ms, mb: payloadBytes / 1048576, frames, checksum };
+}
+
+const results = [
+  run('before   key 0x12345678, arraybuffer', FIRMWARE_KEY, 'arraybuffer'),
+  run('buffers  key 0x12345678, nodebuffer', FIRMWARE_KEY, 'nodebuffer'),
+  run('zero     key 0, nodebuffer', ZERO_KEY, 'nodebuffer'),
+];
+
+console.log(
+  `${results[0].frames} frames, ${results[0].mb.toFixed(0)} MB per round, ~${FRAME_BYTES / 1024} KB frames, ` +
+    `${READ_BYTES / 1024} KB reads; median of ${ROUNDS} rounds; bufferutil ${bufferutil}`
+);
+console.log('');
+console.log('                                       ms/MB      MB/s   vs before');
+for (const r of results) {
+  const perMb = r.ms / r.mb;
+  console.log(
+    `${r.name.padEnd(38)} ${perMb.toFixed(3).padStart(6)}  ${(r.mb / (r.ms / 1000)).toFixed(0).padStart(8)}   ` +
+      `${(results[0].ms / r.ms).toFixed(1).padStart(6)}x`
+  );
+}
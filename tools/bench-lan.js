@@ -0,0 +1,276 @@
+// Direct LAN MJPEG vs the relay path: latency and relay CPU per viewer
+// A simulated camera produces timed JPEG frames at a fixed rate and delivers
+// them to the same number of viewers two ways:
+//   relay  - camera -> relay process (the relay's real stream profile routing,
+//            viewer sockets as TCP connections carrying one packet per frame)
+//            -> viewers
+//   direct - viewers read multipart/x-mixed-replace straight from the camera,
+//            as the firmware's LAN server sends it (newest frame per client)
+// Capture time and arrival are taken on the same clock, so latency is exact.
+// On hardware the relay path also crosses the Wi-Fi twice (camera -> AP ->
+// relay -> AP -> viewer) where the direct path crosses it once; this bench
+// only measures the software hop. The relay's CPU is what the direct path
+// saves; the camera's uplink is what it costs (one copy per direct viewer).
+//
+// Usage: node tools/bench-lan.js [--viewers 3] [--fps 15] [--frame-kb 40] [--seconds 5]
+const { fork } = require('child_process');
+const http = require('http');
+const net = require('net');
+const { performance } = require('perf_hooks');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const RELAY_PORT = 4198;
+const CAMERA_PORT = 4197;
+const CAMERA_ID = 'cam0';
+const BOUNDARY = 'zccframe';
+const settings = {
+  viewers: Number(arg('viewers', 3)),
+  fps: Number(arg('fps', 15)),
+  frameBytes: Number(arg('frame-kb', 40)) * 1024,
+  seconds: Number(arg('seconds', 5)),
+};
+
+function cpuSeconds() {
+  const { user, system } = process.cpuUsage();
+  return (user + system) / 1e6;
+}
+
+// Length-prefixed messages over TCP, standing in for WebSocket frames
+function writeMessage(socket, buf) {
+  const len = Buffer.alloc(4);
+  len.writeUInt32LE(buf.length);
+  socket.write(Buffer.concat([len, buf]));
+}
+
+function readMessages(socket, onMessage) {
+  let pending = Buffer.alloc(0);
+  socket.on('data', (chunk) => {
+    pending = Buffer.concat([pending, chunk]);
+    while (pending.length >= 4 && pending.length >= 4 + pending.readUInt32LE(0)) {
+      const len = pending.readUInt32LE(0);
+      onMessage(pending.subarray(4, 4 + len));
+      pending = pending.subarray(4 + len);
+    }
+  });
+}
+
+// ---- Relay process ----
+
+function runRelay() {
+  console.log = () => {}; // Keep per-event relay logging out of the measurement
+  const { createStreamProfiles } = require('../backend/services/streamProfiles.js');
+  const rooms = new Map();
+  const viewerSockets = new Map();
+  const io = {
+    sockets: { adapter: { rooms } },
+    to: (target) => ({
+      emit: (event, data) => {
+        if (event !== 'stream') return;
+        // One packet per viewer, like socket.io's binary attachment per socket
+        const header = Buffer.alloc(8);
+        header.writeDoubleLE(data.captureTs ?? -1);
+        for (const room of [].concat(target)) {
+          for (const id of rooms.get(room) || []) writeMessage(viewerSockets.get(id), Buffer.concat([header, data.frame]));
+        }
+      },
+    }),
+  };
+  const activeCameras = { [CAMERA_ID]: { name: CAMERA_ID, userId: 1, status: 'online', ws: { readyState: 1, send: () => {} } } };
+  const streamProfiles = createStreamProfiles(io, activeCameras, {});
+  streamProfiles.cameraConnected(CAMERA_ID);
+
+  let viewerCount = 0;
+  const server = net.createServer((socket) => {
+    socket.setNoDelay(true);
+    socket.once('data', (hello) => {
+      if (hello.toString() === 'camera') {
+        readMessages(socket, (buf) => streamProfiles.routeFrame(CAMERA_ID, Buffer.from(buf)));
+        return;
+      }
+      const id = `v${viewerCount++}`;
+      viewerSockets.set(id, socket);
+      streamProfiles.setViewerProfile(
+        {
+          id,
+          user: { id: 1 },
+          join: (room) => (rooms.get(room) || rooms.set(room, new Set()).get(room)).add(id),
+          leave: (room) => rooms.get(room)?.delete(id),
+          emit: () => {},
+        },
+        CAMERA_ID,
+        'main'
+      );
+    });
+  });
+  let cpuStart = 0;
+  process.on('message', (msg) => {
+    if (msg.start) cpuStart = cpuSeconds();
+    if (msg.report) process.send({ cpu: cpuSeconds() - cpuStart });
+  });
+  server.listen(RELAY_PORT, '127.0.0.1', () => process.send({ ready: true }));
+}
+
+// ---- Parent: camera and viewers ----
+
+function request(child, msg) {
+  return new Promise((resolve) => {
+    child.once('message', resolve);
+    child.send(msg);
+  });
+}
+
+function createCamera() {
+  const jpeg = Buffer.alloc(settings.frameBytes, 0x55);
+  jpeg[0] = 0xff;
+  jpeg[1] = 0xd8;
+  const message = Buffer.concat([Buffer.from([0xa2, 0, 0, 0, 0, 0]), jpeg]);
+  const listeners = new Set();
+  let uplinkBytes = 0;
+  let timer = null;
+  return {
+    onFrame: (fn) => listeners.add(fn),
+    start() {
+      timer = setInterval(() => {
+        const captureMs = Math.round(performance.now());
+        message.writeUInt32LE(captureMs, 2);
+        listeners.forEach((fn) => (uplinkBytes += fn(message, jpeg, captureMs) || 0));
+      }, 1000 / settings.fps);
+    },
+    stop: () => clearInterval(timer),
+    uplinkBytes: () => uplinkBytes,
+  };
+}
+
+function createViewerStats() {
+  const latencies = [];
+  return {
+    record: (captureMs) => latencies.push(performance.now() - captureMs),
+    summary() {
+      const sorted = latencies.slice().sort((a, b) => a - b);
+      const at = (p) => sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))] || 0;
+      return { frames: sorted.length, p50: at(0.5), p95: at(0.95) };
+    },
+  };
+}
+
+// Camera's LAN server: every client gets the newest frame once it has drained the last
+function startDirectServer(camera) {
+  const clients = new Set();
+  camera.onFrame((message, jpeg, captureMs) => {
+    let bytes = 0;
+    for (const res of clients) {
+      if (res.writableNeedDrain) continue; // Slow client skips frames
+      const header = `--${BOUNDARY}\r\nContent-Type: image/jpeg\r\nContent-Length: ${jpeg.length}\r\nX-Timestamp: ${captureMs}\r\n\r\n`;
+      res.write(Buffer.concat([Buffer.from(header), jpeg, Buffer.from('\r\n')]));
+      bytes += jpeg.length;
+    }
+    return bytes;
+  });
+  const server = http.createServer((req, res) => {
+    res.writeHead(200, { 'Content-Type': `multipart/x-mixed-replace; boundary=${BOUNDARY}`, 'Cache-Control': 'no-store' });
+    res.flushHeaders();
+    res.socket.setNoDelay(true);
+    clients.add(res);
+    req.on('close', () => clients.delete(res));
+  });
+  return new Promise((resolve) => server.listen(CAMERA_PORT, '127.0.0.1', () => resolve(server)));
+}
+
+function directViewer(stats) {
+  return new Promise((resolve) => {
+    http.get(`http://127.0.0.1:${CAMERA_PORT}/stream`, (res) => {
+      let pending = Buffer.alloc(0);
+      res.on('data', (chunk) => {
+        pending = Buffer.concat([pending, chunk]);
+        for (;;) {
+          const end = pending.indexOf('\r\n\r\n');
+          if (end < 0) return;
+          const headers = pending.subarray(0, end).toString();
+          const length = Number(/Content-Length: (\d+)/.exec(headers)?.[1]);
+          if (pending.length < end + 4 + length + 2) return;
+          stats.record(Number(/X-Timestamp: (\d+)/.exec(headers)[1]));
+          pending = pending.subarray(end + 4 + length + 2);
+        }
+      });
+      resolve(res);
+    });
+  });
+}
+
+function relayViewer(stats) {
+  return new Promise((resolve) => {
+    const socket = net.connect(RELAY_PORT, '127.0.0.1', () => {
+      socket.setNoDelay(true);
+      socket.write('viewer');
+      resolve(socket);
+    });
+    readMessages(socket, (buf) => stats.record(buf.readDoubleLE(0)));
+  });
+}
+
+async function runPath(path) {
+  const camera = createCamera();
+  const stats = createViewerStats();
+  let relay = null;
+  let server = null;
+  const sockets = [];
+  if (path === 'relay') {
+    relay = fork(__filename, [...process.argv.slice(2), '--role', 'relay'], { stdio: ['ignore', 'inherit', 'inherit', 'ipc'] });
+    await new Promise((r) => relay.once('message', r));
+    const uplink = net.connect(RELAY_PORT, '127.0.0.1');
+    await new Promise((r) => uplink.once('connect', r));
+    uplink.setNoDelay(true);
+    uplink.write('camera');
+    await new Promise((r) => setTimeout(r, 100)); // Hello is read on its own
+    sockets.push(uplink);
+    camera.onFrame((message) => {
+      writeMessage(uplink, message);
+      return message.length;
+    });
+    for (let v = 0; v < settings.viewers; v++) sockets.push(await relayViewer(stats));
+  } else {
+    server = await startDirectServer(camera);
+    for (let v = 0; v < settings.viewers; v++) sockets.push(await directViewer(stats));
+  }
+  await new Promise((r) => setTimeout(r, 300));
+
+  relay?.send({ start: true });
+  camera.start();
+  await new Promise((r) => setTimeout(r, settings.seconds * 1000));
+  camera.stop();
+  const relayCpu = relay ? (await request(relay, { report: true })).cpu : 0;
+  await new Promise((r) => setTimeout(r, 200)); // Let in-flight frames land
+
+  sockets.forEach((s) => s.destroy());
+  relay?.kill();
+  server?.close();
+  const s = stats.summary();
+  return {
+    path,
+    fps: s.frames / settings.viewers / settings.seconds,
+    p50: s.p50,
+    p95: s.p95,
+    relayCpu: relayCpu / settings.seconds,
+    cpuPerFrameUs: s.frames ? (relayCpu * 1e6) / s.frames : 0,
+    uplinkKBs: camera.uplinkBytes() / 1024 / settings.seconds,
+  };
+}
+
+async function main() {
+  console.log(`viewers=${settings.viewers} fps=${settings.fps} frame=${settings.frameBytes / 1024}KB seconds=${settings.seconds}`);
+  console.log('path    fps/viewer  p50_ms  p95_ms  relay_cpu  relay_us/viewer_frame  camera_uplink_KB/s');
+  for (const path of ['relay', 'direct']) {
+    const r = await runPath(path);
+    console.log(
+      `${r.path.padEnd(6)}  ${r.fps.toFixed(1).padStart(10)}  ${r.p50.toFixed(2).padStart(6)}  ${r.p95.toFixed(2).padStart(6)}  ` +
+        `${(r.relayCpu * 100).toFixed(1).padStart(8)}%  ${r.cpuPerFrameUs.toFixed(0).padStart(21)}  ${r.uplinkKBs.toFixed(0).padStart(18)}`
+    );
+  }
+}
+
+if (arg('role') === 'relay') runRelay();
+else main();
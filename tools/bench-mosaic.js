@@ -0,0 +1,116 @@
+// Grid mosaic vs per-tile streams: server CPU and bytes to the client
+// Per tile: the relay forwards every camera frame and the browser decodes each
+// one at full size. Mosaic: the relay decodes at reduced scale into one canvas
+// and encodes it once per tick. Decode costs are measured with the relay's own
+// decoder; the mosaic encode is measured when ffmpeg-static is installed.
+// The mosaic is also run as the relay runs it, on a compositing thread
+// (mosaicWorker.js), to show what is left on the main thread per tick: the
+// copies of the tile JPEGs and the canvas handed back for the encoder.
+//
+// Usage: node tools/bench-mosaic.js --jpeg frame.jpg [--cameras 16] [--ticks 20]
+const fs = require('fs');
+const path = require('path');
+const { once } = require('events');
+const { spawnSync } = require('child_process');
+const { Worker } = require('worker_threads');
+const { performance } = require('perf_hooks');
+const config = require('../backend/config/app-config.js');
+const { decodeScaled } = require('../backend/services/jpegScaledDecoder.js');
+const { createCanvas } = require('../backend/services/mosaicWorker.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const CAMERAS = Number(arg('cameras', 16));
+const TICKS = Number(arg('ticks', 20));
+const jpegPath = arg('jpeg');
+if (!jpegPath) {
+  console.error('Usage: node tools/bench-mosaic.js --jpeg frame.jpg [--cameras 16] [--ticks 20]');
+  process.exit(1);
+}
+const jpeg = fs.readFileSync(jpegPath);
+
+function timeMs(fn, runs) {
+  fn(); // Warm up the JIT
+  const start = process.hrtime.bigint();
+  for (let i = 0; i < runs; i++) fn();
+  return Number(process.hrtime.bigint() - start) / 1e6 / runs;
+}
+
+const { tileWidth, tileHeight, quality, fps } = config.mosaic;
+const columns = Math.ceil(Math.sqrt(CAMERAS));
+const canvas = createCanvas(columns, Math.ceil(CAMERAS / columns), tileWidth, tileHeight);
+
+const fullDecodeMs = timeMs(() => decodeScaled(jpeg, 8), 3);
+const scaled = {};
+for (const n of [4, 2, 1]) scaled[n] = timeMs(() => decodeScaled(jpeg, n), 10);
+const composeMs = timeMs(() => {
+  for (let i = 0; i < CAMERAS; i++) canvas.drawTile(i, jpeg);
+}, TICKS);
+
+// Ticks through a compositing thread; main-thread time is the synchronous
+// part of sending the tiles and taking the canvas back
+async function onWorker() {
+  const worker = new Worker(path.join(__dirname, '../backend/services/mosaicWorker.js'));
+  worker.postMessage({ create: 1, columns, rows: Math.ceil(CAMERAS / columns), tileWidth, tileHeight });
+  const tiles = Array.from({ length: CAMERAS }, (_, i) => i);
+  let mainMs = 0;
+  let composeMs = 0;
+  let wallMs = 0;
+  for (let t = 0; t <= TICKS; t++) {
+    const t0 = performance.now();
+    const jpegs = tiles.map(() => new Uint8Array(jpeg));
+    worker.postMessage({ id: 1, tiles, jpegs }, jpegs.map((j) => j.buffer));
+    const t1 = performance.now();
+    const [reply] = await once(worker, 'message');
+    const t2 = performance.now();
+    Buffer.from(reply.frame.buffer, reply.frame.byteOffset, reply.frame.byteLength);
+    const t3 = performance.now();
+    if (t === 0) continue; // Warm up the JIT
+    mainMs += t1 - t0 + (t3 - t2);
+    composeMs += reply.composeMs;
+    wallMs += t3 - t0;
+  }
+  await worker.terminate();
+  return { mainMs: mainMs / TICKS, composeMs: composeMs / TICKS, wallMs: wallMs / TICKS };
+}
+
+let encodeMs = null;
+let mosaicBytes = null;
+try {
+  const ffmpegPath = require('ffmpeg-static');
+  const input = Buffer.concat(new Array(TICKS).fill(canvas.buffer));
+  const start = process.hrtime.bigint();
+  const result = spawnSync(ffmpegPath, [
+    '-loglevel', 'error', '-f', 'rawvideo', '-pix_fmt', 'yuvj420p', '-s', `${canvas.width}x${canvas.height}`,
+    '-i', 'pipe:0', '-f', 'mjpeg', '-q:v', String(quality), 'pipe:1',
+  ], { input, maxBuffer: 64 * 1024 * 1024 });
+  if (result.error) throw result.error;
+  encodeMs = Number(process.hrtime.bigint() - start) / 1e6 / TICKS;
+  mosaicBytes = result.stdout.length / TICKS;
+} catch (err) {
+  console.log(`(mosaic encode not measured: ${err.message})`);
+}
+
+console.log(`source ${jpegPath}: ${(jpeg.length / 1024).toFixed(1)} KB, ${CAMERAS} cameras, ${fps} fps mosaic ${canvas.width}x${canvas.height}`);
+console.log(`decode per frame: full ${fullDecodeMs.toFixed(2)} ms, 1/2 ${scaled[4].toFixed(2)} ms, 1/4 ${scaled[2].toFixed(2)} ms, 1/8 ${scaled[1].toFixed(2)} ms`);
+const { width, height } = decodeScaled(jpeg, 1);
+const sourcePixels = width * 8 * height * 8;
+console.log('');
+console.log('approach   server_ms/tick  client_decodes/tick  client_pixels/tick  bytes_to_client/tick');
+console.log(
+  `per-tile   ${'~0 (forward)'.padStart(14)}  ${String(CAMERAS).padStart(19)}  ${String(sourcePixels * CAMERAS).padStart(18)}  ${String(jpeg.length * CAMERAS).padStart(20)}`
+);
+const mosaicServer = encodeMs === null ? `${composeMs.toFixed(1)}+enc` : (composeMs + encodeMs).toFixed(1);
+console.log(
+  `mosaic     ${mosaicServer.padStart(14)}  ${'1'.padStart(19)}  ${String(canvas.width * canvas.height).padStart(18)}  ${String(mosaicBytes === null ? '-' : Math.round(mosaicBytes)).padStart(20)}`
+);
+console.log(`mosaic compose ${composeMs.toFixed(2)} ms/tick${encodeMs === null ? '' : `, encode ${encodeMs.toFixed(2)} ms/tick`}`);
+onWorker().then((pooled) => {
+  console.log(
+    `on a compositing thread: main thread ${pooled.mainMs.toFixed(2)} ms/tick (was ${composeMs.toFixed(2)}), ` +
+      `thread ${pooled.composeMs.toFixed(2)} ms/tick, tick round trip ${pooled.wallMs.toFixed(2)} ms`
+  );
+});
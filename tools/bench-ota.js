@@ -0,0 +1,208 @@
+// OTA updates: bytes transferred, update duration and stream downtime
+// Builds two firmware-like images (the second with code inserted in a few
+// places, a few constants changed and every address past an insertion
+// shifted), makes the delta the relay serves (backend/services/firmwareDelta.js)
+// and checks it applies back to the new image. The camera's update is then
+// replayed chunk by chunk over a link of --link-kbps (what is left of the
+// camera's airtime next to its stream) into flash written at --flash-kbs:
+//   full, serial    - the whole image, each 4 KB received and then written,
+//                     streaming stopped for the update (the naive OTA)
+//   full, pipelined - the whole image through the camera's two flash buffers:
+//                     the next 4 KB arrives while the last one is written
+//   delta, serial   - the delta, inflated and applied on the camera, one buffer
+//   delta, pipelined- the same into the two buffers, as the firmware does it
+// Per-chunk download sizes come from inflating the delta the way the camera
+// does, 1460-byte segments at a time. Stream downtime is the time the camera
+// sends no video: the whole update for the naive OTA, only the reboot and
+// reconnect (--reboot-ms) when the update runs beside the stream.
+//
+// Usage: node tools/bench-ota.js [--image-kb 1536] [--insert-kb 24] [--link-kbps 1000]
+//          [--flash-kbs 128] [--reboot-ms 2500]
+const zlib = require('zlib');
+const { performance } = require('perf_hooks');
+const { createDelta, applyDelta, HEADER_SIZE } = require('../backend/services/firmwareDelta.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const IMAGE_BYTES = arg('image-kb', 1536) * 1024;
+const INSERT_BYTES = arg('insert-kb', 24) * 1024;
+const LINK_BPS = (arg('link-kbps', 1000) * 1000) / 8; // bytes per second
+const FLASH_BPS = arg('flash-kbs', 128) * 1024; // sector erase + program, bytes per second
+const REBOOT_MS = arg('reboot-ms', 2500);
+const CHUNK = 4096; // OTA_CHUNK_BYTES: one flash sector per buffer
+const SEGMENT = 1460; // TCP payload per read
+const BASE = 0x42000000; // Where the image's code is mapped
+
+// Deterministic pseudo-random numbers
+function rng(seed) {
+  let s = seed >>> 0;
+  return () => {
+    s = (Math.imul(s ^ (s >>> 15), 0x2c1b3c6d) + 0x6d2b79f5) >>> 0;
+    return s / 2 ** 32;
+  };
+}
+
+// Code-like bytes: instructions from a skewed vocabulary, with 32-bit absolute
+// addresses into the image (literal pools) every few instructions. Returns the
+// bytes and where the addresses are.
+function codeBlock(bytes, random, vocabulary) {
+  const buf = Buffer.alloc(bytes);
+  const pointers = [];
+  let i = 0;
+  while (i + 4 <= bytes) {
+    if (random() < 0.08) {
+      buf.writeUInt32LE(BASE + Math.floor(random() * IMAGE_BYTES) & ~3, i);
+      pointers.push(i);
+      i += 4;
+    } else {
+      const word = vocabulary[Math.floor(vocabulary.length * random() ** 6)];
+      buf.writeUIntLE(word, i, 3);
+      i += 3;
+    }
+  }
+  return { buf, pointers };
+}
+
+function images() {
+  const random = rng(1);
+  const vocabulary = Array.from({ length: 3000 }, () => Math.floor(random() * 2 ** 24));
+  const old = codeBlock(IMAGE_BYTES, random, vocabulary);
+
+  // New build: code inserted at three places, a few bytes changed here and there
+  const inserts = [0.2, 0.55, 0.8].map((f) => ({ at: Math.floor(IMAGE_BYTES * f) & ~3, len: (INSERT_BYTES / 3) & ~3 }));
+  const parts = [];
+  let from = 0;
+  for (const ins of inserts) {
+    parts.push(old.buf.subarray(from, ins.at), codeBlock(ins.len, random, vocabulary).buf);
+    from = ins.at;
+  }
+  parts.push(old.buf.subarray(from));
+  const next = Buffer.concat(parts);
+  const shiftAt = (offset) => inserts.filter((ins) => ins.at <= offset).reduce((sum, ins) => sum + ins.len, 0);
+  for (const p of old.pointers) {
+    const value = old.buf.readUInt32LE(p);
+    next.writeUInt32LE(value + shiftAt(value - BASE), p + shiftAt(p));
+  }
+  for (let n = 0; n < 40; n++) next[Math.floor(random() * next.length)] ^= 0x5a;
+  return { source: old.buf, target: next };
+}
+
+// Target bytes available after each received byte count: inflate the delta's
+// operation stream one segment at a time and follow the operations
+async function targetProgress(delta) {
+  const inflater = zlib.createInflateRaw();
+  const points = []; // [received bytes, target bytes]
+  let ops = Buffer.alloc(0);
+  let opAt = 0;
+  let produced = 0;
+  let pending = 0; // Bytes of the current operation still to come
+  inflater.on('data', (out) => {
+    ops = Buffer.concat([ops.subarray(opAt), out]);
+    opAt = 0;
+    for (;;) {
+      if (pending) {
+        const take = Math.min(pending, ops.length - opAt);
+        produced += take;
+        pending -= take;
+        opAt += take;
+        if (pending) break;
+      }
+      const op = ops[opAt];
+      const head = op === 0x44 ? 9 : op === 0x58 ? 5 : 1;
+      if (op === undefined || ops.length - opAt < head) break;
+      pending = op === 0x45 ? 0 : ops.readUInt32LE(opAt + head - 4);
+      opAt += head;
+      if (op === 0x45) break;
+    }
+  });
+  for (let off = HEADER_SIZE; off < delta.length; off += SEGMENT) {
+    await new Promise((resolve) => inflater.write(delta.subarray(off, off + SEGMENT), resolve));
+    points.push([Math.min(off + SEGMENT, delta.length), produced]);
+  }
+  inflater.end();
+  return points;
+}
+
+// Bytes received while each target chunk is being filled
+function chunkDownloads(points, targetBytes, headerBytes) {
+  const downloads = [];
+  let p = 0;
+  let received = headerBytes;
+  for (let end = CHUNK; end - CHUNK < targetBytes; end += CHUNK) {
+    const need = Math.min(end, targetBytes);
+    while (points[p][1] < need) p++;
+    downloads.push(points[p][0] + headerBytes - received);
+    received = points[p][0] + headerBytes;
+  }
+  return downloads;
+}
+
+function fullDownloads(targetBytes) {
+  const downloads = [];
+  for (let at = 0; at < targetBytes; at += CHUNK) downloads.push(Math.min(CHUNK, targetBytes - at));
+  return downloads;
+}
+
+// Two buffers: the receiver fills one while the other is written, and waits
+// (the link idles) when the buffer it needs next is still being written
+function pipelined(downloads, targetBytes) {
+  const written = [];
+  let received = 0;
+  for (let i = 0; i < downloads.length; i++) {
+    const free = i >= 2 ? written[i - 2] : 0;
+    received = Math.max(received, free) + downloads[i] / LINK_BPS;
+    const bytes = Math.min(CHUNK, targetBytes - i * CHUNK);
+    written.push(Math.max(received, written[i - 1] ?? 0) + bytes / FLASH_BPS);
+  }
+  return written[written.length - 1];
+}
+
+// One buffer: receive a chunk, then write it
+function serial(downloads, targetBytes) {
+  let t = 0;
+  for (let i = 0; i < downloads.length; i++) {
+    t += downloads[i] / LINK_BPS + Math.min(CHUNK, targetBytes - i * CHUNK) / FLASH_BPS;
+  }
+  return t;
+}
+
+(async () => {
+  const { source, target } = images();
+  let t0 = performance.now();
+  const delta = createDelta(source, target);
+  const diffMs = performance.now() - t0;
+  t0 = performance.now();
+  const applied = applyDelta(source, delta);
+  const applyMs = performance.now() - t0;
+  const compressed = zlib.deflateRawSync(target, { level: 9 }).length;
+
+  const fullTime = fullDownloads(target.length);
+  const deltaTime = chunkDownloads(await targetProgress(delta), target.length, HEADER_SIZE);
+  const runs = [
+    { name: 'full, serial', bytes: target.length, s: serial(fullTime, target.length), streaming: false },
+    { name: 'full, pipelined', bytes: target.length, s: pipelined(fullTime, target.length), streaming: true },
+    { name: 'delta, serial', bytes: delta.length, s: serial(deltaTime, target.length), streaming: true },
+    { name: 'delta, pipelined', bytes: delta.length, s: pipelined(deltaTime, target.length), streaming: true },
+  ];
+
+  console.log(
+    `images ${(source.length / 1024).toFixed(0)} KB -> ${(target.length / 1024).toFixed(0)} KB (${INSERT_BYTES / 1024} KB inserted); ` +
+      `link ${(LINK_BPS / 125).toFixed(0)} kbit/s, flash ${(FLASH_BPS / 1024).toFixed(0)} KB/s, reboot ${REBOOT_MS} ms`
+  );
+  console.log(
+    `delta ${(delta.length / 1024).toFixed(1)} KB (${((delta.length / target.length) * 100).toFixed(1)}% of the image, ` +
+      `deflated image ${(compressed / 1024).toFixed(0)} KB); built in ${diffMs.toFixed(0)} ms, applied in ${applyMs.toFixed(0)} ms, ` +
+      `reproduces the image: ${applied.equals(target) ? 'yes' : 'NO'}`
+  );
+  console.log('');
+  console.log('                    transferred    update    stream downtime');
+  for (const r of runs) {
+    const downtime = (r.streaming ? 0 : r.s) + REBOOT_MS / 1000;
+    console.log(
+      `${r.name.padEnd(18)} ${(r.bytes / 1024).toFixed(0).padStart(9)} KB ${r.s.toFixed(1).padStart(8)} s ${downtime.toFixed(1).padStart(12)} s`
+    );
+  }
+})();
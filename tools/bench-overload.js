@@ -0,0 +1,307 @@
+// Relay overload: graceful degradation against collapse
+// Runs the relay's frame path (streamProfiles.js, and overload.js when on) in
+// real time against simulated cameras and dashboards, at up to twice the load
+// one core can fan out. Each camera sends 10 fps over an in-order stream, so a
+// heartbeat pong queues behind the frames sent before it, as on a real socket;
+// the relay reads a chunk per camera per loop turn. Delivering a frame to a
+// dashboard costs --delivery-us of CPU (socket.io encode and write) and adds
+// its bytes to that socket's send queue, drained at the viewer's link rate.
+// Every camera has two focused viewers and two unfocused ones; a quarter of
+// the cameras are priority cameras; one viewer in ten is on a slow link.
+//
+// "before" is the relay without overload control (pongs are the only sign of
+// life); "after" sheds frames as overload.js does and cameras slow down when
+// asked. Capacity is measured first: the cost of one frame through the same
+// path with nothing shed. Reported after a warm-up of --warmup seconds: time
+// spent at each load level, event loop delay, age of frames when delivered,
+// frame rate per viewer by class, delay of a dashboard request and the slow
+// viewers' send queues; and, over the whole run, cameras the heartbeat would
+// have terminated.
+//
+// Usage: node tools/bench-overload.js [--seconds 15] [--warmup 3] [--delivery-us 500] [--loads 0.75,1,2]
+const { performance, monitorEventLoopDelay } = require('perf_hooks');
+const config = require('../backend/config/app-config.js');
+const { createStreamProfiles, MSG_TYPE_TIMED_FRAME } = require('../backend/services/streamProfiles.js');
+const { createOverloadControl } = require('../backend/services/overload.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const SECONDS = Number(arg('seconds', 15));
+const WARMUP_MS = Number(arg('warmup', 3)) * 1000;
+const DELIVERY_US = Number(arg('delivery-us', 500));
+const LOADS = String(arg('loads', '0.75,1,2')).split(',').map(Number);
+const FPS = 10;
+const FRAME_BYTES = 40000;
+const INGEST_US = 100; // per camera message: parsing, metrics, activity index
+const READ_CHUNK_BYTES = 64 * 1024;
+const HEARTBEAT_MS = 2000; // 30 s in the relay, shortened to fit the run
+const RTT_MS = 10;
+const LINK_BYTES_PER_S = 1e6; // 8 Mbit/s per dashboard
+const SLOW_LINK_BYTES_PER_S = 64e3; // 512 kbit/s
+const REQUEST_INTERVAL_MS = 50;
+const VIEWERS = [
+  { focused: true },
+  { focused: true },
+  { focused: false },
+  { focused: false },
+];
+
+const payload = Buffer.alloc(6 + FRAME_BYTES);
+payload[0] = MSG_TYPE_TIMED_FRAME;
+
+function spin(us) {
+  const end = performance.now() + us / 1000;
+  while (performance.now() < end);
+}
+
+function percentile(values, q) {
+  const sorted = values.slice().sort((a, b) => a - b);
+  return sorted[Math.min(sorted.length - 1, Math.floor(q * sorted.length))] || 0;
+}
+
+// socket.io as far as the relay uses it: rooms, to/except/emit, per-socket send queues
+function createFakeIo() {
+  const rooms = new Map();
+  const sockets = new Map();
+  function members(names) {
+    const ids = new Set();
+    for (const name of names) for (const id of rooms.get(name) || []) ids.add(id);
+    return ids;
+  }
+  const io = {
+    sockets: { adapter: { rooms }, sockets },
+    to(names) {
+      const target = { include: [].concat(names), exclude: [] };
+      target.except = (names) => (target.exclude.push(...[].concat(names)), target);
+      target.emit = (event, data) => {
+        const skip = members(target.exclude);
+        for (const id of members(target.include)) if (!skip.has(id)) sockets.get(id).deliver(data);
+      };
+      return target;
+    },
+  };
+  function addSocket(id, linkRate, onFrame) {
+    const queue = { bytes: 0, at: performance.now() };
+    const drained = () => {
+      const t = performance.now();
+      queue.bytes = Math.max(0, queue.bytes - ((t - queue.at) * linkRate) / 1000);
+      queue.at = t;
+      return queue.bytes;
+    };
+    const socket = {
+      id,
+      user: { id: 1 },
+      data: {},
+      rooms: new Set(),
+      join: (room) => (rooms.has(room) || rooms.set(room, new Set()), rooms.get(room).add(id), socket.rooms.add(room)),
+      leave: (room) => (rooms.get(room)?.delete(id), socket.rooms.delete(room)),
+      emit: () => {},
+      conn: { transport: { socket: { get bufferedAmount() { return drained(); } } } },
+      deliver(data) {
+        spin(DELIVERY_US);
+        drained();
+        queue.bytes += data.frameSize;
+        onFrame(data);
+      },
+      queued: drained,
+    };
+    sockets.set(id, socket);
+    return socket;
+  }
+  return { io, addSocket };
+}
+
+// Cost of one frame through the read path with every viewer served (ms)
+function frameCostMs() {
+  const { io, addSocket } = createFakeIo();
+  const activeCameras = { cal: { userId: 1, ws: { readyState: 1, send: () => {} } } };
+  const streamProfiles = createStreamProfiles(io, activeCameras, {});
+  VIEWERS.forEach((v, j) => streamProfiles.setViewerProfile(addSocket(`cal-v${j}`, LINK_BYTES_PER_S, () => {}), 'cal', 'main'));
+  const batch = () => {
+    const t = performance.now();
+    for (let i = 0; i < 100; i++) {
+      spin(INGEST_US);
+      streamProfiles.routeFrame('cal', payload);
+    }
+    return (performance.now() - t) / 100;
+  };
+  for (let i = 0; i < 3; i++) batch(); // JIT warm-up
+  return percentile([batch(), batch(), batch(), batch(), batch()], 0.5);
+}
+
+async function run(capacity, load, overloadOn) {
+  const cameraCount = Math.round(capacity * load);
+  const { io, addSocket } = createFakeIo();
+  const activeCameras = {};
+  const overload = overloadOn ? createOverloadControl(io, activeCameras, { settings: config.overload }) : null;
+  const streamProfiles = createStreamProfiles(io, activeCameras, { overload });
+  const t0 = performance.now();
+  const measuring = () => performance.now() - t0 >= WARMUP_MS;
+  const levels = [0, 0, 0, 0];
+  const received = { priority: 0, other: 0, background: 0 };
+  const viewerCounts = { priority: 0, other: 0, background: 0 };
+  const ages = { priority: [], other: [] };
+  const requestDelays = [];
+  const slowViewers = [];
+  let terminated = 0;
+
+  const cameras = [];
+  for (let i = 0; i < cameraCount; i++) {
+    const id = `cam${i}`;
+    const camera = {
+      id,
+      priority: i % 4 === 0 ? 2 : 1,
+      fps: FPS,
+      nextFrameAt: t0 + Math.random() * (1000 / FPS),
+      inbox: [], // { at, pong }, in send order
+      isAlive: true,
+    };
+    activeCameras[id] = {
+      userId: 1,
+      ws: {
+        readyState: 1,
+        send: (text) => {
+          const msg = JSON.parse(text);
+          if (msg.type === 'relay_load') setTimeout(() => (camera.fps = msg.max_fps || FPS), RTT_MS / 2);
+        },
+      },
+    };
+    cameras.push(camera);
+    overload?.cameraConnected(id, { priority: camera.priority });
+    VIEWERS.forEach((v, j) => {
+      const slow = (i * VIEWERS.length + j) % 10 === 0;
+      const cls = !v.focused ? 'background' : camera.priority > 1 ? 'priority' : 'other';
+      viewerCounts[cls]++;
+      const socket = addSocket(`${id}-v${j}`, slow ? SLOW_LINK_BYTES_PER_S : LINK_BYTES_PER_S, () => {
+        if (!measuring()) return;
+        received[cls]++;
+        if (cls !== 'background') ages[cls].push(performance.now() - sentAt);
+      });
+      streamProfiles.setViewerProfile(socket, id, 'main');
+      overload?.setBackground(socket, !v.focused);
+      if (slow) slowViewers.push(socket);
+    });
+  }
+
+  // Cameras: frames at their current rate, written to their stream in order
+  const generator = setInterval(() => {
+    const t = performance.now();
+    for (const camera of cameras) {
+      while (camera.nextFrameAt <= t) {
+        camera.inbox.push({ at: camera.nextFrameAt, pong: false });
+        camera.nextFrameAt += 1000 / camera.fps;
+      }
+    }
+  }, 2);
+
+  // Relay heartbeat, as in cameraEvents.js: a camera that has not answered the
+  // last ping is terminated (here: counted, and it reconnects at once)
+  const heartbeat = setInterval(() => {
+    for (const camera of cameras) {
+      if (!camera.isAlive) terminated++;
+      camera.isAlive = false;
+      setTimeout(() => camera.inbox.push({ at: performance.now(), pong: true }), RTT_MS / 2);
+    }
+  }, HEARTBEAT_MS);
+
+  // Dashboard requests (control messages, REST) arrive on a fixed schedule and
+  // wait for the loop; the delay is from arrival to handling
+  let nextRequest = performance.now() + REQUEST_INTERVAL_MS;
+  const requests = setInterval(() => {
+    for (; nextRequest <= performance.now(); nextRequest += REQUEST_INTERVAL_MS) {
+      const arrived = nextRequest;
+      setImmediate(() => measuring() && requestDelays.push(performance.now() - arrived));
+    }
+  }, REQUEST_INTERVAL_MS / 5);
+
+  const levelSampler = setInterval(() => measuring() && levels[overload?.stats().level ?? 0]++, 100);
+  const loopDelay = monitorEventLoopDelay({ resolution: 10 });
+  const warmup = setTimeout(() => loopDelay.enable(), WARMUP_MS);
+
+  // Relay reads: one chunk per camera socket per loop turn
+  let running = true;
+  let sentAt = 0; // when the camera sent the frame being routed
+  function read() {
+    if (!running) return;
+    const t = performance.now();
+    let worked = false;
+    for (const camera of cameras) {
+      let bytes = 0;
+      while (camera.inbox.length && camera.inbox[0].at <= t && bytes < READ_CHUNK_BYTES) {
+        const msg = camera.inbox.shift();
+        worked = true;
+        if (msg.pong) {
+          camera.isAlive = true;
+          continue;
+        }
+        if (overloadOn) camera.isAlive = true; // any message is a sign of life
+        bytes += payload.length;
+        spin(INGEST_US);
+        if (overload && !overload.admitFrame(camera.id, payload)) continue;
+        sentAt = msg.at; // routeFrame delivers synchronously
+        streamProfiles.routeFrame(camera.id, payload);
+      }
+    }
+    if (worked) setImmediate(read);
+    else setTimeout(read, 1);
+  }
+  read();
+
+  let maxSlowQueue = 0;
+  const queueSampler = setInterval(() => {
+    if (measuring()) for (const s of slowViewers) maxSlowQueue = Math.max(maxSlowQueue, s.queued());
+  }, 100);
+
+  await new Promise((resolve) => setTimeout(resolve, SECONDS * 1000));
+  running = false;
+  [generator, heartbeat, requests, levelSampler, queueSampler].forEach(clearInterval);
+  clearTimeout(warmup);
+  loopDelay.disable();
+  overload?.close();
+
+  const measuredSeconds = SECONDS - WARMUP_MS / 1000;
+  const perViewerFps = (cls) => received[cls] / viewerCounts[cls] / measuredSeconds;
+  const samples = levels.reduce((a, b) => a + b, 0);
+  return {
+    label: `${load}x ${overloadOn ? 'after' : 'before'}`,
+    cameraCount,
+    levels: levels.map((n) => n / samples),
+    loopP99: loopDelay.count ? loopDelay.percentile(99) / 1e6 : 0,
+    ageP99: { priority: percentile(ages.priority, 0.99), other: percentile(ages.other, 0.99) },
+    fps: { priority: perViewerFps('priority'), other: perViewerFps('other'), background: perViewerFps('background') },
+    terminated,
+    requestP99: percentile(requestDelays, 0.99),
+    maxSlowQueue,
+  };
+}
+
+(async () => {
+  // The relay logs every camera's profiles as the run sets up; keep the table readable
+  const log = console.log;
+  console.log = (...args) => String(args[0]).startsWith('🎚️') || log(...args);
+
+  const costMs = frameCostMs();
+  const capacity = Math.floor(1000 / (FPS * costMs));
+  log(`one frame to ${VIEWERS.length} viewers costs ${costMs.toFixed(2)} ms: capacity ${capacity} cameras at ${FPS} fps`);
+  log(`${SECONDS} s per run, measured after ${WARMUP_MS / 1000} s; a quarter of the cameras are priority cameras`);
+  log('');
+  log('                  time at level (%)  loop    frame age p99   fps per viewer     heart-  request  slow');
+  log('run         cams    0   1   2   3    p99 ms  prio   other   prio other  bg     beat    p99 ms   queue MB');
+  for (const load of LOADS) {
+    for (const on of [false, true]) {
+      const r = await run(capacity, load, on);
+      log(
+        `${r.label.padEnd(11)} ${String(r.cameraCount).padStart(4)}  ${r.levels.map((x) => (x * 100).toFixed(0).padStart(3)).join(' ')}  ` +
+          `${r.loopP99.toFixed(0).padStart(7)}  ${r.ageP99.priority.toFixed(0).padStart(5)}  ${r.ageP99.other.toFixed(0).padStart(6)}   ` +
+          `${r.fps.priority.toFixed(1).padStart(4)} ${r.fps.other.toFixed(1).padStart(4)} ${r.fps.background.toFixed(1).padStart(4)}  ` +
+          `${String(r.terminated).padStart(5)}  ${r.requestP99.toFixed(0).padStart(8)}  ${(r.maxSlowQueue / 1048576).toFixed(1).padStart(8)}`
+      );
+    }
+  }
+  log('');
+  log('heartbeat: cameras that missed a ping and would have been terminated');
+  log(`fps per viewer includes the slow viewers, held to a frame every ${config.overload.backgroundIntervalMs / 1000} s per camera after`);
+})();
@@ -0,0 +1,72 @@
+// Grid substream: bytes and client decode time per dashboard layout
+// For grids of 1x1 to --max-columns squared on a --screen-px wide dashboard,
+// compares every tile on the main stream (before) with the profile the
+// dashboard now picks per tile (frontend/scripts/dashboard/streamProfiles.js:
+// main for tiles wider than 640 device px, else the 2 fps substream).
+// Frame sizes are those of --main and --sub, a camera frame and its 1/4-scale
+// substream. Client CPU is the full-size decode of each frame with the relay's
+// JPEG decoder, a stand-in for the browser's: absolute times differ, the
+// before/after ratio is what matters.
+//
+// Usage: node tools/bench-substream.js --main frame.jpg --sub sub.jpg [--fps 10]
+//          [--screen-px 1920] [--max-columns 4]
+const fs = require('fs');
+const { performance } = require('perf_hooks');
+const { decodeScaled, readJpegSize } = require('../backend/services/jpegScaledDecoder.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const FPS = Number(arg('fps', 10));
+const SUB_FPS = 2; // SUBSTREAM_INTERVAL_MS 500 in the firmware
+const SCREEN_PX = Number(arg('screen-px', 1920));
+const MAX_COLUMNS = Number(arg('max-columns', 4));
+const SUBSTREAM_MAX_TILE_PX = 640;
+const mainPath = arg('main');
+const subPath = arg('sub');
+if (!mainPath || !subPath) {
+  console.error('Usage: node tools/bench-substream.js --main frame.jpg --sub sub.jpg [--fps 10] [--screen-px 1920] [--max-columns 4]');
+  process.exit(1);
+}
+const main = fs.readFileSync(mainPath);
+const sub = fs.readFileSync(subPath);
+
+function decodeMs(jpeg, runs) {
+  decodeScaled(jpeg, 8); // Warm up the JIT
+  const t0 = performance.now();
+  for (let i = 0; i < runs; i++) decodeScaled(jpeg, 8);
+  return (performance.now() - t0) / runs;
+}
+
+const profiles = {
+  main: { bytes: main.length, fps: FPS, ms: decodeMs(main, 20) },
+  sub: { bytes: sub.length, fps: SUB_FPS, ms: decodeMs(sub, 100) },
+};
+
+function load(tiles, profile) {
+  const p = profiles[profile];
+  return { kbps: (tiles * p.bytes * p.fps * 8) / 1000, decodeMs: tiles * p.ms * p.fps };
+}
+
+const mainSize = readJpegSize(main);
+const subSize = readJpegSize(sub);
+console.log(
+  `main ${mainSize.width}x${mainSize.height} ${(main.length / 1024).toFixed(1)} KB at ${FPS} fps, decode ${profiles.main.ms.toFixed(2)} ms; ` +
+    `sub ${subSize.width}x${subSize.height} ${(sub.length / 1024).toFixed(1)} KB at ${SUB_FPS} fps, decode ${profiles.sub.ms.toFixed(2)} ms; ` +
+    `${SCREEN_PX} px wide dashboard`
+);
+console.log('');
+console.log('layout  tile px  profile   before kbit/s  after kbit/s   before decode ms/s  after decode ms/s');
+for (let columns = 1; columns <= MAX_COLUMNS; columns++) {
+  const tiles = columns * columns;
+  const tilePx = Math.floor(SCREEN_PX / columns);
+  const profile = tilePx > SUBSTREAM_MAX_TILE_PX ? 'main' : 'sub';
+  const before = load(tiles, 'main');
+  const after = load(tiles, profile);
+  console.log(
+    `${`${columns}x${columns}`.padEnd(7)} ${String(tilePx).padStart(7)}  ${profile.padEnd(7)} ${before.kbps.toFixed(0).padStart(14)} ` +
+      `${after.kbps.toFixed(0).padStart(13)} ${before.decodeMs.toFixed(0).padStart(19)} ${after.decodeMs.toFixed(0).padStart(17)}`
+  );
+}
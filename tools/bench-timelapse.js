@@ -0,0 +1,150 @@
+// Time-lapse archives: storage per camera-day and generation cost
+// Replays one camera-day of --fps frames of ~--frame-kb through the relay's
+// time-lapse builder (backend/services/timelapse.js) on a simulated clock, for
+// several sampling intervals, into a temporary directory. Reports what a day
+// takes on disk next to keeping the full-rate MJPEG, the event-loop time spent
+// per ingested frame, and what it costs to produce a time-lapse:
+//   archive - the range located through the index and read part by part, as
+//             GET /api/camera/:id/timelapse?fps=0 does
+//   rescan  - picking one frame per interval out of the full-rate recording,
+//             which has to be read and parsed end to end; measured on
+//             --rescan-mb of it and scaled to the day
+//
+// Usage: node tools/bench-timelapse.js [--fps 10] [--frame-kb 40] [--intervals 10,60,300] [--rescan-mb 64]
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { performance } = require('perf_hooks');
+const { createTimelapse, BOUNDARY } = require('../backend/services/timelapse.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const FPS = Number(arg('fps', 10));
+const FRAME_BYTES = Number(arg('frame-kb', 40)) * 1024;
+const INTERVALS = String(arg('intervals', '10,60,300')).split(',').map(Number);
+const RESCAN_BYTES = Number(arg('rescan-mb', 64)) * 1048576;
+const DAY_MS = 24 * 60 * 60 * 1000;
+const DAY_START = Date.parse('2026-01-05T00:00:00Z');
+
+// JPEG-like frames of varying size; the builder only looks at the bytes' length
+const frames = Array.from({ length: 64 }, (_, n) => {
+  const len = Math.round(FRAME_BYTES * (0.75 + ((n * 7919) % 500) / 1000));
+  const buf = Buffer.alloc(len, n);
+  buf[0] = 0xff;
+  buf[1] = 0xd8;
+  return buf;
+});
+
+function partOf(jpeg, atMs) {
+  return Buffer.concat([
+    Buffer.from(`--${BOUNDARY}\r\nContent-Type: image/jpeg\r\nContent-Length: ${jpeg.length}\r\nX-Timestamp: ${atMs}\r\n\r\n`),
+    jpeg,
+    Buffer.from('\r\n'),
+  ]);
+}
+
+// A response that takes everything at once
+function sink() {
+  return {
+    bytes: 0,
+    writeHead() {},
+    write(chunk) {
+      this.bytes += chunk.length;
+      return true;
+    },
+    end(chunk) {
+      this.bytes += chunk ? chunk.length : 0;
+    },
+  };
+}
+
+async function day(intervalSeconds) {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'zcc-timelapse-'));
+  let clock = DAY_START;
+  const timelapse = createTimelapse({
+    settings: { dir, intervalSeconds, profile: 'main', retentionDays: 0, playbackFps: 24 },
+    now: () => clock,
+  });
+  const total = Math.round((DAY_MS / 1000) * FPS);
+  const t0 = performance.now();
+  for (let n = 0; n < total; n++) {
+    clock = DAY_START + Math.floor((n * 1000) / FPS);
+    timelapse.recordFrame('cam', frames[n % frames.length]);
+  }
+  const ingestMs = performance.now() - t0;
+  timelapse.cameraDisconnected('cam');
+  const [stored] = timelapse.days('cam');
+
+  const req = { on() {} };
+  const serve = async (fromMs, toMs) => {
+    const res = sink();
+    const s0 = performance.now();
+    const sent = await timelapse.stream(req, res, 'cam', fromMs, toMs, { fps: 0 });
+    return { ms: performance.now() - s0, sent, bytes: res.bytes };
+  };
+  const hour = await serve(DAY_START + 12 * 3600000, DAY_START + 13 * 3600000 - 1);
+  const whole = await serve(DAY_START, DAY_START + DAY_MS - 1);
+  timelapse.close();
+  fs.rmSync(dir, { recursive: true, force: true });
+  return { intervalSeconds, total, ingestMs, stored, hour, whole };
+}
+
+// Read a full-rate recording and keep one frame per interval: boundary search
+// and part headers for every frame
+function rescanMbPerSecond() {
+  const file = path.join(fs.mkdtempSync(path.join(os.tmpdir(), 'zcc-rescan-')), 'day.mjpeg');
+  const fd = fs.openSync(file, 'w');
+  let written = 0;
+  for (let n = 0; written < RESCAN_BYTES; n++) {
+    const part = partOf(frames[n % frames.length], DAY_START + Math.floor((n * 1000) / FPS));
+    fs.writeSync(fd, part);
+    written += part.length;
+  }
+  fs.closeSync(fd);
+
+  const marker = Buffer.from(`--${BOUNDARY}\r\n`);
+  const t0 = performance.now();
+  const data = fs.readFileSync(file);
+  let kept = 0;
+  let nextAt = 0;
+  for (let at = data.indexOf(marker); at !== -1; ) {
+    const headEnd = data.indexOf('\r\n\r\n', at);
+    const head = data.toString('latin1', at, headEnd);
+    const len = Number(/Content-Length: (\d+)/.exec(head)[1]);
+    const ts = Number(/X-Timestamp: (\d+)/.exec(head)[1]);
+    if (ts >= nextAt) {
+      kept++;
+      nextAt = ts + INTERVALS[0] * 1000;
+    }
+    at = data.indexOf(marker, headEnd + 4 + len);
+  }
+  const ms = performance.now() - t0;
+  fs.rmSync(path.dirname(file), { recursive: true, force: true });
+  return { mbPerS: written / 1048576 / (ms / 1000), kept };
+}
+
+(async () => {
+  const fullDayBytes = (DAY_MS / 1000) * FPS * (FRAME_BYTES + 100);
+  const rescan = rescanMbPerSecond();
+  const rescanDayS = fullDayBytes / 1048576 / rescan.mbPerS;
+
+  console.log(
+    `one camera-day at ${FPS} fps, ~${FRAME_BYTES / 1024} KB frames; ` +
+      `full-rate MJPEG ${(fullDayBytes / 1073741824).toFixed(1)} GB per camera-day`
+  );
+  console.log('');
+  console.log('interval   frames   per camera-day   of full rate   ingest ns/frame   1 h served   day served   rescan day');
+  for (const interval of INTERVALS) {
+    const r = await day(interval);
+    console.log(
+      `${String(interval).padStart(6)} s ${String(r.stored.frames).padStart(8)} ${(r.stored.bytes / 1048576).toFixed(1).padStart(13)} MB ` +
+        `${((r.stored.bytes / fullDayBytes) * 100).toFixed(2).padStart(12)}% ${((r.ingestMs * 1e6) / r.total).toFixed(0).padStart(17)} ` +
+        `${r.hour.ms.toFixed(1).padStart(9)} ms ${r.whole.ms.toFixed(0).padStart(9)} ms ${rescanDayS.toFixed(1).padStart(10)} s`
+    );
+  }
+  console.log('');
+  console.log(`rescan reads and parses full-rate MJPEG at ${rescan.mbPerS.toFixed(0)} MB/s from the page cache (${RESCAN_BYTES / 1048576} MB measured)`);
+})();
@@ -0,0 +1,155 @@
+// Reconnect latency and steady-state frame rate: plaintext vs TLS (full and resumed)
+// Runs a local relay stand-in (plain HTTP + the backend's TLS termination with a
+// self-signed certificate) and drives it with a client that frames data exactly
+// like the camera firmware (masked binary WebSocket frames).
+//
+// Usage: node tools/bench-tls-reconnect.js [--reconnects 50] [--seconds 5] [--frame-bytes 60000]
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const net = require('net');
+const tls = require('tls');
+const http = require('http');
+const { execFileSync } = require('child_process');
+const startTlsTermination = require('../backend/services/tlsTermination.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const RECONNECTS = arg('reconnects', 50);
+const SECONDS = arg('seconds', 5);
+const FRAME_BYTES = arg('frame-bytes', 60000);
+const PLAIN_PORT = 39080;
+const TLS_PORT = 39443;
+
+function selfSignedCert() {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'zcc-tls-'));
+  const keyPath = path.join(dir, 'key.pem');
+  const certPath = path.join(dir, 'cert.pem');
+  execFileSync('openssl', [
+    'req', '-x509', '-newkey', 'ec', '-pkeyopt', 'ec_paramgen_curve:prime256v1',
+    '-nodes', '-keyout', keyPath, '-out', certPath, '-days', '1', '-subj', '/CN=localhost',
+  ], { stdio: 'ignore' });
+  return { keyPath, certPath, ca: fs.readFileSync(certPath) };
+}
+
+function startRelayStandIn() {
+  const server = http.createServer((req, res) => res.end());
+  let receivedBytes = 0;
+  server.on('upgrade', (req, socket) => {
+    socket.setNoDelay(true);
+    socket.write('HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n');
+    socket.on('data', (chunk) => (receivedBytes += chunk.length));
+    socket.on('error', () => {});
+  });
+  server.listen(PLAIN_PORT, '127.0.0.1');
+  return { server, received: () => receivedBytes };
+}
+
+// Same header layout and fixed mask key as websocket_write_frame in the firmware
+function encodeFrame(payload) {
+  const mask = Buffer.from([0x12, 0x34, 0x56, 0x78]);
+  const len = payload.length;
+  const header = len < 126 ? Buffer.alloc(2) : len < 65536 ? Buffer.alloc(4) : Buffer.alloc(10);
+  header[0] = 0x82;
+  if (len < 126) header[1] = 0x80 | len;
+  else if (len < 65536) {
+    header[1] = 0x80 | 126;
+    header.writeUInt16BE(len, 2);
+  } else {
+    header[1] = 0x80 | 127;
+    header.writeUInt32BE(len, 6);
+  }
+  const masked = Buffer.alloc(len);
+  for (let i = 0; i < len; i++) masked[i] = payload[i] ^ mask[i & 3];
+  return Buffer.concat([header, mask, masked]);
+}
+
+function connect(mode, ca, session) {
+  return new Promise((resolve, reject) => {
+    const start = process.hrtime.bigint();
+    const socket =
+      mode === 'plain'
+        ? net.connect(PLAIN_PORT, '127.0.0.1')
+        : tls.connect({ port: TLS_PORT, host: '127.0.0.1', servername: 'localhost', ca, session, maxVersion: 'TLSv1.2' });
+    let newSession = null;
+    socket.on('session', (s) => (newSession = s));
+    socket.setNoDelay(true);
+    socket.once(mode === 'plain' ? 'connect' : 'secureConnect', () => {
+      socket.write('GET /bench HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n');
+    });
+    socket.once('data', () => {
+      const ms = Number(process.hrtime.bigint() - start) / 1e6;
+      const resumed = mode === 'plain' ? false : socket.isSessionReused();
+      resolve({ socket, ms, resumed, session: newSession || session });
+    });
+    socket.once('error', reject);
+  });
+}
+
+function percentile(values, p) {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted[Math.min(sorted.length - 1, Math.floor((p / 100) * sorted.length))];
+}
+
+async function measureReconnects(mode, ca) {
+  const times = [];
+  let session;
+  let resumedCount = 0;
+  // Prime the session cache for the resumed case
+  if (mode === 'resumed') {
+    const first = await connect('tls', ca);
+    session = first.session;
+    first.socket.destroy();
+  }
+  for (let i = 0; i < RECONNECTS; i++) {
+    const r = await connect(mode === 'plain' ? 'plain' : 'tls', ca, mode === 'resumed' ? session : undefined);
+    times.push(r.ms);
+    if (r.resumed) resumedCount++;
+    if (mode === 'resumed') session = r.session;
+    r.socket.destroy();
+  }
+  return { times, resumedCount };
+}
+
+async function measureThroughput(mode, ca) {
+  const { socket } = await connect(mode === 'plain' ? 'plain' : 'tls', ca);
+  const frame = encodeFrame(Buffer.alloc(FRAME_BYTES, 0xab));
+  const deadline = Date.now() + SECONDS * 1000;
+  let frames = 0;
+  while (Date.now() < deadline) {
+    if (!socket.write(frame)) await new Promise((r) => socket.once('drain', r));
+    frames++;
+  }
+  socket.destroy();
+  return { fps: frames / SECONDS, mbps: (frames * frame.length * 8) / SECONDS / 1e6 };
+}
+
+(async () => {
+  const cert = selfSignedCert();
+  const relay = startRelayStandIn();
+  const tlsServer = startTlsTermination(relay.server, {
+    port: TLS_PORT,
+    keyPath: cert.keyPath,
+    certPath: cert.certPath,
+    sessionTimeout: 300,
+  });
+  await new Promise((r) => setTimeout(r, 200));
+
+  console.log(`reconnects=${RECONNECTS} frame=${FRAME_BYTES}B duration=${SECONDS}s`);
+  console.log('mode      p50_ms  p95_ms  resumed  fps      Mbit/s');
+  for (const mode of ['plain', 'full', 'resumed']) {
+    const { times, resumedCount } = await measureReconnects(mode, cert.ca);
+    const { fps, mbps } = await measureThroughput(mode, cert.ca);
+    console.log(
+      `${mode.padEnd(9)} ${percentile(times, 50).toFixed(2).padStart(6)}  ${percentile(times, 95).toFixed(2).padStart(6)}  ` +
+        `${String(resumedCount).padStart(7)}  ${fps.toFixed(1).padStart(7)}  ${mbps.toFixed(1).padStart(7)}`
+    );
+  }
+
+  tlsServer.close();
+  relay.server.close();
+  process.exit(0);
+})();
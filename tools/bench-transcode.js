@@ -0,0 +1,85 @@
+// MJPEG vs on-demand H.264: bitrate and encoder CPU for one camera
+// Generates an XGA MJPEG test pattern with ffmpeg-static, feeds it through the
+// relay's transcoder at the camera frame rate and reports input/output bitrate,
+// encoder CPU share and the frame decimation the CPU cap applied.
+//
+// Usage: node tools/bench-transcode.js [--seconds 20] [--fps 10] [--quality 6]
+const { spawn } = require('child_process');
+const ffmpegPath = require('ffmpeg-static');
+const { createTranscoder } = require('../backend/services/transcoder.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const SECONDS = arg('seconds', 20);
+const FPS = arg('fps', 10);
+const QUALITY = arg('quality', 6); // mjpeg -q:v, roughly the camera's jpeg_quality
+
+// Render test frames once and split the MJPEG stream on SOI/EOI markers
+function generateFrames(count) {
+  return new Promise((resolve, reject) => {
+    const proc = spawn(ffmpegPath, [
+      '-f', 'lavfi', '-i', `testsrc2=size=1024x768:rate=${FPS}`,
+      '-frames:v', String(count), '-q:v', String(QUALITY), '-f', 'mjpeg', 'pipe:1',
+    ]);
+    const chunks = [];
+    proc.stdout.on('data', (c) => chunks.push(c));
+    proc.on('error', reject);
+    proc.on('close', () => {
+      const data = Buffer.concat(chunks);
+      const frames = [];
+      let start = data.indexOf(Buffer.from([0xff, 0xd8]));
+      while (start !== -1) {
+        const end = data.indexOf(Buffer.from([0xff, 0xd9]), start + 2);
+        if (end === -1) break;
+        frames.push(data.subarray(start, end + 2));
+        start = data.indexOf(Buffer.from([0xff, 0xd8]), end + 2);
+      }
+      resolve(frames);
+    });
+  });
+}
+
+(async () => {
+  const frames = await generateFrames(FPS * 5);
+  let bytesOut = 0;
+  let fragments = 0;
+  const io = {
+    to: () => ({
+      emit: (event, msg) => {
+        bytesOut += msg.data.length;
+        if (!msg.init) fragments++;
+      },
+    }),
+  };
+  const transcoder = createTranscoder(io, { room: (id) => id });
+  transcoder.setDemand('bench', true);
+
+  let bytesIn = 0;
+  let sent = 0;
+  const timer = setInterval(() => {
+    const frame = frames[sent++ % frames.length];
+    bytesIn += frame.length;
+    transcoder.push('bench', frame);
+  }, 1000 / FPS);
+
+  const cpuSamples = [];
+  const sampler = setInterval(() => cpuSamples.push(transcoder.stats()[0]), 2000);
+
+  await new Promise((r) => setTimeout(r, SECONDS * 1000));
+  clearInterval(timer);
+  clearInterval(sampler);
+  transcoder.stop('bench');
+
+  const steady = cpuSamples.slice(1).filter(Boolean);
+  const avgCpu = steady.reduce((a, s) => a + s.cpuRatio, 0) / Math.max(1, steady.length);
+  const maxStride = Math.max(1, ...steady.map((s) => s.frameStride));
+  console.log(`frames=${sent} fps=${FPS} duration=${SECONDS}s avg_jpeg=${(bytesIn / sent / 1024).toFixed(1)}KB`);
+  console.log(`MJPEG in : ${((bytesIn * 8) / SECONDS / 1e6).toFixed(2)} Mbit/s`);
+  console.log(`H.264 out: ${((bytesOut * 8) / SECONDS / 1e6).toFixed(2)} Mbit/s (${fragments} fragments)`);
+  console.log(`reduction: ${(bytesIn / Math.max(1, bytesOut)).toFixed(1)}x`);
+  console.log(`encoder CPU: ${(avgCpu * 100).toFixed(1)}% of one core, max frame stride ${maxStride}`);
+  process.exit(0);
+})();
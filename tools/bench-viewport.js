@@ -0,0 +1,170 @@
+// Viewport-aware subscriptions: bytes and decodes per dashboard client
+// Runs the relay's stream profile routing for one account's cameras and one
+// dashboard socket. Cameras produce only the profiles the relay announces to
+// them, like the firmware does. Each scenario is a subscription set the
+// dashboard would send: every tile (before viewport tracking), the tiles on
+// screen, one full-view camera, or a background tab. Every frame a client
+// receives is one JPEG decode in the browser.
+// Also checks that an unsubscribed tile gets no further frames and that a
+// resubscribed one gets a cached frame right away.
+//
+// Usage: node tools/bench-viewport.js [--cameras 50] [--visible 12] [--fps 10]
+//          [--main-kb 60] [--sub-kb 8] [--seconds 10]
+const { createStreamProfiles, profileRoom } = require('../backend/services/streamProfiles.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? Number(process.argv[i + 1]) : fallback;
+}
+
+const CAMERAS = arg('cameras', 50);
+const VISIBLE = arg('visible', 12); // tiles on screen in the grid
+const FPS = arg('fps', 10);
+const MAIN_BYTES = arg('main-kb', 60) * 1024;
+const SUB_BYTES = arg('sub-kb', 8) * 1024;
+const SECONDS = arg('seconds', 10);
+
+const print = console.log;
+console.log = () => {}; // Keep per-camera relay logging out of the report
+
+function createHarness() {
+  const rooms = new Map();
+  const received = { frames: 0, bytes: 0, byCamera: new Map() };
+
+  function deliver(data) {
+    received.frames++;
+    received.bytes += data.frameSize;
+    received.byCamera.set(data.cameraId, (received.byCamera.get(data.cameraId) || 0) + 1);
+  }
+
+  const io = {
+    sockets: { adapter: { rooms } },
+    to: (target) => ({
+      emit: (event, data) => {
+        if (event !== 'stream') return;
+        for (const room of [].concat(target)) {
+          if (rooms.get(room)?.has('dashboard')) deliver(data);
+        }
+      },
+    }),
+  };
+  const socket = {
+    id: 'dashboard',
+    user: { id: 1 },
+    join: (room) => {
+      if (!rooms.has(room)) rooms.set(room, new Set());
+      rooms.get(room).add('dashboard');
+    },
+    leave: (room) => rooms.get(room)?.delete('dashboard'),
+    emit: (event, data) => event === 'stream' && deliver(data),
+  };
+
+  // Cameras encode what the relay last announced to them
+  const activeCameras = {};
+  const produces = new Map();
+  const cameraIds = [];
+  for (let c = 0; c < CAMERAS; c++) {
+    const cameraId = `cam${c}`;
+    cameraIds.push(cameraId);
+    produces.set(cameraId, { main: false, sub: false });
+    activeCameras[cameraId] = {
+      name: cameraId,
+      userId: 1,
+      status: 'online',
+      ws: { readyState: 1, send: (msg) => produces.set(cameraId, JSON.parse(msg)) },
+    };
+  }
+  const streamProfiles = createStreamProfiles(io, activeCameras, {});
+  cameraIds.forEach((cameraId) => streamProfiles.cameraConnected(cameraId));
+
+  const main = Buffer.alloc(MAIN_BYTES, 0x55);
+  const sub = Buffer.concat([Buffer.from([0xa1, 1]), Buffer.alloc(SUB_BYTES, 0x55)]);
+  const encoded = { frames: 0, bytes: 0 };
+
+  function tick() {
+    for (const cameraId of cameraIds) {
+      const p = produces.get(cameraId);
+      if (p.sub) {
+        streamProfiles.routeFrame(cameraId, sub);
+        encoded.frames++;
+        encoded.bytes += SUB_BYTES;
+      }
+      if (p.main) {
+        streamProfiles.routeFrame(cameraId, main);
+        encoded.frames++;
+        encoded.bytes += MAIN_BYTES;
+      }
+    }
+  }
+
+  function subscribe(selection) {
+    cameraIds.forEach((cameraId, i) => streamProfiles.setViewerProfile(socket, cameraId, selection(i)));
+  }
+
+  function reset() {
+    received.frames = 0;
+    received.bytes = 0;
+    received.byCamera.clear();
+    encoded.frames = 0;
+    encoded.bytes = 0;
+  }
+
+  return { tick, subscribe, reset, received, encoded, rooms, streamProfiles, socket, cameraIds };
+}
+
+function runScenario(name, selection) {
+  const h = createHarness();
+  h.tick(); // Warm caches like a dashboard opened on a running account
+  h.subscribe(selection);
+  h.reset();
+  for (let t = 0; t < SECONDS * FPS; t++) h.tick();
+  return {
+    name,
+    tiles: h.cameraIds.filter((_, i) => selection(i)).length,
+    decodesPerSec: h.received.frames / SECONDS,
+    kbPerSec: h.received.bytes / 1024 / SECONDS,
+    cameraKbPerSec: h.encoded.bytes / 1024 / SECONDS,
+  };
+}
+
+function checkSwitching() {
+  const h = createHarness();
+  const cameraId = h.cameraIds[0];
+  h.streamProfiles.setViewerProfile(h.socket, cameraId, 'sub');
+  h.tick();
+  h.tick();
+
+  h.reset();
+  h.streamProfiles.setViewerProfile(h.socket, cameraId, null);
+  h.tick();
+  const afterUnsubscribe = h.received.byCamera.get(cameraId) || 0;
+  const stillInRoom = ['main', 'sub'].some((p) => h.rooms.get(profileRoom(cameraId, p))?.has('dashboard'));
+
+  h.tick();
+  h.reset();
+  h.streamProfiles.setViewerProfile(h.socket, cameraId, 'sub');
+  const onResubscribe = h.received.byCamera.get(cameraId) || 0;
+  return { afterUnsubscribe, stillInRoom, onResubscribe };
+}
+
+const scenarios = [
+  runScenario('all tiles (before)', () => 'sub'),
+  runScenario('grid viewport', (i) => (i < VISIBLE ? 'sub' : null)),
+  runScenario('full view', (i) => (i === 0 ? 'main' : null)),
+  runScenario('background tab', () => null),
+];
+
+print(`${CAMERAS} cameras, ${VISIBLE} grid tiles on screen, ${FPS} fps, main ${MAIN_BYTES / 1024} KB, sub ${SUB_BYTES / 1024} KB`);
+print('');
+print('scenario             tiles  decodes/s  KB/s_to_client  KB/s_from_cameras');
+for (const s of scenarios) {
+  print(
+    `${s.name.padEnd(19)}  ${String(s.tiles).padStart(5)}  ${s.decodesPerSec.toFixed(0).padStart(9)}  ` +
+      `${s.kbPerSec.toFixed(0).padStart(14)}  ${s.cameraKbPerSec.toFixed(0).padStart(16)}`
+  );
+}
+
+const sw = checkSwitching();
+print('');
+print(`frames after unsubscribe (next camera frame): ${sw.afterUnsubscribe}${sw.stillInRoom ? ' (socket still in a room!)' : ''}`);
+print(`frames delivered synchronously on resubscribe: ${sw.onResubscribe}`);
@@ -0,0 +1,31 @@
+// Local pub/sub broker for multi-node relays (CLUSTER_BUS=tcp)
+// Stand-in for a production broker: run one per deployment and point every
+// relay node at it with CLUSTER_BROKER_HOST / CLUSTER_BROKER_PORT. Nodes must
+// present the same CLUSTER_BUS_SECRET. The broker listens on loopback unless
+// --host says otherwise; only bind it where the relay nodes need to reach it.
+//
+// Usage: CLUSTER_BUS_SECRET=... node tools/bus-broker.js [--port 4100] [--host 127.0.0.1]
+const { createBusBroker } = require('../backend/services/bus.js');
+
+function arg(name, fallback) {
+  const i = process.argv.indexOf(`--${name}`);
+  return i !== -1 ? process.argv[i + 1] : fallback;
+}
+
+const port = Number(arg('port', process.env.CLUSTER_BROKER_PORT || 4100));
+const host = arg('host', '127.0.0.1');
+const secret = process.env.CLUSTER_BUS_SECRET;
+if (!secret) {
+  console.error('Set CLUSTER_BUS_SECRET to the secret the relay nodes are configured with');
+  process.exit(1);
+}
+
+const broker = createBusBroker(port, { host, secret });
+broker.server.on('listening', () => console.log(`🛰️ Bus broker listening on ${host}:${port}`));
+setInterval(() => {
+  const s = broker.stats();
+  console.log(
+    `🛰️ ${s.connections} nodes, ${s.channels} channels, ${s.messages} messages / ${(s.bytes / 1e6).toFixed(1)} MB forwarded, ` +
+      `${s.rejected} rejected, ${s.slowDropped} slow nodes dropped`
+  );
+}, 30000).unref();
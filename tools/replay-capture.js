@@ -0,0 +1,281 @@
+// Replay captured camera sessions into a relay
+// Plays .zcap files recorded with CAMERA_CAPTURE_DIR (backend/services/streamCapture.js)
+// back over fresh TCP connections: the same bytes, in the same chunks, at the
+// recorded arrival times (or scaled, or as fast as the relay reads). Playback
+// starts when the relay sends its first message (stream_profiles, sent once
+// the camera is known), so database latency on connect does not decide which
+// frames are dropped. Cameras must be claimed on the target relay for their
+// frames to be routed.
+//
+// Usage: node tools/replay-capture.js [--url ws://localhost:3000] [--speed 1|<n>|max]
+//          [--copies 1] [--camera id] [--insecure] [--json] capture.zcap...
+const fs = require('fs');
+const net = require('net');
+const tls = require('tls');
+const { readCapture } = require('../backend/services/streamCapture.js');
+
+const SYNC_TIMEOUT_MS = 5000;
+const CLOSE_TIMEOUT_MS = 2000;
+const WS_OPCODE_TEXT = 0x1;
+const WS_OPCODE_BINARY = 0x2;
+const WS_OPCODE_CLOSE = 0x8;
+const WS_OPCODE_PING = 0x9;
+const WS_OPCODE_PONG = 0xa;
+
+function parseArgs(argv) {
+  const opts = { url: 'ws://localhost:3000', speed: 1, copies: 1, camera: null, insecure: false, json: false, files: [] };
+  for (let i = 0; i < argv.length; i++) {
+    const a = argv[i];
+    if (a === '--url') opts.url = argv[++i];
+    else if (a === '--speed') opts.speed = argv[++i] === 'max' ? Infinity : Number(argv[i]);
+    else if (a === '--copies') opts.copies = Math.max(1, Number(argv[++i]));
+    else if (a === '--camera') opts.camera = argv[++i];
+    else if (a === '--insecure') opts.insecure = true;
+    else if (a === '--json') opts.json = true;
+    else opts.files.push(a);
+  }
+  if (opts.files.length === 0 || !(opts.speed > 0)) {
+    console.error('Usage: node tools/replay-capture.js [--url ws://host:port] [--speed 1|<n>|max] [--copies N] [--camera id] [--insecure] [--json] capture.zcap...');
+    process.exit(1);
+  }
+  return opts;
+}
+
+/**
+ * Walk the recorded client->relay byte stream frame by frame
+ * Returns the ascending stream offsets where frames end (where a pong may be
+ * inserted) and frame counts by opcode.
+ */
+function scanFrames(records) {
+  const data = Buffer.concat(records.map((r) => r.data));
+  const boundaries = [];
+  const counts = { binary: 0, text: 0, control: 0, partial: 0 };
+  let lastOpcode = null;
+  let off = 0;
+  while (off + 2 <= data.length) {
+    const opcode = data[off] & 0x0f;
+    const masked = (data[off + 1] & 0x80) !== 0;
+    let len = data[off + 1] & 0x7f;
+    let hdr = 2;
+    if (len === 126) {
+      if (off + 4 > data.length) break;
+      len = data.readUInt16BE(off + 2);
+      hdr = 4;
+    } else if (len === 127) {
+      if (off + 10 > data.length) break;
+      len = Number(data.readBigUInt64BE(off + 2));
+      hdr = 10;
+    }
+    const end = off + hdr + (masked ? 4 : 0) + len;
+    if (end > data.length) break;
+    if (opcode === WS_OPCODE_BINARY) counts.binary++;
+    else if (opcode === WS_OPCODE_TEXT) counts.text++;
+    else counts.control++;
+    lastOpcode = opcode;
+    off = end;
+    boundaries.push(off);
+  }
+  if (off < data.length) counts.partial = 1; // Capture stopped mid-frame
+  return { boundaries, counts, totalBytes: data.length, endsWithClose: lastOpcode === WS_OPCODE_CLOSE && off === data.length };
+}
+
+// Client frames must be masked; an all-zero key keeps the bytes reproducible
+function maskedFrame(opcode, payload) {
+  const head = Buffer.from([0x80 | opcode, 0x80 | payload.length, 0, 0, 0, 0]);
+  return Buffer.concat([head, payload]);
+}
+
+// Incremental parser for relay->camera frames (unmasked)
+function createFrameReader(onFrame) {
+  let pending = Buffer.alloc(0);
+  return (chunk) => {
+    pending = pending.length ? Buffer.concat([pending, chunk]) : chunk;
+    while (pending.length >= 2) {
+      let len = pending[1] & 0x7f;
+      let hdr = 2;
+      if (len === 126) {
+        if (pending.length < 4) return;
+        len = pending.readUInt16BE(2);
+        hdr = 4;
+      } else if (len === 127) {
+        if (pending.length < 10) return;
+        len = Number(pending.readBigUInt64BE(2));
+        hdr = 10;
+      }
+      if (pending.length < hdr + len) return;
+      onFrame(pending[0] & 0x0f, pending.subarray(hdr, hdr + len));
+      pending = pending.subarray(hdr + len);
+    }
+  };
+}
+
+function connect(url, cameraId, insecure) {
+  const target = new URL(url);
+  const secure = target.protocol === 'wss:';
+  const port = Number(target.port) || (secure ? 443 : 80);
+  const socket = secure
+    ? tls.connect({ host: target.hostname, port, servername: target.hostname, rejectUnauthorized: !insecure })
+    : net.connect({ host: target.hostname, port });
+  socket.setNoDelay(true);
+
+  return new Promise((resolve, reject) => {
+    let response = Buffer.alloc(0);
+    const onData = (chunk) => {
+      response = Buffer.concat([response, chunk]);
+      const end = response.indexOf('\r\n\r\n');
+      if (end === -1) return;
+      socket.removeListener('data', onData);
+      const status = response.toString('latin1', 0, response.indexOf('\r\n'));
+      if (!/^HTTP\/1\.1 101/.test(status)) return reject(new Error(`Upgrade refused: ${status}`));
+      resolve({ socket, rest: response.subarray(end + 4) });
+    };
+    socket.once('error', reject);
+    socket.once(secure ? 'secureConnect' : 'connect', () => {
+      socket.write(
+        `GET /${encodeURIComponent(cameraId)} HTTP/1.1\r\n` +
+          `Host: ${target.host}\r\n` +
+          'Upgrade: websocket\r\n' +
+          'Connection: Upgrade\r\n' +
+          'Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n' +
+          'Sec-WebSocket-Version: 13\r\n\r\n'
+      );
+    });
+    socket.on('data', onData);
+  });
+}
+
+function waitUntil(targetNs) {
+  return new Promise((resolve) => {
+    const step = () => {
+      const remainingMs = Number(targetNs - process.hrtime.bigint()) / 1e6;
+      if (remainingMs <= 0) return resolve();
+      // Coarse sleep, then spin the last millisecond on the event loop
+      if (remainingMs > 2) setTimeout(step, remainingMs - 1);
+      else setImmediate(step);
+    };
+    step();
+  });
+}
+
+async function replaySession(capture, cameraId, opts) {
+  const { records } = capture;
+  const { boundaries, counts, totalBytes, endsWithClose } = scanFrames(records);
+  const { socket, rest } = await connect(opts.url, cameraId, opts.insecure);
+
+  const stats = { cameraId, records: records.length, bytes: totalBytes, frames: counts, relayMessages: 0, pongsSent: 0, lateMs: [] };
+  const pendingPongs = [];
+  let synced;
+  const firstMessage = new Promise((resolve) => (synced = resolve));
+  let closed = false;
+  const closedPromise = new Promise((resolve) => socket.once('close', resolve)).then(() => (closed = true));
+  socket.on('error', () => {});
+
+  const read = createFrameReader((opcode, payload) => {
+    stats.relayMessages++;
+    if (opcode === WS_OPCODE_PING) pendingPongs.push(maskedFrame(WS_OPCODE_PONG, Buffer.from(payload)));
+    if (opcode === WS_OPCODE_TEXT) synced();
+  });
+  socket.on('data', read);
+  if (rest.length) read(rest);
+
+  const syncStart = process.hrtime.bigint();
+  const syncedInTime = await Promise.race([
+    firstMessage.then(() => true),
+    new Promise((r) => setTimeout(() => r(false), SYNC_TIMEOUT_MS)),
+  ]);
+  stats.syncMs = Number(process.hrtime.bigint() - syncStart) / 1e6;
+  if (!syncedInTime) console.warn(`⚠️ ${cameraId}: no message from the relay; is the camera claimed? Replaying anyway`);
+
+  const write = async (buf) => {
+    if (!socket.write(buf)) await new Promise((r) => socket.once('drain', r));
+  };
+
+  const firstOffsetUs = records.length ? records[0].offsetUs : 0;
+  const start = process.hrtime.bigint();
+  let streamOffset = 0;
+  let nextBoundary = 0;
+  for (const record of records) {
+    if (closed) break;
+    if (opts.speed !== Infinity) {
+      const targetNs = start + BigInt(Math.round(((record.offsetUs - firstOffsetUs) * 1000) / opts.speed));
+      await waitUntil(targetNs);
+      stats.lateMs.push(Number(process.hrtime.bigint() - targetNs) / 1e6);
+    }
+    const recordEnd = streamOffset + record.data.length;
+    while (nextBoundary < boundaries.length && boundaries[nextBoundary] <= streamOffset) nextBoundary++;
+    if (pendingPongs.length && nextBoundary < boundaries.length && boundaries[nextBoundary] <= recordEnd) {
+      // Answer relay pings at the next frame end, splitting this chunk there if needed
+      const split = boundaries[nextBoundary] - streamOffset;
+      await write(record.data.subarray(0, split));
+      for (const pong of pendingPongs.splice(0)) {
+        await write(pong);
+        stats.pongsSent++;
+      }
+      if (split < record.data.length) await write(record.data.subarray(split));
+    } else {
+      await write(record.data);
+    }
+    streamOffset = recordEnd;
+  }
+  stats.durationMs = Number(process.hrtime.bigint() - start) / 1e6;
+  stats.captureMs = records.length ? (records[records.length - 1].offsetUs - firstOffsetUs) / 1000 : 0;
+
+  const atFrameEnd = streamOffset === 0 || boundaries[boundaries.length - 1] === streamOffset;
+  if (!closed && !endsWithClose && atFrameEnd) {
+    await write(maskedFrame(WS_OPCODE_CLOSE, Buffer.from([0x03, 0xe8]))); // 1000, normal closure
+  }
+  socket.end();
+  await Promise.race([closedPromise, new Promise((r) => setTimeout(r, CLOSE_TIMEOUT_MS))]);
+  socket.destroy();
+  return stats;
+}
+
+function percentile(sorted, p) {
+  if (sorted.length === 0) return 0;
+  return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+}
+
+// Send lateness against the recorded schedule, in ms; only for timed playback
+function summarize(lateMs) {
+  const sorted = [...lateMs].sort((a, b) => a - b);
+  return { p50: percentile(sorted, 0.5), p99: percentile(sorted, 0.99), max: sorted.length ? sorted[sorted.length - 1] : 0 };
+}
+
+(async () => {
+  const opts = parseArgs(process.argv.slice(2));
+  const captures = opts.files.map((file) => {
+    const capture = readCapture(fs.readFileSync(file));
+    if (capture.truncated) console.warn(`⚠️ ${file}: truncated, replaying the complete records`);
+    return capture;
+  });
+
+  const sessions = [];
+  captures.forEach((capture) => {
+    const baseId = (captures.length === 1 && opts.camera) || capture.cameraId;
+    for (let copy = 0; copy < opts.copies; copy++) {
+      const cameraId = opts.copies > 1 ? `${baseId}-r${copy + 1}` : baseId;
+      sessions.push(replaySession(capture, cameraId, opts).catch((err) => ({ cameraId, error: err.message })));
+    }
+  });
+  const results = await Promise.all(sessions);
+
+  if (opts.json) {
+    console.log(JSON.stringify(results.map(({ lateMs, ...r }) => ({ ...r, lateMs: summarize(lateMs) })), null, 2));
+  } else {
+    console.log(`speed=${opts.speed === Infinity ? 'max' : opts.speed} sessions=${results.length} url=${opts.url}`);
+    console.log('camera                     frames   MB      capture_s  replay_s  late_p50  late_p99  late_max  relay_msgs');
+    for (const r of results) {
+      if (r.error) {
+        console.log(`${r.cameraId.padEnd(25)}  error: ${r.error}`);
+        continue;
+      }
+      const late = summarize(r.lateMs);
+      console.log(
+        `${r.cameraId.padEnd(25)}  ${String(r.frames.binary).padStart(6)}  ${(r.bytes / 1e6).toFixed(2).padStart(6)}  ` +
+          `${(r.captureMs / 1000).toFixed(1).padStart(9)}  ${(r.durationMs / 1000).toFixed(1).padStart(8)}  ` +
+          `${late.p50.toFixed(2).padStart(8)}  ${late.p99.toFixed(2).padStart(8)}  ${late.max.toFixed(2).padStart(8)}  ${String(r.relayMessages).padStart(10)}`
+      );
+    }
+  }
+  process.exit(results.some((r) => r.error) ? 1 : 0);
+})();